@@ -17,6 +17,7 @@
  */
 
 #include "LPC17xx.h"
+#include "lpc_isr.h"
 
 
 
@@ -24,6 +25,8 @@
 #define SPI_DMA_RX_NUM      1    ///< DMA Channel number for SSP Rx
 #define SSP1_TX_CHAN        2UL  ///< DMA source for TX of SSP1
 #define SSP1_RX_CHAN        3UL  ///< DMA source for RX of SSP1
+#define SSP0_DMA_TX_NUM     2    ///< DMA Channel number for SSP0 Tx
+#define SSP0_TX_CHAN        0UL  ///< DMA source for TX of SSP0
 
 
 
@@ -186,3 +189,102 @@ unsigned ssp1_dma_transfer_block(unsigned char* pBuffer, uint32_t num_bytes, cha
     return 0;
 }
 
+
+
+/// Called from the DMA interrupt when an SSP0 write finishes
+static void (*g_ssp0_dma_done_callback)(void) = 0;
+
+/// Set by the DMA interrupt if the last SSP0 write hit a bus error
+static volatile char g_ssp0_dma_error = 0;
+
+static void ssp0_dma_isr(void)
+{
+    const uint32_t channel_bit = (1 << SSP0_DMA_TX_NUM);
+
+    // SSP1 channels are polled and never raise this interrupt
+    if (LPC_GPDMA->DMACIntStat & channel_bit)
+    {
+        if (LPC_GPDMA->DMACIntErrStat & channel_bit) {
+            g_ssp0_dma_error = 1;
+        }
+        LPC_GPDMA->DMACIntTCClear = channel_bit;
+        LPC_GPDMA->DMACIntErrClr  = channel_bit;
+
+        if (g_ssp0_dma_done_callback) {
+            g_ssp0_dma_done_callback();
+        }
+    }
+}
+
+void ssp0_dma_init(void (*done_callback)(void))
+{
+    // Power up and enable GPDMA, might already be enabled by SSP1
+    lpc_pconp(pconp_gpdma, true);
+    LPC_GPDMA->DMACConfig = 1;
+    while (!(LPC_GPDMA->DMACConfig & 1));
+
+    g_ssp0_dma_done_callback = done_callback;
+    isr_register(DMA_IRQn, ssp0_dma_isr);
+    NVIC_EnableIRQ(DMA_IRQn);
+}
+
+unsigned ssp0_dma_write_block(const unsigned char* pBuffer, uint32_t num_bytes)
+{
+    LPC_GPDMACH_TypeDef *pDmaTxChannel = (LPC_GPDMACH_TypeDef *)
+                                          (LPC_GPDMACH0_BASE + SSP0_DMA_TX_NUM*0x20);
+
+    // DMA is limited to 12-bit transfer size
+    if(0 == num_bytes || num_bytes >= 0x1000) {
+        return 1;
+    }
+    // DMA channel should not be busy
+    if(pDmaTxChannel->DMACCConfig & 1) {
+        return 2;
+    }
+
+    LPC_GPDMA->DMACIntTCClear = (1 << SSP0_DMA_TX_NUM);
+    LPC_GPDMA->DMACIntErrClr  = (1 << SSP0_DMA_TX_NUM);
+    g_ssp0_dma_error = 0;
+
+    /**
+     * Only the Tx side is driven by DMA, whatever is shifted in is dropped
+     * and cleaned up by ssp0_dma_finish_write()
+     */
+    pDmaTxChannel->DMACCSrcAddr  = (uint32_t)(pBuffer);
+    pDmaTxChannel->DMACCDestAddr = (uint32_t)(&(LPC_SSP0->DR));
+    pDmaTxChannel->DMACCControl  = num_bytes | SRC_INCR_BIT | TCIE_BIT;
+    pDmaTxChannel->DMACCLLI      = 0;
+    pDmaTxChannel->DMACCConfig   = (SSP0_TX_CHAN << 6) | M_TO_P_BIT | ER_INTR_BIT | TC_INTR_BIT;
+
+    pDmaTxChannel->DMACCConfig |= 1;
+    LPC_SSP0->DMACR |= (1 << 1); // TX: B1
+
+    return 0;
+}
+
+unsigned ssp0_dma_finish_write(void)
+{
+    const uint32_t spi_busy_bitmask      = (1 << 4);
+    const uint32_t rx_fifo_not_empty_bit = (1 << 2);
+    const uint32_t rx_overrun_clear_bit  = (1 << 0);
+
+    LPC_GPDMACH_TypeDef *pDmaTxChannel = (LPC_GPDMACH_TypeDef *)
+                                          (LPC_GPDMACH0_BASE + SSP0_DMA_TX_NUM*0x20);
+
+    // Channel disables itself upon completion, but not upon a timeout of the caller
+    const unsigned incomplete = (pDmaTxChannel->DMACCConfig & 1) || g_ssp0_dma_error;
+    pDmaTxChannel->DMACCConfig &= ~1;
+
+    // Terminal count only means the last byte went into the FIFO, wait for it to shift out
+    while (LPC_SSP0->SR & spi_busy_bitmask);
+    LPC_SSP0->DMACR &= ~(1 << 1);
+
+    // Throw away what was shifted in, and clear the overrun that caused
+    while (LPC_SSP0->SR & rx_fifo_not_empty_bit) {
+        char dummy = LPC_SSP0->DR;
+        (void)dummy;
+    }
+    LPC_SSP0->ICR = rx_overrun_clear_bit;
+
+    return incomplete;
+}
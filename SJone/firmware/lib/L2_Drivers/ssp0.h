@@ -74,6 +74,31 @@ static inline void ssp0_exchange_data(void *data, int len)
     ssp_exchange_data(LPC_SSP0, data, len);
 }
 
+/**
+ * Enables the DMA interrupt used by ssp0_dma_write_block()
+ * @param done_callback  Called from the DMA interrupt when a write completes or fails,
+ *                       so it may only use FreeRTOS "FromISR" API
+ */
+void ssp0_dma_init(void (*done_callback)(void));
+
+/**
+ * Starts writing a block over SPI (SSP#0) through DMA and returns immediately
+ * @param pBuffer    The data to write, must remain valid until the write completes
+ * @param num_bytes  The length of the transfer in bytes, less than 4096
+ *
+ * @note Received data is discarded.  Once the callback has run, or the caller gave up
+ *       waiting for it, ssp0_dma_finish_write() must be called before using SSP0 again.
+ *
+ * @return 0 upon success, or non-zero if the transfer could not be started.
+ */
+unsigned ssp0_dma_write_block(const unsigned char* pBuffer, uint32_t num_bytes);
+
+/**
+ * Waits for the last byte of ssp0_dma_write_block() to shift out, and cleans up the Rx FIFO
+ * @return 0 if the whole block was written, or non-zero if the DMA failed or is still running.
+ */
+unsigned ssp0_dma_finish_write(void);
+
 
 
 #ifdef __cplusplus
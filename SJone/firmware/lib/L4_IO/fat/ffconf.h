@@ -10,7 +10,9 @@
 / Functions and Buffer Configurations
 /---------------------------------------------------------------------------*/
 
+#ifndef _FS_TINY
 #define	_FS_TINY		0	/* 0:Normal or 1:Tiny */
+#endif
 /* When _FS_TINY is set to 1, it reduces memory consumption _MAX_SS bytes each
 /  file object. For file data transfer, FatFs uses the common sector buffer in
 /  the file system object (FATFS) instead of private sector buffer eliminated
@@ -49,8 +51,11 @@
 /* To enable volume label functions, set _USE_LAVEL to 1 */
 
 
+#ifndef _USE_FORWARD
 #define	_USE_FORWARD	0	/* 0:Disable or 1:Enable */
-/* To enable f_forward() function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
+#endif
+/* To enable f_forward() function, set _USE_FORWARD to 1 and set _FS_TINY to 1.
+/  Both can be overridden from a project's CFLAGS without affecting other projects. */
 
 
 /*---------------------------------------------------------------------------/
@@ -0,0 +1,45 @@
+#include "clock_governor.hpp"
+#include <stddef.h>
+
+// CLKI of every SC_MULT, in tenths of XTALI
+static const uint8_t MultiplierTenths[8] = { 10, 20, 25, 30, 35, 40, 45, 50 };
+
+// Cycles to decode a sample of one channel, Layer I, II and III
+static const uint16_t CyclesPerSample[3] = { 50, 70, 120 };
+
+// Cycles to unpack a bit of the stream
+static const uint32_t CyclesPerBit = 30;
+
+// Channel mode of a mono stream
+static const uint8_t MonoChannelMode = 3;
+
+uint8_t clock_governor_choose(const mp3_frame_header_S *header, uint32_t speed)
+{
+    if (NULL == header || header->layer < 1 || header->layer > 3)
+    {
+        return CLOCK_GOVERNOR_DEFAULT_MULT;
+    }
+
+    const uint32_t channels = (MonoChannelMode == header->channel_mode) ? (1) : (2);
+    const uint64_t cycles   = (uint64_t)channels * header->sample_rate * CyclesPerSample[header->layer - 1]
+                            + (uint64_t)header->bit_rate * CyclesPerBit
+                            + CLOCK_GOVERNOR_BASE_HZ;
+    const uint64_t needed   = cycles * ((speed > 0) ? (speed) : (1)) * CLOCK_GOVERNOR_HEADROOM_PCT / 100;
+
+    uint8_t multiplier = CLOCK_GOVERNOR_MIN_MULT;
+    while (multiplier < CLOCK_GOVERNOR_MAX_MULT && clock_governor_clki_hz(multiplier) < needed)
+    {
+        ++multiplier;
+    }
+    return multiplier;
+}
+
+uint32_t clock_governor_clki_hz(uint8_t multiplier)
+{
+    return (uint64_t)CLOCK_GOVERNOR_XTALI_HZ * MultiplierTenths[multiplier & 0x7] / 10;
+}
+
+uint32_t clock_governor_spi_max_hz(uint8_t multiplier)
+{
+    return clock_governor_clki_hz(multiplier) / 7;
+}
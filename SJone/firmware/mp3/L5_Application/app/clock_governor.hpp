@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include "mp3_frame.hpp"
+
+/**
+ *  @explanation:
+ *  The VS1053b runs its DSP at CLKI, a multiple of XTALI set by SC_MULT of CLOCKF.  A faster clock draws
+ *  more current and runs hotter, so the governor picks the lowest multiple that still decodes the stream
+ *  in real time with some headroom, from the frame header the device reports in HDAT0 / HDAT1:
+ *
+ *      cycles / s = channels * sample rate * cycles per sample of the layer
+ *                 + bit rate * cycles per bit                              (Huffman decoding)
+ *                 + CLOCK_GOVERNOR_BASE_HZ                                 (SDI, SCI and the DAC)
+ *
+ *  times the play speed, times CLOCK_GOVERNOR_HEADROOM_PCT percent.  The cycle counts are estimates, a
+ *  stall shows up as underruns in 'mp3 buffer' and is fixed by raising them here.  Until the header is
+ *  known the default of SystemInit is used, 3.0x.
+ *
+ *  SCI reads only work up to CLKI / 7, so the SPI clock is derived from the multiple after every change.
+ *
+ *  @example:
+ *  44100 Hz stereo at 128 kbps needs about 23 MHz, 2.0x of 12.288 MHz is 24.6 MHz
+ *  48000 Hz stereo at 320 kbps needs about 31 MHz, 3.0x is 36.9 MHz
+ */
+
+// Crystal of the board, SC_FREQ is left at 0 for it
+#define CLOCK_GOVERNOR_XTALI_HZ (12288000)
+
+// SC_MULT values, CLKI is XTALI times 1.0, 2.0, 2.5, 3.0, 3.5, 4.0, 4.5 and 5.0
+// 5.0x is over the 55.3 MHz the datasheet allows with this crystal, so 4.5x is the most it goes to
+#define CLOCK_GOVERNOR_MIN_MULT     (0)
+#define CLOCK_GOVERNOR_MAX_MULT     (6)
+#define CLOCK_GOVERNOR_DEFAULT_MULT (3)
+
+// Cycles spent every second no matter what is being decoded
+#define CLOCK_GOVERNOR_BASE_HZ (4000000)
+
+// Percent of the estimated cycles the clock has to have
+#define CLOCK_GOVERNOR_HEADROOM_PCT (125)
+
+// @description  : Chooses the lowest SC_MULT that decodes a stream in real time
+// @param header : Frame header of the stream, NULL if it is not known yet
+// @param speed  : How many times faster than real time the stream is played, 1 for normal playback
+// @returns      : SC_MULT, from CLOCK_GOVERNOR_MIN_MULT to CLOCK_GOVERNOR_MAX_MULT
+uint8_t clock_governor_choose(const mp3_frame_header_S *header, uint32_t speed);
+
+// @description  : CLKI for a SC_MULT, with SC_ADD and SC_FREQ at 0
+uint32_t clock_governor_clki_hz(uint8_t multiplier);
+
+// @description  : Fastest SPI clock SCI reads and writes work at for a SC_MULT, CLKI / 7
+uint32_t clock_governor_spi_max_hz(uint8_t multiplier);
@@ -0,0 +1,183 @@
+#include "codec.hpp"
+#include "mp3_frame.hpp"
+#include "clock_governor.hpp"
+#include <cstring>
+
+// Size of an ID3v2 header, and of its footer
+#define ID3V2_HEADER_SIZE (10)
+
+// Offset of the Vorbis identification header in the first Ogg page, which holds a single segment
+#define OGG_VORBIS_OFFSET (28)
+
+// Size of a RIFF chunk header, id and size
+#define RIFF_CHUNK_HEADER_SIZE (8)
+
+// endFillBytes for everything but FLAC, which keeps a lot more in flight
+#define END_FILL_SIZE      (2052)
+#define FLAC_END_FILL_SIZE (12288)
+
+// SC_MULT 4.0x, VLSI asks for 4.0x to 4.5x for WMA, AAC, Ogg Vorbis and FLAC
+#define MULT_4_0X (5)
+
+// First 16 bytes of every ASF file, the GUID of its header object
+static const uint8_t AsfGuid[16] =
+{
+    0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C,
+};
+
+// Sample rate indexes of ADTS, 12 and up are reserved
+static const uint8_t AdtsSampleRates = 12;
+
+// In the order of codec_E
+static const codec_info_S Codecs[CODEC_COUNT] =
+{
+    //  name          seek               end fill            multiplier                   tags   gapless patched
+    { "unknown",    CODEC_SEEK_NONE,   END_FILL_SIZE,      CLOCK_GOVERNOR_DEFAULT_MULT, false, false, false },
+    { "MP3",        CODEC_SEEK_FRAMES, END_FILL_SIZE,      CLOCK_GOVERNOR_DEFAULT_MULT, true,  true,  false },
+    { "AAC",        CODEC_SEEK_NONE,   END_FILL_SIZE,      CLOCK_GOVERNOR_MAX_MULT,     true,  false, false },
+    { "M4A",        CODEC_SEEK_NONE,   END_FILL_SIZE,      CLOCK_GOVERNOR_MAX_MULT,     false, false, false },
+    { "Ogg Vorbis", CODEC_SEEK_NONE,   END_FILL_SIZE,      MULT_4_0X,                   false, false, false },
+    { "WMA",        CODEC_SEEK_NONE,   END_FILL_SIZE,      CLOCK_GOVERNOR_MAX_MULT,     false, false, false },
+    { "WAV",        CODEC_SEEK_BYTES,  END_FILL_SIZE,      CLOCK_GOVERNOR_DEFAULT_MULT, false, false, false },
+    { "FLAC",       CODEC_SEEK_NONE,   FLAC_END_FILL_SIZE, CLOCK_GOVERNOR_MAX_MULT,     false, false, true  },
+    { "MIDI",       CODEC_SEEK_NONE,   END_FILL_SIZE,      CLOCK_GOVERNOR_DEFAULT_MULT, false, false, false },
+};
+
+static uint32_t ReadLittleEndian(const uint8_t *bytes, uint32_t size)
+{
+    uint32_t value = 0;
+    for (uint32_t i=size; i>0; i--)
+    {
+        value = (value << 8) | bytes[i - 1];
+    }
+    return value;
+}
+
+// Size of an ID3v2 tag, its 28 bit size is syncsafe, 7 bits per byte, 0 if the header is not valid
+static uint32_t GetTagSize(const uint8_t *data, uint32_t size)
+{
+    if (size < ID3V2_HEADER_SIZE || 0 != memcmp(data, "ID3", 3) || 0xFF == data[3] || 0xFF == data[4])
+    {
+        return 0;
+    }
+
+    uint32_t tag_size = 0;
+    for (uint8_t i=6; i<ID3V2_HEADER_SIZE; i++)
+    {
+        if (data[i] & 0x80)
+        {
+            return 0;
+        }
+        tag_size = (tag_size << 7) | data[i];
+    }
+
+    // Footer flag, the tag ends with a copy of the header
+    const bool footer = (data[5] & 0x10);
+    return ID3V2_HEADER_SIZE + tag_size + ((footer) ? (ID3V2_HEADER_SIZE) : (0));
+}
+
+// Looks for a frame sync after nothing but zeros, ADTS and MPEG audio share the first 12 bits of it
+static codec_E SniffFrames(const uint8_t *data, uint32_t size)
+{
+    uint32_t i = 0;
+    while (i < size && 0x00 == data[i])
+    {
+        ++i;
+    }
+    if (i + MP3_FRAME_HEADER_SIZE > size || 0xFF != data[i])
+    {
+        return CODEC_UNKNOWN;
+    }
+
+    // ADTS has 12 set bits and a layer of 0, followed by the profile and sample rate index
+    if (0xF0 == (data[i + 1] & 0xF6))
+    {
+        return (((data[i + 2] >> 2) & 0xF) < AdtsSampleRates) ? (CODEC_AAC) : (CODEC_UNKNOWN);
+    }
+
+    mp3_frame_header_S header;
+    return (mp3_frame_parse_header(&data[i], &header)) ? (CODEC_MP3) : (CODEC_UNKNOWN);
+}
+
+codec_E codec_sniff(const uint8_t *data, uint32_t size, uint32_t *tag_size)
+{
+    *tag_size = GetTagSize(data, size);
+    if (*tag_size > 0)
+    {
+        return CODEC_UNKNOWN;
+    }
+
+    if (size >= 4 && 0 == memcmp(data, "fLaC", 4))
+    {
+        return CODEC_FLAC;
+    }
+    if (size >= 4 && 0 == memcmp(data, "OggS", 4))
+    {
+        const bool vorbis = (size >= OGG_VORBIS_OFFSET + 7 && 0 == memcmp(&data[OGG_VORBIS_OFFSET], "\x01vorbis", 7));
+        return (vorbis) ? (CODEC_OGG) : (CODEC_UNKNOWN);
+    }
+    if (size >= 12 && 0 == memcmp(data, "RIFF", 4) && 0 == memcmp(&data[8], "WAVE", 4))
+    {
+        return CODEC_WAV;
+    }
+    if (size >= sizeof(AsfGuid) && 0 == memcmp(data, AsfGuid, sizeof(AsfGuid)))
+    {
+        return CODEC_WMA;
+    }
+    if (size >= 8 && 0 == memcmp(&data[4], "ftyp", 4))
+    {
+        return CODEC_M4A;
+    }
+    if (size >= 4 && 0 == memcmp(data, "ADIF", 4))
+    {
+        return CODEC_AAC;
+    }
+    if (size >= 4 && 0 == memcmp(data, "MThd", 4))
+    {
+        return CODEC_MIDI;
+    }
+
+    return SniffFrames(data, size);
+}
+
+codec_info_S const* codec_get_info(codec_E codec)
+{
+    return &Codecs[(codec < CODEC_COUNT) ? (codec) : (CODEC_UNKNOWN)];
+}
+
+bool codec_parse_wav(const uint8_t *buffer, uint32_t size, codec_wav_S *wav)
+{
+    memset(wav, 0, sizeof(*wav));
+    if (size < 12 || 0 != memcmp(buffer, "RIFF", 4) || 0 != memcmp(&buffer[8], "WAVE", 4))
+    {
+        return false;
+    }
+
+    // Chunks are padded to an even size
+    for (uint32_t offset=12; offset + RIFF_CHUNK_HEADER_SIZE <= size; )
+    {
+        const uint8_t *chunk      = &buffer[offset];
+        const uint32_t chunk_size = ReadLittleEndian(&chunk[4], 4);
+
+        if (0 == memcmp(chunk, "fmt ", 4) && offset + RIFF_CHUNK_HEADER_SIZE + 14 <= size)
+        {
+            wav->sample_rate = ReadLittleEndian(&chunk[12], 4);
+            wav->byte_rate   = ReadLittleEndian(&chunk[16], 4);
+            wav->block_align = ReadLittleEndian(&chunk[20], 2);
+        }
+        else if (0 == memcmp(chunk, "data", 4))
+        {
+            wav->data_start = offset + RIFF_CHUNK_HEADER_SIZE;
+            wav->data_bytes = chunk_size;
+            return wav->byte_rate > 0 && wav->block_align > 0;
+        }
+
+        const uint64_t next = (uint64_t)offset + RIFF_CHUNK_HEADER_SIZE + chunk_size + (chunk_size & 1);
+        if (next > size)
+        {
+            break;
+        }
+        offset = (uint32_t)next;
+    }
+    return false;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  The VS1053b decodes more than MP3, it takes Ogg Vorbis, AAC in ADTS, ADIF or an MP4 container, WMA,
+ *  WAV, MIDI, and FLAC once its patch is loaded.  What a file holds is told by the first bytes of it, not
+ *  the extension:
+ *
+ *      "ID3"               ID3v2 tag, sniffed again after it, any of the raw streams can have one in front
+ *      "fLaC"              FLAC
+ *      "OggS"              Ogg, only Vorbis is decoded, "\x01vorbis" at 28
+ *      "RIFF" .... "WAVE"  WAV
+ *      30 26 B2 75 ...     ASF GUID, WMA
+ *      .... "ftyp"         MP4, M4A
+ *      "ADIF"              AAC with a single header
+ *      "MThd"              MIDI
+ *      FF Fx               Frame sync, ADTS AAC if the layer bits are 0, MPEG audio if it is a valid frame header
+ *
+ *  A frame sync only counts if there is nothing but zeros before it, so random data is not taken for audio.
+ *  All of it is in the first CODEC_SNIFF_SIZE bytes, so a file takes one small read, or two with a tag.
+ *
+ *  Every codec is then handled its own way, see codec_info_S: which tags are skipped, how many endFillBytes
+ *  end the stream, how the clock is chosen, how it is seeked in and whether the next track can follow right
+ *  behind it.
+ */
+
+// Bytes read to tell what a file holds
+#define CODEC_SNIFF_SIZE (64)
+
+typedef enum
+{
+    CODEC_UNKNOWN,              // Not something the VS1053b decodes
+    CODEC_MP3,                  // MPEG 1, 2 and 2.5 audio, layers I, II and III
+    CODEC_AAC,                  // AAC in ADTS or ADIF
+    CODEC_M4A,                  // AAC in an MP4 container
+    CODEC_OGG,                  // Ogg Vorbis
+    CODEC_WMA,                  // WMA in an ASF container
+    CODEC_WAV,                  // PCM or IMA ADPCM in a RIFF container
+    CODEC_FLAC,                 // FLAC, needs its patch
+    CODEC_MIDI,                 // General MIDI
+    CODEC_COUNT,
+} codec_E;
+
+typedef enum
+{
+    CODEC_SEEK_FRAMES,          // Frame index and table of contents, see frame_index.hpp and mp3_vbr.hpp
+    CODEC_SEEK_BYTES,           // Constant byte rate, the offset is worked out from the time
+    CODEC_SEEK_NONE,            // Only played from the start
+} codec_seek_E;
+
+typedef struct
+{
+    const char  *name;
+    codec_seek_E seek;
+    uint16_t     end_fill_size; // endFillBytes that flush the decoder at the end of a stream
+    uint8_t      multiplier;    // SC_MULT while the device does not report an MPEG frame header, see clock_governor.hpp
+    bool         trailing_tags; // ID3v1 and APE tags can follow the audio, and are not streamed
+    bool         gapless;       // Stream of frames, the next track of the same codec can follow right behind it
+    bool         patched;       // Only decoded once its patch is loaded, see plugin_image.hpp
+} codec_info_S;
+
+// Header of a WAV file, the offsets are from the start of the RIFF header
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t byte_rate;         // Bytes per second
+    uint16_t block_align;       // Bytes of a sample of every channel, or of an ADPCM block
+    uint32_t data_start;        // Offset of the first sample
+    uint32_t data_bytes;        // Size of the samples, as written in the header
+} codec_wav_S;
+
+// @description    : Tells what a file holds from its first bytes
+// @param data     : First bytes of the file, or the first bytes after an ID3v2 tag
+// @param size     : Number of bytes, CODEC_SNIFF_SIZE is enough
+// @param tag_size : Set to the size of an ID3v2 tag in front, 0 if there is none
+// @returns        : CODEC_UNKNOWN if it is not decodable, or if there is a tag, in which case the bytes after it tell
+codec_E codec_sniff(const uint8_t *data, uint32_t size, uint32_t *tag_size);
+
+// @description : How a codec is handled
+// @param codec : Codec, anything out of range is CODEC_UNKNOWN
+codec_info_S const* codec_get_info(codec_E codec);
+
+// @description  : Walks the chunks of a WAV header up to the samples
+// @param buffer : Start of the RIFF header
+// @param size   : Size of buffer
+// @param wav    : Struct to fill in
+// @returns      : False if the format or the start of the samples is not in the buffer
+bool codec_parse_wav(const uint8_t *buffer, uint32_t size, codec_wav_S *wav);
@@ -0,0 +1,470 @@
+#include "frame_index.hpp"
+#include "stop_watch.hpp"
+#include <cstring>
+#include <stdio.h>
+
+FrameIndex Mp3Index;
+
+// Header of the cache file, followed by count entries
+typedef struct
+{
+    uint32_t magic;
+    uint32_t file_size;         // Size of the mp3 file when it was indexed
+    uint32_t frames_per_entry;
+    uint32_t frames;
+    uint32_t samples;
+    uint32_t sample_rate;
+    uint32_t samples_per_frame;
+    uint32_t count;
+} frame_index_cache_S;
+
+// "MIDX" in little endian
+static const uint32_t CacheMagic = 0x5844494D;
+
+// Bytes read at a time while searching for a lost frame header
+#define RESYNC_CHUNK_SIZE (256)
+
+// Size of an ID3v2 tag header
+#define ID3V2_HEADER_SIZE (10)
+
+FrameIndex::FrameIndex()
+{
+    Mutex = NULL;
+    memset(Entries, 0, sizeof(Entries));
+    memset(&FileName, 0, sizeof(FileName));
+    Count           = 0;
+    FramesPerEntry  = 1;
+    FileSize        = 0;
+    Position        = 0;
+    FileOpen        = false;
+    Frames          = 0;
+    Samples         = 0;
+    SampleRate      = 0;
+    SamplesPerFrame = 0;
+    BuildUs         = 0;
+    Building        = false;
+    Complete        = false;
+    Cached          = false;
+}
+
+void FrameIndex::Init()
+{
+    Mutex = xSemaphoreCreateMutex();
+}
+
+void FrameIndex::Begin(file_name_S *file_name)
+{
+    // Already done, or in progress, or there are no MPEG frames to index
+    if ((0 == strcmp(FileName.full_name, file_name->full_name) && (Building || Complete)) ||
+        CODEC_SEEK_FRAMES != codec_get_info(file_name->codec)->seek)
+    {
+        return;
+    }
+
+    // A partial index of the previous track is thrown away
+    CloseFile();
+
+    xSemaphoreTake(Mutex, portMAX_DELAY);
+    {
+        FileName        = *file_name;
+        Count           = 0;
+        FramesPerEntry  = 1;
+        Frames          = 0;
+        Samples         = 0;
+        SampleRate      = 0;
+        SamplesPerFrame = 0;
+        BuildUs         = 0;
+        Complete        = false;
+        Cached          = false;
+    }
+    xSemaphoreGive(Mutex);
+
+    if (!OpenFile())
+    {
+        return;
+    }
+
+    if (LoadCache())
+    {
+        printf("[FrameIndex::Begin] Loaded cached index of %s, %lu entries.\n", FileName.short_name, Count);
+        CloseFile();
+        return;
+    }
+
+    Building = true;
+}
+
+bool FrameIndex::Step(uint32_t max_frames)
+{
+    if (!Building)
+    {
+        return false;
+    }
+
+    MicroSecondStopWatch timer;
+    uint8_t bytes[MP3_FRAME_HEADER_SIZE] = { 0 };
+    mp3_frame_header_S header = { };
+    bool end_of_file = false;
+
+    for (uint32_t i=0; i<max_frames && !end_of_file; i++)
+    {
+        UINT read = 0;
+        if (FR_OK != f_lseek(&File, Position) || FR_OK != f_read(&File, bytes, sizeof(bytes), &read))
+        {
+            printf("[FrameIndex::Step] Failed to read %s at %lu.\n", FileName.short_name, Position);
+            CloseFile();
+            return false;
+        }
+
+        if (read < sizeof(bytes))
+        {
+            end_of_file = true;
+        }
+        // Frames with a different sample rate or frame length would break the constant time lookup
+        else if (mp3_frame_parse_header(bytes, &header) &&
+                 (0 == Frames || (header.sample_rate == SampleRate && header.samples == SamplesPerFrame)))
+        {
+            AddFrame(&header);
+            Position += header.size;
+        }
+        else
+        {
+            end_of_file = !Resync();
+        }
+    }
+
+    BuildUs += timer.getElapsedTime();
+
+    if (end_of_file)
+    {
+        Complete = true;
+        CloseFile();
+        SaveCache();
+
+        const frame_index_stats_S stats = GetStats();
+        printf("[FrameIndex::Step] Indexed %s: %lu frames, %lu entries of %lu frames, %lu ms, built in %lu ms.\n",
+                FileName.short_name, stats.frames, stats.entries, stats.frames_per_entry, stats.duration_ms, stats.build_ms);
+    }
+
+    return Building;
+}
+
+bool FrameIndex::IsBuilding()
+{
+    return Building;
+}
+
+bool FrameIndex::Lookup(file_name_S *file_name, uint32_t ms, uint32_t *offset, uint32_t *frame_ms)
+{
+    bool found = false;
+
+    xSemaphoreTake(Mutex, portMAX_DELAY);
+    if (IsFileName(file_name) && Count > 0)
+    {
+        const uint32_t samples = (uint32_t)((uint64_t)ms * SampleRate / 1000);
+
+        // Past the last entry is only known to be the last frame once the whole file is walked
+        if (Complete || samples <= Entries[Count - 1].samples)
+        {
+            const uint32_t i = FindEntryBySamples(samples);
+            *offset = Entries[i].offset;
+            if (frame_ms)
+            {
+                *frame_ms = SamplesToMs(Entries[i].samples);
+            }
+            found = true;
+        }
+    }
+    xSemaphoreGive(Mutex);
+
+    return found;
+}
+
+bool FrameIndex::Rewind(file_name_S *file_name, uint32_t from_offset, uint32_t ms, uint32_t *offset, uint32_t *frame_ms)
+{
+    bool found = false;
+
+    xSemaphoreTake(Mutex, portMAX_DELAY);
+    if (IsFileName(file_name) && Count > 0 && (Complete || from_offset <= Entries[Count - 1].offset))
+    {
+        // First entry at or after the offset
+        uint32_t low  = 0;
+        uint32_t high = Count;
+        while (low < high)
+        {
+            const uint32_t middle = (low + high) / 2;
+            if (Entries[middle].offset < from_offset)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        // Step back from the entry before it, which is the frame boundary preceding the offset
+        const uint32_t current = (low > 0) ? (low - 1) : (0);
+        const uint32_t back    = (uint32_t)((uint64_t)ms * SampleRate / 1000);
+        const uint32_t target  = (Entries[current].samples > back) ? (Entries[current].samples - back) : (0);
+        const uint32_t i       = MIN(FindEntryBySamples(target), current);
+
+        *offset   = Entries[i].offset;
+        *frame_ms = SamplesToMs(Entries[i].samples);
+        found = true;
+    }
+    xSemaphoreGive(Mutex);
+
+    return found;
+}
+
+file_name_S FrameIndex::GetFileName()
+{
+    file_name_S file_name;
+    xSemaphoreTake(Mutex, portMAX_DELAY);
+    {
+        file_name = FileName;
+    }
+    xSemaphoreGive(Mutex);
+    return file_name;
+}
+
+frame_index_stats_S FrameIndex::GetStats()
+{
+    frame_index_stats_S stats;
+    xSemaphoreTake(Mutex, portMAX_DELAY);
+    {
+        stats.building         = Building;
+        stats.complete         = Complete;
+        stats.cached           = Cached;
+        stats.entries          = Count;
+        stats.frames_per_entry = FramesPerEntry;
+        stats.frames           = Frames;
+        stats.sample_rate      = SampleRate;
+        stats.duration_ms      = SamplesToMs(Samples);
+        stats.build_ms         = (uint32_t)(BuildUs / 1000);
+    }
+    xSemaphoreGive(Mutex);
+    return stats;
+}
+
+bool FrameIndex::OpenFile()
+{
+    char path[MAX_PATH_LENGTH + 8] = { 0 };
+    snprintf(path, sizeof(path), "1:%s", FileName.full_name);
+
+    const FRESULT result = f_open(&File, path, FA_OPEN_EXISTING | FA_READ);
+    if (FR_OK != result)
+    {
+        printf("[FrameIndex::OpenFile] Failed to open %s. Error: %d\n", FileName.short_name, result);
+        return false;
+    }
+
+    FileOpen = true;
+    FileSize = (uint32_t)File.fsize;
+    Position = 0;
+
+    // Skip the ID3v2 tag, its size is stored as a 28 bit syncsafe integer
+    uint8_t tag[ID3V2_HEADER_SIZE] = { 0 };
+    UINT read = 0;
+    if (FR_OK == f_read(&File, tag, sizeof(tag), &read) && sizeof(tag) == read && 0 == memcmp(tag, "ID3", 3))
+    {
+        const bool has_footer = (tag[5] & 0x10);
+        Position = ID3V2_HEADER_SIZE + ((tag[6] & 0x7F) << 21) + ((tag[7] & 0x7F) << 14) +
+                                       ((tag[8] & 0x7F) << 7)  +  (tag[9] & 0x7F);
+        Position += (has_footer) ? (ID3V2_HEADER_SIZE) : (0);
+    }
+
+    return true;
+}
+
+void FrameIndex::CloseFile()
+{
+    if (FileOpen)
+    {
+        f_close(&File);
+        FileOpen = false;
+    }
+    Building = false;
+}
+
+void FrameIndex::AddFrame(mp3_frame_header_S *header)
+{
+    if (0 == Frames)
+    {
+        SampleRate      = header->sample_rate;
+        SamplesPerFrame = header->samples;
+    }
+
+    if (0 == (Frames % FramesPerEntry))
+    {
+        xSemaphoreTake(Mutex, portMAX_DELAY);
+        {
+            if (MP3_INDEX_MAX_ENTRIES == Count)
+            {
+                Decimate();
+            }
+
+            // Frame may not be on an entry anymore after the table was thinned out
+            if (0 == (Frames % FramesPerEntry))
+            {
+                Entries[Count].offset  = Position;
+                Entries[Count].samples = Samples;
+                ++Count;
+            }
+        }
+        xSemaphoreGive(Mutex);
+    }
+
+    ++Frames;
+    Samples += header->samples;
+}
+
+void FrameIndex::Decimate()
+{
+    for (uint32_t i=0; i<(Count / 2); i++)
+    {
+        Entries[i] = Entries[i * 2];
+    }
+    Count /= 2;
+    FramesPerEntry *= 2;
+}
+
+bool FrameIndex::Resync()
+{
+    uint8_t buffer[RESYNC_CHUNK_SIZE] = { 0 };
+    mp3_frame_header_S header = { };
+    UINT read = 0;
+
+    // Frame at Position was not valid, start from the byte after it
+    ++Position;
+    if (FR_OK != f_lseek(&File, Position) || FR_OK != f_read(&File, buffer, sizeof(buffer), &read) || read < MP3_FRAME_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    const uint32_t index = mp3_frame_find_sync(buffer, read, &header);
+    if (index < read)
+    {
+        Position += index;
+    }
+    else
+    {
+        // Overlap the chunks in case a header straddles the boundary
+        Position += read - MP3_FRAME_HEADER_SIZE;
+    }
+    return true;
+}
+
+bool FrameIndex::LoadCache()
+{
+    char path[MAX_PATH_LENGTH + 8] = { 0 };
+    GetCachePath(path, sizeof(path));
+
+    FIL cache;
+    if (FR_OK != f_open(&cache, path, FA_OPEN_EXISTING | FA_READ))
+    {
+        return false;
+    }
+
+    frame_index_cache_S header = { };
+    UINT read = 0;
+    bool valid = (FR_OK == f_read(&cache, &header, sizeof(header), &read)) && (sizeof(header) == read) &&
+                 (CacheMagic == header.magic) && (FileSize == header.file_size) &&
+                 (header.count > 0) && (header.count <= MP3_INDEX_MAX_ENTRIES);
+
+    // Count is still 0, so no lookup touches the entries while they are being read in
+    const UINT entries_size = header.count * sizeof(frame_index_entry_S);
+    valid = valid && (FR_OK == f_read(&cache, Entries, entries_size, &read)) && (entries_size == read);
+    f_close(&cache);
+
+    if (!valid)
+    {
+        printf("[FrameIndex::LoadCache] Cached index of %s is out of date.\n", FileName.short_name);
+        return false;
+    }
+
+    xSemaphoreTake(Mutex, portMAX_DELAY);
+    {
+        FramesPerEntry  = header.frames_per_entry;
+        Frames          = header.frames;
+        Samples         = header.samples;
+        SampleRate      = header.sample_rate;
+        SamplesPerFrame = header.samples_per_frame;
+        Count           = header.count;
+        Complete        = true;
+        Cached          = true;
+    }
+    xSemaphoreGive(Mutex);
+
+    return true;
+}
+
+void FrameIndex::SaveCache()
+{
+    char path[MAX_PATH_LENGTH + 8] = { 0 };
+    GetCachePath(path, sizeof(path));
+
+    frame_index_cache_S header = { };
+    header.magic             = CacheMagic;
+    header.file_size         = FileSize;
+    header.frames_per_entry  = FramesPerEntry;
+    header.frames            = Frames;
+    header.samples           = Samples;
+    header.sample_rate       = SampleRate;
+    header.samples_per_frame = SamplesPerFrame;
+    header.count             = Count;
+
+    FIL cache;
+    FRESULT result = f_open(&cache, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != result)
+    {
+        printf("[FrameIndex::SaveCache] Failed to create %s. Error: %d\n", path, result);
+        return;
+    }
+
+    UINT written = 0;
+    const UINT entries_size = Count * sizeof(frame_index_entry_S);
+    if (FR_OK != f_write(&cache, &header, sizeof(header), &written) || sizeof(header) != written ||
+        FR_OK != f_write(&cache, Entries, entries_size, &written)   || entries_size   != written)
+    {
+        printf("[FrameIndex::SaveCache] Failed to write %s.\n", path);
+    }
+    f_close(&cache);
+}
+
+void FrameIndex::GetCachePath(char *path, uint32_t size)
+{
+    // Next to the track, the leading underscore keeps the track list from picking it up
+    const char *slash = strrchr(FileName.full_name, '/');
+    const int folder_size = (slash) ? (slash - FileName.full_name + 1) : (0);
+    snprintf(path, size, "1:%.*s_%s.idx", folder_size, FileName.full_name, &FileName.full_name[folder_size]);
+}
+
+bool FrameIndex::IsFileName(file_name_S *file_name)
+{
+    return (0 == strcmp(FileName.full_name, file_name->full_name));
+}
+
+uint32_t FrameIndex::FindEntryBySamples(uint32_t samples)
+{
+    // Every frame has the same number of samples, so the entry is found by division
+    const uint32_t samples_per_entry = FramesPerEntry * SamplesPerFrame;
+    uint32_t i = MIN(samples / samples_per_entry, Count - 1);
+
+    // Only a corrupted cache could be off, walk to the right entry just in case
+    while (i > 0 && Entries[i].samples > samples)
+    {
+        --i;
+    }
+    while ((i + 1) < Count && Entries[i + 1].samples <= samples)
+    {
+        ++i;
+    }
+    return i;
+}
+
+uint32_t FrameIndex::SamplesToMs(uint32_t samples)
+{
+    return (SampleRate) ? ((uint32_t)((uint64_t)samples * 1000 / SampleRate)) : (0);
+}
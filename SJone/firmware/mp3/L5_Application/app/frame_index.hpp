@@ -0,0 +1,152 @@
+#pragma once
+#include "common.hpp"
+#include "ff.h"
+#include "mp3_frame.hpp"
+
+/**
+ *  @explanation:
+ *  Seek index of a single track, built by walking the frame headers of the file.  Every FramesPerEntry
+ *  frames, the byte offset of the frame and the number of samples before it are stored.  When the table
+ *  fills up, every other entry is dropped and FramesPerEntry doubles, so any track length fits in the
+ *  same fixed table and a time lookup is a division instead of a search.
+ *
+ *  The index is built a few frames at a time by the ReaderTask whenever it has nothing else to do, and
+ *  is cached on the SD card as "_<file name>.idx", which the track list skips.
+ */
+
+// Max entries in the table, 8 bytes each
+#define MP3_INDEX_MAX_ENTRIES (256)
+
+// A frame boundary in the file
+typedef struct
+{
+    uint32_t offset;    // Byte offset of the frame header
+    uint32_t samples;   // Samples decoded before this frame
+} frame_index_entry_S;
+
+// Progress of the index, for diagnostics
+typedef struct
+{
+    bool     building;          // Frames are still being walked
+    bool     complete;          // Whole file has been indexed
+    bool     cached;            // Index was loaded from the SD card instead of built
+    uint32_t entries;           // Entries in the table
+    uint32_t frames_per_entry;  // Frames between two entries
+    uint32_t frames;            // Frames walked so far
+    uint32_t sample_rate;       // Sample rate of the first frame
+    uint32_t duration_ms;       // Time covered by the frames walked so far
+    uint32_t build_ms;          // Time spent walking the file, not including pauses between steps
+} frame_index_stats_S;
+
+class FrameIndex
+{
+public:
+
+    // Constructor
+    FrameIndex();
+
+    // @description : Creates the mutex guarding the table, must be called before any task uses the index
+    void Init();
+
+    // @description     : Starts indexing a file, does nothing if the file is already indexed or being indexed
+    //                    or is not MP3, see codec.hpp
+    //                    The cached index is used if there is one matching the file size
+    // @param file_name : Struct containing name of the MP3 file
+    void Begin(file_name_S *file_name);
+
+    // @description      : Walks the next frames of the file, saves the index when reaching the end
+    // @param max_frames : Max number of frames to walk in this step
+    // @returns          : True if there are frames left to walk
+    bool Step(uint32_t max_frames);
+
+    // @description : True if the file is opened and frames are left to walk
+    bool IsBuilding();
+
+    // @description     : Finds the frame at or before a point in time, in constant time
+    // @param file_name : Track the lookup is for, fails if the index belongs to another track
+    // @param ms        : Time from the start of the track
+    // @param offset    : Byte offset of the frame
+    // @param frame_ms  : Time of the frame, can be NULL
+    // @returns         : False if that part of the track is not indexed yet
+    bool Lookup(file_name_S *file_name, uint32_t ms, uint32_t *offset, uint32_t *frame_ms);
+
+    // @description       : Finds the frame some time before the frame boundary preceding an offset
+    //                      Always lands on a frame before the offset, unless already at the first frame
+    // @param file_name   : Track the lookup is for, fails if the index belongs to another track
+    // @param from_offset : Byte offset currently being played
+    // @param ms          : Time to go back
+    // @param offset      : Byte offset of the frame
+    // @param frame_ms    : Time of the frame, 0 if it is the first frame of the track
+    // @returns           : False if the offset is not indexed yet
+    bool Rewind(file_name_S *file_name, uint32_t from_offset, uint32_t ms, uint32_t *offset, uint32_t *frame_ms);
+
+    // @description : Name of the file being indexed
+    file_name_S GetFileName();
+
+    // @description : Returns a snapshot of the progress
+    frame_index_stats_S GetStats();
+
+private:
+
+    // Opens the file for walking, and skips the ID3v2 tag
+    bool OpenFile();
+
+    // Stops walking and closes the file
+    void CloseFile();
+
+    // Adds the frame at Position to the table, thinning out the table if it is full
+    void AddFrame(mp3_frame_header_S *header);
+
+    // Drops every other entry and doubles FramesPerEntry
+    void Decimate();
+
+    // Searches for the next frame header after losing sync
+    // Returns false at the end of the file
+    bool Resync();
+
+    // Loads the table from the cache file, returns false if there is none or it is out of date
+    bool LoadCache();
+
+    // Writes the table to the cache file
+    void SaveCache();
+
+    // Builds the path of the cache file
+    void GetCachePath(char *path, uint32_t size);
+
+    // True if the index belongs to the file, must be called with the mutex taken
+    bool IsFileName(file_name_S *file_name);
+
+    // Index of the entry for a number of samples, must be called with the mutex taken
+    uint32_t FindEntryBySamples(uint32_t samples);
+
+    // Converts samples to milliseconds
+    uint32_t SamplesToMs(uint32_t samples);
+
+    // Guards the table, which is read by the DecoderTask while the ReaderTask builds it
+    SemaphoreHandle_t Mutex;
+
+    // Frame boundaries
+    frame_index_entry_S Entries[MP3_INDEX_MAX_ENTRIES];
+    uint32_t Count;
+    uint32_t FramesPerEntry;
+
+    // File being walked
+    file_name_S FileName;
+    FIL         File;
+    uint32_t    FileSize;
+    uint32_t    Position;
+    bool        FileOpen;
+
+    // Walk progress
+    uint32_t Frames;
+    uint32_t Samples;
+    uint32_t SampleRate;
+    uint16_t SamplesPerFrame;
+    uint64_t BuildUs;
+    bool     Building;
+    bool     Complete;
+    bool     Cached;
+};
+
+// Built by the ReaderTask, used by the DecoderTask
+extern FrameIndex Mp3Index;
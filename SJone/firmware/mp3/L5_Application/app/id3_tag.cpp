@@ -0,0 +1,467 @@
+#include "id3_tag.hpp"
+#include <cstring>
+
+typedef enum
+{
+    STATE_HEADER,               // Tag header
+    STATE_EXTENDED_SIZE,        // Size of the extended header
+    STATE_FRAME_HEADER,         // Id, size and flags of a frame
+    STATE_BODY,                 // Start of a wanted frame
+    STATE_SIZE_CHECK,           // Bytes after a v2.4 frame that could have either size
+    STATE_SKIP,                 // Bytes that are not wanted, then the next frame header
+} state_E;
+
+// Tag header flags
+#define TAG_UNSYNC          (0x80)
+#define TAG_EXTENDED        (0x40)
+#define TAG_V22_COMPRESSED  (0x40)
+#define TAG_FOOTER          (0x10)
+
+// Frame format flags, v2.3
+#define V23_COMPRESSED      (0x80)
+#define V23_ENCRYPTED       (0x40)
+#define V23_GROUPED         (0x20)
+
+// Frame format flags, v2.4
+#define V24_GROUPED         (0x40)
+#define V24_COMPRESSED      (0x08)
+#define V24_ENCRYPTED       (0x04)
+#define V24_UNSYNC          (0x02)
+#define V24_LENGTH          (0x01)
+
+// Text encodings
+#define ENCODING_LATIN1     (0)
+#define ENCODING_UTF16      (1)
+#define ENCODING_UTF16BE    (2)
+#define ENCODING_UTF8       (3)
+
+// Ids of the wanted frames, in the order of id3_tag_field_E, v2.2 then v2.3 and v2.4
+static const char *FrameIds[ID3_TAG_FIELD_COUNT][2] =
+{
+    { "TT2", "TIT2" },
+    { "TP1", "TPE1" },
+    { "TCO", "TCON" },
+};
+
+static uint32_t ReadBigEndian(const uint8_t *bytes, uint32_t size)
+{
+    uint32_t value = 0;
+    for (uint32_t i=0; i<size; i++)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// 7 bits per byte, false if a byte has its top bit set
+static bool ReadSyncsafe(const uint8_t *bytes, uint32_t *value)
+{
+    *value = 0;
+    for (uint32_t i=0; i<4; i++)
+    {
+        if (bytes[i] & 0x80)
+        {
+            return false;
+        }
+        *value = (*value << 7) | bytes[i];
+    }
+    return true;
+}
+
+static uint32_t GetFrameHeaderSize(const id3_tag_S *tag)
+{
+    return (2 == tag->version) ? (6) : (10);
+}
+
+// Whole tag is unsynchronised, 0x00 after 0xFF is taken out as the bytes are read
+static bool IsTagUnsync(const id3_tag_S *tag)
+{
+    return (tag->flags & TAG_UNSYNC) && tag->version < 4 && tag->state != STATE_HEADER;
+}
+
+static void Expect(id3_tag_S *tag, state_E state, uint32_t wanted)
+{
+    tag->state         = state;
+    tag->buffer_size   = 0;
+    tag->buffer_wanted = wanted;
+}
+
+// Skips count bytes, then reads what is expected after them
+static void SkipThen(id3_tag_S *tag, uint32_t count, state_E state, uint32_t wanted)
+{
+    Expect(tag, state, wanted);
+    if (count > 0)
+    {
+        tag->next_state = state;
+        tag->state      = STATE_SKIP;
+        tag->skip       = count;
+    }
+}
+
+static void PutChar(char *text, uint32_t *length, uint32_t code)
+{
+    if (*length < ID3_TAG_TEXT_SIZE - 1)
+    {
+        text[(*length)++] = (code >= 0x20 && code <= 0x7E) ? ((char)code) : ('?');
+    }
+}
+
+// Only the first string counts, v2.4 can hold several separated by a 0
+static void DecodeText(const uint8_t *data, uint32_t size, char *text)
+{
+    memset(text, 0, ID3_TAG_TEXT_SIZE);
+    if (0 == size)
+    {
+        return;
+    }
+
+    const uint8_t encoding = data[0];
+    uint32_t length = 0;
+    data++;
+    size--;
+
+    if (ENCODING_LATIN1 == encoding)
+    {
+        for (uint32_t i=0; i<size && 0 != data[i]; i++)
+        {
+            PutChar(text, &length, data[i]);
+        }
+    }
+    else if (ENCODING_UTF8 == encoding)
+    {
+        // One '?' for every character of more than one byte, continuation bytes are 10xxxxxx
+        for (uint32_t i=0; i<size && 0 != data[i]; i++)
+        {
+            if (0x80 != (data[i] & 0xC0))
+            {
+                PutChar(text, &length, (data[i] < 0x80) ? (data[i]) : ('?'));
+            }
+        }
+    }
+    else if (ENCODING_UTF16 == encoding || ENCODING_UTF16BE == encoding)
+    {
+        // Byte order mark, little endian without one, which is what most writers that leave it out meant
+        bool big_endian = (ENCODING_UTF16BE == encoding);
+        uint32_t i = 0;
+        if (ENCODING_UTF16 == encoding && size >= 2)
+        {
+            if      (0xFF == data[0] && 0xFE == data[1]) { big_endian = false; i = 2; }
+            else if (0xFE == data[0] && 0xFF == data[1]) { big_endian = true;  i = 2; }
+        }
+
+        for (; i + 1 < size; i += 2)
+        {
+            const uint32_t unit = (big_endian) ? ((data[i] << 8) | data[i + 1]) : (data[i] | (data[i + 1] << 8));
+            if (0 == unit)
+            {
+                break;
+            }
+            // Second half of a surrogate pair, the first half already put a '?'
+            if (unit >= 0xDC00 && unit <= 0xDFFF)
+            {
+                continue;
+            }
+            PutChar(text, &length, unit);
+        }
+    }
+}
+
+// Takes the 0x00 after every 0xFF back out of the body of a v2.4 frame
+static uint32_t RemoveUnsync(uint8_t *data, uint32_t size)
+{
+    uint32_t out = 0;
+    for (uint32_t i=0; i<size; i++)
+    {
+        data[out++] = data[i];
+        if (0xFF == data[i] && i + 1 < size && 0x00 == data[i + 1])
+        {
+            ++i;
+        }
+    }
+    return out;
+}
+
+static uint8_t MatchField(const id3_tag_S *tag, const uint8_t *id)
+{
+    const uint32_t id_size = (2 == tag->version) ? (3) : (4);
+    for (uint8_t field=0; field<ID3_TAG_FIELD_COUNT; field++)
+    {
+        if (0 == memcmp(id, FrameIds[field][(2 == tag->version) ? (0) : (1)], id_size))
+        {
+            return field;
+        }
+    }
+    return ID3_TAG_FIELD_COUNT;
+}
+
+static void HandleHeader(id3_tag_S *tag)
+{
+    const uint8_t *header = tag->buffer;
+    uint32_t size = 0;
+    if (0 != memcmp(header, "ID3", 3) || header[3] < 2 || header[3] > 4 || 0xFF == header[4] || !ReadSyncsafe(&header[6], &size))
+    {
+        tag->done = true;
+        return;
+    }
+
+    tag->version  = header[3];
+    tag->flags    = header[5];
+    tag->end      = ID3_TAG_HEADER_SIZE + size;
+    tag->tag_size = tag->end + ((4 == tag->version && (tag->flags & TAG_FOOTER)) ? (ID3_TAG_HEADER_SIZE) : (0));
+
+    // A compressed v2.2 tag has no defined compression, nothing in it can be read
+    if (2 == tag->version && (tag->flags & TAG_V22_COMPRESSED))
+    {
+        tag->done = true;
+    }
+    else if (2 != tag->version && (tag->flags & TAG_EXTENDED))
+    {
+        Expect(tag, STATE_EXTENDED_SIZE, 4);
+    }
+    else
+    {
+        Expect(tag, STATE_FRAME_HEADER, GetFrameHeaderSize(tag));
+    }
+}
+
+// v2.3 counts the bytes after the size, v2.4 counts the size too and writes it syncsafe
+static void HandleExtendedSize(id3_tag_S *tag)
+{
+    uint32_t size = ReadBigEndian(tag->buffer, 4);
+    if (4 == tag->version && !(ReadSyncsafe(tag->buffer, &size) && size >= 4))
+    {
+        size = 4;
+    }
+    SkipThen(tag, (4 == tag->version) ? (size - 4) : (size), STATE_FRAME_HEADER, GetFrameHeaderSize(tag));
+}
+
+static bool IsFrameId(const uint8_t *id, uint32_t size)
+{
+    for (uint32_t i=0; i<size; i++)
+    {
+        if (!((id[i] >= 'A' && id[i] <= 'Z') || (id[i] >= '0' && id[i] <= '9')))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads the body of a wanted frame, and skips any other one, once its size is known
+static void BeginFrame(id3_tag_S *tag)
+{
+    uint32_t extra = 0;
+    bool readable = true;
+    if (3 == tag->version)
+    {
+        readable = !(tag->frame_flags & (V23_COMPRESSED | V23_ENCRYPTED));
+        extra    = (tag->frame_flags & V23_GROUPED) ? (1) : (0);
+    }
+    else if (4 == tag->version)
+    {
+        readable = !(tag->frame_flags & (V24_COMPRESSED | V24_ENCRYPTED));
+        extra    = ((tag->frame_flags & V24_GROUPED) ? (1) : (0)) + ((tag->frame_flags & V24_LENGTH) ? (4) : (0));
+    }
+
+    if (ID3_TAG_FIELD_COUNT == tag->field || tag->found[tag->field] || !readable || tag->frame_size <= extra)
+    {
+        SkipThen(tag, tag->frame_size, STATE_FRAME_HEADER, GetFrameHeaderSize(tag));
+        return;
+    }
+
+    // Rest of the frame after the body that is read is skipped once it is parsed
+    tag->frame_size -= extra;
+    const uint32_t body = (tag->frame_size < ID3_TAG_READ_SIZE) ? (tag->frame_size) : (ID3_TAG_READ_SIZE);
+    SkipThen(tag, extra, STATE_BODY, body);
+}
+
+static void HandleFrameHeader(id3_tag_S *tag)
+{
+    const uint8_t *header = tag->buffer;
+
+    // Padding, or whatever it is that is not a frame, ends the frames
+    if (!IsFrameId(header, (2 == tag->version) ? (3) : (4)))
+    {
+        tag->done = true;
+        return;
+    }
+
+    tag->field       = MatchField(tag, header);
+    tag->frame_flags = (2 == tag->version) ? (0) : (header[9]);
+    if (2 == tag->version)
+    {
+        tag->frame_size = ReadBigEndian(&header[3], 3);
+    }
+    else if (3 == tag->version)
+    {
+        tag->frame_size = ReadBigEndian(&header[4], 4);
+    }
+    else
+    {
+        // Some writers put plain sizes in v2.4 tags, which is certain once a byte has its top bit set, and
+        // otherwise told by whether the syncsafe size lands on the next frame
+        tag->plain_size = ReadBigEndian(&header[4], 4);
+        if (!ReadSyncsafe(&header[4], &tag->frame_size))
+        {
+            tag->frame_size = tag->plain_size;
+        }
+        else if (tag->frame_size != tag->plain_size && tag->position + tag->frame_size + 4 <= tag->end)
+        {
+            tag->frame_start = tag->position;
+            SkipThen(tag, tag->frame_size, STATE_SIZE_CHECK, 4);
+            return;
+        }
+    }
+    BeginFrame(tag);
+}
+
+// Bytes the syncsafe size lands on, the frame is read from its start again either way
+static void HandleSizeCheck(id3_tag_S *tag)
+{
+    const bool zero = (0 == ReadBigEndian(tag->buffer, 4));
+    if (!IsFrameId(tag->buffer, 4) && !zero)
+    {
+        tag->frame_size = tag->plain_size;
+    }
+    tag->position = tag->frame_start;
+    BeginFrame(tag);
+}
+
+static void HandleBody(id3_tag_S *tag)
+{
+    uint32_t size = tag->buffer_size;
+    if (4 == tag->version && (tag->frame_flags & V24_UNSYNC))
+    {
+        size = RemoveUnsync(tag->buffer, size);
+    }
+
+    DecodeText(tag->buffer, size, tag->text[tag->field]);
+    tag->found[tag->field] = (0 != tag->text[tag->field][0]);
+
+    bool all = true;
+    for (uint32_t i=0; i<ID3_TAG_FIELD_COUNT; i++)
+    {
+        all = all && tag->found[i];
+    }
+    if (all)
+    {
+        tag->done = true;
+        return;
+    }
+
+    SkipThen(tag, tag->frame_size - tag->buffer_size, STATE_FRAME_HEADER, GetFrameHeaderSize(tag));
+}
+
+void id3_tag_init(id3_tag_S *tag)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->field = ID3_TAG_FIELD_COUNT;
+    Expect(tag, STATE_HEADER, ID3_TAG_HEADER_SIZE);
+}
+
+bool id3_tag_next(id3_tag_S *tag, uint32_t *offset, uint32_t *size)
+{
+    // Nothing between here and what is expected next is wanted, unless the bytes have to be read to count them
+    if (STATE_SKIP == tag->state && !IsTagUnsync(tag))
+    {
+        tag->position += tag->skip;
+        tag->skip      = 0;
+        tag->state     = tag->next_state;
+    }
+
+    // Frames end where the tag does, a frame that runs past it is not read
+    const uint32_t wanted = (STATE_SKIP == tag->state) ? (tag->skip) : (tag->buffer_wanted - tag->buffer_size);
+    if (STATE_HEADER != tag->state && tag->position + ((STATE_SKIP == tag->state) ? (1) : (wanted)) > tag->end)
+    {
+        tag->done = true;
+    }
+    if (tag->done)
+    {
+        return false;
+    }
+
+    *offset    = tag->position;
+    *size      = (wanted < ID3_TAG_READ_SIZE) ? (wanted) : (ID3_TAG_READ_SIZE);
+    tag->asked = *size;
+    return true;
+}
+
+uint32_t id3_tag_feed(id3_tag_S *tag, const uint8_t *data, uint32_t size)
+{
+    uint32_t used = 0;
+    while (used < size && !tag->done && (STATE_HEADER == tag->state || tag->position < tag->end))
+    {
+        const uint8_t byte = data[used++];
+        ++tag->position;
+        ++tag->bytes_fed;
+
+        if (IsTagUnsync(tag))
+        {
+            const bool removed = tag->after_ff && 0x00 == byte;
+            tag->after_ff = !removed && 0xFF == byte;
+            if (removed)
+            {
+                continue;
+            }
+        }
+
+        if (STATE_SKIP == tag->state)
+        {
+            if (0 == --tag->skip)
+            {
+                tag->state = tag->next_state;
+            }
+            continue;
+        }
+
+        tag->buffer[tag->buffer_size++] = byte;
+        if (tag->buffer_size < tag->buffer_wanted)
+        {
+            continue;
+        }
+
+        const uint32_t position = tag->position;
+        switch (tag->state)
+        {
+            case STATE_HEADER:        HandleHeader(tag);       break;
+            case STATE_EXTENDED_SIZE: HandleExtendedSize(tag); break;
+            case STATE_FRAME_HEADER:  HandleFrameHeader(tag);  break;
+            case STATE_SIZE_CHECK:    HandleSizeCheck(tag);    break;
+            case STATE_BODY:          HandleBody(tag);         break;
+            default:                                           break;
+        }
+
+        // Went back to the start of a frame, the rest of the bytes are not the ones that come next
+        if (position != tag->position)
+        {
+            break;
+        }
+    }
+
+    // Fewer bytes than asked for, the file ends inside the tag
+    tag->done  = tag->done || (size < tag->asked);
+    tag->asked = 0;
+    return used;
+}
+
+bool id3_tag_genre_number(const char *text, uint8_t *number)
+{
+    const bool bracket = ('(' == text[0]);
+    uint32_t value = 0;
+    uint32_t i = (bracket) ? (1) : (0);
+    const uint32_t start = i;
+
+    for (; text[i] >= '0' && text[i] <= '9' && i - start < 3; i++)
+    {
+        value = value * 10 + (text[i] - '0');
+    }
+
+    const bool digits = (i > start) && (value <= 0xFF);
+    const bool closed = (bracket) ? (')' == text[i]) : ('\0' == text[i]);
+    if (!digits || !closed)
+    {
+        return false;
+    }
+    *number = (uint8_t)value;
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  An ID3v2 tag sits in front of the audio and is made of frames, most of a large tag is album art in an APIC
+ *  frame, while the title, artist and genre take a few dozen bytes.  The tag is parsed a piece at a time as it
+ *  is read, the parser tells the caller which bytes of the file it wants next, and jumps over everything else:
+ *
+ *      "ID3" major minor flags size        Header, size is syncsafe, 7 bits per byte, and does not count the header
+ *      [extended header]                   Skipped
+ *      id size flags body                  Frames, until the padding, the end of the tag, or all wanted frames are found
+ *
+ *  The versions differ in their frames:
+ *      v2.2 : 3 byte ids like TT2, 3 byte sizes, no flags
+ *      v2.3 : 4 byte ids like TIT2, 4 byte sizes, 2 bytes of flags
+ *      v2.4 : 4 byte ids, 4 byte syncsafe sizes, which some encoders wrote as plain ones, 2 bytes of flags
+ *
+ *  A v2.4 size that reads differently as syncsafe and plain is checked by reading the 4 bytes the syncsafe one
+ *  lands on, which are the id of the next frame, or padding, if it is right.  That is only the case for frames
+ *  of 128 bytes or more, and those are usually album art, where the next frame header is read next anyway.
+ *
+ *  Unsynchronisation puts a 0x00 after every 0xFF, so a tag never looks like a frame sync.  In v2.2 and v2.3 it
+ *  covers the whole tag and frame sizes do not count the added bytes, so the bytes are read through instead
+ *  of jumped over.  In v2.4 it is a flag of every frame and its size counts them, so only the bytes of a
+ *  wanted frame are taken back out.
+ *
+ *  Text comes as ISO-8859-1, UTF-16 with a byte order mark, UTF-16BE or UTF-8, and is kept as the ASCII the LCD
+ *  shows, anything else is a '?'.  Only the first ID3_TAG_READ_SIZE bytes of a text frame are read.
+ *
+ *  @example:
+ *  49 44 33 04 00 00 00 00 00 17  54 49 54 32 00 00 00 0D 00 00  03 48 65 6C 6C 6F ...
+ *      v2.4 tag of 23 bytes, TIT2 of 13 bytes, UTF-8 "Hello ..."
+ */
+
+// Size of the tag header, and of the footer of a v2.4 tag
+#define ID3_TAG_HEADER_SIZE (10)
+
+// Most bytes wanted at a time, and most bytes of a text frame read, enough for 31 characters of UTF-16
+#define ID3_TAG_READ_SIZE (72)
+
+// Text is cut to fit, with the terminating 0
+#define ID3_TAG_TEXT_SIZE (32)
+
+typedef enum
+{
+    ID3_TAG_TITLE,              // TIT2 / TT2
+    ID3_TAG_ARTIST,             // TPE1 / TP1
+    ID3_TAG_GENRE,              // TCON / TCO, as it is written, see id3_tag_genre_number
+    ID3_TAG_FIELD_COUNT,
+} id3_tag_field_E;
+
+typedef struct
+{
+    // Results
+    uint8_t  version;                       // Major version, 2 to 4, 0 if there is no tag
+    uint32_t tag_size;                      // Header, frames, padding and footer, 0 if there is no tag
+    bool     found[ID3_TAG_FIELD_COUNT];
+    char     text[ID3_TAG_FIELD_COUNT][ID3_TAG_TEXT_SIZE];
+    uint32_t bytes_fed;                     // Bytes the parser took, which is what needs to be read
+    bool     done;
+
+    // Parser
+    uint8_t  state;
+    uint8_t  flags;                         // Flags of the tag header
+    uint32_t position;                      // File offset of the next byte wanted
+    uint32_t end;                           // File offset of the end of the frames
+    bool     after_ff;                      // Last byte read was 0xFF, the next 0x00 is taken out
+    uint32_t skip;                          // Bytes still to jump over
+    uint8_t  next_state;                    // What is read after them
+    uint32_t asked;                         // Bytes the last id3_tag_next asked for
+    uint8_t  field;                         // Field of the frame being read, ID3_TAG_FIELD_COUNT if it is not wanted
+    uint8_t  frame_flags;                   // Format flags of the frame being read
+    uint32_t frame_size;                    // Bytes of the frame being read after its header
+    uint32_t plain_size;                    // Same, if a v2.4 writer put a plain size there
+    uint32_t frame_start;                   // File offset of the frame after its header, while its size is checked
+    uint8_t  buffer[ID3_TAG_READ_SIZE];     // Header or body being read
+    uint32_t buffer_size;                   // Bytes in buffer
+    uint32_t buffer_wanted;                 // Bytes to read into buffer
+} id3_tag_S;
+
+// @description : Starts parsing the tag at the start of a file
+void id3_tag_init(id3_tag_S *tag);
+
+// @description  : Which bytes the parser wants next
+// @param offset : Set to the file offset to read from
+// @param size   : Set to the number of bytes to read, never more than ID3_TAG_READ_SIZE
+// @returns      : False once the parser is done, either every wanted frame is found or the tag has ended
+bool id3_tag_next(id3_tag_S *tag, uint32_t *offset, uint32_t *size);
+
+// @description : Hands the parser the bytes of the file at the offset it asked for
+// @param data  : Bytes read, fewer than asked for ends the tag
+// @param size  : Number of bytes, more than asked for is fine, the parser takes what it needs
+// @returns     : Number of bytes taken
+uint32_t id3_tag_feed(id3_tag_S *tag, const uint8_t *data, uint32_t size);
+
+// @description  : Number of a genre written as "(17)", "(17)Rock" or "17"
+// @param text   : Genre as it is in the tag
+// @param number : Set to the number of the genre
+// @returns      : False if it is written out as text
+bool id3_tag_genre_number(const char *text, uint8_t *number);
@@ -0,0 +1,548 @@
+#include "library_index.hpp"
+#include "stop_watch.hpp"
+#include "ff.h"
+#include <cstring>
+#include <stdio.h>
+
+// "LIDX" in little endian
+static const uint32_t IndexMagic = 0x5844494C;
+
+// Index is read and written a few sectors at a time from sector boundaries, whole sectors go straight between
+// the card and the buffer instead of through the sector buffer the directory walk is using
+#define LIBRARY_INDEX_CHUNK_SIZE (2048)
+
+// FNV-1a, the path of a folder only has to tell it apart from the few other folders in the window
+static const uint32_t PathHashBasis = 0x811C9DC5;
+static const uint32_t PathHashPrime = 0x01000193;
+
+// Folder the walk is in, the stack of them is the walk itself, so nothing is recursed on the task stack
+typedef struct
+{
+    DIR      directory;
+    uint16_t folder;            // Number it was given when the walk went into it
+    uint16_t path_size;         // Characters of the path up to it, with the "1:" and the slash after it
+    uint32_t path_hash;         // Hash of the path up to it, without the "1:", see library_record_S
+} library_level_S;
+
+// Walk of the SD card, depth first
+typedef struct
+{
+    library_level_S       levels[LIBRARY_MAX_DEPTH + 1];   // Root and the folders under it the walk is in
+    uint32_t              depth;                           // Level being read
+    char                  path[LIBRARY_PATH_SIZE + 2];     // "1:" and the path of the last file
+    uint16_t              folders;                         // Last folder number given out
+    library_folder_t      enter;                           // Told about every folder, NULL if nobody asked
+    bool                  stopped;                         // Folder callback asked to stop
+    library_scan_stats_S *stats;
+} library_walk_S;
+
+// Everything the scan keeps, only allocated while it runs
+typedef struct
+{
+    // Old index, read front to back
+    FIL              old_file;
+    bool             old_open;
+    uint32_t         old_left;                                  // Records not read into the window yet
+    uint8_t          in[LIBRARY_INDEX_CHUNK_SIZE];
+    uint32_t         in_used;
+    uint32_t         in_size;
+    library_record_S window[LIBRARY_INDEX_WINDOW];              // Next records of the old index
+    uint32_t         window_count;
+
+    // New index, only written once something changed
+    FIL              new_file;
+    bool             changed;
+    bool             failed;
+    uint32_t         matched;                                   // Records at the start that are the same as the old index
+    uint32_t         count;                                     // Records in the new index
+    uint8_t          out[LIBRARY_INDEX_CHUNK_SIZE];
+    uint32_t         out_used;
+
+    uint32_t         index_us;
+
+    library_walk_S   walk;
+} library_scan_S;
+
+static bool ReadOld(library_scan_S *scan, void *destination, uint32_t size)
+{
+    uint8_t *bytes = (uint8_t*)destination;
+    while (size > 0)
+    {
+        if (scan->in_used == scan->in_size)
+        {
+            UINT read = 0;
+            if (FR_OK != f_read(&scan->old_file, scan->in, sizeof(scan->in), &read) || 0 == read)
+            {
+                return false;
+            }
+            scan->in_size = read;
+            scan->in_used = 0;
+        }
+
+        const uint32_t length = (size < scan->in_size - scan->in_used) ? (size) : (scan->in_size - scan->in_used);
+        memcpy(bytes, &scan->in[scan->in_used], length);
+        scan->in_used += length;
+        bytes         += length;
+        size          -= length;
+    }
+    return true;
+}
+
+static void OpenOld(library_scan_S *scan)
+{
+    MicroSecondStopWatch timer;
+    if (FR_OK != f_open(&scan->old_file, LIBRARY_INDEX_PATH, FA_OPEN_EXISTING | FA_READ))
+    {
+        printf("[library_scan] No index yet, every file is parsed.\n");
+        return;
+    }
+    scan->old_open = true;
+
+    library_index_header_S header = { };
+    if (!ReadOld(scan, &header, sizeof(header)) || IndexMagic != header.magic ||
+        LIBRARY_INDEX_VERSION != header.version || sizeof(library_record_S) != header.record_size)
+    {
+        printf("[library_scan] Index is of another version, every file is parsed.\n");
+        f_close(&scan->old_file);
+        scan->old_open = false;
+    }
+    else
+    {
+        scan->old_left = header.count;
+    }
+    scan->index_us += (uint32_t)timer.getElapsedTime();
+}
+
+static void FillWindow(library_scan_S *scan)
+{
+    MicroSecondStopWatch timer;
+    while (scan->window_count < LIBRARY_INDEX_WINDOW && scan->old_left > 0)
+    {
+        // Whatever is after a short read is taken as gone
+        if (!ReadOld(scan, &scan->window[scan->window_count], sizeof(library_record_S)))
+        {
+            printf("[library_scan] Index ends %lu records early.\n", scan->old_left);
+            scan->old_left = 0;
+            break;
+        }
+        ++scan->window_count;
+        --scan->old_left;
+    }
+    scan->index_us += (uint32_t)timer.getElapsedTime();
+}
+
+// Drops count records of the window from first on, and reads as many after them
+static void DropWindow(library_scan_S *scan, uint32_t first, uint32_t count)
+{
+    scan->window_count -= count;
+    memmove(&scan->window[first], &scan->window[first + count], (scan->window_count - first) * sizeof(library_record_S));
+    FillWindow(scan);
+}
+
+// Looks for the record of a file by its folder and name, a file of the same name in another folder is not it
+static int FindInWindow(library_scan_S *scan, const library_record_S *record)
+{
+    for (uint32_t i=0; i<scan->window_count; i++)
+    {
+        if (scan->window[i].path_hash == record->path_hash && 0 == strcmp(scan->window[i].name, record->name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t HashPath(uint32_t hash, const char *path)
+{
+    for (; *path; path++)
+    {
+        hash = (hash ^ (uint8_t)*path) * PathHashPrime;
+    }
+    return hash;
+}
+
+// Buffer is flushed a whole chunk at a time, so every write starts on a sector boundary
+static void WriteNew(library_scan_S *scan, const void *source, uint32_t size)
+{
+    MicroSecondStopWatch timer;
+    const uint8_t *bytes = (const uint8_t*)source;
+    while (size > 0 && !scan->failed)
+    {
+        const uint32_t space  = sizeof(scan->out) - scan->out_used;
+        const uint32_t length = (size < space) ? (size) : (space);
+        memcpy(&scan->out[scan->out_used], bytes, length);
+        scan->out_used += length;
+        bytes          += length;
+        size           -= length;
+
+        UINT written = 0;
+        if (sizeof(scan->out) == scan->out_used)
+        {
+            scan->failed   = (FR_OK != f_write(&scan->new_file, scan->out, sizeof(scan->out), &written)) || (sizeof(scan->out) != written);
+            scan->out_used = 0;
+        }
+    }
+    scan->index_us += (uint32_t)timer.getElapsedTime();
+}
+
+// Starts the new index with the header and the records that matched the old index so far, copied over as they are
+static void BeginNew(library_scan_S *scan)
+{
+    MicroSecondStopWatch timer;
+    scan->changed = true;
+
+    const FRESULT result = f_open(&scan->new_file, LIBRARY_INDEX_TEMP_PATH, FA_CREATE_ALWAYS | FA_WRITE);
+    if (FR_OK != result)
+    {
+        printf("[library_scan] Failed to create %s. Error: %d\n", LIBRARY_INDEX_TEMP_PATH, result);
+        scan->failed = true;
+        return;
+    }
+
+    if (0 == scan->matched)
+    {
+        // Count is filled in once it is known
+        library_index_header_S header = { IndexMagic, LIBRARY_INDEX_VERSION, sizeof(library_record_S), 0 };
+        WriteNew(scan, &header, sizeof(header));
+        return;
+    }
+
+    FIL copy;
+    if (FR_OK != f_open(&copy, LIBRARY_INDEX_PATH, FA_OPEN_EXISTING | FA_READ))
+    {
+        scan->failed = true;
+        return;
+    }
+
+    // Header comes along too, the old index has the same layout
+    uint32_t left = sizeof(library_index_header_S) + scan->matched * sizeof(library_record_S);
+    while (left > 0 && !scan->failed)
+    {
+        const uint32_t length = (left < sizeof(scan->out)) ? (left) : (sizeof(scan->out));
+        UINT read = 0;
+        scan->failed = (FR_OK != f_read(&copy, scan->out, length, &read)) || (length != read);
+        scan->out_used = length;
+        left -= length;
+
+        UINT written = 0;
+        if (!scan->failed && sizeof(scan->out) == scan->out_used)
+        {
+            scan->failed   = (FR_OK != f_write(&scan->new_file, scan->out, sizeof(scan->out), &written)) || (sizeof(scan->out) != written);
+            scan->out_used = 0;
+        }
+    }
+    f_close(&copy);
+    scan->index_us += (uint32_t)timer.getElapsedTime();
+}
+
+// Writes the count into the header, and puts the new index in place of the old one
+static bool FinishNew(library_scan_S *scan)
+{
+    MicroSecondStopWatch timer;
+    library_index_header_S header = { IndexMagic, LIBRARY_INDEX_VERSION, sizeof(library_record_S), scan->count };
+
+    UINT written = 0;
+    bool saved = !scan->failed &&
+                 FR_OK == f_write(&scan->new_file, scan->out, scan->out_used, &written) && scan->out_used == written &&
+                 FR_OK == f_lseek(&scan->new_file, 0) &&
+                 FR_OK == f_write(&scan->new_file, &header, sizeof(header), &written) && sizeof(header) == written;
+    saved = (FR_OK == f_close(&scan->new_file)) && saved;
+
+    if (saved)
+    {
+        f_unlink(LIBRARY_INDEX_PATH);
+        saved = (FR_OK == f_rename(LIBRARY_INDEX_TEMP_PATH, LIBRARY_INDEX_PATH));
+    }
+    if (!saved)
+    {
+        printf("[library_scan] Failed to write %s, every changed file is parsed again next time.\n", LIBRARY_INDEX_PATH);
+        f_unlink(LIBRARY_INDEX_TEMP_PATH);
+    }
+    scan->index_us += (uint32_t)timer.getElapsedTime();
+    return saved;
+}
+
+// Starts a walk at the root of the SD card
+static FRESULT BeginWalk(library_walk_S *walk, library_folder_t enter, library_scan_stats_S *stats)
+{
+    memset(walk, 0, sizeof(*walk));
+    walk->enter = enter;
+    walk->stats = stats;
+
+    // 1: for sd card directory
+    strcpy(walk->path, "1:");
+    walk->levels[0].folder    = LIBRARY_ROOT_FOLDER;
+    walk->levels[0].path_size = 2;
+    walk->levels[0].path_hash = PathHashBasis;
+    return f_opendir(&walk->levels[0].directory, walk->path);
+}
+
+// Closes whatever the walk is still in, after it stopped early
+static void EndWalk(library_walk_S *walk)
+{
+    for (uint32_t level=0; level<=walk->depth; level++)
+    {
+        f_closedir(&walk->levels[level].directory);
+    }
+    walk->depth = 0;
+}
+
+// Goes into a folder that was just read, unless it is left out, result is set if it fails to open
+static void EnterFolder(library_walk_S *walk, const char *name, FRESULT *result)
+{
+    const library_level_S *level = &walk->levels[walk->depth];
+    const uint32_t size = level->path_size + strlen(name);
+
+    // Path of a file in it, without the "1:", needs a slash, a character and the terminator after the folder name
+    if (walk->depth == LIBRARY_MAX_DEPTH || size + 1 > LIBRARY_PATH_SIZE)
+    {
+        ++walk->stats->skipped;
+        return;
+    }
+
+    const uint16_t folder = walk->folders + 1;
+    if (walk->enter && !walk->enter(folder, level->folder, name))
+    {
+        walk->stopped = true;
+        return;
+    }
+
+    strcpy(&walk->path[level->path_size], name);
+    library_level_S *next = &walk->levels[walk->depth + 1];
+    *result = f_opendir(&next->directory, walk->path);
+    if (FR_OK == *result)
+    {
+        walk->folders        = folder;
+        walk->path[size]     = '/';
+        walk->path[size + 1] = '\0';
+        next->folder         = folder;
+        next->path_size      = size + 1;
+        next->path_hash      = HashPath(level->path_hash, &walk->path[level->path_size]);
+        ++walk->depth;
+        ++walk->stats->folders;
+    }
+}
+
+// Reads the next file of the walk into a record, with its name, size, modification time and folder, its path is
+// in walk->path, going into every folder it gets to first
+// Returns false at the end of the walk, or on an error, which result is set to, or when the folder callback stops it
+static bool ReadFile(library_walk_S *walk, library_record_S *record, FRESULT *result)
+{
+    FILINFO file_info;
+    char name_buffer[LIBRARY_NAME_SIZE] = { 0 };
+    while (1)
+    {
+        library_level_S *level = &walk->levels[walk->depth];
+        file_info.lfname = name_buffer;
+        file_info.lfsize = sizeof(name_buffer);
+
+        // When no more to read, back up to the folder it is in, the walk is over once that is the root
+        *result = f_readdir(&level->directory, &file_info);
+        if (FR_OK != *result)
+        {
+            EndWalk(walk);
+            return false;
+        }
+        if (!file_info.fname[0])
+        {
+            f_closedir(&level->directory);
+            if (0 == walk->depth)
+            {
+                return false;
+            }
+            --walk->depth;
+            continue;
+        }
+
+        // Some file names are prefix with _, dont use those files, the index is one of them
+        if (file_info.fname[0] == '_' || file_info.lfname[0] == '_') continue;
+
+        // Use the long name if there is one that fits, "Disc 1" has a short name of "DISC1~1" that is longer
+        const char *file_name = (file_info.lfname[0]) ? (file_info.lfname) : (file_info.fname);
+
+        if (file_info.fattrib & AM_DIR)
+        {
+            EnterFolder(walk, file_name, result);
+            if (FR_OK != *result || walk->stopped)
+            {
+                EndWalk(walk);
+                return false;
+            }
+            continue;
+        }
+
+        // Path without the "1:" and with the terminator
+        if (level->path_size - 2 + strlen(file_name) + 1 > LIBRARY_PATH_SIZE)
+        {
+            ++walk->stats->skipped;
+            continue;
+        }
+        strcpy(&walk->path[level->path_size], file_name);
+
+        memset(record, 0, sizeof(*record));
+        strncpy(record->name, file_name, sizeof(record->name) - 1);
+        record->size      = file_info.fsize;
+        record->modified  = ((uint32_t)file_info.fdate << 16) | file_info.ftime;
+        record->folder    = level->folder;
+        record->path_hash = level->path_hash;
+        return true;
+    }
+}
+
+void library_list(library_add_t add, library_folder_t folder, library_wait_t wait, library_scan_stats_S *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    MicroSecondStopWatch total;
+
+    library_walk_S *walk = new library_walk_S;
+    FRESULT result = BeginWalk(walk, folder, stats);
+    if (FR_OK != result)
+    {
+        printf("[library_list] Failed to open the SD card. Error: %d\n", result);
+        delete walk;
+        return;
+    }
+
+    library_record_S record;
+    bool adding = true;
+    while (adding)
+    {
+        if (wait)
+        {
+            wait();
+        }
+        if (!ReadFile(walk, &record, &result))
+        {
+            break;
+        }
+        if (0 == stats->files)
+        {
+            stats->first_us = (uint32_t)total.getElapsedTime();
+        }
+        ++stats->files;
+        adding = add(&record);
+    }
+    if (FR_OK != result)
+    {
+        printf("[library_list] Walk stopped after %lu files in %s. Error: %d\n", stats->files, walk->path, result);
+    }
+    if (!adding)
+    {
+        EndWalk(walk);
+    }
+    stats->total_us = (uint32_t)total.getElapsedTime();
+    delete walk;
+}
+
+void library_scan(library_parse_t parse, library_add_t add, library_folder_t folder, library_wait_t wait,
+                  library_scan_stats_S *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    MicroSecondStopWatch total;
+
+    library_scan_S *scan = new library_scan_S;
+    memset(scan, 0, sizeof(*scan));
+
+    OpenOld(scan);
+    FillWindow(scan);
+
+    library_record_S record;
+    bool adding   = true;
+    bool complete = false;
+
+    FRESULT result = BeginWalk(&scan->walk, folder, stats);
+    if (FR_OK != result)
+    {
+        printf("[library_scan] Failed to open the SD card. Error: %d\n", result);
+    }
+
+    while (FR_OK == result)
+    {
+        if (wait)
+        {
+            wait();
+        }
+        if (!ReadFile(&scan->walk, &record, &result))
+        {
+            if (FR_OK != result)
+            {
+                printf("[library_scan] Walk stopped after %lu files in %s. Error: %d\n", stats->files, scan->walk.path, result);
+            }
+            complete = (FR_OK == result);
+            break;
+        }
+        ++stats->files;
+
+        const int found = FindInWindow(scan, &record);
+        const bool reuse = (found >= 0) && (scan->window[found].size == record.size) &&
+                           (scan->window[found].modified == record.modified);
+        if (reuse)
+        {
+            // Folder numbers are only good for the walk that found them
+            const uint16_t walked = record.folder;
+            record = scan->window[found];
+            record.folder = walked;
+            ++stats->reused;
+        }
+        else
+        {
+            MicroSecondStopWatch timer;
+            parse(&scan->walk.path[2], &record);
+            stats->parsed   += 1;
+            stats->parse_us += (uint32_t)timer.getElapsedTime();
+        }
+
+        // Anything but the next record of the old index, as it was, means the index is written again
+        if (!scan->changed && (!reuse || 0 != found))
+        {
+            BeginNew(scan);
+        }
+        // Records in front of one that is taken as it is are files that are gone, one that changed is only replaced,
+        // the file it matched may have been moved up from further down instead of the ones in front being removed
+        if (reuse)
+        {
+            stats->removed += found;
+            DropWindow(scan, 0, found + 1);
+        }
+        else if (found >= 0)
+        {
+            DropWindow(scan, found, 1);
+        }
+
+        if (scan->changed) WriteNew(scan, &record, sizeof(record));
+        else               ++scan->matched;
+        ++scan->count;
+
+        if (CODEC_UNKNOWN != record.codec)
+        {
+            if (0 == stats->tracks)
+            {
+                stats->first_us = (uint32_t)total.getElapsedTime();
+            }
+            ++stats->tracks;
+            adding = adding && add(&record);
+        }
+    }
+    // Whatever is left of the old index are files that are gone
+    stats->removed += scan->window_count + scan->old_left;
+    const bool removed = (scan->window_count + scan->old_left) > 0;
+    if (scan->old_open)
+    {
+        f_close(&scan->old_file);
+    }
+
+    // A walk that stopped early leaves the index as it was
+    if (complete && !scan->changed && (removed || !scan->old_open))
+    {
+        BeginNew(scan);
+    }
+    scan->failed = scan->failed || !complete;
+    if (scan->changed)
+    {
+        stats->saved = FinishNew(scan);
+    }
+
+    stats->index_us = scan->index_us;
+    stats->total_us = (uint32_t)total.getElapsedTime();
+    delete scan;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <stdint.h>
+#include "codec.hpp"
+
+/**
+ *  @explanation:
+ *  Opening every track on the SD card at boot to tell its codec and read its tags takes a few file system
+ *  walks per track, which adds up to seconds for a large library before the menu shows anything.  What was
+ *  found is kept in LIBRARY_INDEX_PATH instead, a header followed by one fixed size record per file, in the
+ *  order the walk gets to them:
+ *
+ *      library_index_header_S                  Magic, version and record size, a mismatch throws the index away
+ *      library_record_S * count                Name, size, modification time, codec and tags
+ *
+ *  At boot the SD card is walked next to the index, which is read front to back a few sectors at a time.
+ *  A file with the same name, size and modification time as its record is taken as it is, anything else is
+ *  parsed again.  The next LIBRARY_INDEX_WINDOW records are looked through for the name, so files that were
+ *  removed are skipped over as long as no more than a window of them is gone in a row, and files that were
+ *  added do not throw off the files after them.
+ *
+ *  The index is only written if something changed, copying the records of the files before the first change
+ *  over from the old one, so an unchanged library costs a directory walk and a read of the index.
+ *
+ *  Files that are not playable are kept too, as CODEC_UNKNOWN, so they are not sniffed again either.
+ *
+ *  Finding the index takes a walk through the directory entries before the first file, as long as the whole
+ *  directory if the index was written after the tracks were copied.  library_list gets the names out without
+ *  it, for a track list that is filled in by library_scan afterwards.
+ *
+ *  Folders are walked depth first, in the order their folder lists them, the files of a folder and every
+ *  folder under it are handed over before the walk moves on.  Going into a folder pushes its directory onto a
+ *  stack of LIBRARY_MAX_DEPTH + 1 levels kept with the rest of the walk on the heap, so how deep the folders go
+ *  costs nothing on the task stack.  Folders below LIBRARY_MAX_DEPTH, and files and folders with a path from the
+ *  root longer than fits in LIBRARY_PATH_SIZE, are left out and counted as skipped.  Folders are numbered in the
+ *  order the walk goes into them, from 1, the root is 0, so both walks number them the same.  A record keeps
+ *  the number of its folder and its own name, the number is whatever the walk that wrote it found.  Names are
+ *  only unique within a folder, "01.mp3" is in every album, so a record also keeps a hash of the path of its
+ *  folder, and is looked for in the window by the hash and its name.  Only a record that is taken as it is
+ *  moves the window past the records in front of it, a record that changed is only taken out of it.
+ */
+
+// Index file, the leading underscore keeps it out of the track list
+#define LIBRARY_INDEX_PATH      "1:_library.idx"
+#define LIBRARY_INDEX_TEMP_PATH "1:_library.tmp"
+
+// Bumped whenever library_record_S changes
+#define LIBRARY_INDEX_VERSION (4)
+
+// Records looked through for the name of a file, how many removed files in a row are skipped over
+#define LIBRARY_INDEX_WINDOW (8)
+
+// Name size, the same as a file_name_S short name, path size, the same as a file_name_S full name, without
+// the "1:", and tag size, the same as mp3_header_S
+#define LIBRARY_NAME_SIZE (64)
+#define LIBRARY_PATH_SIZE (128)
+#define LIBRARY_TAG_SIZE  (32)
+
+// Folders below the root that are walked, enough for Artist/Album/Disc and one more
+#define LIBRARY_MAX_DEPTH (4)
+
+// Folder number of the root
+#define LIBRARY_ROOT_FOLDER (0)
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t count;
+} library_index_header_S;
+
+typedef struct
+{
+    char     name[LIBRARY_NAME_SIZE];
+    uint32_t size;                      // File size
+    uint32_t modified;                  // FatFs date in the upper half, time in the lower half
+    uint8_t  codec;                     // codec_E, CODEC_UNKNOWN if it is not played
+    uint8_t  reserved;
+    uint16_t folder;                    // Number of the folder it is in
+    uint32_t path_hash;                 // FNV-1a of the path of the folder it is in, "" for the root
+    char     artist[LIBRARY_TAG_SIZE];
+    char     title[LIBRARY_TAG_SIZE];
+    char     genre[LIBRARY_TAG_SIZE];
+} library_record_S;
+
+typedef struct
+{
+    uint32_t files;         // Files walked
+    uint32_t folders;       // Folders walked, not counting the root
+    uint32_t skipped;       // Files and folders left out for being too deep or too long a path
+    uint32_t tracks;        // Files that are played
+    uint32_t reused;        // Files taken from the index as they are
+    uint32_t parsed;        // Files opened because they were added or changed
+    uint32_t removed;       // Records of files that are gone
+    bool     saved;         // Index was written again
+    uint32_t first_us;      // Time until the first file was handed over
+    uint32_t index_us;      // Time spent reading the old index and writing the new one
+    uint32_t parse_us;      // Time spent opening files
+    uint32_t total_us;
+} library_scan_stats_S;
+
+// @description  : Opens a file that was added or changed, to fill in its codec and tags
+// @param path   : Path from the root, without the "1:", only valid during the call
+// @param record : Name, size, modification time and folder are filled in, the rest is zeroed
+typedef void (*library_parse_t)(const char *path, library_record_S *record);
+
+// @description  : Hands a playable file over to the track list, in the order of the walk
+// @param record : File, only valid during the call
+// @returns      : False to stop adding tracks, the index is still kept up to date
+typedef bool (*library_add_t)(const library_record_S *record);
+
+// @description  : Hands a folder over to the track list, before anything in it
+// @param folder : Number of the folder, one more than the folder before
+// @param parent : Number of the folder it is in
+// @param name   : Folder name, without the path to it, only valid during the call
+// @returns      : False to stop the walk
+typedef bool (*library_folder_t)(uint16_t folder, uint16_t parent, const char *name);
+
+// @description : Called before every file, to let other tasks have the SD card
+typedef void (*library_wait_t)(void);
+
+// @description  : Walks the SD card next to the index, and writes the index again if anything changed
+// @param parse  : Called for every file that is not in the index as it is
+// @param add    : Called for every playable file
+// @param folder : Called for every folder, before the files in it, NULL if library_list already handed them over
+// @param wait   : Called before every file, NULL to go straight through
+// @param stats  : Set to what was found and how long it took
+void library_scan(library_parse_t parse, library_add_t add, library_folder_t folder, library_wait_t wait,
+                  library_scan_stats_S *stats);
+
+// @description  : Walks the SD card without opening anything, not even the index
+// @param add    : Called for every file, with only the name, size, modification time and folder, CODEC_UNKNOWN
+// @param folder : Called for every folder, before the files in it
+// @param wait   : Called before every file, NULL to go straight through
+// @param stats  : Set to the files and folders found and how long it took
+void library_list(library_add_t add, library_folder_t folder, library_wait_t wait, library_scan_stats_S *stats);
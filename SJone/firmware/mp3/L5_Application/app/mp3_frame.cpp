@@ -0,0 +1,109 @@
+#include "mp3_frame.hpp"
+
+// Bit rates in kbps, indexed by [layer - 1][bit rate index]
+static const uint16_t BitRatesMpeg1[3][16] = {
+    { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+    { 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+    { 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0 },
+};
+
+// MPEG 2 and 2.5 share the same bit rates, layer 2 and 3 are the same
+static const uint16_t BitRatesMpeg2[3][16] = {
+    { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+    { 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0 },
+    { 0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0 },
+};
+
+// Sample rates in Hz, indexed by [version][sample rate index]
+static const uint32_t SampleRates[4][3] = {
+    { 11025, 12000,  8000 },    // MPEG 2.5
+    {     0,     0,     0 },    // Reserved
+    { 22050, 24000, 16000 },    // MPEG 2
+    { 44100, 48000, 32000 },    // MPEG 1
+};
+
+bool mp3_frame_parse_header(const uint8_t *bytes, mp3_frame_header_S *header)
+{
+    // 11 bits of sync word
+    if (bytes[0] != 0xFF || (bytes[1] & 0xE0) != 0xE0)
+    {
+        return false;
+    }
+
+    const uint8_t version          = (bytes[1] >> 3) & 0x3;
+    const uint8_t layer_bits       = (bytes[1] >> 1) & 0x3;
+    const uint8_t bit_rate_index   = (bytes[2] >> 4) & 0xF;
+    const uint8_t sample_rate_index= (bytes[2] >> 2) & 0x3;
+    const uint8_t emphasis         = (bytes[3] & 0x3);
+
+    // Reserved values, and free format which has no frame size in the header
+    if (MPEG_VERSION_RESERVED == version || 0 == layer_bits ||
+        0 == bit_rate_index || 0xF == bit_rate_index ||
+        0x3 == sample_rate_index || 0x2 == emphasis)
+    {
+        return false;
+    }
+
+    // Layer bits are reversed, 3 is layer I and 1 is layer III
+    const uint8_t layer = 4 - layer_bits;
+    const uint16_t kbps = (MPEG_VERSION_1 == version) ? (BitRatesMpeg1[layer - 1][bit_rate_index]) :
+                                                        (BitRatesMpeg2[layer - 1][bit_rate_index]);
+
+    header->version      = (mpeg_version_E)version;
+    header->layer        = layer;
+    header->channel_mode = (bytes[3] >> 6) & 0x3;
+    header->padding      = (bytes[2] >> 1) & 0x1;
+    header->crc          = !(bytes[1] & 0x1);
+    header->bit_rate     = kbps * 1000;
+    header->sample_rate  = SampleRates[version][sample_rate_index];
+
+    switch (layer)
+    {
+        case 1:
+            header->samples = 384;
+            header->size    = ((12 * header->bit_rate / header->sample_rate) + header->padding) * 4;
+            break;
+        case 2:
+            header->samples = 1152;
+            header->size    = (144 * header->bit_rate / header->sample_rate) + header->padding;
+            break;
+        default:
+            // Layer III of MPEG 2 and 2.5 only has half the samples per frame
+            header->samples = (MPEG_VERSION_1 == version) ? (1152) : (576);
+            header->size    = (header->samples / 8 * header->bit_rate / header->sample_rate) + header->padding;
+            break;
+    }
+
+    return true;
+}
+
+bool mp3_frame_is_same_stream(const mp3_frame_header_S *a, const mp3_frame_header_S *b)
+{
+    return (a->version == b->version) && (a->layer == b->layer) && (a->sample_rate == b->sample_rate);
+}
+
+uint32_t mp3_frame_find_sync(const uint8_t *buffer, uint32_t size, mp3_frame_header_S *header)
+{
+    mp3_frame_header_S next = { };
+
+    for (uint32_t i=0; i + MP3_FRAME_HEADER_SIZE <= size; i++)
+    {
+        if (!mp3_frame_parse_header(&buffer[i], header))
+        {
+            continue;
+        }
+
+        // A lone 0xFFE is common in audio data, confirm with the next frame whenever possible
+        const uint32_t next_index = i + header->size;
+        if (next_index + MP3_FRAME_HEADER_SIZE > size)
+        {
+            return i;
+        }
+        if (mp3_frame_parse_header(&buffer[next_index], &next) && mp3_frame_is_same_stream(header, &next))
+        {
+            return i;
+        }
+    }
+
+    return size;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  An mp3 file is a sequence of independent frames, each one starting with a 4 byte header.  The header
+ *  starts with 11 set bits of sync word, followed by the MPEG version, layer, bit rate and sample rate,
+ *  which together give the size of the frame, and the number of samples it decodes to.
+ *
+ *  @example:
+ *  0xFF 0xFB 0x90 0x64 : MPEG 1, Layer III, 128 kbps, 44100 Hz, no padding, 417 byte frame of 1152 samples
+ */
+
+// Size of a frame header
+#define MP3_FRAME_HEADER_SIZE (4)
+
+typedef enum
+{
+    MPEG_VERSION_2_5 = 0,
+    MPEG_VERSION_RESERVED = 1,
+    MPEG_VERSION_2 = 2,
+    MPEG_VERSION_1 = 3,
+} mpeg_version_E;
+
+// Decoded frame header
+typedef struct
+{
+    mpeg_version_E version;
+    uint8_t  layer;             // 1, 2, or 3
+    uint8_t  channel_mode;      // 0 stereo, 1 joint stereo, 2 dual channel, 3 mono
+    bool     padding;           // Frame has one extra slot
+    bool     crc;               // Header is followed by a 16 bit CRC
+    uint32_t bit_rate;          // Bits per second
+    uint32_t sample_rate;       // Samples per second
+    uint16_t samples;           // Samples per frame
+    uint16_t size;              // Frame size in bytes, including the header
+} mp3_frame_header_S;
+
+// @description  : Decodes a frame header, rejects free format and reserved values
+// @param bytes  : At least MP3_FRAME_HEADER_SIZE bytes, starting at the sync word
+// @param header : Struct to decode into
+// @returns      : True if the bytes are a valid frame header, false if not
+bool mp3_frame_parse_header(const uint8_t *bytes, mp3_frame_header_S *header);
+
+// @description  : Checks if two frame headers could belong to the same stream
+// @returns      : True if version, layer and sample rate match
+bool mp3_frame_is_same_stream(const mp3_frame_header_S *a, const mp3_frame_header_S *b);
+
+// @description  : Searches a buffer for the first valid frame header
+//                 If the frame following it is also in the buffer, it must be valid as well
+// @param buffer : Bytes to search
+// @param size   : Size of buffer
+// @param header : Struct the found header is decoded into
+// @returns      : Index of the frame header in the buffer, or size if none was found
+uint32_t mp3_frame_find_sync(const uint8_t *buffer, uint32_t size, mp3_frame_header_S *header);
@@ -0,0 +1,119 @@
+#include "mp3_reverse.hpp"
+#include "mp3_frame.hpp"
+#include <cstring>
+
+void mp3_reverse_begin(mp3_reverse_S *reverse, const mp3_stream_info_S *info, uint32_t offset, uint32_t speed)
+{
+    if (speed < MP3_REVERSE_MIN_SPEED) speed = MP3_REVERSE_MIN_SPEED;
+    if (speed > MP3_REVERSE_MAX_SPEED) speed = MP3_REVERSE_MAX_SPEED;
+
+    memset(reverse, 0, sizeof(*reverse));
+    reverse->info    = *info;
+    reverse->play_ms = MP3_REVERSE_PLAY_MS;
+    reverse->jump_ms = MP3_REVERSE_PLAY_MS * (speed + 1);
+    reverse->cut     = (offset > info->audio_start) ? (offset) : (info->audio_start);
+    reverse->done    = true;
+}
+
+void mp3_reverse_begin_fast_forward(mp3_reverse_S *reverse, const mp3_stream_info_S *info, uint32_t offset, uint32_t ratio)
+{
+    if (ratio < MP3_REVERSE_MIN_RATIO) ratio = MP3_REVERSE_MIN_RATIO;
+    if (ratio > MP3_REVERSE_MAX_RATIO) ratio = MP3_REVERSE_MAX_RATIO;
+
+    // Same as rewinding at speed 1, then only the jump and direction change
+    mp3_reverse_begin(reverse, info, offset, MP3_REVERSE_MIN_SPEED);
+    reverse->jump_ms = MP3_REVERSE_PLAY_MS * (ratio - 1);
+    reverse->forward = true;
+}
+
+bool mp3_reverse_next_window(mp3_reverse_S *reverse, uint32_t *offset, uint32_t *size)
+{
+    if (reverse->last)
+    {
+        return false;
+    }
+
+    // Window n+1 starts jump_ms before window n ended, or jump_ms after when fast forwarding
+    const uint32_t cut_ms   = mp3_vbr_offset_to_ms(&reverse->info, reverse->cut);
+    uint32_t start_ms = 0;
+    if (reverse->forward)
+    {
+        // The rest of the track is played normally once a whole window no longer fits
+        start_ms = cut_ms + reverse->jump_ms;
+        if (start_ms + reverse->play_ms > mp3_vbr_get_duration_ms(&reverse->info))
+        {
+            return false;
+        }
+    }
+    else if (cut_ms > reverse->jump_ms)
+    {
+        start_ms = cut_ms - reverse->jump_ms;
+    }
+
+    reverse->start = mp3_vbr_ms_to_offset(&reverse->info, start_ms);
+    if (!reverse->forward && (0 == start_ms || reverse->start <= reverse->info.audio_start))
+    {
+        reverse->start = reverse->info.audio_start;
+        reverse->last  = true;
+    }
+
+    // Never plays past where the last window ended when rewinding, which only happens close to the start of the track
+    const uint32_t end = mp3_vbr_ms_to_offset(&reverse->info, start_ms + reverse->play_ms);
+    reverse->end      = (reverse->forward || end < reverse->cut) ? (end) : (reverse->cut);
+    reverse->read_end = reverse->end + MP3_REVERSE_MAX_FRAME_SIZE + MP3_FRAME_HEADER_SIZE;
+    reverse->aligned  = false;
+    reverse->done     = false;
+    ++reverse->windows;
+
+    *offset = reverse->start;
+    *size   = reverse->read_end - reverse->start;
+    return true;
+}
+
+uint32_t mp3_reverse_trim(mp3_reverse_S *reverse, const uint8_t *data, uint32_t size, uint32_t offset, uint32_t *skip)
+{
+    mp3_frame_header_S header;
+    *skip = size;
+
+    if (reverse->done)
+    {
+        return 0;
+    }
+
+    // Everything up to the first frame of the window is dropped, the window start is only an estimate
+    // A window is at least that one frame long, even when it is already past the end
+    uint32_t first = 0;
+    uint32_t min_search = 0;
+    if (!reverse->aligned)
+    {
+        first = mp3_frame_find_sync(data, size, &header);
+        if (first == size)
+        {
+            return 0;
+        }
+        reverse->aligned = true;
+        min_search = first + MP3_FRAME_HEADER_SIZE;
+    }
+    *skip = first;
+
+    const uint32_t end_in_data = (reverse->end > offset) ? (reverse->end - offset) : (0);
+    const uint32_t search      = (end_in_data > min_search) ? (end_in_data) : (min_search);
+    if (search < size)
+    {
+        const uint32_t boundary = search + mp3_frame_find_sync(data + search, size - search, &header);
+        if (boundary < size)
+        {
+            reverse->done = true;
+            reverse->cut  = offset + boundary;
+            return boundary - first;
+        }
+    }
+
+    // Read everything there is to the window without finding its end, the data is not a stream there
+    if (offset + size >= reverse->read_end)
+    {
+        reverse->done = true;
+        reverse->cut  = offset + size;
+    }
+    return size - first;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include "mp3_vbr.hpp"
+
+/**
+ *  @explanation:
+ *  Bytes of an mp3 file played backwards never decode, so rewinding works the way a CD player scans backwards.
+ *  A short window of the track is played forward, then playback jumps back further than the window was long:
+ *
+ *                  |<------------------- jump_ms ------------------->|
+ *      ...---------[ window n+1 ]---------------------[  window n    ]---------...
+ *                  |<- play_ms->|                     |<- play_ms -->|
+ *
+ *  With 250 ms windows and a speed of 2, every window starts 750 ms before the end of the one before it, so
+ *  the track moves back 500 ms for every 250 ms heard, twice as fast as it plays.
+ *
+ *  A window has to start and end on a frame boundary, or the decoder drops the frame it was cut in.  Only
+ *  the offsets of the window are estimated from the time, through the Xing table of contents or the bit rate,
+ *  the bytes read for the window are then scanned for sync words to find the frames they fall on.  The scan
+ *  runs over data that has to be read anyway, so a window costs one seek and about play_ms worth of bytes.
+ *
+ *  Fast forward plays the same windows, but jumps ahead between them instead of back:
+ *
+ *      ...---------[  window n    ]---------------------[ window n+1 ]---------...
+ *                  |<- play_ms -->|<----- jump_ms ----->|
+ *
+ *  With a ratio of 4, only one in every 4 frames is read and sent to the decoder, instead of sending all of
+ *  them and having it play them at a higher speed, which needs 4 times the SPI and SD card bandwidth.
+ */
+
+// Length of each window that is played, about 10 frames
+#define MP3_REVERSE_PLAY_MS (250)
+
+// Speed is how many times faster than playback the track moves back
+#define MP3_REVERSE_MIN_SPEED     (1)
+#define MP3_REVERSE_MAX_SPEED     (8)
+#define MP3_REVERSE_DEFAULT_SPEED (2)
+
+// Ratio is how many times faster than playback fast forward moves through the track
+#define MP3_REVERSE_MIN_RATIO     (2)
+#define MP3_REVERSE_MAX_RATIO     (16)
+#define MP3_REVERSE_DEFAULT_RATIO (4)
+
+// Largest Layer III frame, MPEG 1 at 320 kbps and 32000 Hz, the end of a window is always within this many bytes
+#define MP3_REVERSE_MAX_FRAME_SIZE (1441)
+
+typedef struct
+{
+    mp3_stream_info_S info;     // Maps between time and offsets of the track being rewound
+    uint32_t play_ms;           // Audio played per window
+    uint32_t jump_ms;           // Time from the end of a window back, or ahead, to the start of the next one
+    uint32_t start;             // Offset the window is read from, not frame aligned
+    uint32_t end;               // Window ends at the first frame boundary at or after this offset
+    uint32_t read_end;          // Offset the reads of the window stop at
+    uint32_t cut;               // Frame boundary the last window ended at, where scanning began before the first
+    bool     forward;           // Fast forwarding instead of rewinding
+    bool     aligned;           // First frame boundary of the window has been found
+    bool     done;              // Window has reached its end
+    bool     last;              // Window starts at the first frame of the track, rewinding is over after it
+    uint32_t windows;           // Windows started since scanning began
+} mp3_reverse_S;
+
+// @description  : Starts rewinding a track
+// @param info   : Stream info of the track, copied
+// @param offset : Frame boundary playback is at
+// @param speed  : Times faster than playback the track moves back, clamped to [MIN_SPEED, MAX_SPEED]
+void mp3_reverse_begin(mp3_reverse_S *reverse, const mp3_stream_info_S *info, uint32_t offset, uint32_t speed);
+
+// @description  : Starts fast forwarding through a track, by the same windows as rewinding
+// @param info   : Stream info of the track, copied
+// @param offset : Frame boundary playback is at
+// @param ratio  : Times faster than playback the track moves ahead, clamped to [MIN_RATIO, MAX_RATIO]
+void mp3_reverse_begin_fast_forward(mp3_reverse_S *reverse, const mp3_stream_info_S *info, uint32_t offset, uint32_t ratio);
+
+// @description  : Moves on to the next window, call once the last one is done
+// @param offset : Set to the offset to read the window from
+// @param size   : Set to the number of bytes to read
+// @returns      : False once the window at the first frame of the track has been played, or when fast
+//                 forwarding, once the next window would run past the end of the track.  reverse->cut is
+//                 then the frame boundary to continue playing from
+bool mp3_reverse_next_window(mp3_reverse_S *reverse, uint32_t *offset, uint32_t *size);
+
+// @description  : Trims bytes read for the current window to whole frames, sets reverse->done at the end of it
+// @param data   : Bytes of the window, in the order they were read
+// @param size   : Size of data
+// @param offset : File offset data was read from
+// @param skip   : Set to the number of bytes at the start of data that are not part of the window
+// @returns      : Number of bytes after the skipped ones that are part of the window
+uint32_t mp3_reverse_trim(mp3_reverse_S *reverse, const uint8_t *data, uint32_t size, uint32_t offset, uint32_t *skip);
@@ -4,6 +4,9 @@
 #include <cstring>
 #include "utilities.hpp"
 #include "genre_lut.hpp"
+#include "frame_index.hpp"
+#include "mp3_vbr.hpp"
+#include "id3_tag.hpp"
 
 // ID3 10-byte header
 typedef struct
@@ -12,13 +15,14 @@ typedef struct
     uint8_t version[2];             // 2 bytes
     struct
     {
-        uint8_t unsync       : 1;
-        uint8_t extended     : 1;
-        uint8_t experimental : 1;
-        uint8_t footer       : 1;
+        // Bit fields are allocated from the least significant bit, flags are stored from the most
         uint8_t unused       : 4;
+        uint8_t footer       : 1;
+        uint8_t experimental : 1;
+        uint8_t extended     : 1;
+        uint8_t unsync       : 1;
     } flags;                        // 1 bytes
-    uint32_t size;                  // 4 bytes
+    uint32_t size;                  // 4 bytes, syncsafe and big endian
 
 } __attribute__((packed)) mp3_id3_header_S;
 
@@ -31,6 +35,10 @@ typedef struct
     uint32_t length;
     uint32_t segment;
     seek_direction_E direction;
+    mp3_stream_info_S stream_info;  // Frame count and table of contents from the info frame, or CBR estimate
+    uint32_t audio_start;           // Offset of the first frame, after the ID3v2 tag
+    uint32_t audio_end;             // Offset right after the last frame, before any ID3v1 or APE tags
+    uint16_t block_align;           // Offsets worked out from a time land on a multiple of it, bytes of a WAV sample
 } mp3_song_info_S;
 
 // A struct that holds information about the current song open
@@ -41,137 +49,185 @@ static mp3_song_info_S current_song = {
     .mp3_file      = { 0 },
     .length        = 0,
     .segment       = 0,
+    .direction     = DIR_FORWARD,
+    .stream_info   = { },
+    .audio_start   = 0,
+    .audio_end     = 0,
+    .block_align   = 1,
 };
 
-/**
- *  @explanation:
- *  ID3 is a universal de facto standard of MP3 files.  The encoding stores a large header section in the beginning of the file.
- *  The header is always prefixed by 3 bytes, the first 3 bytes of the file: "ID3".  It is followed by 7 bytes of encoding information.
- *  These 10 bytes are the metadata of the header.  After the metadata, until the end of the header section, are tag fields.
- *  The format of the tag fields is as follows:
- *      - 3-5 bytes of tag code
- *      - 1-2 bytes of 0x00
- *      - 1 byte of the size of the tag field
- *      - 1-2 bytes of 0x00 (if 1 byte before, 2 bytes here, else if 2 bytes before, 1 byte here)
- *      - N bytes for the tag field specified in the size above
- *
- *  @example:
- *  T L E 0x00 0x10 0x00 0x00 0x1 0x2 0x3 0x4 0x5 0x6 0x7 0x8 0x9 0xA 0xB 0xC 0xD 0xE 0xF
- *  @example:
- *  T P 1 0x00 0x00 0x11 0x00 0x1 0x2 0x3 0x4 0x5 0x6 0x7 0x8 0x9 0xA 0xB 0xC 0xD 0xE 0xF 0x10
- */
-static void mp3_ip3_parser(uint8_t *buffer, uint32_t size, mp3_header_S *header)
-{
-    if (size < 10)
+// Stream tags to the decoder like audio, only for measuring what skipping them saves
+static bool SkipTags = true;
+
+// Fills one field of the header, what the tag leaves out is unknown
+static void mp3_copy_tag(char *destination, uint32_t size, const id3_tag_S *tag, id3_tag_field_E field)
+{
+    const char *text = (tag->found[field]) ? (tag->text[field]) : ("Unknown");
+
+    // Genre is a number into the ID3v1 list, "(17)", or written out as text
+    uint8_t genre_code = 0;
+    if (ID3_TAG_GENRE == field && tag->found[field] && id3_tag_genre_number(text, &genre_code) && genre_code < 192)
     {
-        printf("[mp3_ip3_parser] Cannot parse header shorter than the minimum 10 byte header size.\n");
+        text = genre_lookup(genre_code);
     }
-    else
+
+    memset(destination, 0, size);
+    strncpy(destination, text, size - 1);
+}
+
+// Walks the ID3v2 tag with the parser, reading only the bytes it asks for, so album art is never read
+void mp3_read_tags(FIL *file, const uint8_t *start, uint32_t start_size, mp3_header_S *header)
+{
+    id3_tag_S tag;
+    id3_tag_init(&tag);
+
+    uint8_t buffer[ID3_TAG_READ_SIZE] = { 0 };
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+    while (id3_tag_next(&tag, &offset, &size))
     {
-        // Start off with unknown
-        const char *unknown = "Unknown";
-        strncpy(header->artist, unknown, strlen(unknown));
-        strncpy(header->genre,  unknown, strlen(unknown));
-        strncpy(header->title,  unknown, strlen(unknown));
-
-        const uint8_t char_TERMINATE = 0x00;
-        mp3_id3_header_S id3_header = { 0 };
-        // Tags are usually 3-4 bytes, but leaving enough space to always be null terminated
-        uint8_t  tag[6]          = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-        uint8_t  tag_value[128]  = { 0 };
-        uint32_t buffer_index    = 0;
-        uint32_t tag_size        = 0;
-        uint8_t  tag_value_index = 0;
-
-        // Save general file meta information (the main file header)
-        memcpy(&id3_header, buffer, sizeof(id3_header));
-        buffer       += 10;
-        buffer_index += 10;
-
-        // While there are still bytes left in the buffer
-        while (buffer_index < size)
+        UINT read = 0;
+        if (offset + size <= start_size)
+        {
+            id3_tag_feed(&tag, &start[offset], start_size - offset);
+        }
+        else if (FR_OK == f_lseek(file, offset) && FR_OK == f_read(file, buffer, size, &read))
         {
-            memset(tag_value, 0, sizeof(tag_value));
-            tag_value_index = 0;
+            id3_tag_feed(&tag, buffer, read);
+        }
+        else
+        {
+            printf("[mp3_read_tags] Failed to read the tag at %lu.\n", offset);
+            break;
+        }
+    }
 
-            // Parse the tag
-            for (int i=0; i<5; i++)
-            {
-                // Stop parsing tag after seeing the terminating character, usually after 3-4 characters
-                if (*buffer == char_TERMINATE) 
-                {
-                    break;
-                }
-                else
-                {
-                    tag[i] = *(buffer++);
-                    buffer_index++;
-                }
-            }
+    mp3_copy_tag(header->title,  sizeof(header->title),  &tag, ID3_TAG_TITLE);
+    mp3_copy_tag(header->artist, sizeof(header->artist), &tag, ID3_TAG_ARTIST);
+    mp3_copy_tag(header->genre,  sizeof(header->genre),  &tag, ID3_TAG_GENRE);
+}
 
-            // Next byte should be 0x00, skip it
-            buffer++;
-            buffer_index++;
+// Bytes read from the first frame, enough for a Xing header with a LAME tag, and most VBRI tables
+#define MP3_INFO_FRAME_READ_SIZE (512)
 
-            // The size can either be the next byte or next next byte,
-            // if it is the next next byte, skip one more byte
-            if (*buffer == char_TERMINATE)
-            {
-                // Next character should be 0x00, skip it
-                buffer++;
-                buffer_index++;
-            }
+// Decodes the 28 bit syncsafe size of an ID3v2 tag, 7 bits per byte
+static uint32_t mp3_id3_get_tag_size(mp3_id3_header_S *id3_header)
+{
+    const uint8_t *size = (const uint8_t *)&id3_header->size;
+    return ((size[0] & 0x7F) << 21) | ((size[1] & 0x7F) << 14) | ((size[2] & 0x7F) << 7) | (size[3] & 0x7F);
+}
 
-            // Size of tag field
-            tag_size = *(buffer++);
-            buffer_index++;
+// Sizes of the tags found at the end of a file
+#define ID3V1_TAG_SIZE      (128)
+#define APE_FOOTER_SIZE     (32)
+#define APE_HAS_HEADER_FLAG (1UL << 31)
 
-            // Parse the contents of the tag field
-            for (uint32_t i=0; i<tag_size; i++)
-            {
-                if (*buffer >= 0x20 && *buffer <=0x7E) 
-                    tag_value[tag_value_index++] = *buffer;
-                buffer++;
-                buffer_index++;
-            }
+// Walks back over the ID3v1 and APEv2 tags at the end of the file, in either order
+static uint32_t mp3_find_audio_end(uint32_t audio_start)
+{
+    FIL *file = &current_song.mp3_file;
+    uint32_t end = (uint32_t)file->fsize;
+    uint8_t footer[APE_FOOTER_SIZE] = { 0 };
+    UINT read = 0;
 
-            // Don't print it if it's empty or just a junk char
-            if (tag_value_index < 2) continue;
+    bool found = true;
+    while (found && end > audio_start + APE_FOOTER_SIZE)
+    {
+        found = false;
+
+        // ID3v1, fixed size starting with "TAG"
+        if (end >= audio_start + ID3V1_TAG_SIZE && FR_OK == f_lseek(file, end - ID3V1_TAG_SIZE) &&
+            FR_OK == f_read(file, footer, 3, &read) && 3 == read && 0 == memcmp(footer, "TAG", 3))
+        {
+            end  -= ID3V1_TAG_SIZE;
+            found = true;
+            continue;
+        }
 
-            if      (strcmp((const char*)tag, "TT2")  == 0)  memcpy(&header->title , tag_value, MAX_NAME_LENGTH);
-            else if (strcmp((const char*)tag, "TP1")  == 0)  memcpy(&header->artist, tag_value, MAX_NAME_LENGTH);
-            else if (strcmp((const char*)tag, "TCO")  == 0) 
+        // APEv2, the footer holds the size of the items and footer, plus a header of the same size if flagged
+        if (FR_OK == f_lseek(file, end - APE_FOOTER_SIZE) && FR_OK == f_read(file, footer, APE_FOOTER_SIZE, &read) &&
+            APE_FOOTER_SIZE == read && 0 == memcmp(footer, "APETAGEX", 8))
+        {
+            const uint32_t size  = footer[12] | (footer[13] << 8) | (footer[14] << 16) | (footer[15] << 24);
+            const uint32_t flags = footer[20] | (footer[21] << 8) | (footer[22] << 16) | ((uint32_t)footer[23] << 24);
+            const uint32_t total = size + ((flags & APE_HAS_HEADER_FLAG) ? (APE_FOOTER_SIZE) : (0));
+            if (total <= end - audio_start)
             {
-                // Genre is in the format "(xy)"
-                if  (tag_value[0] == '(' && 
-                    (tag_value[1] >= 0x30 && tag_value[1] <= 0x39) && 
-                    (tag_value[2] >= 0x30 && tag_value[2] <= 0x39) &&
-                    (tag_value[3] == ')'))
-                {
-                    uint8_t genre_code = (tag_value[1] - '0') * 10 + (tag_value[2] - '0');
-                    const char* genre = genre_lookup(genre_code);
-                    memcpy(header->genre, genre, strlen(genre));
-                    header->genre[strlen(genre)] = '\0';
-                }
-                // Genre is in the format "(x)"
-                else if  (tag_value[0] == '(' && 
-                         (tag_value[1] >= 0x30 && tag_value[1] <= 0x39) && 
-                         (tag_value[2] == ')'))
-                {
-                    uint8_t genre_code = (tag_value[1] - '0');
-                    const char* genre = genre_lookup(genre_code);
-                    memcpy(header->genre, genre, strlen(genre));
-                    header->genre[strlen(genre)] = '\0';
-                }
-                // Genre is in ascii rather than a lookup code
-                else
-                {
-                    memcpy(&header->genre, tag_value, MAX_NAME_LENGTH);
-                }
-                header->genre[31] = '\0';
+                end  -= total;
+                found = true;
             }
         }
     }
+
+    return end;
+}
+
+// Fills in the stream info of a WAV file from its header, it plays at a constant byte rate
+static bool mp3_read_wav_info(const uint8_t *buffer, uint32_t size, uint32_t offset)
+{
+    codec_wav_S wav;
+    if (!codec_parse_wav(buffer, size, &wav))
+    {
+        return false;
+    }
+
+    // Header is streamed too, the decoder needs it to know the format
+    mp3_stream_info_S *info = &current_song.stream_info;
+    info->type         = MP3_VBR_NONE;
+    info->stream_start = offset + wav.data_start;
+    info->audio_start  = info->stream_start;
+    info->stream_bytes = (current_song.audio_end > info->stream_start) ?
+                         (MIN(wav.data_bytes, current_song.audio_end - info->stream_start)) : (0);
+    info->sample_rate  = wav.sample_rate;
+    info->bit_rate     = wav.byte_rate * 8;
+    current_song.block_align = wav.block_align;
+    return true;
+}
+
+// Finds the audio between the tags and parses the info frame, leaves the file at the first frame
+// Only MP3 has an info frame, and only MP3 and AAC have tags at the end, see codec.hpp
+static void mp3_read_stream_info(void)
+{
+    const codec_E codec = current_song.file_name.codec;
+    FIL *file = &current_song.mp3_file;
+    mp3_id3_header_S id3_header = { 0 };
+    uint8_t buffer[MP3_INFO_FRAME_READ_SIZE] = { 0 };
+    uint32_t tag_end = 0;
+    UINT read = 0;
+
+    // ID3v2 tag, which often carries hundreds of KB of album art, and its optional footer
+    if (FR_OK == f_read(file, &id3_header, sizeof(id3_header), &read) &&
+        sizeof(id3_header) == read && 0 == memcmp(id3_header.id3, "ID3", 3))
+    {
+        tag_end  = sizeof(id3_header) + mp3_id3_get_tag_size(&id3_header);
+        tag_end += (id3_header.flags.footer) ? (sizeof(id3_header)) : (0);
+    }
+
+    current_song.audio_end = (codec_get_info(codec)->trailing_tags) ? (mp3_find_audio_end(tag_end)) : ((uint32_t)file->fsize);
+    current_song.audio_start = tag_end;
+
+    read = 0;
+    if (FR_OK != f_lseek(file, tag_end) || FR_OK != f_read(file, buffer, sizeof(buffer), &read))
+    {
+        printf("[mp3_read_stream_info] Failed to read after %lu, length is unknown.\n", tag_end);
+    }
+    else if (CODEC_MP3 == codec && mp3_vbr_parse(buffer, read, tag_end, current_song.audio_end, &current_song.stream_info))
+    {
+        // Info frame is left in, it decodes to silence and keeps the encoder delay accounting intact
+        current_song.audio_start = current_song.stream_info.stream_start;
+    }
+    else if (CODEC_WAV != codec || !mp3_read_wav_info(buffer, read, tag_end))
+    {
+        printf("[mp3_read_stream_info] No %s stream info after %lu, length is unknown.\n", codec_get_info(codec)->name, tag_end);
+    }
+
+    if (!SkipTags)
+    {
+        current_song.audio_start = 0;
+        current_song.audio_end   = (uint32_t)file->fsize;
+    }
+
+    f_lseek(file, current_song.audio_start);
 }
 
 bool mp3_open_file(file_name_S *file_name)
@@ -183,12 +239,16 @@ bool mp3_open_file(file_name_S *file_name)
     }
 
     // Clear everything
-    current_song.length  = 0;
-    current_song.segment = 0;
+    current_song.length      = 0;
+    current_song.segment     = 0;
+    current_song.audio_start = 0;
+    current_song.audio_end   = 0;
+    current_song.block_align = 1;
+    memset(&current_song.stream_info, 0, sizeof(current_song.stream_info));
 
     // 1: for sd card directory, buffer = directory_path + name
     const char *directory_path = "1:";
-    char buffer[33] = { 0 };
+    char buffer[MAX_PATH_LENGTH + 3] = { 0 };
     strcpy(buffer, directory_path);
     strcat(buffer, file_name->full_name);
 
@@ -203,6 +263,7 @@ bool mp3_open_file(file_name_S *file_name)
     {
         memcpy(&(current_song.file_name), file_name, sizeof(file_name_S));
         current_song.file_is_open = true;
+        mp3_read_stream_info();
         printf("[mp3_open_file] %s successfully opened.\n", current_song.file_name.short_name);
         return true;
     }
@@ -213,12 +274,13 @@ file_name_S mp3_get_name(void)
     return current_song.file_name;
 }
 
-void mp3_get_header_info(mp3_header_S *header, uint8_t *buffer)
+void mp3_get_header_info(mp3_header_S *header)
 {
-    const uint32_t max_header_size = 470;
-    uint32_t current_segment_size;
-    mp3_read_segment(buffer, max_header_size, &current_segment_size);
-    mp3_ip3_parser(buffer, max_header_size, header);
+    if (!current_song.file_is_open) return;
+
+    // Tag is in front of the audio, the file is put back where playback starts
+    mp3_read_tags(&current_song.mp3_file, NULL, 0, header);
+    current_song.file_status = f_lseek(&current_song.mp3_file, current_song.audio_start);
 }
 
 bool mp3_close_file(void)
@@ -250,7 +312,7 @@ bool mp3_restart_file(void)
 {
     if (!current_song.file_is_open) return false;
 
-    current_song.file_status = f_lseek(&current_song.mp3_file, 0);
+    current_song.file_status = f_lseek(&current_song.mp3_file, current_song.audio_start);
     if (FR_OK != current_song.file_status)
     {
         printf("[mp3_restart_file] failed to restart file. Error: %d\n", current_song.file_status);
@@ -268,8 +330,97 @@ uint32_t mp3_get_file_size(void)
     return (current_song.file_is_open) ? (uint32_t)current_song.mp3_file.fsize : 0;
 }
 
+void mp3_set_skip_tags(bool skip)
+{
+    SkipTags = skip;
+}
+
+bool mp3_get_skip_tags(void)
+{
+    return SkipTags;
+}
+
+uint32_t mp3_get_song_length_in_seconds(void)
+{
+    return mp3_get_song_length_in_ms() / 1000;
+}
+
+uint32_t mp3_get_song_length_in_ms(void)
+{
+    return (current_song.file_is_open) ? mp3_vbr_get_duration_ms(&current_song.stream_info) : 0;
+}
+
+bool mp3_get_track_info(mp3_track_info_S *track)
+{
+    memset(track, 0, sizeof(*track));
+    if (!current_song.file_is_open)
+    {
+        return false;
+    }
+
+    track->info        = current_song.stream_info;
+    track->block_align = current_song.block_align;
+    track->codec       = current_song.file_name.codec;
+    track->valid       = true;
+    return true;
+}
+
+uint32_t mp3_track_get_length_ms(const mp3_track_info_S *track)
+{
+    return (track->valid) ? (mp3_vbr_get_duration_ms(&track->info)) : (0);
+}
+
+uint32_t mp3_track_offset_to_ms(const mp3_track_info_S *track, uint32_t offset)
+{
+    return (track->valid) ? (mp3_vbr_offset_to_ms(&track->info, offset)) : (0);
+}
+
+uint32_t mp3_track_ms_to_offset(const mp3_track_info_S *track, uint32_t ms)
+{
+    if (!track->valid)
+    {
+        return 0;
+    }
+
+    // Same distance from the first sample, rounded down to a whole sample
+    const uint32_t start  = track->info.audio_start;
+    const uint32_t offset = mp3_vbr_ms_to_offset(&track->info, ms);
+    return (offset > start) ? (offset - (offset - start) % track->block_align) : (offset);
+}
+
+const char* mp3_track_get_type(const mp3_track_info_S *track)
+{
+    if (!track->valid)
+    {
+        return "Unknown";
+    }
+
+    // Nothing but MP3 has an info frame
+    if (CODEC_MP3 != track->codec)
+    {
+        return codec_get_info(track->codec)->name;
+    }
+
+    switch (track->info.type)
+    {
+        case MP3_VBR_XING: return "Xing (VBR)";
+        case MP3_VBR_INFO: return "Info (CBR)";
+        case MP3_VBR_VBRI: return "VBRI (VBR)";
+        default:           return "No header (CBR)";
+    }
+}
+
+// Bytes left before the trailing tags, caps a read so they are never streamed
+static uint32_t mp3_get_bytes_left(uint32_t segment_size)
+{
+    const uint32_t offset = (uint32_t)f_tell(&current_song.mp3_file);
+    const uint32_t left   = (current_song.audio_end > offset) ? (current_song.audio_end - offset) : (0);
+    return MIN(segment_size, left);
+}
+
 bool mp3_read_segment(uint8_t *buffer, uint32_t segment_size, uint32_t *current_segment_size)
 {
+    segment_size = mp3_get_bytes_left(segment_size);
     current_song.file_status = f_read(&current_song.mp3_file, buffer, segment_size, (UINT*)current_segment_size);
     if (current_song.file_status != FR_OK)
     {
@@ -281,6 +432,39 @@ bool mp3_read_segment(uint8_t *buffer, uint32_t segment_size, uint32_t *current_
     return true;
 }
 
+bool mp3_forward_segment(mp3_sink_t sink, uint32_t segment_size, uint32_t *forwarded_size)
+{
+    segment_size    = mp3_get_bytes_left(segment_size);
+    *forwarded_size = 0;
+
+    // One sector per f_forward, every call takes the volume mutex for as long as the sink waits on DREQ,
+    // so other tasks get the SD card in between instead of waiting out the whole segment
+    while (*forwarded_size < segment_size)
+    {
+        const uint32_t offset = (uint32_t)f_tell(&current_song.mp3_file);
+        const uint32_t step   = MIN(segment_size - *forwarded_size, _MAX_SS - (offset % _MAX_SS));
+        UINT forwarded = 0;
+
+        current_song.file_status = f_forward(&current_song.mp3_file, sink, step, &forwarded);
+        if (current_song.file_status != FR_OK)
+        {
+            printf("[mp3_forward_segment] mp3 file failed to forward. Error: %d\n", current_song.file_status);
+            return false;
+        }
+
+        *forwarded_size += forwarded;
+
+        // End of file, or the sink stopped taking data
+        if (forwarded < step)
+        {
+            break;
+        }
+    }
+
+    ++current_song.segment;
+    return true;
+}
+
 static bool mp3_go_to_offset(uint32_t offset)
 {
     current_song.file_status = f_lseek(&current_song.mp3_file, offset);
@@ -295,27 +479,39 @@ static bool mp3_go_to_offset(uint32_t offset)
     }
 }
 
-bool mp3_rewind_segments(uint32_t segments)
+bool mp3_seek_to_offset(uint32_t offset)
 {
-    // If hit beginning of song, start playing forward
-    if (current_song.segment - segments <= 0)
+    if (!current_song.file_is_open) return false;
+
+    // Rewinding to the beginning means the first frame, not the tag
+    offset = MAX(offset, current_song.audio_start);
+
+    if (!mp3_go_to_offset(offset))
     {
-        mp3_go_to_offset(0);
-        current_song.direction = DIR_FORWARD;
-        current_song.segment   = 0;
-        return true;
+        return false;
     }
-    // Rewind segments
-    else if (mp3_go_to_offset( (current_song.segment - segments) * MP3_SEGMENT_SIZE ))
+
+    current_song.segment = offset / MP3_SEGMENT_SIZE;
+    return true;
+}
+
+uint32_t mp3_get_offset(void)
+{
+    return (current_song.file_is_open) ? (uint32_t)f_tell(&current_song.mp3_file) : 0;
+}
+
+bool mp3_seek_to_ms(uint32_t ms)
+{
+    if (!current_song.file_is_open) return false;
+
+    uint32_t offset = 0;
+    if (!Mp3Index.Lookup(&current_song.file_name, ms, &offset, NULL))
     {
-        current_song.segment -= segments;
-        return true;
-    }
-    // Seeking failed
-    else
-    {   
+        printf("[mp3_seek_to_ms] %lu ms of %s is not indexed yet.\n", ms, current_song.file_name.short_name);
         return false;
     }
+
+    return mp3_seek_to_offset(offset);
 }
 
 void mp3_set_direction(seek_direction_E direction)
@@ -330,7 +526,11 @@ seek_direction_E mp3_get_direction(void)
 
 float mp3_get_percentage(void)
 {
-    // Find total segments = fsize / segment_size
-    // Percentage = current segment / total segments
-    return (float)current_song.segment / ((float)(current_song.mp3_file.fsize) / (MP3_SEGMENT_SIZE));
+    // Bit rate of a VBR file changes, so time is not proportional to the bytes read
+    const uint32_t length = mp3_get_song_length_in_ms();
+    if (0 == length)
+    {
+        return 0.0f;
+    }
+    return (float)mp3_vbr_offset_to_ms(&current_song.stream_info, mp3_get_offset()) / length;
 }
\ No newline at end of file
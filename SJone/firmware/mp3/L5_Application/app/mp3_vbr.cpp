@@ -0,0 +1,272 @@
+#include "mp3_vbr.hpp"
+#include "mp3_frame.hpp"
+#include <cstring>
+
+// Offset of the VBRI header from the frame header, always after 32 bytes of side information
+#define VBRI_OFFSET (MP3_FRAME_HEADER_SIZE + 32)
+
+// Size of the VBRI header up to the table of contents
+#define VBRI_HEADER_SIZE (26)
+
+// Offset of the encoder delay and padding from the start of the LAME tag
+#define LAME_DELAY_OFFSET (21)
+
+// Xing flags, saying which fields follow
+#define XING_FRAMES  (1 << 0)
+#define XING_BYTES   (1 << 1)
+#define XING_TOC     (1 << 2)
+#define XING_QUALITY (1 << 3)
+
+static uint32_t ReadBigEndian(const uint8_t *bytes, uint32_t size)
+{
+    uint32_t value = 0;
+    for (uint32_t i=0; i<size; i++)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// Side information sits between the frame header and the Xing header, its size depends on the version and channels
+static uint32_t GetSideInfoSize(const mp3_frame_header_S *header)
+{
+    const bool mono = (3 == header->channel_mode);
+    const uint32_t size = (MPEG_VERSION_1 == header->version) ? ((mono) ? (17) : (32)) : ((mono) ? (9) : (17));
+    return size + ((header->crc) ? (2) : (0));
+}
+
+// Parses the LAME tag at the end of the Xing header, ffmpeg writes the same layout
+static void ParseLameTag(const uint8_t *tag, uint32_t size, mp3_stream_info_S *info)
+{
+    if (size < LAME_DELAY_OFFSET + 3)
+    {
+        return;
+    }
+    if (0 != memcmp(tag, "LAME", 4) && 0 != memcmp(tag, "Lavf", 4) && 0 != memcmp(tag, "Lavc", 4))
+    {
+        return;
+    }
+
+    // 12 bits of delay followed by 12 bits of padding
+    const uint8_t *delay = &tag[LAME_DELAY_OFFSET];
+    info->encoder_delay   = (delay[0] << 4) | (delay[1] >> 4);
+    info->encoder_padding = ((delay[1] & 0xF) << 8) | delay[2];
+}
+
+static bool ParseXing(const uint8_t *frame, uint32_t size, const mp3_frame_header_S *header, mp3_stream_info_S *info)
+{
+    uint32_t index = MP3_FRAME_HEADER_SIZE + GetSideInfoSize(header);
+    if (index + 8 > size)
+    {
+        return false;
+    }
+
+    if (0 == memcmp(&frame[index], "Xing", 4))
+    {
+        info->type = MP3_VBR_XING;
+    }
+    else if (0 == memcmp(&frame[index], "Info", 4))
+    {
+        info->type = MP3_VBR_INFO;
+    }
+    else
+    {
+        return false;
+    }
+
+    const uint32_t flags = ReadBigEndian(&frame[index + 4], 4);
+    index += 8;
+
+    if ((flags & XING_FRAMES) && index + 4 <= size)
+    {
+        info->frames = ReadBigEndian(&frame[index], 4);
+        index += 4;
+    }
+    if ((flags & XING_BYTES) && index + 4 <= size)
+    {
+        info->stream_bytes = ReadBigEndian(&frame[index], 4);
+        index += 4;
+    }
+    if ((flags & XING_TOC) && index + MP3_VBR_TOC_SIZE <= size)
+    {
+        memcpy(info->toc, &frame[index], MP3_VBR_TOC_SIZE);
+        info->has_toc = true;
+        index += MP3_VBR_TOC_SIZE;
+    }
+    if (flags & XING_QUALITY)
+    {
+        index += 4;
+    }
+
+    if (index < size)
+    {
+        ParseLameTag(&frame[index], size - index, info);
+    }
+    return true;
+}
+
+static bool ParseVbri(const uint8_t *frame, uint32_t size, mp3_stream_info_S *info)
+{
+    if (VBRI_OFFSET + VBRI_HEADER_SIZE > size || 0 != memcmp(&frame[VBRI_OFFSET], "VBRI", 4))
+    {
+        return false;
+    }
+
+    const uint8_t *vbri = &frame[VBRI_OFFSET];
+    info->type         = MP3_VBR_VBRI;
+    info->stream_bytes = ReadBigEndian(&vbri[10], 4);
+    info->frames       = ReadBigEndian(&vbri[14], 4);
+
+    const uint32_t entries          = ReadBigEndian(&vbri[18], 2);
+    const uint32_t scale            = ReadBigEndian(&vbri[20], 2);
+    const uint32_t entry_size       = ReadBigEndian(&vbri[22], 2);
+    const uint32_t frames_per_entry = ReadBigEndian(&vbri[24], 2);
+
+    // Table has to be usable and fit in the buffer
+    const uint32_t table_size = entries * entry_size;
+    if (0 == entries || 0 == frames_per_entry || 0 == entry_size || entry_size > 4 ||
+        0 == info->stream_bytes || VBRI_OFFSET + VBRI_HEADER_SIZE + table_size > size)
+    {
+        return true;
+    }
+
+    // Every entry is the size of the next frames_per_entry frames, resample it to the Xing layout
+    const uint8_t *table = &vbri[VBRI_HEADER_SIZE];
+    uint32_t entry = 0;
+    uint32_t bytes = 0;
+    for (uint32_t percent=0; percent<MP3_VBR_TOC_SIZE; percent++)
+    {
+        const uint32_t target = (uint32_t)((uint64_t)percent * info->frames / MP3_VBR_TOC_SIZE / frames_per_entry);
+        while (entry < target && entry < entries)
+        {
+            bytes += ReadBigEndian(&table[entry * entry_size], entry_size) * scale;
+            ++entry;
+        }
+        const uint64_t position = (uint64_t)bytes * 256 / info->stream_bytes;
+        info->toc[percent] = (position > 255) ? (255) : ((uint8_t)position);
+    }
+    info->has_toc = true;
+    return true;
+}
+
+bool mp3_vbr_parse(const uint8_t *buffer, uint32_t size, uint32_t offset, uint32_t end, mp3_stream_info_S *info)
+{
+    memset(info, 0, sizeof(mp3_stream_info_S));
+
+    mp3_frame_header_S header = { };
+    const uint32_t index = mp3_frame_find_sync(buffer, size, &header);
+    if (index >= size)
+    {
+        return false;
+    }
+
+    const uint8_t *frame      = &buffer[index];
+    const uint32_t frame_size = size - index;
+
+    info->stream_start      = offset + index;
+    info->audio_start       = info->stream_start;
+    info->sample_rate       = header.sample_rate;
+    info->bit_rate          = header.bit_rate;
+    info->samples_per_frame = header.samples;
+
+    // Info frame itself has no audio
+    if (ParseXing(frame, frame_size, &header, info) || ParseVbri(frame, frame_size, info))
+    {
+        info->audio_start = info->stream_start + header.size;
+    }
+
+    // Header did not have a byte count, or there was no header
+    const uint32_t bytes_to_end = (end > info->stream_start) ? (end - info->stream_start) : (0);
+    if (0 == info->stream_bytes || info->stream_bytes > bytes_to_end)
+    {
+        info->stream_bytes = bytes_to_end;
+    }
+
+    return true;
+}
+
+uint32_t mp3_vbr_get_duration_ms(const mp3_stream_info_S *info)
+{
+    if (info->frames > 0 && info->sample_rate > 0)
+    {
+        uint64_t samples = (uint64_t)info->frames * info->samples_per_frame;
+        const uint32_t trimmed = info->encoder_delay + info->encoder_padding;
+        samples -= (samples > trimmed) ? (trimmed) : (0);
+        return (uint32_t)(samples * 1000 / info->sample_rate);
+    }
+    else if (info->bit_rate > 0)
+    {
+        const uint32_t audio_bytes = info->stream_start + info->stream_bytes - info->audio_start;
+        return (uint32_t)((uint64_t)audio_bytes * 8000 / info->bit_rate);
+    }
+    return 0;
+}
+
+uint32_t mp3_vbr_get_byte_rate(const mp3_stream_info_S *info)
+{
+    const uint32_t duration    = mp3_vbr_get_duration_ms(info);
+    const uint32_t audio_bytes = info->stream_start + info->stream_bytes - info->audio_start;
+    return (duration > 0) ? ((uint32_t)((uint64_t)audio_bytes * 1000 / duration)) : (0);
+}
+
+uint32_t mp3_vbr_offset_to_ms(const mp3_stream_info_S *info, uint32_t offset)
+{
+    const uint32_t duration = mp3_vbr_get_duration_ms(info);
+    const uint32_t end      = info->stream_start + info->stream_bytes;
+
+    if (offset <= info->audio_start)
+    {
+        return 0;
+    }
+    if (offset >= end)
+    {
+        return duration;
+    }
+
+    // Bit rate is constant, the mapping is linear
+    if (!info->has_toc)
+    {
+        return (uint32_t)((uint64_t)(offset - info->audio_start) * duration / (end - info->audio_start));
+    }
+
+    // Find the last percent at or before the position, and interpolate to the next one
+    const float position = 256.0f * (offset - info->stream_start) / info->stream_bytes;
+    uint32_t percent = 0;
+    while (percent + 1 < MP3_VBR_TOC_SIZE && info->toc[percent + 1] <= position)
+    {
+        ++percent;
+    }
+
+    const float lower = info->toc[percent];
+    const float upper = (percent + 1 < MP3_VBR_TOC_SIZE) ? (info->toc[percent + 1]) : (256.0f);
+    const float fraction = (upper > lower) ? ((position - lower) / (upper - lower)) : (0.0f);
+    return (uint32_t)((percent + fraction) * duration / MP3_VBR_TOC_SIZE);
+}
+
+uint32_t mp3_vbr_ms_to_offset(const mp3_stream_info_S *info, uint32_t ms)
+{
+    const uint32_t duration = mp3_vbr_get_duration_ms(info);
+    if (0 == duration || 0 == ms)
+    {
+        return info->audio_start;
+    }
+    if (ms >= duration)
+    {
+        return info->stream_start + info->stream_bytes;
+    }
+
+    if (!info->has_toc)
+    {
+        const uint32_t audio_bytes = info->stream_start + info->stream_bytes - info->audio_start;
+        return info->audio_start + (uint32_t)((uint64_t)ms * audio_bytes / duration);
+    }
+
+    // Same interpolation the Xing reference decoder does
+    const float percent  = (float)ms * MP3_VBR_TOC_SIZE / duration;
+    const uint32_t whole = (uint32_t)percent;
+    const float lower    = info->toc[whole];
+    const float upper    = (whole + 1 < MP3_VBR_TOC_SIZE) ? (info->toc[whole + 1]) : (256.0f);
+    const float position = lower + (upper - lower) * (percent - whole);
+    const uint32_t offset = info->stream_start + (uint32_t)(position / 256.0f * info->stream_bytes);
+    return (offset > info->audio_start) ? (offset) : (info->audio_start);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  The bit rate of a VBR file changes from frame to frame, so its length cannot be worked out from the file size.
+ *  Encoders put a frame without audio at the start of the stream that describes the rest of it instead:
+ *      - Xing / Info : Frame count, byte count, and a 100 point table of contents, "Info" is written for CBR files
+ *      - LAME        : Extends the Xing frame with the encoder delay and padding, in samples
+ *      - VBRI        : Fraunhofer's version, frame count, byte count, and a table of byte sizes every N frames
+ *
+ *  The table of contents maps every percent of the duration to a byte position in 1/256 of the stream, which
+ *  is all that is needed to map between time and bytes without walking the frames.  Files without either
+ *  header are treated as CBR, using the bit rate of the first frame.
+ */
+
+typedef enum
+{
+    MP3_VBR_NONE,       // No info frame, assumed to be CBR
+    MP3_VBR_XING,       // Xing header, VBR
+    MP3_VBR_INFO,       // Info header, CBR written by LAME
+    MP3_VBR_VBRI,       // Fraunhofer VBRI header
+} mp3_vbr_type_E;
+
+// Number of points in the table of contents
+#define MP3_VBR_TOC_SIZE (100)
+
+typedef struct
+{
+    mp3_vbr_type_E type;
+    uint32_t stream_start;          // File offset of the first frame, the info frame if there is one
+    uint32_t stream_bytes;          // Bytes from stream_start to the end of the audio
+    uint32_t audio_start;           // File offset of the first frame with audio
+    uint32_t frames;                // Audio frames, 0 if unknown
+    uint32_t sample_rate;           // Samples per second
+    uint32_t bit_rate;              // Bit rate of the first frame, only used without a frame count
+    uint16_t samples_per_frame;
+    uint16_t encoder_delay;         // Samples of silence the encoder added in front, from the LAME tag
+    uint16_t encoder_padding;       // Samples of silence the encoder added at the end, from the LAME tag
+    bool     has_toc;
+    uint8_t  toc[MP3_VBR_TOC_SIZE]; // Byte position of every percent of the duration, in 1/256 of stream_bytes
+} mp3_stream_info_S;
+
+// @description   : Finds the first frame in a buffer and parses its Xing, Info, VBRI and LAME headers
+// @param buffer  : Bytes at the start of the audio, after any ID3v2 tag
+// @param size    : Size of buffer, a VBRI table of contents that does not fit is left out
+// @param offset  : File offset of the first byte of buffer
+// @param end     : File offset of the end of the audio, before any trailing tags
+// @param info    : Struct to fill in
+// @returns       : False if there is no frame in the buffer
+bool mp3_vbr_parse(const uint8_t *buffer, uint32_t size, uint32_t offset, uint32_t end, mp3_stream_info_S *info);
+
+// @description : Length of the audio, without the encoder delay and padding
+// @returns     : Duration in milliseconds
+uint32_t mp3_vbr_get_duration_ms(const mp3_stream_info_S *info);
+
+// @description : Average bit rate of the whole track, from its length and duration
+// @returns     : Bytes per second, 0 if the duration is unknown
+uint32_t mp3_vbr_get_byte_rate(const mp3_stream_info_S *info);
+
+// @description  : Maps a file offset to the time it is played at
+// @param offset : File offset
+// @returns      : Time in milliseconds
+uint32_t mp3_vbr_offset_to_ms(const mp3_stream_info_S *info, uint32_t offset);
+
+// @description : Maps a time to the file offset played at that time, the offset is not frame aligned
+// @param ms    : Time in milliseconds
+// @returns     : File offset
+uint32_t mp3_vbr_ms_to_offset(const mp3_stream_info_S *info, uint32_t ms);
@@ -32,6 +32,11 @@ static const char* parser_state_enum_to_string(parser_state_E state)
 
 static void msg_enqueue_no_timeout(diagnostic_packet_S *packet)
 {
+    // Dropped until the TxTask has created its queue
+    if (NULL == MessageTxQueue)
+    {
+        return;
+    }
     xQueueSend(MessageTxQueue, packet, portMAX_DELAY);
 }
 
@@ -0,0 +1,271 @@
+#include "plugin_image.hpp"
+#include <cstring>
+
+typedef enum
+{
+    TEXT_CODE,
+    TEXT_SLASH,                 // '/' that may start a comment
+    TEXT_BLOCK_COMMENT,
+    TEXT_BLOCK_STAR,            // '*' that may end a block comment
+    TEXT_SKIP_LINE,             // Line comment or preprocessor line
+} text_state_E;
+
+typedef enum
+{
+    ARRAY_BEFORE,
+    ARRAY_INSIDE,
+    ARRAY_AFTER,
+} array_state_E;
+
+typedef enum
+{
+    RECORD_REGISTER,
+    RECORD_COUNT,
+    RECORD_REPEAT,              // Word to write count times
+    RECORD_DATA,                // Words to write one after the other
+} record_state_E;
+
+// Number of SCI registers, a record for anything past them is not a plugin
+static const uint16_t SciRegisters = 16;
+
+// Count of a record that repeats one word
+static const uint16_t RepeatFlag = 0x8000;
+
+// Passes the next word of the file through the records
+static void DecodeWord(plugin_image_S *image, uint16_t word)
+{
+    ++image->words;
+
+    switch (image->record_state)
+    {
+        case RECORD_REGISTER:
+            if (word >= SciRegisters)
+            {
+                image->failed = true;
+            }
+            image->reg          = word;
+            image->record_state = RECORD_COUNT;
+            break;
+
+        case RECORD_COUNT:
+            image->remaining    = word & ~RepeatFlag;
+            image->record_state = (word & RepeatFlag) ? (RECORD_REPEAT) : (RECORD_DATA);
+            if (0 == image->remaining)
+            {
+                image->record_state = RECORD_REGISTER;
+            }
+            break;
+
+        case RECORD_REPEAT:
+            image->run.reg       = image->reg;
+            image->run.repeat    = true;
+            image->run.count     = image->remaining;
+            image->run.values[0] = word;
+            image->run_ready     = true;
+            image->record_state  = RECORD_REGISTER;
+            break;
+
+        case RECORD_DATA:
+            image->run.reg    = image->reg;
+            image->run.repeat = false;
+            image->run.values[image->run.count++] = word;
+            if (0 == --image->remaining)
+            {
+                image->record_state = RECORD_REGISTER;
+            }
+            image->run_ready = (0 == image->remaining) || (PLUGIN_IMAGE_RUN_SIZE == image->run.count);
+            break;
+    }
+}
+
+// Value of a digit in a base, or base if it is not one
+static uint8_t DigitValue(uint8_t c, uint8_t base)
+{
+    uint8_t value = base;
+    if      (c >= '0' && c <= '9') value = c - '0';
+    else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+    return (value < base) ? (value) : (base);
+}
+
+// Turns the number read from a .plg into a word, hex with 0x or decimal, an unsigned or long suffix is allowed
+static void EndToken(plugin_image_S *image)
+{
+    if (0 == image->token_size)
+    {
+        return;
+    }
+
+    uint8_t size = image->token_size;
+    image->token_size = 0;
+    while (size > 0 && strchr("uUlL", image->token[size - 1]))
+    {
+        --size;
+    }
+
+    const bool hex     = (size > 2 && '0' == image->token[0] && ('x' == image->token[1] || 'X' == image->token[1]));
+    const uint8_t base = (hex) ? (16) : (10);
+    uint32_t value     = 0;
+    for (uint8_t i=(hex) ? (2) : (0); i<size; i++)
+    {
+        const uint8_t digit = DigitValue(image->token[i], base);
+        if (digit == base || (value = value * base + digit) > 0xFFFF)
+        {
+            image->failed = true;
+            return;
+        }
+    }
+
+    if (0 == size)
+    {
+        image->failed = true;
+        return;
+    }
+    DecodeWord(image, value);
+}
+
+// Passes the next character of a .plg through the comments, the braces and the numbers
+static void DecodeText(plugin_image_S *image, uint8_t c)
+{
+    const bool new_line = ('\n' == c);
+
+    switch (image->text_state)
+    {
+        case TEXT_SLASH:
+            if ('*' == c || '/' == c)
+            {
+                image->text_state = ('*' == c) ? (TEXT_BLOCK_COMMENT) : (TEXT_SKIP_LINE);
+                return;
+            }
+            // Division is not part of a plugin, the character after it is still looked at
+            image->failed     = (ARRAY_INSIDE == image->array_state);
+            image->text_state = TEXT_CODE;
+            break;
+
+        case TEXT_BLOCK_COMMENT:
+            image->text_state = ('*' == c) ? (TEXT_BLOCK_STAR) : (TEXT_BLOCK_COMMENT);
+            return;
+
+        case TEXT_BLOCK_STAR:
+            image->text_state = ('/' == c) ? (TEXT_CODE) : (('*' == c) ? (TEXT_BLOCK_STAR) : (TEXT_BLOCK_COMMENT));
+            return;
+
+        case TEXT_SKIP_LINE:
+            image->text_state = (new_line) ? (TEXT_CODE) : (TEXT_SKIP_LINE);
+            image->line_start = new_line;
+            return;
+
+        case TEXT_CODE:
+            break;
+    }
+
+    const bool letter = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || '_' == c;
+    const bool space  = (' ' == c || '\t' == c || '\r' == c || new_line);
+
+    if (letter && ARRAY_INSIDE == image->array_state)
+    {
+        if (image->token_size == sizeof(image->token))
+        {
+            image->failed = true;
+            return;
+        }
+        image->token[image->token_size++] = c;
+    }
+    else
+    {
+        EndToken(image);
+
+        if ('#' == c && image->line_start)
+        {
+            image->text_state = TEXT_SKIP_LINE;
+        }
+        else if ('/' == c)
+        {
+            image->text_state = TEXT_SLASH;
+        }
+        else if ('{' == c && ARRAY_BEFORE == image->array_state)
+        {
+            image->array_state = ARRAY_INSIDE;
+        }
+        else if ('}' == c && ARRAY_INSIDE == image->array_state)
+        {
+            image->array_state = ARRAY_AFTER;
+        }
+        else if (!space && ',' != c && ARRAY_INSIDE == image->array_state)
+        {
+            image->failed = true;
+        }
+    }
+
+    image->line_start = new_line || (image->line_start && space);
+}
+
+bool plugin_image_format_from_name(const char *name, plugin_format_E *format)
+{
+    const char *dot = strrchr(name, '.');
+    if (NULL == dot || 4 != strlen(dot))
+    {
+        return false;
+    }
+
+    char extension[5] = { 0 };
+    for (uint8_t i=0; i<4; i++)
+    {
+        extension[i] = (dot[i] >= 'A' && dot[i] <= 'Z') ? (dot[i] - 'A' + 'a') : (dot[i]);
+    }
+
+    if      (0 == strcmp(extension, ".plg")) *format = PLUGIN_FORMAT_PLG;
+    else if (0 == strcmp(extension, ".img")) *format = PLUGIN_FORMAT_IMG;
+    else                                     return false;
+    return true;
+}
+
+void plugin_image_init(plugin_image_S *image, plugin_format_E format)
+{
+    memset(image, 0, sizeof(*image));
+    image->format       = format;
+    image->text_state   = TEXT_CODE;
+    image->array_state  = ARRAY_BEFORE;
+    image->record_state = RECORD_REGISTER;
+    image->line_start   = true;
+}
+
+size_t plugin_image_decode(plugin_image_S *image, const uint8_t *data, size_t size)
+{
+    // Last run has been written by now
+    if (image->run_ready)
+    {
+        image->run_ready = false;
+        image->run.count = 0;
+    }
+
+    size_t used = 0;
+    while (used < size && !image->failed && !image->run_ready)
+    {
+        const uint8_t c = data[used++];
+        if (PLUGIN_FORMAT_PLG == image->format)
+        {
+            DecodeText(image, c);
+        }
+        else if (image->have_low_byte)
+        {
+            image->have_low_byte = false;
+            DecodeWord(image, image->low_byte | (c << 8));
+        }
+        else
+        {
+            image->low_byte      = c;
+            image->have_low_byte = true;
+        }
+    }
+
+    return used;
+}
+
+bool plugin_image_finish(plugin_image_S *image)
+{
+    // A .plg has to get to the closing brace, a number before it is still being read
+    const bool whole_array = (PLUGIN_FORMAT_IMG == image->format) || (ARRAY_AFTER == image->array_state);
+    return !image->failed && whole_array && !image->have_low_byte &&
+           RECORD_REGISTER == image->record_state && image->words > 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  @explanation:
+ *  VLSI ships patches and plugins for the VS1053b, like the FLAC decoder, the spectrum analyzer and the
+ *  5 band equalizer, as a compressed list of 16 bit words made of records:
+ *
+ *      register, count, count words        Writes the words to the SCI register one after the other
+ *      register, 0x8000 | count, word      Writes the word to the SCI register count times
+ *
+ *  Nearly every record sets WRAMADDR once and then writes a block of WRAM, which moves WRAMADDR on by
+ *  itself, so a record goes out as one SCI multiple write instead of a transaction per word.
+ *
+ *  Two kinds of files hold the words:
+ *      .plg : The C array VLSI ships, "const unsigned short plugin[N] = { 0x0007, 0x0001, 0x8050, ... };"
+ *             Only numbers between the braces count, comments and preprocessor lines are skipped
+ *      .img : The same words as raw 16 bit little endian values, a quarter of the size and nothing to parse,
+ *             which is what gets a large patch like the FLAC decoder off the SD card quickly
+ *
+ *  Either one is decoded a piece at a time as the file is read, into runs of words for one register of at
+ *  most PLUGIN_IMAGE_RUN_SIZE words.
+ *
+ *  @example:
+ *  0x0007, 0x0001, 0x8050, 0x0006, 0x0003, 0x1234, 0x5678, 0x9ABC, 0x0006, 0x8004, 0x0000
+ *      WRAMADDR <- 0x8050
+ *      WRAM     <- 0x1234, 0x5678, 0x9ABC
+ *      WRAM     <- 0x0000 four times
+ */
+
+// Most words in a run, a longer record is split up into several runs to the same register
+#define PLUGIN_IMAGE_RUN_SIZE (64)
+
+typedef enum
+{
+    PLUGIN_FORMAT_PLG,          // C array
+    PLUGIN_FORMAT_IMG,          // Raw little endian words
+} plugin_format_E;
+
+typedef struct
+{
+    uint8_t  reg;               // SCI register the words go to
+    bool     repeat;            // values[0] is written count times
+    uint16_t count;             // Number of words to write
+    uint16_t values[PLUGIN_IMAGE_RUN_SIZE];
+} plugin_run_S;
+
+typedef struct
+{
+    plugin_format_E format;
+    bool     failed;            // File is not a plugin, nothing more is decoded
+    bool     run_ready;         // run is ready to be written, cleared by the next call
+    uint32_t words;             // Words decoded so far
+
+    // Words out of the file
+    uint8_t  text_state;        // Whether a .plg is in code, a comment or a preprocessor line
+    uint8_t  array_state;       // Whether a .plg is before, between or after the braces of the array
+    uint8_t  token[8];          // Number being read from a .plg
+    uint8_t  token_size;
+    bool     line_start;        // Nothing but white space since the last new line, where a preprocessor line can start
+    uint8_t  low_byte;          // First byte of a word of a .img
+    bool     have_low_byte;
+
+    // Records out of the words
+    uint8_t  record_state;
+    uint8_t  reg;               // Register of the record
+    uint16_t remaining;         // Words of the record left
+
+    plugin_run_S run;           // Run to write once ready
+} plugin_image_S;
+
+// @description  : Picks the format from the extension of a file name, .plg or .img, in any case
+// @param name   : File name
+// @param format : Set to the format
+// @returns      : False if it is neither
+bool plugin_image_format_from_name(const char *name, plugin_format_E *format);
+
+// @description  : Starts decoding a new file
+// @param image  : Decoder to start
+// @param format : Format of the file
+void plugin_image_init(plugin_image_S *image, plugin_format_E format);
+
+// @description  : Decodes the next piece of the file, stopping as soon as a run is ready
+// @param image  : Decoder
+// @param data   : Next bytes of the file
+// @param size   : Number of bytes
+// @returns      : Number of bytes used, call again with the rest once image->run has been written
+//                 image->run_ready is set when image->run is ready, image->failed if the file is not a plugin
+size_t plugin_image_decode(plugin_image_S *image, const uint8_t *data, size_t size);
+
+// @description  : Checks the file once all of it has been decoded, every run has been handed out by then
+// @param image  : Decoder
+// @returns      : True if the file held whole records, false if it ended in the middle of one or had none
+bool plugin_image_finish(plugin_image_S *image);
@@ -0,0 +1,97 @@
+#include "mp3_tasks.hpp"
+#include "plugin_image.hpp"
+#include "clock_governor.hpp"
+#include "stop_watch.hpp"
+#include "ff.h"
+#include <cstring>
+#include <stdio.h>
+
+// Plugin is read a few sectors at a time, fewer reads wait less on the SD card, kept off the stack of the DecoderTask
+static uint8_t Buffer[2048];
+
+// Decoder of the plugin being loaded
+static plugin_image_S Image;
+
+bool plugin_load(const char *name, plugin_load_stats_S *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    MicroSecondStopWatch total;
+
+    plugin_format_E format;
+    if (!plugin_image_format_from_name(name, &format))
+    {
+        printf("[plugin_load] %s is not a .plg or .img file.\n", name);
+        return false;
+    }
+
+    // 1: for sd card directory, path = directory_path + name
+    char path[MAX_NAME_LENGTH + 3] = { 0 };
+    snprintf(path, sizeof(path), "1:%s", name);
+
+    // Own file, the ReaderTask may be streaming a track at the same time
+    FIL file;
+    const FRESULT result = f_open(&file, path, FA_OPEN_EXISTING | FA_READ);
+    if (FR_OK != result)
+    {
+        printf("[plugin_load] %s failed to open. Error: %d\n", path, result);
+        return false;
+    }
+
+    // Writes take fewer microseconds at the top clock, and the SPI clock goes up with it
+    // Only while nothing is playing, the governor or the fixed multiplier take over again afterwards
+    const vs1053b_clock_stats_S clock = MP3Player.GetClockStats();
+    const bool boost = !MP3Player.IsPlaying() && !MP3Player.GetStatus()->low_power_mode;
+    if (boost)
+    {
+        MP3Player.SetClockMultiplier(CLOCK_GOVERNOR_MAX_MULT);
+    }
+
+    plugin_image_init(&Image, format);
+    bool written = true;
+    UINT size    = 0;
+    do
+    {
+        MicroSecondStopWatch read;
+        if (FR_OK != f_read(&file, Buffer, sizeof(Buffer), &size))
+        {
+            written = false;
+            break;
+        }
+        stats->read_us += (uint32_t)read.getElapsedTime();
+        stats->bytes   += size;
+
+        // Every run goes out as one multiple write as soon as it is decoded
+        for (UINT used=0; used<size && written && !Image.failed; )
+        {
+            used += plugin_image_decode(&Image, &Buffer[used], size - used);
+            if (Image.run_ready)
+            {
+                written = MP3Player.WriteRegisterWords((SCI_reg)Image.run.reg, Image.run.values, Image.run.count, Image.run.repeat);
+                ++stats->runs;
+            }
+        }
+    }
+    while (written && !Image.failed && sizeof(Buffer) == size);
+    f_close(&file);
+
+    if (boost)
+    {
+        MP3Player.SetClockMultiplier(clock.multiplier);
+    }
+
+    stats->words    = Image.words;
+    stats->loaded   = written && plugin_image_finish(&Image);
+    stats->total_us = (uint32_t)total.getElapsedTime();
+
+    if (stats->loaded)
+    {
+        printf("[plugin_load] Loaded %s, %lu words in %lu runs, %lu ms of which %lu ms reading.\n", name,
+               stats->words, stats->runs, stats->total_us / 1000, stats->read_us / 1000);
+    }
+    else
+    {
+        printf("[plugin_load] %s stopped after %lu words, %s.\n", name, stats->words,
+               (written) ? ("not a whole plugin") : ("could not write to the device"));
+    }
+    return stats->loaded;
+}
@@ -0,0 +1,32 @@
+#include "segment_plan.hpp"
+
+// Assumed when the bit rate of the track is not known, the highest MPEG 1 Layer III bit rate
+static const uint32_t DefaultByteRate = 320000 / 8;
+
+segment_plan_S segment_plan_choose(uint32_t byte_rate, uint32_t max_read_us, uint32_t arena_size, uint32_t max_depth)
+{
+    if (0 == byte_rate)
+    {
+        byte_rate = DefaultByteRate;
+    }
+
+    // Bytes played while waiting for the slowest read, with the margin
+    const uint64_t needed = (uint64_t)byte_rate * max_read_us * SEGMENT_PLAN_READ_MARGIN / 1000000;
+
+    segment_plan_S plan = { };
+    for (uint32_t size=SEGMENT_PLAN_MAX_SIZE; size>=SEGMENT_PLAN_MIN_SIZE; size/=2)
+    {
+        const uint32_t depth = (arena_size / size < max_depth) ? (arena_size / size) : (max_depth);
+        const uint32_t segment_ms = (uint32_t)((uint64_t)size * 1000 / byte_rate);
+
+        plan.size          = size;
+        plan.depth         = depth;
+        plan.read_ahead_ms = (depth > 0) ? ((uint32_t)((uint64_t)(depth - 1) * size * 1000 / byte_rate)) : (0);
+
+        if (depth >= 2 && segment_ms <= SEGMENT_PLAN_MAX_MS && (uint64_t)(depth - 1) * size >= needed)
+        {
+            break;
+        }
+    }
+    return plan;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  The segment ring has a fixed number of bytes to share between its slots.  How they are split up is chosen
+ *  for every track from its bit rate, and from how slow the SD card has been:
+ *
+ *      - Larger segments mean fewer SD card reads and fewer times the DecoderTask has to wake up for a
+ *        segment, but the DecoderTask only looks at commands between segments, so a segment holds no more
+ *        than SEGMENT_PLAN_MAX_MS of audio.
+ *      - Once the decoder takes a slot, the other depth - 1 slots are all that is read ahead.  They have to
+ *        hold enough audio to play through the slowest read seen so far, SEGMENT_PLAN_READ_MARGIN times over.
+ *
+ *  The largest segment that meets both wins.  With 8 KB to share, a 64 kbps track gets 4 segments of 2048
+ *  bytes, a 320 kbps track 2 segments of 4096 bytes until a read takes longer than 50 ms, then 4 of 2048.
+ */
+
+// Segments are whole SD card sectors, powers of 2 from the smallest to the largest
+#define SEGMENT_PLAN_MIN_SIZE (512)
+#define SEGMENT_PLAN_MAX_SIZE (4096)
+
+// Longest a segment can play for
+#define SEGMENT_PLAN_MAX_MS (256)
+
+// Read ahead covers the slowest read this many times over
+#define SEGMENT_PLAN_READ_MARGIN (2)
+
+typedef struct
+{
+    uint32_t size;              // Bytes per segment
+    uint32_t depth;             // Number of segments
+    uint32_t read_ahead_ms;     // Audio in depth - 1 segments
+} segment_plan_S;
+
+// @description      : Chooses the segment size and depth for a track
+// @param byte_rate  : Average bytes per second of the track, 0 if unknown
+// @param max_read_us: Slowest segment read seen so far, 0 if there has not been one
+// @param arena_size : Bytes the segments share
+// @param max_depth  : Most segments there can be
+// @returns          : Plan to use, the smallest segments if none is good enough
+segment_plan_S segment_plan_choose(uint32_t byte_rate, uint32_t max_read_us, uint32_t arena_size, uint32_t max_depth);
@@ -0,0 +1,155 @@
+#include "segment_ring.hpp"
+#include <cstring>
+#include <stdio.h>
+
+SegmentRing Mp3Ring;
+
+SegmentRing::SegmentRing()
+{
+    FreeQueue   = NULL;
+    FilledQueue = NULL;
+    memset(Slots, 0, sizeof(Slots));
+    Depth       = MP3_RING_ARENA_SIZE / MP3_SEGMENT_SIZE;
+    SegmentSize = MP3_SEGMENT_SIZE;
+    ResetStats();
+}
+
+void SegmentRing::Init()
+{
+    FreeQueue   = xQueueCreate(MP3_RING_MAX_DEPTH, sizeof(segment_slot_S*));
+    FilledQueue = xQueueCreate(MP3_RING_MAX_DEPTH, sizeof(segment_slot_S*));
+
+    Carve(MP3_SEGMENT_SIZE, MP3_RING_ARENA_SIZE / MP3_SEGMENT_SIZE);
+    ResetStats();
+    printf("[SegmentRing::Init] %lu slots of %lu bytes.\n", Depth, SegmentSize);
+}
+
+segment_slot_S* SegmentRing::AcquireFree(TickType_t ticks)
+{
+    segment_slot_S *slot = NULL;
+    return (xQueueReceive(FreeQueue, &slot, ticks)) ? (slot) : (NULL);
+}
+
+void SegmentRing::CommitFilled(segment_slot_S *slot)
+{
+    // Can never block, there are only as many slots as the queue can hold
+    xQueueSend(FilledQueue, &slot, 0);
+    ++Stats.segments_read;
+}
+
+segment_slot_S* SegmentRing::AcquireFilled(TickType_t ticks)
+{
+    segment_slot_S *slot = NULL;
+    if (!xQueueReceive(FilledQueue, &slot, ticks))
+    {
+        return NULL;
+    }
+
+    // Fill level the decoder left behind after taking this slot
+    const uint32_t fill_level = uxQueueMessagesWaiting(FilledQueue);
+    Stats.min_fill_level = MIN(Stats.min_fill_level, fill_level);
+    return slot;
+}
+
+void SegmentRing::ReleaseFree(segment_slot_S *slot)
+{
+    xQueueSend(FreeQueue, &slot, 0);
+}
+
+void SegmentRing::Flush()
+{
+    segment_slot_S *slot = NULL;
+    while (xQueueReceive(FilledQueue, &slot, 0))
+    {
+        xQueueSend(FreeQueue, &slot, 0);
+    }
+}
+
+bool SegmentRing::Resize(uint32_t segment_size, uint32_t depth, TickType_t ticks)
+{
+    depth = MIN(depth, MIN((uint32_t)MP3_RING_MAX_DEPTH, MP3_RING_ARENA_SIZE / segment_size));
+    if (segment_size == SegmentSize && depth == Depth)
+    {
+        return true;
+    }
+
+    Flush();
+
+    // Take every slot out of circulation, the consumer may still be playing one
+    segment_slot_S *taken[MP3_RING_MAX_DEPTH];
+    uint32_t count = 0;
+    const TickType_t start_tick = xTaskGetTickCount();
+    while (count < Depth)
+    {
+        const TickType_t elapsed = xTaskGetTickCount() - start_tick;
+        if (elapsed > ticks || !xQueueReceive(FreeQueue, &taken[count], ticks - elapsed))
+        {
+            break;
+        }
+        ++count;
+    }
+
+    if (count < Depth)
+    {
+        for (uint32_t i=0; i<count; i++)
+        {
+            xQueueSend(FreeQueue, &taken[i], 0);
+        }
+        return false;
+    }
+
+    Carve(segment_size, depth);
+    return true;
+}
+
+void SegmentRing::Carve(uint32_t segment_size, uint32_t depth)
+{
+    Depth       = depth;
+    SegmentSize = segment_size;
+    for (uint32_t i=0; i<Depth; i++)
+    {
+        segment_slot_S *slot = &Slots[i];
+        slot->data     = &Arena[i * SegmentSize];
+        slot->capacity = SegmentSize;
+        xQueueSend(FreeQueue, &slot, 0);
+    }
+
+    Stats.depth          = Depth;
+    Stats.segment_size   = SegmentSize;
+    Stats.min_fill_level = MIN(Stats.min_fill_level, Depth);
+}
+
+void SegmentRing::RecordReadTime(uint32_t micros)
+{
+    Stats.max_read_us = MAX(Stats.max_read_us, micros);
+}
+
+void SegmentRing::RecordUnderrun()
+{
+    ++Stats.underruns;
+}
+
+void SegmentRing::RecordReaderStall()
+{
+    ++Stats.reader_stalls;
+}
+
+uint32_t SegmentRing::GetFillLevel()
+{
+    return (FilledQueue) ? (uxQueueMessagesWaiting(FilledQueue)) : (0);
+}
+
+segment_ring_stats_S SegmentRing::GetStats()
+{
+    segment_ring_stats_S stats = Stats;
+    stats.fill_level = GetFillLevel();
+    return stats;
+}
+
+void SegmentRing::ResetStats()
+{
+    memset(&Stats, 0, sizeof(Stats));
+    Stats.depth          = Depth;
+    Stats.segment_size   = SegmentSize;
+    Stats.min_fill_level = Depth;
+}
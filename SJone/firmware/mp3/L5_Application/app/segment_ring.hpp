@@ -0,0 +1,121 @@
+#pragma once
+#include "common.hpp"
+
+/**
+ * The segment ring sits between the ReaderTask and the DecoderTask.  The reader fills free slots
+ * with a segment from the SD card, and the decoder drains filled slots into the VS1053b, so a slow
+ * SD read only eats into the read-ahead instead of stalling the decoder.
+ *
+ * Slots are never copied, only their pointers move between a free queue and a filled queue.  Their
+ * data is carved out of a single arena, which the reader splits up again for every track, see
+ * segment_plan.hpp.
+ */
+
+// One segment of an mp3 file waiting to be played
+typedef struct
+{
+    uint8_t *data;          // Points into the arena of the ring
+    uint32_t capacity;      // Size of data
+    uint32_t size;          // Number of valid bytes in data
+    uint32_t offset;        // File offset of the first byte in data
+    uint32_t generation;    // Stream request the slot was read for, stale slots are discarded
+    uint32_t track;         // File the slot was read from, numbered by the reader every time it opens one
+    bool     last_segment;  // True if this is the last segment of the stream
+    bool     track_start;   // True if this is the first segment of a track queued up behind the previous one
+    bool     failed;        // True if the file could not be opened or read, data is not valid
+} segment_slot_S;
+
+// Fill level and stall statistics of the ring
+typedef struct
+{
+    uint32_t depth;             // Number of slots in the ring
+    uint32_t segment_size;      // Size of every slot
+    uint32_t fill_level;        // Slots currently waiting for the decoder
+    uint32_t min_fill_level;    // Lowest fill level the decoder has seen since the last reset
+    uint32_t underruns;         // Times the decoder found the ring empty while streaming
+    uint32_t reader_stalls;     // Times the reader had to wait for a free slot
+    uint32_t segments_read;     // Segments committed by the reader
+    uint32_t max_read_us;       // Longest time a single segment read took
+} segment_ring_stats_S;
+
+class SegmentRing
+{
+public:
+
+    // Constructor
+    SegmentRing();
+
+    // @description : Creates the free and filled queues and hands every slot to the free queue
+    //                Must be called before any task uses the ring
+    void Init();
+
+    // @description : Producer side, takes an empty slot to read into
+    // @param ticks : How long to wait for a slot to be freed
+    // @returns     : Pointer to the slot, NULL on timeout
+    segment_slot_S* AcquireFree(TickType_t ticks);
+
+    // @description : Producer side, passes a filled slot on to the decoder
+    // @param slot  : Slot previously returned by AcquireFree
+    void CommitFilled(segment_slot_S *slot);
+
+    // @description : Consumer side, takes the oldest filled slot
+    // @param ticks : How long to wait for the reader to fill a slot
+    // @returns     : Pointer to the slot, NULL on timeout
+    segment_slot_S* AcquireFilled(TickType_t ticks);
+
+    // @description : Returns a slot to the free queue, used by both sides
+    // @param slot  : Slot previously returned by AcquireFree or AcquireFilled
+    void ReleaseFree(segment_slot_S *slot);
+
+    // @description : Producer side, returns every filled slot to the free queue
+    //                Slots already taken by the consumer are not affected
+    void Flush();
+
+    // @description        : Producer side, flushes the ring and splits the arena up into depth slots of segment_size
+    //                       Every slot has to be back, so it waits for the consumer to release the one it has
+    // @param segment_size : Bytes per slot
+    // @param depth        : Number of slots, limited to what fits in the arena
+    // @param ticks        : How long to wait for the consumer
+    // @returns            : False if the consumer did not release its slot in time, the ring is left as it was
+    bool Resize(uint32_t segment_size, uint32_t depth, TickType_t ticks);
+
+    // @description     : Records how long the reader spent filling a slot
+    // @param micros    : Duration of the read in microseconds
+    void RecordReadTime(uint32_t micros);
+
+    // @description : Records that the decoder found the ring empty while a stream was active
+    void RecordUnderrun();
+
+    // @description : Records that the reader found the ring full
+    void RecordReaderStall();
+
+    // @description : Number of filled slots waiting for the decoder
+    uint32_t GetFillLevel();
+
+    // @description : Returns a snapshot of the statistics
+    segment_ring_stats_S GetStats();
+
+    // @description : Clears the statistics, the fill level is left alone
+    void ResetStats();
+
+private:
+
+    // Splits the arena up and hands every slot to the free queue, the queues must not hold any slot
+    void Carve(uint32_t segment_size, uint32_t depth);
+
+    // Storage of all slots, only the first Depth are in use
+    uint8_t        Arena[MP3_RING_ARENA_SIZE];
+    segment_slot_S Slots[MP3_RING_MAX_DEPTH];
+    uint32_t       Depth;
+    uint32_t       SegmentSize;
+
+    // Queues of slot pointers
+    QueueHandle_t FreeQueue;
+    QueueHandle_t FilledQueue;
+
+    // Statistics, only written from task context
+    segment_ring_stats_S Stats;
+};
+
+// Shared between the ReaderTask and the DecoderTask
+extern SegmentRing Mp3Ring;
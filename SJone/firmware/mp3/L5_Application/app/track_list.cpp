@@ -4,195 +4,394 @@
 #include <cstdlib>
 #include "circular_buffer.hpp"
 #include "ff.h"
+#include "lpc_sys.h"
+#include "library_index.hpp"
+#include "track_table.hpp"
 
-#define MAX_TRACK_LIST_SIZE (20)
+// Folders, names and tags of every track, in the order the walk gets to them, see track_table.hpp
+// Filled in by the ScannerTask while everything else reads it, only touched with TrackListMutex taken
+static track_table_S TrackTable;
+static SemaphoreHandle_t TrackListMutex = NULL;
+static uint16_t CurrentTrackNumber = 0;
 
-// Linked list of track list
-// static CircularBuffer TrackList;
-static file_name_S **TrackList;
-static uint8_t TrackListSize = 0;
-static uint8_t CurrentTrackNumber = 0;
+// Current track, filled in from the table, only handed out as a copy
+static file_name_S CurrentTrack;
 
-// Array of song header information in the same order as tracklist
-mp3_header_S *Headers;
+// Next track the parse pass expects to see, it walks the directory in the same order as the names pass
+static uint32_t FillCursor = 0;
 
-void track_list_init(void)
+// How often the parse pass checks if the stream it is waiting for has ended
+static const uint32_t ScanPauseMs = 250;
+
+// Bytes a track took before the table, a file_name_S, a pointer to it and an mp3_header_S with 32 character strings
+static const uint32_t FixedBytesPerTrack = 4 + 68 + 164;
+
+// Sniffs a file that was added or changed since the index was written, and reads its tags if it is played
+// The file is opened once, and the tags are read right after its first bytes, while the sector they are in is
+// still in the FatFs sector buffer, which is where the text frames of most tags are
+static void ParseFile(const char *path, library_record_S *record)
 {
-    TrackList = new file_name_S*[MAX_TRACK_LIST_SIZE];
-    for (int i=0; i<MAX_TRACK_LIST_SIZE; i++)
+    // 1: for sd card directory, full_path = directory_path + path
+    char full_path[MAX_PATH_LENGTH + 3] = { 0 };
+    snprintf(full_path, sizeof(full_path), "1:%s", path);
+
+    FIL file;
+    if (FR_OK != f_open(&file, full_path, FA_OPEN_EXISTING | FA_READ))
+    {
+        record->codec = CODEC_UNKNOWN;
+        return;
+    }
+
+    uint8_t buffer[CODEC_SNIFF_SIZE] = { 0 };
+    uint32_t tag_size = 0;
+    UINT read = 0;
+    codec_E codec = CODEC_UNKNOWN;
+    mp3_header_S header;
+    memset(&header, 0, sizeof(header));
+    if (FR_OK == f_read(&file, buffer, sizeof(buffer), &read))
     {
-        TrackList[i] = new file_name_S;
-        memset(TrackList[i]->full_name,  0, 32);
-        memset(TrackList[i]->short_name, 0, 32);
+        codec = codec_sniff(buffer, read, &tag_size);
+        mp3_read_tags(&file, buffer, read, &header);
+
+        // Only one tag is looked past, so every file takes at most two reads to sniff
+        if (tag_size > 0 && FR_OK == f_lseek(&file, tag_size) && FR_OK == f_read(&file, buffer, sizeof(buffer), &read))
+        {
+            codec = codec_sniff(buffer, read, &tag_size);
+        }
     }
+    f_close(&file);
 
-    // File system variables
-    DIR directory;
-    FILINFO file_info;
-    uint32_t counter = 0;
-    char name_buffer[32] = { 0 };
+    record->codec = codec;
+    if (CODEC_UNKNOWN != codec)
+    {
+        memcpy(record->artist, header.artist, sizeof(record->artist));
+        memcpy(record->title,  header.title,  sizeof(record->title));
+        memcpy(record->genre,  header.genre,  sizeof(record->genre));
+    }
+}
 
-    // 1: for sd card directory
-    const char *directory_path = "1:";
-    f_opendir(&directory, directory_path);
+// Names pass, lets anything else at this priority run between files
+static void YieldBetweenFiles(void)
+{
+    taskYIELD();
+}
 
-    printf("\n--------------------------------------\n");
-    printf("Reading SD directory:\n");
+// Parse pass, leaves the SD card alone for as long as a track is streaming off it
+static void WaitForCard(void)
+{
+    while (decoder_is_streaming())
+    {
+        DELAY_MS(ScanPauseMs);
+    }
+    taskYIELD();
+}
 
-    while (1)
+// Sniffs a track that is wanted before the parse pass got to it, TrackListMutex has to be taken
+// The mutex is given up while the file is opened, so the menu and the other tasks are not held up by the SD card
+// Records are never moved or removed, so the index still points at the same track once it is taken again
+static void ResolveTrack(uint16_t index)
+{
+    library_record_S record;
+    memset(&record, 0, sizeof(record));
+    char path[MAX_PATH_LENGTH] = { 0 };
+    if (!track_table_get_path(&TrackTable, index, path, sizeof(path)))
     {
-        file_info.lfname = name_buffer;
-        file_info.lfsize = sizeof(name_buffer);
+        track_table_update(&TrackTable, index, NULL, NULL, NULL, CODEC_UNKNOWN);
+        return;
+    }
 
-        // When no more to read
-        if (FR_OK != f_readdir(&directory, &file_info) || !file_info.fname[0])
+    xSemaphoreGive(TrackListMutex);
+    ParseFile(path, &record);
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+
+    // The parse pass, or another task, may have filled it in while the mutex was given up
+    if (TRACK_CODEC_PENDING == track_table_get(&TrackTable, index)->codec)
+    {
+        track_table_update(&TrackTable, index, record.artist, record.title, record.genre, record.codec);
+    }
+}
+
+// Fills in a file_name_S from the table, the track has to be in it, TrackListMutex has to be taken
+// The mutex can be given up in between, see ResolveTrack, so the track has to be the caller's own
+static void LoadTrack(uint16_t index, file_name_S *track)
+{
+    if (TRACK_CODEC_PENDING == track_table_get(&TrackTable, index)->codec)
+    {
+        ResolveTrack(index);
+    }
+
+    const track_record_S *record = track_table_get(&TrackTable, index);
+    memset(track, 0, sizeof(*track));
+    track_table_get_path(&TrackTable, index, track->full_name, sizeof(track->full_name));
+    track->codec = (codec_E)record->codec;
+    track_list_convert_to_short_name(track);
+}
+
+// Loads the first track from index on that is played, moving by step, files that turned out not to be are skipped
+// TrackListMutex has to be taken, index and track have to be the caller's own, see LoadTrack
+static bool LoadPlayable(uint16_t *index, int step, file_name_S *track)
+{
+    const uint32_t count = TrackTable.count;
+    for (uint32_t i=0; i<count; i++)
+    {
+        LoadTrack(*index, track);
+        if (CODEC_UNKNOWN != track->codec)
         {
-            break;
+            return true;
         }
+        *index = (*index + count + step) % count;
+    }
+    return false;
+}
 
-        // Some file names are prefix with _, dont use those files
-        if (file_info.fname[0] == '_' || file_info.lfname[0] == '_') continue;
+// Names pass, adds a folder before the files in it
+// The walk stops at the first folder or file that does not fit, so the table numbers folders the same as the walk
+static bool AddFolder(uint16_t folder, uint16_t parent, const char *name)
+{
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const bool added = track_table_add_folder(&TrackTable, parent, name);
+    xSemaphoreGive(TrackListMutex);
+
+    if (!added)
+    {
+        printf("Track list is full, folder %s and everything after it is left out.\n", name);
+    }
+    return added;
+}
 
-        // Use the name pointer that has the longest name
-        char *file_name = (strlen(&(file_info.fname[0])) > strlen(file_info.lfname)) ?
-                          (&(file_info.fname[0])) : (file_info.lfname);
+// Names pass, adds a file by its name alone, whether it is played is not known yet
+static bool AddTrack(const library_record_S *record)
+{
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const bool added = track_table_add(&TrackTable, record->folder, record->name, NULL, NULL, NULL, TRACK_CODEC_PENDING);
+    xSemaphoreGive(TrackListMutex);
 
-        // printf("%s | %s\n", file_info.fname, file_info.lfname);
+    if (!added)
+    {
+        printf("Track list is full, %s and everything after it is left out.\n", record->name);
+    }
+    return added;
+}
+
+// Parse pass, fills in a track from the index or from the file, the names pass added it in the same order
+// A file that showed up in between is left for the next boot, adding it after the others would break up the runs
+// of tracks the folders are
+static bool FillTrack(const library_record_S *record)
+{
+    const char *artist = (record->artist[0]) ? (record->artist) : (NULL);
+    const char *title  = (record->title[0])  ? (record->title)  : (NULL);
+    const char *genre  = (record->genre[0])  ? (record->genre)  : (NULL);
 
-        // Find index of last dot
-        char *index_of_dot = strrchr(file_name, '.');
-        uint32_t index = index_of_dot - file_name + 1;
-        if (index_of_dot)
-        {   
-            // Filename has to be at least 3 characters longer than the position of the last dot
-            if (strlen(file_name) >= index + 3)
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    uint32_t index = FillCursor;
+    while (index < TrackTable.count && (TrackTable.records[index].folder != record->folder ||
+           0 != strcmp(track_table_string(&TrackTable, TrackTable.records[index].name), record->name)))
+    {
+        ++index;
+    }
+
+    if (index < TrackTable.count)
+    {
+        // Tracks skipped over were not handed over again, so they are not played
+        for (; FillCursor < index; FillCursor++)
+        {
+            if (TRACK_CODEC_PENDING == TrackTable.records[FillCursor].codec)
             {
-                // If file extension == "mp3" then add to the track list
-                if ((*(file_name+index) == 'm') && (*(file_name+index+1) == 'p') && (*(file_name+index+2) == '3'))
-                {
-                    // TrackList.InsertBack(file_name);
-                    memcpy(TrackList[TrackListSize++]->full_name, file_name, strlen(file_name));
-                    printf("[File %lu] Name: %s Size: %lu\n", counter++, TrackList[TrackListSize-1]->full_name, file_info.fsize);
-                    track_list_convert_to_short_name(TrackList[TrackListSize-1]);
-                }
-                // If file extension == "MP3" then add to the track list
-                else if ((*(file_name+index) == 'M') && (*(file_name+index+1) == 'P') && (*(file_name+index+2) == '3'))
-                {
-                    // TrackList.InsertBack(file_name);
-                    memcpy(TrackList[TrackListSize++]->full_name, file_name, strlen(file_name));
-                    printf("[File %lu] Name: %s Size: %lu\n", counter++, TrackList[TrackListSize-1]->full_name, file_info.fsize);
-                    track_list_convert_to_short_name(TrackList[TrackListSize-1]);
-                }
+                track_table_update(&TrackTable, FillCursor, NULL, NULL, NULL, CODEC_UNKNOWN);
             }
         }
+        FillCursor = index + 1;
+        if (TRACK_CODEC_PENDING == TrackTable.records[index].codec &&
+            !track_table_update(&TrackTable, index, artist, title, genre, record->codec))
+        {
+            printf("Track list is full, the tags of %s are left out.\n", record->name);
+        }
     }
 
-    uint8_t buffer[480] = { 0 };
-    Headers = new mp3_header_S[TrackListSize];
+    // Nothing after the last track of the names pass is filled in
+    const bool filling = (FillCursor < TrackTable.count);
+    xSemaphoreGive(TrackListMutex);
+    return filling;
+}
+
+void track_list_init(void)
+{
+    // Whatever the heap can spare up to the budget, the table is full when it runs out rather than at a track count
+    const sys_mem_t memory = sys_get_mem_info();
+    const uint32_t available = memory.avail_heap + memory.avail_sys;
+    uint32_t budget = (available > MP3_TRACK_TABLE_RESERVE) ? (available - MP3_TRACK_TABLE_RESERVE) : (0);
+    budget = MIN(budget, (uint32_t)MP3_TRACK_TABLE_BUDGET);
+    track_table_init(&TrackTable, new uint8_t[budget], budget);
+    TrackListMutex     = xSemaphoreCreateMutex();
+    CurrentTrackNumber = 0;
+    FillCursor         = 0;
+}
 
-    // Grab header information
-    for (int i=0; i<TrackListSize; i++)
+void track_list_scan(void)
+{
+    library_scan_stats_S stats;
+
+    // Every name first, so there is something to play before a single file is opened, see library_index.hpp
+    library_list(AddTrack, AddFolder, YieldBetweenFiles, &stats);
+    printf("[track_list_scan] Listed %lu files in %lu folders in %lu ms, the first after %lu ms, %lu left out too deep.\n",
+            stats.files, stats.folders, stats.total_us / 1000, stats.first_us / 1000, stats.skipped);
+
+    // Then codecs and tags, out of the index, and only new and changed files are opened, while nothing is streaming
+    // The walk is the same, so the folders are already there with the same numbers
+    library_scan(ParseFile, FillTrack, NULL, WaitForCard, &stats);
+    printf("[track_list_scan] Scanned %lu files, %lu tracks: %lu from the index, %lu parsed, %lu removed, index %s.\n",
+            stats.files, stats.tracks, stats.reused, stats.parsed, stats.removed, (stats.saved) ? ("saved") : ("unchanged"));
+    printf("[track_list_scan] Scan took %lu ms: %lu ms parsing, %lu ms on the index.\n",
+            stats.total_us / 1000, stats.parse_us / 1000, stats.index_us / 1000);
+
+    // Files after the last track that was handed over are not played either
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    for (; FillCursor < TrackTable.count; FillCursor++)
     {
-        memset(&Headers[i], 0, sizeof(Headers[i]));
-        memcpy(&Headers[i].file_name, TrackList[i], sizeof(file_name_S));
-        mp3_open_file(TrackList[i]);
-        mp3_get_header_info(&Headers[i], buffer);
-        // printf("%s | %s | %s\n", Headers[i].artist, Headers[i].title, Headers[i].genre);
-        mp3_close_file();
+        if (TRACK_CODEC_PENDING == TrackTable.records[FillCursor].codec)
+        {
+            track_table_update(&TrackTable, FillCursor, NULL, NULL, NULL, CODEC_UNKNOWN);
+        }
     }
-    printf("--------------------------------------\n");
+    const uint32_t count = TrackTable.count;
+    const uint32_t used  = track_table_get_used(&TrackTable);
+    printf("[track_list_scan] Track table: %lu files in %lu of %lu bytes, %lu bytes a file against %lu, %lu tags shared saved %lu bytes.\n",
+            count, used, TrackTable.size, (count) ? (used / count) : (0), FixedBytesPerTrack, TrackTable.shared, TrackTable.shared_bytes);
+    printf("[track_list_scan] Track table: %lu of %lu folders.\n", TrackTable.folder_count, TrackTable.folder_capacity);
+    xSemaphoreGive(TrackListMutex);
 }
 
 void track_list_convert_to_short_name(file_name_S *file_names)
 {
-    // Find where the dot is
-    char *index_of_dot = strrchr(file_names->full_name, '.');
-    uint32_t index = index_of_dot - file_names->full_name + 1;
-    index = MIN(index, 32);
-    // Removes the file extension
-    memcpy(file_names->short_name, file_names->full_name, index);
-    if (index < 32) file_names->short_name[index-1] = '\0';
-    else            file_names->short_name[31] = '\0';
+    // Removes the folders
+    const char *index_of_slash = strrchr(file_names->full_name, '/');
+    const char *name = (index_of_slash) ? (index_of_slash + 1) : (file_names->full_name);
 
-    // printf("FULL: %s\n",  file_names->full_name);
-    // printf("SHORT: %s\n", file_names->short_name);
+    // Find where the dot is, a file is played whatever its extension, or without one
+    const char *index_of_dot = strrchr(name, '.');
+    uint32_t index = (index_of_dot) ? (index_of_dot - name + 1) : (strlen(name) + 1);
+    index = MIN(index, MAX_NAME_LENGTH);
+    // Removes the file extension
+    memcpy(file_names->short_name, name, index);
+    file_names->short_name[index-1] = '\0';
 }
 
-char* track_list_get_short_name(uint8_t index)
+const char* track_list_get_short_name(uint16_t index, uint32_t *size)
 {
-    if (index >= TrackListSize) return NULL;
-    else
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const track_record_S *record = track_table_get(&TrackTable, index);
+    const char *name = NULL;
+    if (record)
     {
-        return TrackList[index]->short_name;
+        *size = record->short_size;
+        name  = track_table_string(&TrackTable, record->name);
     }
+    xSemaphoreGive(TrackListMutex);
+    return name;
 }
 
-void track_list_next(void)
+bool track_list_get_tags(uint16_t index, const char **artist, const char **title, const char **genre)
 {
-    // TrackList.RotateBackward();
-    ++CurrentTrackNumber;
-    if (CurrentTrackNumber == TrackListSize) CurrentTrackNumber = 0;
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const track_record_S *record = track_table_get(&TrackTable, index);
+    if (record)
+    {
+        *artist = track_table_string(&TrackTable, record->artist);
+        *title  = track_table_string(&TrackTable, record->title);
+        *genre  = track_table_string(&TrackTable, record->genre);
+    }
+    xSemaphoreGive(TrackListMutex);
+    return (NULL != record);
 }
 
-void track_list_prev(void)
+uint16_t track_list_get_folder_count(void)
 {
-    --CurrentTrackNumber;
-    if (CurrentTrackNumber < 0) CurrentTrackNumber = TrackListSize-1;
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const uint16_t count = TrackTable.folder_count;
+    xSemaphoreGive(TrackListMutex);
+    return count;
 }
 
-uint16_t track_list_get_size(void)
+bool track_list_get_folder(uint16_t folder, const char **name, uint16_t *parent, uint16_t *first, uint16_t *count)
 {
-    // return TrackList.GetBufferSize();
-    return TrackListSize;
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const track_folder_S *record = track_table_get_folder(&TrackTable, folder);
+    if (record)
+    {
+        *name   = track_table_string(&TrackTable, record->name);
+        *parent = record->parent;
+        *first  = record->first;
+        *count  = record->count;
+    }
+    xSemaphoreGive(TrackListMutex);
+    return (NULL != record);
 }
 
-// void track_list_shuffle(void)
-// {
-//     // TrackList.ShuffleList();
-// }
-
-// void track_list_get4(file_name_S file_names[4])
-// {
-//     uint8_t last_index = CurrentTrackNumber;
+// Makes the first track from index on that is played the current one, TrackListMutex has to be taken
+static void SetCurrentTrack(uint16_t index, int step)
+{
+    file_name_S track;
+    const bool loaded = LoadPlayable(&index, step, &track);
 
-//     file_names[0] = track_list_get_current_track();
-//     track_list_next();
+    // Only the last task to get here moves the current track, LoadPlayable can give up the mutex in between
+    CurrentTrackNumber = index;
+    if (loaded)
+    {
+        CurrentTrack = track;
+    }
+}
 
-//     if (TrackListSize > 1)
-//     {
-//         file_names[1] = track_list_get_current_track();
-//         track_list_next();
-//     }
-//     if (TrackListSize > 2)
-//     {
-//         file_names[2] = track_list_get_current_track();
-//         track_list_next();
-//     }
-//     if (TrackListSize > 3)
-//     {
-//         file_names[3] = track_list_get_current_track();
-//         track_list_next();
-//     }
+void track_list_next(void)
+{
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    if (TrackTable.count > 0)
+    {
+        SetCurrentTrack((CurrentTrackNumber + 1) % TrackTable.count, 1);
+    }
+    xSemaphoreGive(TrackListMutex);
+}
 
-//     CurrentTrackNumber = last_index;
-// }
+void track_list_prev(void)
+{
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    if (TrackTable.count > 0)
+    {
+        SetCurrentTrack((CurrentTrackNumber + TrackTable.count - 1) % TrackTable.count, -1);
+    }
+    xSemaphoreGive(TrackListMutex);
+}
 
-file_name_S** track_list_get_track_list()
+uint16_t track_list_get_size(void)
 {
-    return TrackList;
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const uint16_t count = TrackTable.count;
+    xSemaphoreGive(TrackListMutex);
+    return count;
 }
 
-mp3_header_S* track_list_get_headers()
+void track_list_set_current_track(uint16_t index)
 {
-    return Headers;
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    if (index < TrackTable.count)
+    {
+        SetCurrentTrack(index, 1);
+    }
+    xSemaphoreGive(TrackListMutex);
 }
 
-void track_list_set_current_track(uint8_t index)
+void track_list_get_current_track(file_name_S *track)
 {
-    CurrentTrackNumber = MIN(CurrentTrackNumber, TrackListSize);
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    *track = CurrentTrack;
+    xSemaphoreGive(TrackListMutex);
 }
 
-file_name_S* track_list_get_current_track()
+bool track_list_get_track_after(const file_name_S *track, file_name_S *after)
 {
-    return TrackList[CurrentTrackNumber];
-}
\ No newline at end of file
+    xSemaphoreTake(TrackListMutex, portMAX_DELAY);
+    const int32_t found = track_table_find(&TrackTable, track->full_name);
+    uint16_t index = (found >= 0) ? ((found + 1) % TrackTable.count) : (0);
+    const bool loaded = (found >= 0) && LoadPlayable(&index, 1, after);
+    xSemaphoreGive(TrackListMutex);
+    return loaded;
+}
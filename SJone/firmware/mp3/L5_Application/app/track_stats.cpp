@@ -0,0 +1,128 @@
+#include "track_stats.hpp"
+#include "segment_ring.hpp"
+#include "mp3_tasks.hpp"
+#include "lpc_sys.h"
+#include <cstring>
+#include <stdio.h>
+
+TrackStats Mp3Stats;
+
+TrackStats::TrackStats()
+{
+    memset(&Current, 0, sizeof(Current));
+    Active           = false;
+    StartUs          = 0;
+    ReadTotalUs      = 0;
+    UnderrunsAtStart = 0;
+    ResetHistory();
+}
+
+void TrackStats::Begin(const char *name)
+{
+    End();
+
+    const uint32_t underruns = Mp3Ring.GetStats().underruns;
+    taskENTER_CRITICAL();
+    {
+        memset(&Current, 0, sizeof(Current));
+        strncpy(Current.name, name, sizeof(Current.name) - 1);
+        StartUs          = sys_get_uptime_us();
+        ReadTotalUs      = 0;
+        UnderrunsAtStart = underruns;
+        Active           = true;
+        MP3Player.ResetTransferStats();
+    }
+    taskEXIT_CRITICAL();
+}
+
+void TrackStats::End()
+{
+    if (!Active)
+    {
+        return;
+    }
+
+    const uint32_t underruns = Mp3Ring.GetStats().underruns;
+    taskENTER_CRITICAL();
+    {
+        Snapshot(&Current, underruns);
+        History[Head] = Current;
+        Head   = (Head + 1) % MP3_STATS_HISTORY;
+        Count  = MIN(Count + 1, MP3_STATS_HISTORY);
+        Active = false;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void TrackStats::RecordRead(uint32_t micros)
+{
+    taskENTER_CRITICAL();
+    {
+        Current.read_min_us = (0 == Current.reads) ? (micros) : (MIN(Current.read_min_us, micros));
+        Current.read_max_us = MAX(Current.read_max_us, micros);
+        ReadTotalUs += micros;
+        ++Current.reads;
+    }
+    taskEXIT_CRITICAL();
+}
+
+bool TrackStats::GetCurrent(track_stats_S *stats)
+{
+    const uint32_t underruns = Mp3Ring.GetStats().underruns;
+    taskENTER_CRITICAL();
+    {
+        Snapshot(&Current, underruns);
+        *stats = Current;
+    }
+    taskEXIT_CRITICAL();
+    return Active;
+}
+
+bool TrackStats::GetHistory(uint32_t n, track_stats_S *stats)
+{
+    bool found = false;
+    taskENTER_CRITICAL();
+    {
+        if (n < Count)
+        {
+            *stats = History[(Head + MP3_STATS_HISTORY - 1 - n) % MP3_STATS_HISTORY];
+            found  = true;
+        }
+    }
+    taskEXIT_CRITICAL();
+    return found;
+}
+
+void TrackStats::Log(const track_stats_S *stats)
+{
+    // Has to fit in a single packet of MAX_PACKET_SIZE
+    LOG_STATUS("%s %lums %luB/s wait%lums gap%luus starve%lu under%lu sd%lu/%lu/%luus",
+               stats->name, stats->duration_ms, stats->bytes_per_second, stats->transfer.dreq_wait_us / 1000,
+               stats->transfer.max_burst_gap_us, stats->transfer.starvations, stats->underruns,
+               stats->read_min_us, stats->read_avg_us, stats->read_max_us);
+}
+
+void TrackStats::ResetHistory()
+{
+    taskENTER_CRITICAL();
+    {
+        memset(History, 0, sizeof(History));
+        Head  = 0;
+        Count = 0;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void TrackStats::Snapshot(track_stats_S *stats, uint32_t underruns)
+{
+    if (!Active)
+    {
+        return;
+    }
+
+    stats->duration_ms      = (uint32_t)((sys_get_uptime_us() - StartUs) / 1000);
+    stats->transfer         = MP3Player.GetTransferStats();
+    stats->bytes_per_second = (stats->duration_ms > 0) ? ((uint32_t)((uint64_t)stats->transfer.bytes * 1000 / stats->duration_ms)) : (0);
+    stats->read_avg_us      = (stats->reads > 0) ? ((uint32_t)(ReadTotalUs / stats->reads)) : (0);
+    stats->underruns        = underruns - UnderrunsAtStart;
+}
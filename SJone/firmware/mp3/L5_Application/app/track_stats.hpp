@@ -0,0 +1,88 @@
+#pragma once
+#include "common.hpp"
+#include "vs1053b.hpp"
+
+/**
+ * Counters of how close to the edge a track was played, kept per track so a skip or glitch can be looked
+ * into after the fact.  The DecoderTask starts a record when a track starts, and moves it into a ring of
+ * the last MP3_STATS_HISTORY tracks when the track ends or the next one takes over without a gap.
+ *
+ *      - Transfer : From VS1053b::TransferData, reset at the start of every track
+ *      - SD reads : Time the ReaderTask took to read each segment, reads run ahead into the next track
+ *                   so the last few of a track are counted towards the one after it
+ *      - Underruns: Times the DecoderTask found the segment ring empty
+ */
+
+// Number of finished tracks kept
+#define MP3_STATS_HISTORY (8)
+
+typedef struct
+{
+    char     name[MAX_NAME_LENGTH];         // Short name of the track
+    uint32_t duration_ms;                   // Time from the first segment to the end of the track, or now
+    vs1053b_transfer_stats_S transfer;      // Counters of TransferData
+    uint32_t bytes_per_second;              // Bytes sent per second of duration
+    uint32_t reads;                         // Segments read from the SD card
+    uint32_t read_min_us;                   // Shortest segment read, 0 if there were none
+    uint32_t read_avg_us;
+    uint32_t read_max_us;
+    uint32_t underruns;                     // Times the decoder found the ring empty
+} track_stats_S;
+
+class TrackStats
+{
+public:
+
+    // Constructor
+    TrackStats();
+
+    // @description : Ends the current record if there is one, and starts counting for a new track
+    //                Resets the transfer counters of MP3Player
+    // @param name  : Short name of the track
+    void Begin(const char *name);
+
+    // @description : Moves the current record into the history, does nothing if there is none
+    void End();
+
+    // @description : Records how long the reader spent reading a segment from the SD card
+    // @param micros: Duration of the read in microseconds
+    void RecordRead(uint32_t micros);
+
+    // @description : Snapshot of the track being played
+    // @param stats : Struct to fill in
+    // @returns     : False if no track is being played
+    bool GetCurrent(track_stats_S *stats);
+
+    // @description : Snapshot of a finished track
+    // @param n     : 0 for the last track to finish, up to MP3_STATS_HISTORY - 1
+    // @param stats : Struct to fill in
+    // @returns     : False if fewer than n + 1 tracks have finished
+    bool GetHistory(uint32_t n, track_stats_S *stats);
+
+    // @description : Sends a record to the ESP32 as a status packet, only done when asked from the terminal
+    void Log(const track_stats_S *stats);
+
+    // @description : Clears the history, the current record is left alone
+    void ResetHistory();
+
+private:
+
+    // Fills in the counters of the current record that are kept elsewhere, must be called in a critical section
+    // Does nothing if no track is being played
+    void Snapshot(track_stats_S *stats, uint32_t underruns);
+
+    // Track being played
+    track_stats_S Current;
+    bool          Active;
+    uint64_t      StartUs;
+    uint64_t      ReadTotalUs;
+    uint32_t      UnderrunsAtStart;
+
+    // Finished tracks, Head is where the next one goes
+    track_stats_S History[MP3_STATS_HISTORY];
+    uint32_t      Head;
+    uint32_t      Count;
+};
+
+// Written by the DecoderTask and ReaderTask, read from the terminal
+extern TrackStats Mp3Stats;
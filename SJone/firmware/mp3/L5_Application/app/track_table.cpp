@@ -0,0 +1,284 @@
+#include "track_table.hpp"
+#include <cstring>
+
+// FNV-1a
+static uint32_t Hash(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    for (; *text; text++)
+    {
+        hash = (hash ^ (uint8_t)*text) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot that holds the string, or the free slot it would go into
+static uint32_t FindSlot(const track_table_S *table, const char *text)
+{
+    uint32_t slot = Hash(text) % table->slot_count;
+    while (TRACK_STRING_NONE != table->slots[slot] &&
+           0 != strcmp((const char*)&table->memory[table->slots[slot]], text))
+    {
+        slot = (slot + 1) % table->slot_count;
+    }
+    return slot;
+}
+
+// Slots are never more than three quarters full, so there is always a free one to stop at
+static bool CanIntern(const track_table_S *table)
+{
+    return table->slot_count > 0 && (table->slots_used + 1) * 4 <= table->slot_count * 3;
+}
+
+// Strings and slots a track took while it was being added, so a track that does not fit can be taken back out
+typedef struct
+{
+    uint32_t top;
+    uint32_t slots_used;
+    uint32_t shared;
+    uint32_t shared_bytes;
+    uint32_t slots[3];
+    uint32_t slot_count;
+} undo_S;
+
+// Stores a string below the others, or points at it again if it is interned, leaving room for the record
+static bool Store(track_table_S *table, undo_S *undo, const char *text, bool intern, track_string_t *string)
+{
+    *string = TRACK_STRING_NONE;
+    if (!text || !text[0])
+    {
+        return true;
+    }
+
+    const uint32_t size = strlen(text) + 1;
+    uint32_t slot = 0;
+    if (intern && table->slot_count > 0)
+    {
+        slot = FindSlot(table, text);
+        if (TRACK_STRING_NONE != table->slots[slot])
+        {
+            ++table->shared;
+            table->shared_bytes += size;
+            *string = table->slots[slot];
+            return true;
+        }
+    }
+
+    if (table->bottom + sizeof(track_record_S) + size > table->top)
+    {
+        return false;
+    }
+    table->top -= size;
+    memcpy(&table->memory[table->top], text, size);
+    if (intern && CanIntern(table))
+    {
+        table->slots[slot] = table->top;
+        ++table->slots_used;
+        undo->slots[undo->slot_count++] = slot;
+    }
+    *string = table->top;
+    return true;
+}
+
+// Latest slots are freed first, nothing was put in after them that could have probed past them
+static void Undo(track_table_S *table, const undo_S *undo)
+{
+    for (uint32_t i=undo->slot_count; i>0; i--)
+    {
+        table->slots[undo->slots[i - 1]] = TRACK_STRING_NONE;
+    }
+    table->top          = undo->top;
+    table->slots_used   = undo->slots_used;
+    table->shared       = undo->shared;
+    table->shared_bytes = undo->shared_bytes;
+}
+
+// Whether the folders of a track are the first size characters of a path, "Artist/Album/", matched from the end
+static bool IsInFolders(const track_table_S *table, uint32_t index, const char *path, uint32_t size)
+{
+    for (uint32_t folder=table->records[index].folder; TRACK_FOLDER_ROOT != folder; folder=table->folders[folder].parent)
+    {
+        const char *name = track_table_string(table, table->folders[folder].name);
+        const uint32_t length = strlen(name);
+        if (size < length + 1 || '/' != path[size - 1] || 0 != memcmp(&path[size - 1 - length], name, length))
+        {
+            return false;
+        }
+        size -= length + 1;
+    }
+    return (0 == size);
+}
+
+void track_table_init(track_table_S *table, void *memory, uint32_t size)
+{
+    memset(table, 0, sizeof(*table));
+    table->memory = (uint8_t*)memory;
+    table->size   = (size < TRACK_TABLE_MAX_SIZE) ? (size) : (TRACK_TABLE_MAX_SIZE);
+
+    // Folders and records start on an even offset right after the slots, every offset of a string is past them,
+    // so never 0
+    table->slot_count      = table->size / TRACK_TABLE_BYTES_PER_SLOT;
+    table->slots           = (track_string_t*)table->memory;
+    table->folder_capacity = table->size / TRACK_TABLE_BYTES_PER_FOLDER;
+    table->folder_capacity = (table->folder_capacity > 0) ? (table->folder_capacity) : (1);
+    table->folders         = (track_folder_S*)&table->memory[table->slot_count * sizeof(track_string_t)];
+    table->bottom          = table->slot_count * sizeof(track_string_t) + table->folder_capacity * sizeof(track_folder_S);
+    table->records         = (track_record_S*)&table->memory[table->bottom];
+    table->top             = table->size;
+    memset(table->slots, 0, table->slot_count * sizeof(track_string_t));
+
+    // Root has no name and is its own parent
+    table->folders[TRACK_FOLDER_ROOT].name   = TRACK_STRING_NONE;
+    table->folders[TRACK_FOLDER_ROOT].parent = TRACK_FOLDER_ROOT;
+    table->folders[TRACK_FOLDER_ROOT].first  = 0;
+    table->folders[TRACK_FOLDER_ROOT].count  = 0;
+    table->folder_count = 1;
+}
+
+bool track_table_add_folder(track_table_S *table, uint16_t parent, const char *name)
+{
+    undo_S undo = { table->top, table->slots_used, table->shared, table->shared_bytes, { 0 }, 0 };
+    track_folder_S folder;
+    if (table->folder_count >= table->folder_capacity || !Store(table, &undo, name, false, &folder.name))
+    {
+        return false;
+    }
+
+    // Runs of tracks are not moved, a folder starts where the records are now
+    folder.parent = parent;
+    folder.first  = table->count;
+    folder.count  = 0;
+    table->folders[table->folder_count++] = folder;
+    return true;
+}
+
+bool track_table_add(track_table_S *table, uint16_t folder, const char *name, const char *artist, const char *title,
+                     const char *genre, uint8_t codec)
+{
+    undo_S undo = { table->top, table->slots_used, table->shared, table->shared_bytes, { 0 }, 0 };
+    track_record_S record;
+    memset(&record, 0, sizeof(record));
+
+    const bool stored = (table->bottom + sizeof(track_record_S) <= table->top) &&
+                        Store(table, &undo, name,   false, &record.name)   &&
+                        Store(table, &undo, artist, true,  &record.artist) &&
+                        Store(table, &undo, title,  true,  &record.title)  &&
+                        Store(table, &undo, genre,  true,  &record.genre);
+    if (!stored)
+    {
+        Undo(table, &undo);
+        return false;
+    }
+
+    const char *dot = (name) ? (strrchr(name, '.')) : (NULL);
+    const uint32_t short_size = (dot) ? (dot - name) : ((name) ? (strlen(name)) : (0));
+    record.short_size = (short_size < 0xFF) ? (short_size) : (0xFF);
+    record.codec      = codec;
+    record.folder     = folder;
+
+    table->records[table->count++] = record;
+    table->bottom += sizeof(track_record_S);
+
+    // The track is in the run of every folder up to the root
+    for (uint32_t index=folder; ; index=table->folders[index].parent)
+    {
+        ++table->folders[index].count;
+        if (TRACK_FOLDER_ROOT == index)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+bool track_table_update(track_table_S *table, uint32_t index, const char *artist, const char *title, const char *genre,
+                        uint8_t codec)
+{
+    undo_S undo = { table->top, table->slots_used, table->shared, table->shared_bytes, { 0 }, 0 };
+    track_record_S *record = &table->records[index];
+    record->codec = codec;
+
+    track_string_t strings[3];
+    const bool stored = Store(table, &undo, artist, true, &strings[0]) &&
+                        Store(table, &undo, title,  true, &strings[1]) &&
+                        Store(table, &undo, genre,  true, &strings[2]);
+    if (!stored)
+    {
+        Undo(table, &undo);
+        return false;
+    }
+
+    record->artist = strings[0];
+    record->title  = strings[1];
+    record->genre  = strings[2];
+    return true;
+}
+
+const track_record_S* track_table_get(const track_table_S *table, uint32_t index)
+{
+    return (index < table->count) ? (&table->records[index]) : (NULL);
+}
+
+const track_folder_S* track_table_get_folder(const track_table_S *table, uint32_t index)
+{
+    return (index < table->folder_count) ? (&table->folders[index]) : (NULL);
+}
+
+bool track_table_get_path(const track_table_S *table, uint32_t index, char *path, uint32_t size)
+{
+    if (index >= table->count)
+    {
+        return false;
+    }
+
+    // Length first, then the path is filled in from its end, the name, back up to the root
+    const track_record_S *record = &table->records[index];
+    uint32_t length = strlen(track_table_string(table, record->name));
+    for (uint32_t folder=record->folder; TRACK_FOLDER_ROOT != folder; folder=table->folders[folder].parent)
+    {
+        length += strlen(track_table_string(table, table->folders[folder].name)) + 1;
+    }
+    if (length + 1 > size)
+    {
+        return false;
+    }
+
+    path[length] = '\0';
+    const char *name = track_table_string(table, record->name);
+    uint32_t end = length - strlen(name);
+    memcpy(&path[end], name, length - end);
+    for (uint32_t folder=record->folder; TRACK_FOLDER_ROOT != folder; folder=table->folders[folder].parent)
+    {
+        const char *folder_name = track_table_string(table, table->folders[folder].name);
+        const uint32_t folder_size = strlen(folder_name);
+        path[--end] = '/';
+        end -= folder_size;
+        memcpy(&path[end], folder_name, folder_size);
+    }
+    return true;
+}
+
+const char* track_table_string(const track_table_S *table, track_string_t string)
+{
+    return (TRACK_STRING_NONE == string) ? ("") : ((const char*)&table->memory[string]);
+}
+
+int32_t track_table_find(const track_table_S *table, const char *path)
+{
+    // Names are compared first, the folders only for the tracks with the same name
+    const char *slash = strrchr(path, '/');
+    const char *name  = (slash) ? (slash + 1) : (path);
+    for (uint32_t i=0; i<table->count; i++)
+    {
+        if (0 == strcmp(track_table_string(table, table->records[i].name), name) && IsInFolders(table, i, path, name - path))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t track_table_get_used(const track_table_S *table)
+{
+    return table->bottom + (table->size - table->top);
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  The track list keeps every playable file with its name and tags.  A fixed array per string would cost as
+ *  much for "Intro" as for the longest name, cut off anything longer, and store the same artist and genre
+ *  again for every track of an album.  Instead the table lives in one block of memory, sized from a budget,
+ *  with fixed size records growing up from the bottom and the strings they point at growing down from the top:
+ *
+ *      [ intern slots ][ folders ][ record 0 | record 1 | ...  ->        <-  ... | "Rock" | "Song.mp3" | ... ]
+ *
+ *  The table is full once the two meet, whether that is from many tracks with short names or few with long
+ *  ones.  Records point at their strings with 16 bit offsets from the start of the block, so it is at most
+ *  TRACK_TABLE_MAX_SIZE bytes.
+ *
+ *  Artists, titles and genres are interned, a string that is already in the table is pointed at again instead
+ *  of stored twice.  The slots are an open addressing hash table of offsets, one for every
+ *  TRACK_TABLE_BYTES_PER_SLOT bytes of the budget.  Once three quarters of them are taken, new strings are
+ *  stored without being interned.  Names are unique in a folder and are never looked up by the slots.
+ *
+ *  Folders are kept in a fixed array after the slots, one for every TRACK_TABLE_BYTES_PER_FOLDER bytes of the
+ *  budget, with the root as folder 0.  A record only has the folder it is in and its own name, the path is put
+ *  together by following the parents up to the root.  Folders have to be added in the order a depth first walk
+ *  gets to them, with their tracks added before the walk leaves them, so the tracks in a folder and every folder
+ *  under it are one run of the records, first to first + count.  Showing a folder is a slice of the table, and
+ *  the tracks right in it are the ones of the slice that point at it.
+ *
+ *  A track can be added before its codec and tags are known, and filled in later, its strings go wherever
+ *  the top is by then.  Nothing is ever moved, so a string stays where it is for as long as the table does.
+ *
+ *  @example:
+ *  100 tracks by 10 artists, in 3 genres, with names of 20 characters and titles of 15:
+ *      12 byte records, 21 + 16 bytes of name and title, 1.3 bytes of artist and genre, about 50 bytes a track
+ */
+
+// Offsets are 16 bits
+#define TRACK_TABLE_MAX_SIZE (0xFFFF)
+
+// Budget spent on intern slots, 2 bytes out of every 32
+#define TRACK_TABLE_BYTES_PER_SLOT (32)
+
+// Budget spent on folders, 8 bytes out of every 128, never less than the root
+#define TRACK_TABLE_BYTES_PER_FOLDER (128)
+
+// Folder every other one is under, the root of the SD card
+#define TRACK_FOLDER_ROOT (0)
+
+// Offset of a string that is not there, read as ""
+#define TRACK_STRING_NONE (0)
+
+// Codec of a track that was added before it was known
+#define TRACK_CODEC_PENDING (0xFF)
+
+typedef uint16_t track_string_t;
+
+typedef struct
+{
+    track_string_t name;        // File name, with its extension
+    track_string_t artist;
+    track_string_t title;
+    track_string_t genre;
+    uint8_t        short_size;  // Characters of the name before its extension
+    uint8_t        codec;       // codec_E, TRACK_CODEC_PENDING until it is known
+    uint16_t       folder;      // Folder the file is in
+} track_record_S;
+
+typedef struct
+{
+    track_string_t name;        // Folder name, TRACK_STRING_NONE for the root
+    uint16_t       parent;      // Folder it is in, the root is its own parent
+    uint16_t       first;       // First track in it or in a folder under it
+    uint16_t       count;       // Tracks in it and in every folder under it
+} track_folder_S;
+
+typedef struct
+{
+    uint8_t        *memory;
+    uint32_t        size;
+    track_string_t *slots;          // Offsets of interned strings, TRACK_STRING_NONE if free
+    uint32_t        slot_count;
+    uint32_t        slots_used;
+    track_folder_S *folders;
+    uint32_t        folder_count;
+    uint32_t        folder_capacity;
+    track_record_S *records;
+    uint32_t        count;          // Records in the table
+    uint32_t        bottom;         // Offset right after the last record
+    uint32_t        top;            // Offset of the last string stored
+    uint32_t        shared;         // Strings that were already in the table
+    uint32_t        shared_bytes;   // Bytes storing them again would have taken
+} track_table_S;
+
+// @description : Lays out an empty table in a block of memory, with only the root folder
+// @param memory : Block the table lives in, until it is not used anymore
+// @param size   : Size of the block, only the first TRACK_TABLE_MAX_SIZE bytes are used
+void track_table_init(track_table_S *table, void *memory, uint32_t size);
+
+// @description : Adds a folder after the ones already in the table, its index is folder_count - 1
+// @param parent : Folder it is in, the last one added or one of the folders it is under
+// @param name   : Folder name, without the path to it
+// @returns      : False if it does not fit, the table is left as it was
+bool track_table_add_folder(track_table_S *table, uint16_t parent, const char *name);
+
+// @description : Adds a track after the ones already in the table
+// @param folder : Folder it is in, the last one added or one of the folders it is under
+// @param name   : File name, NULL or "" for the strings that are not known
+// @param codec  : codec_E of the file
+// @returns      : False if it does not fit, the table is left as it was
+bool track_table_add(track_table_S *table, uint16_t folder, const char *name, const char *artist, const char *title,
+                     const char *genre, uint8_t codec);
+
+// @description : Fills in the codec and tags of a track that was added before they were known
+// @param index  : Track to fill in, it has to be in the table
+// @returns      : False if the tags do not fit, the codec is set either way and the tags are left as they were
+bool track_table_update(track_table_S *table, uint32_t index, const char *artist, const char *title, const char *genre,
+                        uint8_t codec);
+
+// @description : Record of a track
+// @returns     : NULL if the index is past the last track
+const track_record_S* track_table_get(const track_table_S *table, uint32_t index);
+
+// @description : Folder and the run of tracks under it
+// @returns     : NULL if the index is past the last folder
+const track_folder_S* track_table_get_folder(const track_table_S *table, uint32_t index);
+
+// @description : Puts together the path of a track from the root, "Artist/Album/Song.mp3"
+// @param size  : Size of the path buffer
+// @returns     : False if the index is past the last track or the path does not fit, the buffer is left alone
+bool track_table_get_path(const track_table_S *table, uint32_t index, char *path, uint32_t size);
+
+// @description : String a record points at
+// @returns     : "" for TRACK_STRING_NONE
+const char* track_table_string(const track_table_S *table, track_string_t string);
+
+// @description : Index of the track with a path, as track_table_get_path puts it together
+// @returns     : -1 if there is none
+int32_t track_table_find(const track_table_S *table, const char *path);
+
+// @description : Bytes of the block taken by slots, records and strings
+uint32_t track_table_get_used(const track_table_S *table);
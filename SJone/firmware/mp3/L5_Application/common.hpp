@@ -5,6 +5,7 @@
 #include "queue.h"
 #include "semphr.h"
 #include "event_groups.h"
+#include "codec.hpp"
 
 // Helper macros for size comparison or related
 #define MAX(a, b)   ((a > b) ? (a) : (b))
@@ -13,9 +14,29 @@
 // Helper macro for delaying milliseconds
 #define DELAY_MS(x) (vTaskDelay(x / portTICK_PERIOD_MS))
 
-#define MAX_NAME_LENGTH (32)
+#define MAX_NAME_LENGTH (64)
+
+// Path of a track from the root of the SD card, folders and all, see library_index.hpp
+#define MAX_PATH_LENGTH (128)
 #define MP3_SEGMENT_SIZE (1024)
 
+// Bytes the ReaderTask can read ahead of the DecoderTask, split up into segments for every track
+#define MP3_RING_ARENA_SIZE (8 * MP3_SEGMENT_SIZE)
+
+// Most segments the arena can be split up into
+#define MP3_RING_MAX_DEPTH (16)
+
+// Heap the track list asks for, names and tags of every track share it, see track_table.hpp
+// Less is taken if the heap does not have it, MP3_TRACK_TABLE_RESERVE is always left over for everything after
+#define MP3_TRACK_TABLE_BUDGET  (16 * 1024)
+#define MP3_TRACK_TABLE_RESERVE (8 * 1024)
+
+// VS1053b patches loaded at boot if the SD card has them, see plugin_image.hpp
+#define MP3_BOOT_PLUGIN "patches.img"
+
+// Number of command packets the RxTask can queue up for the DecoderTask
+#define MESSAGE_RX_QUEUE_DEPTH (3)
+
 // Queues for packets going to / from the ESP32
 extern QueueHandle_t MessageRxQueue;
 extern QueueHandle_t MessageTxQueue;
@@ -37,13 +58,15 @@ extern EventGroupHandle_t watchdog_event_group;
 
 extern SemaphoreHandle_t PlaySem;
 
-// Struct containing original name, and name without extension
-// The original name is necessary to open the file from the FatFS
+// Struct containing path of the file, and name without folders or extension
+// The path is necessary to open the file from the FatFS
 // The short name is necessary for displaying on the screen
+// The codec decides how the track is played, see codec.hpp
 typedef struct
 {
-    char full_name[MAX_NAME_LENGTH];    // Original name
+    char full_name[MAX_PATH_LENGTH];    // Path from the root, "Artist/Album/Song.mp3"
     char short_name[MAX_NAME_LENGTH];   // Name without extension
+    codec_E codec;                      // What the file holds, sniffed when the track list is built
 } file_name_S;
 
 
@@ -68,9 +68,7 @@ const uint8_t row_offset[4] = {0x00, 0x40, 0x14, 0x54};
 const char *songStartLine = "------------------|";
 
 
-static file_name_S **track_list;
-static mp3_header_S* headers;
-static uint8_t track_list_size = 0;
+static uint16_t track_list_size = 0;
 
 static uint8_t currentArrowPos = 0;
 static uint32_t currentSongOffset = 0;
@@ -94,7 +92,7 @@ void setArrowPosition(uint8_t pos);
 void clearDisplay();
 void setHome();
 void sendData(char c, uint8_t mode = DATA);
-void sendString(char *str, uint32_t size);
+void sendString(const char *str, uint32_t size);
 void write(uint8_t * wdata, uint32_t wlength);
 void I2C_THIS_IS_TOTALLY_NOT_HARDCODED_MAGIC();
 void playSongScreenSetup(uint8_t rowSelected);
@@ -155,13 +153,13 @@ void printSongs(uint8_t startIndex)
     uint8_t line = 0;
     for (int i = startIndex; i < (startIndex+4); ++i) {
         setCursor(1, line);
-        uint32_t len = MIN(strlen(track_list[i]->short_name), 20);
+        uint32_t len = 0;
 
-        char *short_name = track_list_get_short_name(i);
+        const char *short_name = track_list_get_short_name(i, &len);
         if (short_name)
         {
-            printf("Short: %s\n", short_name);
-            sendString(short_name, len);
+            printf("Short: %.*s\n", (int)len, short_name);
+            sendString(short_name, MIN(len, 20));
             line++;            
         }
     }
@@ -247,7 +245,7 @@ void sendData(char c, uint8_t mode)
     write(send,4);
 }
 
-void sendString(char *str, uint32_t size) 
+void sendString(const char *str, uint32_t size) 
 {
     for (uint32_t i = 0; i < size; i++) {
         sendData(str[i]);
@@ -289,21 +287,22 @@ void I2C_THIS_IS_TOTALLY_NOT_HARDCODED_MAGIC()
 
 void playSongScreenSetup(uint8_t rowSelected) 
 {
-    char *name = headers[currentSongIndex].file_name.short_name;
-    uint8_t length = strlen(name);
-    sendString(name, length);
+    uint32_t length = 0;
+    const char *name = track_list_get_short_name(currentSongIndex, &length);
+    const char *artist = "", *title = "", *genre = "";
+    if (!name) return;
+    track_list_get_tags(currentSongIndex, &artist, &title, &genre);
+    sendString(name, MIN(length, MAX_COL_LENGTH));
 
     // Artist Name
     setCursor(0,1);
-    char *artist = headers[currentSongIndex].artist;
     length = strlen(artist);
-    sendString(artist, length);
+    sendString(artist, MIN(length, MAX_COL_LENGTH));
 
     // Genre
     setCursor(0,2);
-    char *genre = headers[currentSongIndex].genre;
     length = strlen(genre);
-    sendString(genre, length);
+    sendString(genre, MIN(length, MAX_COL_LENGTH));
 
     // Set Song Timeline - bottom row
     setCursor(0,3);
@@ -380,10 +379,8 @@ void LCDTask(void *p)
     LPC_GPIO1->FIODIR   &= ~(0x1 << 20);
     LPC_GPIO1->FIODIR   &= ~(0x1 << 19);
 
-    track_list_init();
-    track_list = track_list_get_track_list();
+    // Whatever the ScannerTask has found so far, the menu fills in as it finds more
     track_list_size = track_list_get_size();
-    headers = track_list_get_headers();
 
     I2C_THIS_IS_TOTALLY_NOT_HARDCODED_MAGIC();
     DELAY_MS(100);
@@ -391,7 +388,8 @@ void LCDTask(void *p)
     sendData(ARROW_CHAR);
 
     printSongs(currentSongOffset);
-    
+    printf("[LCDTask] Menu of %u tracks is up %lu ms after boot.\n", track_list_size, (uint32_t)(sys_get_uptime_us() / 1000));
+
     printf("LCD set up.\n");
 
     while (1)
@@ -419,6 +417,21 @@ void LCDTask(void *p)
             xSemaphoreGive(PlaySem);
         }
 
+        // Tracks the ScannerTask found since, only drawn if they land on the lines showing
+        const uint16_t size = track_list_get_size();
+        if (size != track_list_size)
+        {
+            const bool showing = (currentScreenIndex == 0) && (track_list_size < currentSongOffset + 4);
+            track_list_size = size;
+            if (showing)
+            {
+                printSongs(currentSongOffset);
+            }
+        }
+
+        // Same rate the DecoderTask samples the buttons at, spinning here starves the idle task at this priority
+        DELAY_MS(20);
+
         // {
         //     MP3Player.IncrementVolume();
         // }
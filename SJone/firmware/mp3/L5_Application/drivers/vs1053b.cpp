@@ -6,9 +6,45 @@
 #include "vs1053b.hpp"
 #include "spi.hpp"
 #include "ssp0.h"
+#include "eint.h"
+#include "common.hpp"
+#include "lpc_sys.h"
+#include "sys_config.h"
+#include "clock_governor.hpp"
 
 #define SPI     (Spi0::getInstance())
 
+// Largest burst that can be sent without checking DREQ, the device FIFO is 2048 bytes
+#define MAX_BURST_SIZE  (2048)
+
+// Times DREQ is read between the words of a multiple write before going to sleep on it
+#define DREQ_POLLS_PER_WORD (64)
+
+// Given by the DMA interrupt when a burst has been written to SSP0
+static SemaphoreHandle_t DmaDoneSem = NULL;
+
+// Called from the DMA interrupt
+static void DmaDoneCallback(void)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xSemaphoreGiveFromISR(DmaDoneSem, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+// Task sleeping in WaitForDREQ, NULL if nobody is waiting
+static volatile TaskHandle_t DreqWaiter = NULL;
+
+// Called from the EINT3 interrupt on the rising edge of DREQ
+static void DreqRisingEdge(void)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (DreqWaiter)
+    {
+        vTaskNotifyGiveFromISR(DreqWaiter, &higher_priority_task_woken);
+    }
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //                                         SYSTEM FUNCTIONS                                       //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -16,41 +52,89 @@
 VS1053b::VS1053b(vs1053b_gpio_init_t init) :    DREQ(init.port_dreq,   init.pin_dreq),
                                                 RESET(init.port_reset, init.pin_reset, true),
                                                 XCS(init.port_xcs,     init.pin_xcs, true),
-                                                XDCS(init.port_xdcs,   init.pin_xdcs, true)
-{
-    // Local register default values
-    RegisterMap[MODE]        = { .reg_num=MODE,        .can_write=true,  .reset_value=0x4000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[STATUS]      = { .reg_num=STATUS,      .can_write=true,  .reset_value=0x000C, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[BASS]        = { .reg_num=BASS,        .can_write=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[CLOCKF]      = { .reg_num=CLOCKF,      .can_write=true,  .reset_value=0x0000, .clock_cycles=1200, .reg_value=0 };
-    RegisterMap[DECODE_TIME] = { .reg_num=DECODE_TIME, .can_write=true,  .reset_value=0x0000, .clock_cycles=100,  .reg_value=0 };
-    RegisterMap[AUDATA]      = { .reg_num=AUDATA,      .can_write=true,  .reset_value=0x0000, .clock_cycles=450,  .reg_value=0 };
-    RegisterMap[WRAM]        = { .reg_num=WRAM,        .can_write=true,  .reset_value=0x0000, .clock_cycles=100,  .reg_value=0 };
-    RegisterMap[WRAMADDR]    = { .reg_num=WRAMADDR,    .can_write=true,  .reset_value=0x0000, .clock_cycles=100,  .reg_value=0 };
-    RegisterMap[HDAT0]       = { .reg_num=HDAT0,       .can_write=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[HDAT1]       = { .reg_num=HDAT1,       .can_write=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[AIADDR]      = { .reg_num=AIADDR,      .can_write=true,  .reset_value=0x0000, .clock_cycles=210,  .reg_value=0 };
-    RegisterMap[VOL]         = { .reg_num=VOL,         .can_write=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[AICTRL0]     = { .reg_num=AICTRL0,     .can_write=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[AICTRL1]     = { .reg_num=AICTRL1,     .can_write=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[AICTRL2]     = { .reg_num=AICTRL2,     .can_write=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
-    RegisterMap[AICTRL3]     = { .reg_num=AICTRL3,     .can_write=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+                                                XDCS(init.port_xdcs,   init.pin_xdcs, true),
+                                                DreqPort(init.port_dreq),
+                                                DreqPin(init.pin_dreq)
+{
+    // Local register default values, only the volatile ones are read back from the device
+    RegisterMap[MODE]        = { .reg_num=MODE,        .can_write=true,  .is_volatile=false, .reset_value=0x4000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[STATUS]      = { .reg_num=STATUS,      .can_write=true,  .is_volatile=true,  .reset_value=0x000C, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[BASS]        = { .reg_num=BASS,        .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[CLOCKF]      = { .reg_num=CLOCKF,      .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=1200, .reg_value=0 };
+    RegisterMap[DECODE_TIME] = { .reg_num=DECODE_TIME, .can_write=true,  .is_volatile=true,  .reset_value=0x0000, .clock_cycles=100,  .reg_value=0 };
+    RegisterMap[AUDATA]      = { .reg_num=AUDATA,      .can_write=true,  .is_volatile=true,  .reset_value=0x0000, .clock_cycles=450,  .reg_value=0 };
+    RegisterMap[WRAM]        = { .reg_num=WRAM,        .can_write=true,  .is_volatile=true,  .reset_value=0x0000, .clock_cycles=100,  .reg_value=0 };
+    RegisterMap[WRAMADDR]    = { .reg_num=WRAMADDR,    .can_write=true,  .is_volatile=true,  .reset_value=0x0000, .clock_cycles=100,  .reg_value=0 };
+    RegisterMap[HDAT0]       = { .reg_num=HDAT0,       .can_write=false, .is_volatile=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[HDAT1]       = { .reg_num=HDAT1,       .can_write=false, .is_volatile=true,  .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[AIADDR]      = { .reg_num=AIADDR,      .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=210,  .reg_value=0 };
+    RegisterMap[VOL]         = { .reg_num=VOL,         .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[AICTRL0]     = { .reg_num=AICTRL0,     .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[AICTRL1]     = { .reg_num=AICTRL1,     .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[AICTRL2]     = { .reg_num=AICTRL2,     .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
+    RegisterMap[AICTRL3]     = { .reg_num=AICTRL3,     .can_write=true,  .is_volatile=false, .reset_value=0x0000, .clock_cycles=80,   .reg_value=0 };
 
     Status.fast_forward_mode  = false;
     Status.rewind_mode        = false;
     Status.low_power_mode     = false;
     Status.playing            = false;
     Status.waiting_for_cancel = false;
+
+    BurstSize       = 32;
+    StreamMode      = false;
+    StreamByteRate  = 0;
+    StreamLowMarkUs = 0;
+    LastGovernUs    = 0;
+    GovernSpeed     = 0;
+    StreamCodec     = CODEC_MP3;
+    DreqInterrupt   = false;
+    SegmentCounter  = 0;
+    DirtyRegisters  = 0;
+    SciTransactions = 0;
+    ResetCount      = 0;
+
+    // Found with the first fill level read
+    StreamBufferStart = 0;
+    StreamBufferKnown = false;
+
+    CancelRequested = false;
+    CancelRequestUs = 0;
+    CancelAborted   = false;
+    BurstHook       = NULL;
+
+    ResetCancelStats();
+    ResetTransferStats();
+
+    memset(&Frame, 0, sizeof(Frame));
+    memset(&ClockStats, 0, sizeof(ClockStats));
+    ClockStats.governor   = true;
+    ClockStats.multiplier = CLOCK_GOVERNOR_DEFAULT_MULT;
 }
 
 void VS1053b::SystemInit()
 {
+    // SDI data is sent through DMA, the task blocks until each burst is written
+    DmaDoneSem = xSemaphoreCreateBinary();
+    ssp0_dma_init(DmaDoneCallback);
+
+    // Only ports 0 and 2 can interrupt, anything else keeps polling DREQ
+    switch (DreqPort)
+    {
+        case GPIO_PORT0: eint3_enable_port0(DreqPin, eint_rising_edge, DreqRisingEdge); DreqInterrupt = true; break;
+        case GPIO_PORT2: eint3_enable_port2(DreqPin, eint_rising_edge, DreqRisingEdge); DreqInterrupt = true; break;
+        default:         printf("[VS1053b::SystemInit] DREQ cannot interrupt on port %d, polling instead.\n", DreqPort); break;
+    }
+
     // Hardware reset
     printf("[VS1053b::SystemInit] Resetting device...\n");
     SetReset(false);
     SetReset(true);
     if (!WaitForDREQ(100000)) printf("[VS1053b::SystemInit] Failed to hardware reset timeout of 100000us.\n");
 
+    // Only time every register is read, from here on RegisterMap is what the device has
+    if (!UpdateRegisterMap()) printf("[VS1053b::SystemInit] Failed to read register map.\n");
+    DirtyRegisters = 0;
+
     // Software reset
     if (!SoftwareReset())     printf("[VS1053b::SystemInit] Software reset failed...\n");
     else                      printf("[VS1053b::SystemInit] Device reset.\n");
@@ -64,21 +148,16 @@ void VS1053b::SystemInit()
     printf("[VS1053b::SystemInit] Updating device registers with default settings.\n");
 
     const uint16_t mode_default_state   = 0x4800;
-    const uint16_t clock_default_state  = 0x6000;
+    const uint16_t clock_default_state  = CLOCK_GOVERNOR_DEFAULT_MULT << 13;
     const uint16_t volume_default_state = 0x2020;
 
-    RegisterMap[MODE].reg_value   = mode_default_state;
-    RegisterMap[CLOCKF].reg_value = clock_default_state;
-    RegisterMap[VOL].reg_value    = volume_default_state;
-
-    UpdateRemoteRegister(MODE);
-    UpdateRemoteRegister(CLOCKF);
-    UpdateRemoteRegister(VOL);
+    WriteRegister(MODE,   mode_default_state);
+    WriteRegister(CLOCKF, clock_default_state);
+    WriteRegister(VOL,    volume_default_state);
 
-    // Update local register values
-    if (!UpdateRegisterMap())
+    if (!FlushRegisters())
     {
-        printf("[VS1053b::SystemInit] Failed to update register map.\n");
+        printf("[VS1053b::SystemInit] Failed to write default settings.\n");
     }
 
     printf("[VS1053b::SystemInit] System initialization complete.\n");
@@ -86,56 +165,87 @@ void VS1053b::SystemInit()
 
 vs1053b_transfer_status_E VS1053b::TransferData(uint8_t *data, uint32_t size)
 {
-    // Wait until DREQ goes high
-    if (!WaitForDREQ(100000))
-    {
-        printf("[VS1053b::TransferData] Failed to transfer data timeout of 100000us.\n");
-        return TRANSFER_FAILED;
-    }
-
     if (size < 1)
     {
         return TRANSFER_FAILED;
     }
     else
     {
-        uint32_t cycles    = size / 32;
-        uint16_t remainder = size % 32;
-
         if (!SetXDCS(false))
         {
             printf("TRANSFERDATA: Failed to set XDCS low!\n");
             return TRANSFER_FAILED;
         }
 
-        for (uint32_t i=0; i<cycles; i++)
+        uint32_t burst = 0;
+        for (uint32_t sent=0; sent<size; sent+=burst)
         {
-            for (int byte=0; byte<32; byte++)
+            // A stop or skip is waiting, the rest of the segment would only hold it up, but the end fill of the
+            // cancel itself has to go out
+            if (!Status.waiting_for_cancel)
             {
-                ssp0_exchange_byte(data[i * 32 + byte]);
+                if (BurstHook)
+                {
+                    BurstHook();
+                }
+                if (CancelRequested && !CancelAborted)
+                {
+                    CancelAborted = true;
+                    SetXDCS(true);
+                    return TRANSFER_CANCELLED;
+                }
             }
-            
+
+            // Registers changed while playing go out together, between two bursts
+            if (DirtyRegisters)
+            {
+                SetXDCS(true);
+                const bool flushed = FlushRegisters();
+                SetXDCS(false);
+                if (!flushed)
+                {
+                    printf("[VS1053b::TransferData] Failed to write registers between bursts.\n");
+                }
+            }
+
             // Wait until DREQ goes high
+            const uint64_t wait_us = sys_get_uptime_us();
             if (!WaitForDREQ(100000))
             {
-                printf("[VS1053b::TransferData] Failed to transfer data timeout of 100000.\n");
+                printf("[VS1053b::TransferData] Failed to transfer data timeout of 100000us.\n");
+                SetXDCS(true);
                 return TRANSFER_FAILED;
             }
-        }
 
-        if (remainder > 0)
-        {
-            for (int byte=0; byte<remainder; byte++)
+            const uint64_t burst_us = sys_get_uptime_us();
+            TransferStats.dreq_wait_us += (uint32_t)(burst_us - wait_us);
+            if (Status.playing && LastBurstUs > 0)
             {
-                ssp0_exchange_byte(data[cycles * 32 + byte]);
+                TransferStats.max_burst_gap_us = MAX(TransferStats.max_burst_gap_us, (uint32_t)(burst_us - LastBurstUs));
             }
-            
-            // Wait until DREQ goes high
-            if (!WaitForDREQ(100000))
+
+            // Fill level is read over SCI, which needs XDCS high
+            if (StreamMode)
             {
-                printf("[VS1053b::TransferData] Failed to transfer data timeout of 100000.\n");
+                SetXDCS(true);
+                burst = GetBurstLimit(size - sent);
+                SetXDCS(false);
+            }
+            else
+            {
+                burst = MIN(BurstSize, size - sent);
+            }
+
+            if (!TransferBurst(data + sent, burst))
+            {
+                printf("[VS1053b::TransferData] Failed to transfer burst of %lu bytes.\n", burst);
+                SetXDCS(true);
                 return TRANSFER_FAILED;
             }
+
+            LastBurstUs = sys_get_uptime_us();
+            TransferStats.bytes += burst;
+            ++TransferStats.bursts;
         }
 
         if (!SetXDCS(true))
@@ -144,24 +254,14 @@ vs1053b_transfer_status_E VS1053b::TransferData(uint8_t *data, uint32_t size)
             return TRANSFER_FAILED;
         }
 
-        // Check for pending cancellation request
-        if (Status.waiting_for_cancel)
-        {
-            // Check cancel bit
-            UpdateLocalRegister(MODE);
-            // Cancel succeeded, exit, and return status to bubble up to parent function
-            if (RegisterMap[MODE].reg_value & (1 << 3))
-            {
-                return TRANSFER_CANCELLED;
-            }
-        }
-
         return TRANSFER_SUCCESS;
     }
 }
 
 void VS1053b::HardwareReset()
 {
+    ++ResetCount;
+
     // Pull reset line low
     SetReset(false);
 
@@ -176,17 +276,33 @@ void VS1053b::HardwareReset()
     {
         BlockMicroSeconds(3);
     }
+
+    // Device is back at 1.0x until CLOCKF is restored, which the SPI clock has to be slow enough for, see UpdateSpiClock
+    ssp0_set_max_clock(clock_governor_spi_max_hz(0) / (1000 * 1000) - 1);
+
+    // Device is back at its reset values, restore the settings it had
+    for (int reg=MODE; reg<SCI_reg_last_invalid; reg++)
+    {
+        if (RegisterMap[reg].can_write && !RegisterMap[reg].is_volatile)
+        {
+            DirtyRegisters |= (1 << reg);
+        }
+    }
+    FlushRegisters();
 }
 
 bool VS1053b::SoftwareReset()
 {
     const uint16_t RESET_BIT = (1 << 2);
+    ++ResetCount;
 
-    UpdateLocalRegister(MODE);
-
-    // Set reset bit
+    // Set reset bit, along with anything else that is pending
     RegisterMap[MODE].reg_value |= RESET_BIT;
-    UpdateRemoteRegister(MODE);
+    DirtyRegisters |= (1 << MODE);
+    FlushRegisters();
+
+    // Device clears the bit, so RegisterMap must not send it again
+    RegisterMap[MODE].reg_value &= ~RESET_BIT;
 
     // Wait until DREQ goes high
     if (!WaitForDREQ(100000))
@@ -201,6 +317,8 @@ bool VS1053b::SoftwareReset()
 
 void VS1053b::PrintDebugInformation()
 {
+    // Pending writes first, or reading the registers back would lose them
+    FlushRegisters();
     if (!UpdateRegisterMap())
     {
         printf("[VS1053b::PrintDebugInformation] Failed to update register map.\n");
@@ -245,123 +363,292 @@ void VS1053b::PrintDebugInformation()
 //                                           API FUNCTIONS                                        //
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void VS1053b::CancelDecoding()
+bool VS1053b::CancelDecoding()
 {
-    const uint8_t CANCEL_BIT = (1 << 3);
+    const uint8_t  CANCEL_BIT     = 3;
+    const uint16_t max_fill_bytes = 2048;
+    const uint32_t max_cancel_us  = 1000 * 1000;
+
+    MicroSecondStopWatch swatch;
+    Status.waiting_for_cancel = true;
+
+    // Latency counts from the stop or skip being asked for, which can be a segment before getting here
+    uint64_t request_us = sys_get_uptime_us();
+    taskENTER_CRITICAL();
+    {
+        if (CancelRequested)
+        {
+            request_us = CancelRequestUs;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    // Sent right away, playback is not going to send another burst
+    ChangeSCIRegister(MODE, CANCEL_BIT, true);
+    FlushRegisters();
+
+    uint8_t efb_array[32] = { 0 };
+    memset(efb_array, GetEndFillByte(), sizeof(efb_array));
+
+    // Decoder only stops at the end of a frame, so it has to be fed until it gets there, checking after every 32 bytes
+    bool cancelled = false;
+    for (uint16_t sent=0; sent<=max_fill_bytes && swatch.getElapsedTime() < max_cancel_us; sent+=sizeof(efb_array))
+    {
+        if (!UpdateLocalRegister(MODE))
+        {
+            break;
+        }
+        if (!(RegisterMap[MODE].reg_value & (1 << CANCEL_BIT)))
+        {
+            cancelled = true;
+            break;
+        }
+        if (sent < max_fill_bytes && TRANSFER_SUCCESS != TransferData(efb_array, sizeof(efb_array)))
+        {
+            break;
+        }
+    }
+
+    // Device clears the bit, so RegisterMap must not send it again
+    RegisterMap[MODE].reg_value &= ~(1 << CANCEL_BIT);
 
-    UpdateLocalRegister(MODE);
-    RegisterMap[MODE].reg_value |= CANCEL_BIT;
-    UpdateRemoteRegister(MODE);
+    if (cancelled)
+    {
+        RecordCancel((uint32_t)(sys_get_uptime_us() - request_us), false);
 
-    // Set flag to request cancellation
-    // Status.waiting_for_cancel = true;
+        // Stream ended, FLAC needs a lot more end fill than the rest
+        SendEndFillByte(codec_get_info(StreamCodec)->end_fill_size);
+    }
+    else
+    {
+        printf("[VS1053b::CancelDecoding] SM_CANCEL was not cleared, resetting...\n");
+        SoftwareReset();
+        RecordCancel((uint32_t)(sys_get_uptime_us() - request_us), true);
+    }
+
+    // Request is done with, the next one is timed from scratch
+    CancelRequested = false;
+    CancelAborted   = false;
+
+    Status.waiting_for_cancel = false;
     Status.playing = false;
+    SegmentCounter = 0;
+    LastBurstUs    = 0;
 
-    printf("[VS1053b::CancelDecoding] Waiting for cancel...\n");
+    printf("[VS1053b::CancelDecoding] Silent after %lu us.\n", CancelStats.last_us);
+    return cancelled;
 }
 
-void VS1053b::SetEarSpeakerMode(ear_speaker_mode_t mode)
+void VS1053b::RequestCancel()
+{
+    taskENTER_CRITICAL();
+    {
+        if (Status.playing && !CancelRequested)
+        {
+            CancelRequestUs = sys_get_uptime_us();
+            CancelRequested = true;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+void VS1053b::SetBurstHook(void (*hook)(void))
 {
-    UpdateLocalRegister(MODE);
+    BurstHook = hook;
+}
 
-    const uint16_t low_bit  = (1 << 4);
-    const uint16_t high_bit = (1 << 7);
+void VS1053b::SetEarSpeakerMode(ear_speaker_mode_t mode)
+{
+    const uint8_t low_bit  = 4;
+    const uint8_t high_bit = 7;
 
     switch (mode)
     {
         case EAR_SPEAKER_OFF:
-            RegisterMap[MODE].reg_value &= ~low_bit;
-            RegisterMap[MODE].reg_value &= ~high_bit;
+            ChangeSCIRegister(MODE, low_bit,  false);
+            ChangeSCIRegister(MODE, high_bit, false);
             break;
         case EAR_SPEAKER_MINIMAL:
-            RegisterMap[MODE].reg_value |=  low_bit;
-            RegisterMap[MODE].reg_value &= ~high_bit;
+            ChangeSCIRegister(MODE, low_bit,  true);
+            ChangeSCIRegister(MODE, high_bit, false);
             break;
         case EAR_SPEAKER_NORMAL:
-            RegisterMap[MODE].reg_value &= ~low_bit;
-            RegisterMap[MODE].reg_value |=  high_bit;
+            ChangeSCIRegister(MODE, low_bit,  false);
+            ChangeSCIRegister(MODE, high_bit, true);
             break;
         case EAR_SPEAKER_EXTREME:
-            RegisterMap[MODE].reg_value |=  low_bit;
-            RegisterMap[MODE].reg_value |=  high_bit;
+            ChangeSCIRegister(MODE, low_bit,  true);
+            ChangeSCIRegister(MODE, high_bit, true);
             break;
     }
 
-    UpdateRemoteRegister(MODE);
+    CommitRegisters();
 }
 
 void VS1053b::SetStreamMode(bool on)
 {
-    UpdateLocalRegister(MODE);
+    const uint8_t stream_bit = 6;
 
-    const uint16_t stream_bit = (1 << 6);
+    ChangeSCIRegister(MODE, stream_bit, on);
+    StreamMode = on;
 
-    if (on)
+    CommitRegisters();
+}
+
+bool VS1053b::IsStreamModeEnabled()
+{
+    return StreamMode;
+}
+
+bool VS1053b::GetStreamFillLevel(uint16_t *fill)
+{
+    // Read pointer is the word after the write pointer, WRAMADDR moves on to it by itself
+    const uint16_t write_pointer = ReadRam(VS1053B_STREAM_WRITE_POINTER);
+    UpdateLocalRegister(WRAM);
+    const uint16_t read_pointer  = RegisterMap[WRAM].reg_value;
+
+    // Both pointers have to be in the buffer, which is wherever the first pair that agreed was
+    const uint16_t words = VS1053B_STREAM_BUFFER_SIZE / 2;
+    const uint16_t start = write_pointer & ~(words - 1);
+    if (start != (read_pointer & ~(words - 1)) || (StreamBufferKnown && start != StreamBufferStart))
     {
-        RegisterMap[MODE].reg_value |= stream_bit;
+        return false;
     }
-    else
+    StreamBufferStart = start;
+    StreamBufferKnown = true;
+
+    // Pointers wrap around the buffer, in words, DREQ being high means there are at least 32 bytes free
+    *fill = ((write_pointer - read_pointer) & (words - 1)) * 2;
+    return (*fill <= VS1053B_STREAM_BUFFER_SIZE - 32);
+}
+
+void VS1053b::SetClockGovernor(bool on)
+{
+    ClockStats.governor = on;
+    LastGovernUs        = 0;
+    if (!on)
     {
-        RegisterMap[MODE].reg_value &= ~stream_bit;
+        SetClockMultiplier(CLOCK_GOVERNOR_DEFAULT_MULT);
     }
+}
 
-    UpdateRemoteRegister(MODE);
+void VS1053b::SetClockMultiplier(uint8_t multiplier)
+{
+    // SC_MULT is [15:13], SC_ADD and SC_FREQ are left alone
+    multiplier &= 0x7;
+    if (multiplier != (RegisterMap[CLOCKF].reg_value >> 13))
+    {
+        WriteRegister(CLOCKF, (RegisterMap[CLOCKF].reg_value & 0x1FFF) | (multiplier << 13));
+        ++ClockStats.changes;
+        CommitRegisters();
+    }
 }
 
-void VS1053b::SetClockDivider(bool on)
+vs1053b_clock_stats_S VS1053b::GetClockStats()
+{
+    vs1053b_clock_stats_S stats = ClockStats;
+    stats.multiplier = RegisterMap[CLOCKF].reg_value >> 13;
+    stats.clki_hz    = clock_governor_clki_hz(stats.multiplier);
+    return stats;
+}
+
+void VS1053b::SetStreamCodec(codec_E codec)
 {
-    UpdateLocalRegister(MODE);
+    StreamCodec = codec;
+}
 
-    const uint16_t clock_range_bit = (1 << 15);
+void VS1053b::GovernClock()
+{
+    // Low power mode has the clock at 1.0x on purpose
+    if (!ClockStats.governor || Status.low_power_mode)
+    {
+        return;
+    }
 
-    if (on)
+    // Windows of a rewind or fast forward start decoding over and over, and arrive faster than they play
+    const uint32_t speed = (Status.fast_forward_mode || Status.rewind_mode) ? (2) : (1);
+    const uint64_t now   = sys_get_uptime_us();
+    if (speed == GovernSpeed && LastGovernUs > 0 && now - LastGovernUs < VS1053B_GOVERNOR_PERIOD_US)
     {
-        RegisterMap[MODE].reg_value |= clock_range_bit;
+        return;
+    }
+    GovernSpeed  = speed;
+    LastGovernUs = now;
+
+    // HDAT0 and HDAT1 only hold a frame header for MPEG audio, other codecs get the clock VLSI asks for
+    UpdateHeaderInformation();
+    if (Header.stream_valid)
+    {
+        SetClockMultiplier(clock_governor_choose(&Frame, speed));
     }
     else
     {
-        RegisterMap[MODE].reg_value &= ~clock_range_bit;
+        SetClockMultiplier(codec_get_info(StreamCodec)->multiplier);
     }
+}
 
-    UpdateRemoteRegister(MODE);
+void VS1053b::UpdateSpiClock()
+{
+    // Whole MHz only, rounded down, and never over what SSP0 is allowed to run at on the board
+    const uint32_t mhz = clock_governor_spi_max_hz(RegisterMap[CLOCKF].reg_value >> 13) / (1000 * 1000);
+    ClockStats.spi_hz  = MIN(MAX(mhz, 1), SYS_CFG_SPI0_CLK_MHZ) * 1000 * 1000;
+
+    // The divider is chosen by comparing against the CPU clock over it rounded down to a MHz, which can be
+    // up to a MHz over what was asked for, so ask for one less
+    ssp0_set_max_clock(ClockStats.spi_hz / (1000 * 1000) - 1);
 }
 
-void VS1053b::SetBaseEnhancement(uint8_t amplitude, uint8_t freq_limit)
+void VS1053b::SetClockDivider(bool on)
 {
-    UpdateLocalRegister(STATUS);
+    const uint8_t clock_range_bit = 15;
+
+    ChangeSCIRegister(MODE, clock_range_bit, on);
 
+    CommitRegisters();
+}
+
+void VS1053b::SetBaseEnhancement(uint8_t amplitude, uint8_t freq_limit)
+{
     // Clamp to max
     if (amplitude > 0xF)  amplitude  = 0xF;
     if (freq_limit > 0xF) freq_limit = 0xF;
     
     const uint8_t bass_value = (amplitude << 4) | freq_limit;
     
-    RegisterMap[STATUS].reg_value |= (bass_value << 0);
+    // Bass is the lower byte of BASS, keep the treble
+    WriteRegister(BASS, (RegisterMap[BASS].reg_value & 0xFF00) | (bass_value << 0));
 
-    UpdateRemoteRegister(STATUS);
+    CommitRegisters();
 }
 
 void VS1053b::SetTrebleControl(uint8_t amplitude, uint8_t freq_limit)
 {
-    UpdateLocalRegister(STATUS);
-
     // Clamp to max
     if (amplitude > 0xF)  amplitude  = 0xF;
     if (freq_limit > 0xF) freq_limit = 0xF;
     
     const uint8_t treble_value = (amplitude << 4) | freq_limit;
     
-    RegisterMap[STATUS].reg_value |= (treble_value << 8);
+    // Treble is the upper byte of BASS, keep the bass
+    WriteRegister(BASS, (RegisterMap[BASS].reg_value & 0x00FF) | (treble_value << 8));
 
-    UpdateRemoteRegister(STATUS);
+    CommitRegisters();
+}
+
+void VS1053b::SetSampleRate(uint16_t sample_rate)
+{
+    // Bit 0 is the stereo bit, sample rates are even
+    WriteRegister(AUDATA, (sample_rate & ~1) | (RegisterMap[AUDATA].reg_value & 1));
+
+    CommitRegisters();
 }
 
 void VS1053b::SetVolume(uint8_t left_vol, uint8_t right_vol)
 {
     uint16_t volume = (left_vol << 8) | right_vol;
-    RegisterMap[VOL].reg_value = volume;
+    WriteRegister(VOL, volume);
 
-    UpdateRemoteRegister(VOL);
+    CommitRegisters();
 }
 
 void VS1053b::IncrementVolume(void)
@@ -372,9 +659,9 @@ void VS1053b::IncrementVolume(void)
     uint8_t right_vol = RegisterMap[VOL].reg_value & 0x00FF;
     left_vol  = (left_vol  + increment_step > 0xFF) ? (0xFF) : (left_vol  + increment_step);
     right_vol = (right_vol + increment_step > 0xFF) ? (0xFF) : (right_vol + increment_step);
-    RegisterMap[VOL].reg_value = (left_vol << 8) | (right_vol & 0xFF);
+    WriteRegister(VOL, (left_vol << 8) | (right_vol & 0xFF));
 
-    UpdateRemoteRegister(VOL);
+    CommitRegisters();
 
     printf("Volume: %04X\n", RegisterMap[VOL].reg_value);
 }
@@ -387,33 +674,33 @@ void VS1053b::DecrementVolume(void)
     uint8_t right_vol = RegisterMap[VOL].reg_value & 0x00FF;
     left_vol  = (left_vol  - increment_step < 0) ? (0) : (left_vol  - increment_step);
     right_vol = (right_vol - increment_step < 0) ? (0) : (right_vol - increment_step);
-    RegisterMap[VOL].reg_value = (left_vol << 8) | (right_vol & 0xFF);
+    WriteRegister(VOL, (left_vol << 8) | (right_vol & 0xFF));
 
-    UpdateRemoteRegister(VOL);
+    CommitRegisters();
 
     printf("Volume: %04X\n", RegisterMap[VOL].reg_value);
 }
 
 void VS1053b::SetLowPowerMode(bool on)
 {
+    // Registers are only changed in RegisterMap here, and all go out together at the end
     if (on)
     {
         // If not already in low power mode
         if (!Status.low_power_mode)
         {
             // Set clock speed to 1.0x, disabling PLL
-            RegisterMap[CLOCKF].reg_value = 0x0000;
-            UpdateRemoteRegister(CLOCKF);
+            WriteRegister(CLOCKF, 0x0000);
 
             // Reduce sample rate
-            RegisterMap[AUDATA].reg_value = 0x0010;
-            UpdateRemoteRegister(AUDATA);
+            WriteRegister(AUDATA, 0x0010);
 
             // Turn off ear speaker mode
-            SetEarSpeakerMode(EAR_SPEAKER_OFF);
+            ChangeSCIRegister(MODE, 4, false);
+            ChangeSCIRegister(MODE, 7, false);
 
             // Turn off analog drivers
-            SetVolume(0xFF, 0xFF);
+            WriteRegister(VOL, 0xFFFF);
         }
     }
     else
@@ -422,28 +709,38 @@ void VS1053b::SetLowPowerMode(bool on)
         if (Status.low_power_mode)
         {
             // Turn off analog drivers
-            SetVolume(0xFF, 0xFF);
+            WriteRegister(VOL, 0xFFFF);
 
             // Turn off ear speaker mode
-            SetEarSpeakerMode(EAR_SPEAKER_OFF);
+            ChangeSCIRegister(MODE, 4, false);
+            ChangeSCIRegister(MODE, 7, false);
 
             // Reduce sample rate
-            RegisterMap[AUDATA].reg_value = 0x0010;
-            UpdateRemoteRegister(AUDATA);
+            WriteRegister(AUDATA, 0x0010);
 
             // Set clock speed to 1.0x, disabling PLL
-            RegisterMap[CLOCKF].reg_value = 0x0000;
-            UpdateRemoteRegister(CLOCKF);
+            WriteRegister(CLOCKF, 0x0000);
         }
     }
 
+    CommitRegisters();
+
     Status.low_power_mode = on;
 }
 
 vs1053b_transfer_status_E VS1053b::PlaySegment(uint8_t *mp3, uint32_t size, bool last_segment)
 {
-    static uint32_t segment_counter = 0;
-    const  uint8_t dummy_short[] = { 0x00, 0x00 };
+    StartSegment();
+
+    // Send mp3 file, the last segment can be empty if the file size is a multiple of the segment size
+    vs1053b_transfer_status_E status = (size > 0) ? (TransferData(mp3, size)) : (TRANSFER_SUCCESS);
+
+    return FinishSegment(status, last_segment);
+}
+
+void VS1053b::StartSegment()
+{
+    const uint8_t dummy_short[] = { 0x00, 0x00 };
 
     // If first segment, set up for playback
     if (!Status.playing)
@@ -451,7 +748,12 @@ vs1053b_transfer_status_E VS1053b::PlaySegment(uint8_t *mp3, uint32_t size, bool
         printf("[VS1053b::PlaySegment] Playback starting...\n");
 
         // Reset counter
-        segment_counter = 0;
+        SegmentCounter = 0;
+
+        // New stream, the device works out its byte rate again, and the clock is chosen for it again
+        StreamByteRate  = 0;
+        StreamLowMarkUs = 0;
+        LastGovernUs    = 0;
 
         // Clear decode time
         ClearDecodeTime();
@@ -461,43 +763,53 @@ vs1053b_transfer_status_E VS1053b::PlaySegment(uint8_t *mp3, uint32_t size, bool
 
         Status.playing = true;
     }
+    // Device had room for more before this segment arrived
+    else if (DeviceReady())
+    {
+        ++TransferStats.starvations;
+    }
+
+    GovernClock();
+}
 
-    // Send mp3 file
-    vs1053b_transfer_status_E status = TransferData(mp3, size);
+vs1053b_transfer_status_E VS1053b::FinishSegment(vs1053b_transfer_status_E status, bool last_segment)
+{
     switch (status)
     {
         case TRANSFER_SUCCESS:
             break;
         case TRANSFER_FAILED:
-            printf("[VS1053b::PlaySegment] Transfer failed on %lu segment!\n", segment_counter);
+            printf("[VS1053b::PlaySegment] Transfer failed on %lu segment!\n", SegmentCounter);
             break;
         case TRANSFER_CANCELLED:
-            printf("[VS1053b::PlaySegment] Transfer cancelled on %lu segment!\n", segment_counter);
+            printf("[VS1053b::PlaySegment] Transfer cancelled on %lu segment!\n", SegmentCounter);
             break;
     }
 
-    // Clean up if last segment
-    if (last_segment || TRANSFER_CANCELLED == status)
+    // Segment was cut short for a stop or skip, which goes through CancelDecoding and does the clean up there
+    if (TRANSFER_CANCELLED == status)
     {
-        // To signal the end of the mp3 file need to set 2052 bytes of EndFillByte
-        SendEndFillByte(2052);
+        return status;
+    }
 
-        // Wait 50 ms buffer time between playbacks
-        vTaskDelay(50 / portTICK_PERIOD_MS);
+    // Clean up if last segment
+    if (last_segment)
+    {
+        // To signal the end of the file need to send 2052 bytes of EndFillByte, more for FLAC
+        SendEndFillByte(codec_get_info(StreamCodec)->end_fill_size);
 
-        // Update status flags
+        // Update status flags, the pause until the next track is not a gap between bursts
         Status.playing = false;
+        LastBurstUs    = 0;
+        SegmentCounter = 0;
 
-        if (TRANSFER_CANCELLED == status)
-        {
-            Status.waiting_for_cancel = false;
-        }
-
-        segment_counter = 0;
+        // Stream is over, a request that came too late for it does not carry over to the next one
+        CancelRequested = false;
+        CancelAborted   = false;
     }
     else
     {
-        ++segment_counter;
+        ++SegmentCounter;
     }
 
     return status;
@@ -527,9 +839,10 @@ void VS1053b::SetFastForwardMode(bool on)
     }
 }
 
-void SetRewindMode(bool on)
+void VS1053b::SetRewindMode(bool on)
 {
-    // Not implemented yet
+    // The DecoderTask rewinds by playing frame aligned windows further and further back, the device only plays them
+    Status.rewind_mode = on;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -543,7 +856,7 @@ bool VS1053b::GetFastForwardMode()
 
 uint16_t VS1053b::GetSampleRate()
 {
-    UpdateLocalRegister(AUDATA);
+    ReadRegister(AUDATA);
 
     // If bit 0 is a 1, then the sample rate is -1, else sample rate is the same
     return (RegisterMap[AUDATA].reg_value & 1) ? (RegisterMap[AUDATA].reg_value - 1) : (RegisterMap[AUDATA].reg_value);
@@ -556,15 +869,13 @@ vs1053b_status_S* VS1053b::GetStatus()
 
 uint16_t VS1053b::GetCurrentDecodedTime()
 {
-    UpdateLocalRegister(DECODE_TIME);
-
-    return RegisterMap[DECODE_TIME].reg_value;
+    return ReadRegister(DECODE_TIME);
 }
 
 void VS1053b::UpdateHeaderInformation()
 {
-    UpdateLocalRegister(HDAT0);
-    UpdateLocalRegister(HDAT1);
+    ReadRegister(HDAT0);
+    ReadRegister(HDAT1);
 
     // Clear header
     memset(&Header, 0, sizeof(Header));
@@ -573,78 +884,25 @@ void VS1053b::UpdateHeaderInformation()
     Header.reg1.value = RegisterMap[HDAT1].reg_value;
     Header.reg0.value = RegisterMap[HDAT0].reg_value;
 
-    // HDAT1
-    Header.stream_valid = (Header.reg1.bits.sync_word) == 2047;
-    Header.id           = Header.reg1.bits.id;
-    Header.layer        = Header.reg1.bits.layer;
-    Header.protect_bit  = Header.reg1.bits.protect_bit;
-
-    // HDAT0
-    Header.pad_bit      = Header.reg0.bits.pad_bit;
-    Header.mode         = Header.reg0.bits.mode;
-
-    // Lookup sample rate
-    switch (Header.reg0.bits.sample_rate)
+    // HDAT1 and HDAT0 are the 4 bytes of the last frame header, decoded the same way the frames of a file are
+    const uint8_t bytes[MP3_FRAME_HEADER_SIZE] =
     {
-        case 3:
-            // No sample rate
-            break;
-        case 2:
-            switch (Header.layer)
-            {
-                case 3:  Header.sample_rate = 32000; break;
-                case 2:  Header.sample_rate = 16000; break;
-                default: Header.sample_rate =  8000; break;
-            }
-        case 1:
-            switch (Header.layer)
-            {
-                case 3:  Header.sample_rate = 48000; break;
-                case 2:  Header.sample_rate = 24000; break;
-                default: Header.sample_rate = 12000; break;
-            }
-        case 0:
-            switch (Header.layer)
-            {
-                case 3:  Header.sample_rate = 44100; break;
-                case 2:  Header.sample_rate = 22050; break;
-                default: Header.sample_rate = 11025; break;
-            }
-    }
-
-    // Calculate bit rate
-    uint16_t increment_value = 0;
-    uint16_t start_value     = 0;
-    switch (Header.layer)
+        (uint8_t)(Header.reg1.value >> 8), (uint8_t)(Header.reg1.value & 0xFF),
+        (uint8_t)(Header.reg0.value >> 8), (uint8_t)(Header.reg0.value & 0xFF),
+    };
+    Header.stream_valid = mp3_frame_parse_header(bytes, &Frame);
+    if (!Header.stream_valid)
     {
-        case 1: 
-            switch (Header.id)
-            {
-                case 3:  increment_value = 32; start_value = 32; break;
-                default: increment_value = 8;  start_value = 32; break;
-            }
-            break;
-        case 2: 
-            switch (Header.id)
-            {
-                case 3:  increment_value = 16; start_value = 32; break;
-                default: increment_value = 8;  start_value = 8;  break;
-            }
-            break;
-        case 3: 
-            switch (Header.id)
-            {
-                case 3:  increment_value = 8; start_value = 32; break;
-                default: increment_value = 8; start_value = 8;  break;
-            }
-            break;
+        return;
     }
 
-    const uint16_t bits_in_kilobit = (1 << 10);
-    if (Header.reg0.bits.bit_rate != 0 && Header.reg0.bits.bit_rate != 0xF)
-    {
-        Header.bit_rate = (start_value + (increment_value * (Header.reg0.bits.bit_rate-1))) * bits_in_kilobit;
-    }
+    Header.id           = Frame.version;
+    Header.layer        = Frame.layer;
+    Header.protect_bit  = !Frame.crc;
+    Header.bit_rate     = Frame.bit_rate;
+    Header.sample_rate  = Frame.sample_rate;
+    Header.pad_bit      = Frame.padding;
+    Header.mode         = Frame.channel_mode;
 }
 
 vs1053b_mp3_header_S* VS1053b::GetHeaderInformation()
@@ -770,10 +1028,12 @@ inline bool VS1053b::UpdateLocalRegister(SCI_reg reg)
         // data |= SPI.ReceiveByte();
         ssp0_exchange_byte(OPCODE_READ);
         ssp0_exchange_byte(reg);
-        data |= ssp0_exchange_byte(0x00) << 8;
-        data |= ssp0_exchange_byte(0x00);
+        // char is signed on some targets, only the 8 bits shifted in count
+        data |= (uint8_t)ssp0_exchange_byte(0x00) << 8;
+        data |= (uint8_t)ssp0_exchange_byte(0x00);
         RegisterMap[reg].reg_value = data;
         SetXCS(true);
+        ++SciTransactions;
         return true;
     }
 
@@ -795,11 +1055,39 @@ inline void VS1053b::ChangeSCIRegister(SCI_reg reg, uint8_t bit, bool bit_value)
 {
     if (bit_value)
     {
-        RegisterMap[reg].reg_value |= (1 << bit);
+        WriteRegister(reg, RegisterMap[reg].reg_value | (1 << bit));
     }
     else
     {
-        RegisterMap[reg].reg_value &= ~(1 << bit);
+        WriteRegister(reg, RegisterMap[reg].reg_value & ~(1 << bit));
+    }
+}
+
+inline void VS1053b::WriteRegister(SCI_reg reg, uint16_t value)
+{
+    // Volatile registers may not hold what the device has, so they are always written
+    if (RegisterMap[reg].can_write && (RegisterMap[reg].is_volatile || RegisterMap[reg].reg_value != value))
+    {
+        RegisterMap[reg].reg_value = value;
+        DirtyRegisters |= (1 << reg);
+    }
+}
+
+inline uint16_t VS1053b::ReadRegister(SCI_reg reg)
+{
+    if (RegisterMap[reg].is_volatile)
+    {
+        UpdateLocalRegister(reg);
+    }
+    return RegisterMap[reg].reg_value;
+}
+
+inline void VS1053b::CommitRegisters()
+{
+    // Between segments while playing, wait for the next burst so changes made together go out together
+    if (!Status.playing)
+    {
+        FlushRegisters();
     }
 }
 
@@ -809,17 +1097,48 @@ inline void VS1053b::ChangeSCIRegister(SCI_reg reg, uint8_t bit, bool bit_value)
 
 bool VS1053b::WaitForDREQ(uint32_t timeout_us)
 {
-    // Wait until DREQ goes high
-    while (!DeviceReady())
+    if (DeviceReady())
+    {
+        return true;
+    }
+
+    // Nothing can wake the task up without the scheduler, or without the interrupt
+    if (!DreqInterrupt || taskSCHEDULER_RUNNING != xTaskGetSchedulerState())
     {
-        BlockMicroSeconds(100);
-        timeout_us -= 100;
-        if (timeout_us == 0)
+        // Wait until DREQ goes high
+        while (!DeviceReady())
         {
-            return false;
+            BlockMicroSeconds(100);
+            timeout_us = (timeout_us > 100) ? (timeout_us - 100) : (0);
+            if (timeout_us == 0)
+            {
+                return false;
+            }
         }
+        return true;
     }
-    return true;
+
+    // Register before checking the pin again, so an edge in between is not lost
+    DreqWaiter = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    // Sleep until DREQ goes high, rounding the timeout up to at least a tick
+    const TickType_t timeout_ticks = (timeout_us / 1000 / portTICK_PERIOD_MS) + 1;
+    const TickType_t start_tick    = xTaskGetTickCount();
+    bool ready = DeviceReady();
+    while (!ready)
+    {
+        const TickType_t elapsed = xTaskGetTickCount() - start_tick;
+        if (elapsed >= timeout_ticks)
+        {
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout_ticks - elapsed);
+        ready = DeviceReady();
+    }
+
+    DreqWaiter = NULL;
+    return ready;
 }
 
 uint16_t VS1053b::ReadRam(uint16_t address)
@@ -865,45 +1184,206 @@ uint16_t VS1053b::ReadRam(uint16_t address)
 
 bool VS1053b::WriteRam(uint16_t address, uint16_t value)
 {
+    return WriteRam(address, &value, 1);
+}
+
+bool VS1053b::WriteRam(uint16_t address, const uint16_t *values, uint16_t count)
+{
+    // Write address into WRAMADDR, then the words into WRAM in one go
+    RegisterMap[WRAMADDR].reg_value = address;
+    if (!UpdateRemoteRegister(WRAMADDR))
+    {
+        printf("[VS1053b::WriteRam] Failed to write RAM[%d], could not set WRAMADDR.\n", address);
+        return false;
+    }
+
+    return WriteRegisterWords(WRAM, values, count);
+}
+
+uint8_t VS1053b::GetEndFillByte()
+{
+    const uint16_t end_fill_byte_address = 0x1E06;
+    const uint16_t half_word = ReadRam(end_fill_byte_address);
+
+    // Ignore upper byte
+    return half_word & 0xFF;
+}
+
+bool VS1053b::TransferBurst(uint8_t *data, uint32_t size)
+{
+    // Interrupt cannot wake anyone up without the scheduler, send through the FIFO instead
+    if (taskSCHEDULER_RUNNING != xTaskGetSchedulerState())
+    {
+        for (uint32_t byte=0; byte<size; byte++)
+        {
+            ssp0_exchange_byte(data[byte]);
+        }
+        return true;
+    }
+
+    // Clear any stale give from a previously timed out burst
+    xSemaphoreTake(DmaDoneSem, 0);
+
+    if (0 != ssp0_dma_write_block(data, size))
+    {
+        return false;
+    }
+
+    // Even 2048 bytes at the slowest SPI clock finish well within this
+    const TickType_t timeout = 100 / portTICK_PERIOD_MS;
+    const bool completed = xSemaphoreTake(DmaDoneSem, timeout);
+
+    return (0 == ssp0_dma_finish_write()) && completed;
+}
+
+bool VS1053b::WriteRegisterWords(SCI_reg reg, const uint16_t *values, uint16_t count, bool repeat)
+{
+    if (!RegisterMap[reg].can_write)
+    {
+        return false;
+    }
+
     // Wait until DREQ goes high
     if (!WaitForDREQ(100000))
     {
-        printf("[VS1053b::ReadRam] Failed to read RAM[%d], timeout of 100000.\n", address);
+        printf("[VS1053b::WriteRegisterWords] Failed to write register: %d, DREQ timeout of 100000us.\n", reg);
         return false;
     }
 
-    XCS.SetLow();
+    // Select XCS
+    if (!SetXCS(false))
+    {
+        printf("[VS1053b::WriteRegisterWords] Failed to select XCS as XDCS is already active!\n");
+        return false;
+    }
 
-    // Write address into WRAMADDR
-    RegisterMap[WRAMADDR].reg_value = address;
-    UpdateRemoteRegister(WRAMADDR);
+    // Opcode and register once, then only the words
+    ssp0_exchange_byte(OPCODE_WRITE);
+    ssp0_exchange_byte(reg);
+
+    bool success = true;
+    for (uint16_t word=0; word<count; word++)
+    {
+        // DREQ drops for the hundred or so CLKI cycles each word takes to write, which is over sooner than a sleep
+        // on the interrupt would be, so it is polled for a while first
+        uint8_t polls = 0;
+        while (!DeviceReady() && polls < DREQ_POLLS_PER_WORD)
+        {
+            ++polls;
+        }
+        if (DREQ_POLLS_PER_WORD == polls && !WaitForDREQ(100000))
+        {
+            printf("[VS1053b::WriteRegisterWords] Failed to write register: %d, DREQ timeout of 100000us after %d words.\n", reg, word);
+            success = false;
+            break;
+        }
+
+        // High byte first
+        const uint16_t value = (repeat) ? (values[0]) : (values[word]);
+        ssp0_exchange_byte(value >> 8);
+        ssp0_exchange_byte(value & 0xFF);
+    }
+
+    // Deselect XCS
+    SetXCS(true);
+    ++SciTransactions;
 
     // Wait until DREQ goes high
-    if (!WaitForDREQ(100000))
+    if (success && !WaitForDREQ(100000))
     {
-        printf("[VS1053b::ReadRam] Failed to read RAM[%d], timeout of 100000.\n", address);
+        printf("[VS1053b::WriteRegisterWords] Failed to write register: %d, DREQ timeout of 100000us.\n", reg);
         return false;
     }
 
-    XCS.SetHigh();
-    XCS.SetLow();
+    return success;
+}
 
-    // Write data in WRAM
-    RegisterMap[WRAM].reg_value = value;
-    UpdateRemoteRegister(WRAM);
+void VS1053b::SetDreqInterrupt(bool on)
+{
+    // Interrupt was never attached if DREQ is not on port 0 or port 2
+    DreqInterrupt = on && (GPIO_PORT0 == DreqPort || GPIO_PORT2 == DreqPort);
+}
 
-    XCS.SetHigh();
+bool VS1053b::IsDreqInterruptEnabled()
+{
+    return DreqInterrupt;
+}
 
-    return true;
+uint32_t VS1053b::GetSciTransactionCount()
+{
+    return SciTransactions;
 }
 
-uint8_t VS1053b::GetEndFillByte()
+uint32_t VS1053b::GetResetCount()
 {
-    const uint16_t end_fill_byte_address = 0x1E06;
-    const uint16_t half_word = ReadRam(end_fill_byte_address);
+    return ResetCount;
+}
 
-    // Ignore upper byte
-    return half_word & 0xFF;
+vs1053b_cancel_stats_S VS1053b::GetCancelStats()
+{
+    return CancelStats;
+}
+
+void VS1053b::ResetCancelStats()
+{
+    memset(&CancelStats, 0, sizeof(CancelStats));
+}
+
+vs1053b_transfer_stats_S VS1053b::GetTransferStats()
+{
+    return TransferStats;
+}
+
+void VS1053b::ResetTransferStats()
+{
+    memset(&TransferStats, 0, sizeof(TransferStats));
+    LastBurstUs = 0;
+}
+
+uint32_t VS1053b::GetBurstLimit(uint32_t remaining)
+{
+    // Sleep through the time it takes to play down to the low mark, a short tail of a segment goes out right away
+    // into the room above the high mark instead of being split up
+    const bool tail = (remaining < VS1053B_STREAM_BURST);
+    const uint64_t now = sys_get_uptime_us();
+    if (!tail && StreamLowMarkUs > now)
+    {
+        vTaskDelay((StreamLowMarkUs - now) / 1000 / portTICK_PERIOD_MS);
+    }
+
+    // Pointers that were misread leave the burst to DREQ
+    uint16_t fill = 0;
+    ++TransferStats.fill_reads;
+    if (!GetStreamFillLevel(&fill))
+    {
+        ++TransferStats.fill_misreads;
+        StreamLowMarkUs = 0;
+        return MIN(BurstSize, remaining);
+    }
+
+    // Known once the device has decoded a few frames, until then the buffer is topped up as often as DREQ allows
+    if (0 == StreamByteRate)
+    {
+        StreamByteRate = ReadRam(VS1053B_PARAM_BYTE_RATE);
+    }
+
+    const uint32_t limit = (tail) ? (VS1053B_STREAM_BUFFER_SIZE - 32) : (VS1053B_STREAM_HIGH_MARK);
+    const uint32_t room  = (fill < limit - 32) ? ((limit - fill) & ~31) : (32);
+
+    // No more than a block the datasheet allows per DREQ check, a buffer far below the mark takes a few
+    const uint32_t burst = MIN(room, MIN((uint32_t)VS1053B_STREAM_BURST, remaining));
+
+    // Device plays the buffer down at the byte rate, the next burst is due once it is back at the low mark
+    const uint32_t after = fill + burst;
+    StreamLowMarkUs = (StreamByteRate > 0 && after > VS1053B_STREAM_LOW_MARK)
+                    ? (sys_get_uptime_us() + (uint64_t)(after - VS1053B_STREAM_LOW_MARK) * 1000 * 1000 / StreamByteRate)
+                    : (0);
+    return burst;
+}
+
+void VS1053b::SetBurstSize(uint16_t size)
+{
+    BurstSize = MAX(32, MIN(size, MAX_BURST_SIZE));
 }
 
 void VS1053b::BlockMicroSeconds(uint16_t microseconds)
@@ -917,8 +1397,7 @@ void VS1053b::BlockMicroSeconds(uint16_t microseconds)
 
 float VS1053b::ClockCyclesToMicroSeconds(uint16_t clock_cycles, bool is_clockf)
 {
-    UpdateLocalRegister(CLOCKF);
-
+    // RegisterMap has the CLOCKF the device runs at, no need to read it
     uint8_t multiplier  = RegisterMap[CLOCKF].reg_value >> 13;          // [15:13]
     uint8_t adder       = (RegisterMap[CLOCKF].reg_value >> 12) & 0x3;  // [12:11]
     uint16_t frequency  = RegisterMap[CLOCKF].reg_value & 0x07FF;       // [10:0]
@@ -965,6 +1444,7 @@ bool VS1053b::TransferSCICommand(SCI_reg reg)
     ssp0_exchange_byte(RegisterMap[reg].reg_value & 0xFF);
     // Deselect XCS
     SetXCS(true);
+    ++SciTransactions;
 
     // // CLOCKF is the only register where the calculation is based on XTALI not CLKI
     // const bool reg_is_clockf = (CLOCKF == reg);
@@ -983,19 +1463,64 @@ bool VS1053b::TransferSCICommand(SCI_reg reg)
     return true;
 }
 
+bool VS1053b::FlushRegisters()
+{
+    bool success = true;
+
+    // Lowest register first, TransferSCICommand waits for DREQ before and after each one
+    for (int reg=MODE; DirtyRegisters && reg<SCI_reg_last_invalid; reg++)
+    {
+        if (DirtyRegisters & (1 << reg))
+        {
+            DirtyRegisters &= ~(1 << reg);
+            success &= TransferSCICommand((SCI_reg)reg);
+
+            // TransferSCICommand waited out the clock change, the SPI clock can follow now
+            if (CLOCKF == reg)
+            {
+                UpdateSpiClock();
+            }
+        }
+    }
+
+    return success;
+}
+
 void VS1053b::SendEndFillByte(uint16_t size)
 {
     const uint8_t end_fill_byte = GetEndFillByte();
     // Uses an array of 32 bytes instead of the 2048+ bytes to conserve stack space
     uint8_t efb_array[32] = { 0 };
-    memset(efb_array, end_fill_byte, sizeof(uint8_t) * 32);
+    memset(efb_array, end_fill_byte, sizeof(efb_array));
 
-    for (int i=0; i<65; i++)
+    // Send exactly size bytes, 32 at a time
+    for (uint16_t sent=0; sent<size; sent+=sizeof(efb_array))
     {
-        TransferData(efb_array, size);
+        const uint16_t chunk = MIN(sizeof(efb_array), (uint32_t)(size - sent));
+        if (TRANSFER_SUCCESS != TransferData(efb_array, chunk))
+        {
+            printf("[VS1053b::SendEndFillByte] Failed after %u of %u end fill bytes.\n", sent, size);
+            return;
+        }
     }
 }
 
+void VS1053b::RecordCancel(uint32_t micros, bool reset)
+{
+    // Smallest power of 2 ms the time fits under
+    uint32_t bucket = 0;
+    while (bucket < VS1053B_CANCEL_BUCKETS - 1 && micros >= (1000UL << bucket))
+    {
+        bucket++;
+    }
+
+    ++CancelStats.buckets[bucket];
+    ++CancelStats.count;
+    CancelStats.resets += (reset) ? (1) : (0);
+    CancelStats.last_us = micros;
+    CancelStats.max_us  = MAX(CancelStats.max_us, micros);
+}
+
 bool VS1053b::UpdateRegisterMap()
 {
     for (int reg=MODE; reg<SCI_reg_last_invalid; reg++)
@@ -3,6 +3,8 @@
 #include "gpio_input.hpp"
 #include "gpio_output.hpp"
 #include "spi.hpp"
+#include "mp3_frame.hpp"
+#include "codec.hpp"
 
 typedef enum
 {
@@ -29,6 +31,7 @@ typedef struct
 {
     uint8_t  reg_num;
     bool     can_write;
+    bool     is_volatile;   // Changed by the device itself, reads go to the device instead of RegisterMap
     uint16_t reset_value;
     uint16_t clock_cycles;
     uint16_t reg_value;
@@ -111,6 +114,58 @@ typedef struct
     uint8_t     pin_xdcs;
 } __attribute__((packed)) vs1053b_gpio_init_t;
 
+// SDI stream buffer of the decoder, and where its write and read pointers are in WRAMADDR space
+// The pointers are word addresses into the buffer and are not in the datasheet, neither is where the buffer is.
+// It is taken as the block of VS1053B_STREAM_BUFFER_SIZE / 2 words the first pair of pointers agreed on, a pair
+// outside of it, or a fill level that cannot be right, is ignored and TransferData goes back to DREQ steps
+#define VS1053B_STREAM_BUFFER_SIZE   (2048)
+#define VS1053B_STREAM_WRITE_POINTER (0x5A7D)
+#define VS1053B_STREAM_READ_POINTER  (0x5A7E)
+
+// Average bytes per second of the stream being decoded, byteRate of the extra parameters
+#define VS1053B_PARAM_BYTE_RATE      (0x1E05)
+
+// In stream mode the fill level is kept around half of the buffer, where the device plays at normal speed
+// A burst tops it up to the high mark once it has drained to the low mark, the datasheet asks for blocks under 512
+#define VS1053B_STREAM_BURST         (480)
+#define VS1053B_STREAM_HIGH_MARK     (VS1053B_STREAM_BUFFER_SIZE / 2 + VS1053B_STREAM_BURST / 2)
+#define VS1053B_STREAM_LOW_MARK      (VS1053B_STREAM_HIGH_MARK - VS1053B_STREAM_BURST)
+
+// Buckets of the cancel latency histogram, bucket n counts cancels that took less than 2^n ms, the last one the rest
+#define VS1053B_CANCEL_BUCKETS (10)
+
+typedef struct
+{
+    uint32_t count;                             // Cancels since the statistics were last cleared
+    uint32_t resets;                            // Cancels the device did not honor in time, ended with a software reset
+    uint32_t last_us;                           // Time from the last cancel request to the device going silent
+    uint32_t max_us;                            // Longest time from a cancel request to the device going silent
+    uint32_t buckets[VS1053B_CANCEL_BUCKETS];   // Histogram of the time from a cancel request to the device going silent
+} vs1053b_cancel_stats_S;
+
+typedef struct
+{
+    uint32_t bytes;             // Bytes sent over SDI
+    uint32_t bursts;            // Bursts sent over SDI
+    uint32_t dreq_wait_us;      // Time spent waiting for DREQ to go high before a burst
+    uint32_t max_burst_gap_us;  // Longest time from the end of one burst to the start of the next while playing
+    uint32_t starvations;       // Segments that found DREQ already high, the device had room before the data arrived
+    uint32_t fill_reads;        // Times the stream buffer fill level was read to size a burst, only in stream mode
+    uint32_t fill_misreads;     // Fill levels that could not be right, the burst went out in DREQ steps instead
+} vs1053b_transfer_stats_S;
+
+// Time between two looks at the stream by the clock governor, unless the play speed changes
+#define VS1053B_GOVERNOR_PERIOD_US (500 * 1000)
+
+typedef struct
+{
+    bool     governor;          // CLOCKF follows the stream instead of staying at the default of SystemInit
+    uint8_t  multiplier;        // SC_MULT the device runs at
+    uint32_t clki_hz;           // CLKI of the multiplier
+    uint32_t spi_hz;            // Most the SPI clock was allowed to run at for it
+    uint32_t changes;           // Times the multiplier was changed
+} vs1053b_clock_stats_S;
+
 typedef struct 
 {
     bool fast_forward_mode;
@@ -141,6 +196,11 @@ public:
     // @returns         : Status after transfer
     vs1053b_transfer_status_E TransferData(uint8_t *data, uint32_t size);
 
+    // @description     : Sets how many bytes are sent per DREQ check, DREQ only guarantees room for 32 bytes
+    //                    so only go above 32 when the fill level of the device FIFO is known
+    // @param size      : Number of bytes per burst, clamped to [32, MAX_BURST_SIZE]
+    void SetBurstSize(uint16_t size);
+
     // @description     : Perform a hardware reset
     void HardwareReset();
 
@@ -154,17 +214,64 @@ public:
     //                                           API FUNCTIONS                                        //
     ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    // @description     : Sets flag to request cancellation
-    void CancelDecoding();
+    // @description     : Stops playback the way the datasheet says to, sets SM_CANCEL and keeps feeding end fill
+    //                    bytes 32 at a time until the device clears it, then flushes the stream with as many more
+    //                    as the codec of the stream needs, see SetStreamCodec
+    //                    Falls back to a software reset if the device does not clear it within 2048 bytes or 1 s
+    //                    Its latency is counted from the first RequestCancel before it, or from the call if there was none
+    // @returns         : True if the device honored SM_CANCEL, false if it had to be reset
+    bool CancelDecoding();
+
+    // @description     : Marks that playback is about to be cancelled, called from any task where a stop or skip is asked for
+    //                    TransferData gives up on the segment it is sending between two bursts, once per request, so
+    //                    the playing task gets to CancelDecoding without sending the rest of the segment first
+    //                    Does nothing if not playing, only the first request before a cancel counts
+    void RequestCancel();
+
+    // @description     : Sets a function TransferData calls between two bursts, for what the playing task would
+    //                    otherwise only look at between segments, such as buttons that can request a cancel
+    // @param hook      : Function to call, NULL for none
+    void SetBurstHook(void (*hook)(void));
 
     // @description     : Sets the ear speaking procecssing mode
     // @param mode      : Either off, minimal, normal, or extreme
     void SetEarSpeakerMode(ear_speaker_mode_t mode);
 
-    // @description     : Sets the mode of streaming
+    // @description     : Sets the mode of streaming, the device then speeds up or slows down by a few percent to keep
+    //                    its stream buffer half full, which rides out a source that delivers unevenly
+    //                    TransferData sleeps until the stream buffer is down to VS1053B_STREAM_LOW_MARK and then
+    //                    tops it up in one burst, instead of sending 32 bytes every time DREQ rises
     // @param on        : True for on, false for off
     void SetStreamMode(bool on);
 
+    // @description     : Returns if stream mode is on
+    bool IsStreamModeEnabled();
+
+    // @description     : Reads how full the stream buffer of the device is, from its write and read pointers
+    //                    XDCS must be high, DREQ must be high
+    // @param fill      : Bytes waiting to be decoded
+    // @returns         : False if the pointers are not in the stream buffer, or leave less room than DREQ promises
+    bool GetStreamFillLevel(uint16_t *fill);
+
+    // @description     : Lets the clock follow the stream being played, see clock_governor.hpp
+    //                    Looks at the frame header at most every VS1053B_GOVERNOR_PERIOD_US, from StartSegment
+    // @param on        : True to govern, false to go back to the default of SystemInit
+    void SetClockGovernor(bool on);
+
+    // @description     : Sets SC_MULT of CLOCKF, the SPI clock follows once the register is written
+    //                    Turn the governor off first or it changes the multiplier again
+    // @param multiplier: SC_MULT, 0 to 7
+    void SetClockMultiplier(uint8_t multiplier);
+
+    // @description     : Returns a snapshot of the clock settings
+    vs1053b_clock_stats_S GetClockStats();
+
+    // @description     : Tells the driver what the next stream holds, see codec.hpp
+    //                    Decides the number of end fill bytes at the end of it, and the clock the governor uses
+    //                    while the device does not report an MPEG frame header
+    // @param codec     : Codec of the stream
+    void SetStreamCodec(codec_E codec);
+
     // @description     : Set the clock divider register to divide by 2
     // @param on        : True for on, false for off
     void SetClockDivider(bool on);
@@ -207,19 +314,42 @@ public:
     // @returns            : Status of transfer
     vs1053b_transfer_status_E PlaySegment(uint8_t *mp3, uint32_t size, bool last_segment);
 
+    // @description        : Sets up playback if it has not started yet, for segments sent with TransferData
+    //                       by a streaming source instead of PlaySegment
+    void StartSegment();
+
+    // @description        : Cleans up after a segment sent with TransferData, ends playback if last segment
+    // @param status       : Status of the transfer of the segment
+    // @param last_segment : True for end of file, runs clean up routine, false for not end of file
+    //                       A cancelled segment is not cleaned up, that is left to CancelDecoding
+    // @returns            : Status of transfer
+    vs1053b_transfer_status_E FinishSegment(vs1053b_transfer_status_E status, bool last_segment);
+
     // @description     : Switches current playback to another mp3 file
     // @param mp3       : Array of mp3 file bytes
     // @param size      : Size of the arrray of file
     void SwitchPlayback(uint8_t *mp3, uint32_t size);
 
-    // @description     : Turns on or off the fast forward mode
+    // @description     : Turns on or off double play speed, every byte still has to be sent at twice the rate
+    //                    Fast forward from the DecoderTask skips between windows instead, see mp3_reverse.hpp
     // @param on        : True for on, false for off
     void SetFastForwardMode(bool on);
 
-    // @description     : Turns on or off the rewind mode
+    // @description     : Marks the device as playing rewind windows, see mp3_reverse.hpp
     // @param on        : True for on, false for off
     void SetRewindMode(bool on);
 
+    // @description     : Writes words to one SCI register back to back while XCS stays low, the multiple write of
+    //                    the datasheet, used to load patches and plugins, see plugin_image.hpp
+    //                    Waits for DREQ before every word, XDCS must be high
+    //                    RegisterMap is left alone, a reset drops whatever was loaded this way
+    // @param reg       : Register to write, WRAM moves WRAMADDR on after every word
+    // @param values    : Words to write, only the first one is used if repeat
+    // @param count     : Number of words to write
+    // @param repeat    : True to write values[0] count times
+    // @returns         : True for successful, false for unsuccessful
+    bool WriteRegisterWords(SCI_reg reg, const uint16_t *values, uint16_t count, bool repeat=false);
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     //                                         GETTER FUNCTIONS                                       //
     ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -252,6 +382,32 @@ public:
 
     bool IsPlaying();
 
+    // @description     : Chooses between sleeping on the DREQ rising edge interrupt and polling DREQ
+    // @param on        : True for interrupt, false for polling, only ports 0 and 2 support the interrupt
+    void SetDreqInterrupt(bool on);
+
+    // @description     : Returns if WaitForDREQ sleeps on the DREQ interrupt
+    bool IsDreqInterruptEnabled();
+
+    // @description     : Number of SCI reads and writes since the device was constructed
+    uint32_t GetSciTransactionCount();
+
+    // @description     : Number of hardware and software resets since the device was constructed
+    //                    Anything loaded with WriteRegisterWords is gone once this changes
+    uint32_t GetResetCount();
+
+    // @description     : Returns a snapshot of the latency histogram of CancelDecoding
+    vs1053b_cancel_stats_S GetCancelStats();
+
+    // @description     : Clears the latency histogram of CancelDecoding
+    void ResetCancelStats();
+
+    // @description     : Returns a snapshot of the counters of TransferData
+    vs1053b_transfer_stats_S GetTransferStats();
+
+    // @description     : Clears the counters of TransferData, called at the start of every track
+    void ResetTransferStats();
+
 private:
 
     ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -274,6 +430,71 @@ private:
     // Stores a map of structs of each register's values and information
     SCI_reg_t RegisterMap[SCI_reg_last_invalid];
 
+    // Number of bytes TransferData sends to the device after each DREQ check
+    uint16_t BurstSize;
+
+    // True if SM_STREAM is set and bursts are sized to the free space of the stream buffer
+    bool StreamMode;
+
+    // Clock governor, and when it last looked at the stream at which play speed
+    vs1053b_clock_stats_S ClockStats;
+    uint64_t LastGovernUs;
+    uint32_t GovernSpeed;
+
+    // Frame header the device last reported, only valid if Header.stream_valid
+    mp3_frame_header_S Frame;
+
+    // Codec of the stream being played
+    codec_E StreamCodec;
+
+    // byteRate of the stream being played, 0 until the device has worked it out
+    uint16_t StreamByteRate;
+
+    // Time the stream buffer should be down to the low mark after the last burst, 0 if it is not known
+    uint64_t StreamLowMarkUs;
+
+    // Word address the stream buffer starts at, only valid if StreamBufferKnown
+    uint16_t StreamBufferStart;
+    bool     StreamBufferKnown;
+
+    // DREQ location, needed to attach the rising edge interrupt
+    gpio_port_t DreqPort;
+    uint8_t     DreqPin;
+
+    // True if WaitForDREQ sleeps on the DREQ interrupt instead of polling
+    bool DreqInterrupt;
+
+    // Number of segments played since playback started
+    uint32_t SegmentCounter;
+
+    // Bit per register whose RegisterMap value has not been written to the device yet
+    uint16_t DirtyRegisters;
+
+    // Number of SCI reads and writes
+    uint32_t SciTransactions;
+
+    // Number of hardware and software resets
+    uint32_t ResetCount;
+
+    // Latency of CancelDecoding
+    vs1053b_cancel_stats_S CancelStats;
+
+    // Set by RequestCancel until the next cancel, with the time of the first request
+    volatile bool CancelRequested;
+    uint64_t      CancelRequestUs;
+
+    // TransferData already gave up on a segment for the request
+    volatile bool CancelAborted;
+
+    // Called between two bursts of TransferData
+    void (*BurstHook)(void);
+
+    // Counters of TransferData
+    vs1053b_transfer_stats_S TransferStats;
+
+    // Time the last burst finished, 0 if there is no burst to measure the next gap from
+    uint64_t LastBurstUs;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     //                                         INLINE FUNCTIONS                                       //
     ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -326,18 +547,42 @@ private:
     // @returns         : True for successful, false for unsuccessful
     inline bool UpdateRemoteRegister(SCI_reg reg);
 
-    // @description     : Change a single bit of one of the SCI registers
+    // @description     : Change a single bit of one of the SCI registers in RegisterMap, and marks it dirty
     // @param reg       : Specifies which SCI register
     // @param bit       : Specifies which bit of the SCI register
     // @param bit_value : Specifies value of bit to set, true for 1, false for 0
     inline void ChangeSCIRegister(SCI_reg reg, uint8_t bit, bool bit_value);
 
+    // @description     : Sets the value of a register in RegisterMap, and marks it dirty if it changed
+    // @param reg       : Enum of the register
+    // @param value     : New value of the register
+    inline void WriteRegister(SCI_reg reg, uint16_t value);
+
+    // @description     : Returns the value of a register, only volatile registers are read from the device
+    // @param reg       : Enum of the register
+    inline uint16_t ReadRegister(SCI_reg reg);
+
+    // @description     : Sends the dirty registers now if not playing, otherwise TransferData sends them between bursts
+    inline void CommitRegisters();
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////
     //                                        PRIVATE FUNCTIONS                                       //
     ////////////////////////////////////////////////////////////////////////////////////////////////////
 
     bool WaitForDREQ(uint32_t timeout_us=1000);
 
+    // @description     : Sends a single burst of SDI data through DMA, XDCS must already be low
+    // @param data      : Data to send
+    // @param size      : Number of bytes to send
+    // @returns         : True for successful, false for unsuccessful
+    bool TransferBurst(uint8_t *data, uint32_t size);
+
+    // @description     : Waits for the stream buffer to drain to the low mark, and sizes the burst that tops it up
+    //                    XDCS must be high, DREQ must be high
+    // @param remaining : Bytes left to send, the burst is no larger and a short tail does not wait
+    // @returns         : Number of bytes to send without checking DREQ
+    uint32_t GetBurstLimit(uint32_t remaining);
+
     // @description     : Read a register from RAM that is not a command register
     // @param address   : Address of register to read the data from
     // @returns         : Value of register
@@ -349,23 +594,44 @@ private:
     // @returns         : True for successful, false for unsuccessful
     bool WriteRam(uint16_t address, uint16_t value);
 
+    // @description     : Writes a block of RAM, WRAMADDR is set once and moves on by itself after every word
+    // @param address   : Address of the first word
+    // @param values    : Words to write
+    // @param count     : Number of words
+    // @returns         : True for successful, false for unsuccessful
+    bool WriteRam(uint16_t address, const uint16_t *values, uint16_t count);
+
     // @description     : Sends local SCI register value to remote
     // @param reg       : The specified register
     // @returns         : True for successful, false for unsuccessful
     bool TransferSCICommand(SCI_reg reg);
 
+    // @description     : Sends every dirty register back to back, each write waits for DREQ, XDCS must be high
+    // @returns         : True for successful, false for unsuccessful
+    bool FlushRegisters();
+
     // @description     : Reads the endFillByte parameter from the device
     // @returns         : The endFillByte
     uint8_t GetEndFillByte();
 
-    // @description     : Sends the end fill byte for x amount of transfers
+    // @description     : Sends the end fill byte to flush the end of a stream
     // @param size      : The amount of end fill bytes to send
-    // @returns         : True for successful, false for unsuccessful
     void SendEndFillByte(uint16_t size);
 
+    // @description     : Adds the time a cancel took to the histogram
+    // @param micros    : Time from the cancel request to the device going silent
+    // @param reset     : True if the device had to be reset
+    void RecordCancel(uint32_t micros, bool reset);
+
     // @description     : Updates the header struct with fresh information
     void UpdateHeaderInformation();
 
+    // @description     : Changes the multiplier if the stream needs a different one, see SetClockGovernor
+    void GovernClock();
+
+    // @description     : Sets the SPI clock to the fastest the device can take at the CLOCKF in RegisterMap
+    void UpdateSpiClock();
+
     // @description         : Blocks task until the timer reaches the specified time
     // @param microseconds  : Number of microseconds to block for
     void BlockMicroSeconds(uint16_t microseconds);
@@ -82,4 +82,7 @@ CMD_HANDLER_FUNC(learnIrHandler);
 /// Send a packet over the air
 CMD_HANDLER_FUNC(wirelessHandler);
 
+/// Handler for mp3 player diagnostics
+CMD_HANDLER_FUNC(mp3Handler);
+
 #endif /* HANDLERS_HPP_ */
\ No newline at end of file
@@ -4,14 +4,23 @@
 
 int main(void)
 {    
+    // Ring has to exist before either end of it runs
+    reader_init();
+
     xTaskCreate(DecoderTask,  "DecoderTask",  4098, NULL, PRIORITY_HIGH, NULL);
+    xTaskCreate(ReaderTask,   "ReaderTask",   2048, NULL, PRIORITY_MEDIUM, NULL);
     // xTaskCreate(WatchdogTask, "WatchdogTask", 256,  NULL, PRIORITY_HIGH,   NULL);
     // xTaskCreate(TxTask,       "TxTask",       1024, NULL, PRIORITY_MEDIUM, NULL);
     // xTaskCreate(RxTask,       "RxTask",       1024, NULL, PRIORITY_MEDIUM, NULL);
     xTaskCreate(LCDTask,      "LCDTask",      2048, NULL, PRIORITY_HIGH, NULL);
+    xTaskCreate(ScannerTask,  "ScannerTask",  1024, NULL, PRIORITY_LOW, NULL);
 
     // Can remove eventually to create more task space
     scheduler_add_task(new terminalTask(PRIORITY_HIGH));
+
+    // Track list has to exist before the ScannerTask fills it in and the menu shows it
+    // Set up after every task has its stack, so it only takes what the heap has left
+    track_list_init();
     scheduler_start();
     return -1;
 }
\ No newline at end of file
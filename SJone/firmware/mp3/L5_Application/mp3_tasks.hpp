@@ -2,6 +2,8 @@
 #include <stdarg.h>
 #include "common.hpp"
 #include "vs1053b.hpp"
+#include "mp3_vbr.hpp"
+#include "ff.h"
 
 
 // GPIO ports to interface with VS1053b
@@ -20,6 +22,15 @@ static const vs1053b_gpio_init_t gpio_init = {
 // VS1053b object which handles the device drivers
 extern VS1053b MP3Player;
 
+// What the tasks that do not have a track open need to know of it to map between time and offsets
+typedef struct
+{
+    mp3_stream_info_S info;         // Frame count and table of contents from the info frame, or CBR estimate
+    uint16_t          block_align;  // Offsets worked out from a time land on a multiple of it, bytes of a WAV sample
+    codec_E           codec;
+    bool              valid;        // False until the file has been opened
+} mp3_track_info_S;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //                                          msg_protocol                                         //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -60,6 +71,27 @@ const char* packet_opcode_enum_to_string(packet_opcode_E opcode);
 
 void LCDTask(void *p);
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//                                         plugin_loader                                         //
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    bool     loaded;        // Every word of the file made it to the device
+    uint32_t bytes;         // Bytes read off the SD card
+    uint32_t words;         // Words decoded from the file
+    uint32_t runs;          // SCI multiple writes sent
+    uint32_t read_us;       // Time spent reading the file
+    uint32_t total_us;      // Time from opening the file to the last write
+} plugin_load_stats_S;
+
+// @description : Loads a VS1053b patch or plugin off the SD card, see plugin_image.hpp
+//                Only call from the DecoderTask, which owns the device
+// @param name  : File name, a .plg or .img, no need for prefixing "1:"
+// @param stats : Set to how long it took
+// @returns     : True if the whole file was written to the device
+bool plugin_load(const char *name, plugin_load_stats_S *stats);
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //                                         Decoder Task                                          //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -68,6 +100,180 @@ void LCDTask(void *p);
 // @priority    : PRIORITY_HIGH / PRIORITY_MED?
 void DecoderTask(void *p);
 
+// @description : Chooses how the DecoderTask gets data off the SD card, applied when the next track starts
+// @param on    : True to forward sectors straight to the VS1053b, false to play from the ReaderTask ring
+void decoder_set_direct_mode(bool on);
+
+// @description : Returns true if the next track is forwarded straight to the VS1053b
+bool decoder_get_direct_mode(void);
+
+// @description : Returns true while a track is being read off the SD card, directly or by the ReaderTask
+bool decoder_is_streaming(void);
+
+// @description : Time the device went without data while changing tracks, last measured
+// @returns     : Gap in milliseconds
+uint32_t decoder_get_transition_gap_ms(void);
+
+// @description : Time between two segments in the middle of a track, last measured
+// @returns     : Interval in milliseconds, for comparison with the transition gap
+uint32_t decoder_get_segment_interval_ms(void);
+
+// @description : Time from requesting a track to sending its first frame to the device, last measured
+// @returns     : Time in milliseconds
+uint32_t decoder_get_time_to_first_audio_ms(void);
+
+// @description : Time of the last segment sent to the device, VBR aware
+// @returns     : Position in milliseconds
+uint32_t decoder_get_position_ms(void);
+
+// @description      : Copies the stream info of the track playing, see mp3_track_get_length_ms
+// @param track_info : Struct to copy into
+// @returns          : False if it is not known yet, or nothing is playing
+bool decoder_get_track_info(mp3_track_info_S *track_info);
+
+// @description : Requests the current track to continue from a point in time
+//                Ignored if that part of the track is not indexed yet
+// @param ms    : Time from the start of the track
+void decoder_seek_to_ms(uint32_t ms);
+
+// @description : Wakes the DecoderTask up when it is waiting for something to do, instead of after the next button poll
+//                Call after changing anything the DecoderTask acts on
+void decoder_wake(void);
+
+// @description : Sets how fast rewinding moves back through the track, see mp3_reverse.hpp
+// @param speed : Times faster than playback, clamped to [MP3_REVERSE_MIN_SPEED, MP3_REVERSE_MAX_SPEED]
+void decoder_set_rewind_speed(uint32_t speed);
+
+// @description : Returns the rewind speed
+uint32_t decoder_get_rewind_speed(void);
+
+// @description : Starts or stops fast forwarding by playing short windows and skipping ahead between them
+//                Turning it on turns off rewinding
+// @param on    : True for on, false for off
+void decoder_set_fast_forward(bool on);
+
+// @description : Returns true if fast forwarding
+bool decoder_get_fast_forward(void);
+
+// @description : Sets how fast fast forward moves through the track, see mp3_reverse.hpp
+// @param ratio : Times faster than playback, clamped to [MP3_REVERSE_MIN_RATIO, MP3_REVERSE_MAX_RATIO]
+void decoder_set_fast_forward_ratio(uint32_t ratio);
+
+// @description : Returns the fast forward ratio
+uint32_t decoder_get_fast_forward_ratio(void);
+
+// @description : Requests a VS1053b patch or plugin to be loaded off the SD card, between two segments if playing
+//                It is loaded again after the device is reset
+// @param name  : File name, a .plg or .img, see plugin_image.hpp
+void decoder_load_plugin(const char *name);
+
+// @description : Returns how the last plugin load went
+plugin_load_stats_S decoder_get_plugin_stats(void);
+
+// @description : Requests bursts to be sized by the fill level of the stream buffer instead of DREQ,
+//                applied by the DecoderTask between two segments, see VS1053b::SetStreamMode
+// @param on    : True for on, false for off
+void decoder_set_stream_mode(bool on);
+
+// @description : Returns true if stream mode is on, or has been asked for and is about to be
+bool decoder_get_stream_mode(void);
+
+// @description : Stops the current track and plays the next one, the same as the next button
+//                The cancel latency is counted from here, see VS1053b::RequestCancel
+void decoder_skip(void);
+
+// @description : Stops playback, the same as the play button while playing
+//                The cancel latency is counted from here, see VS1053b::RequestCancel
+void decoder_stop(void);
+
+// @description     : Requests the clock of the VS1053b to be changed by the DecoderTask between two segments,
+//                    see VS1053b::SetClockGovernor and VS1053b::SetClockMultiplier
+// @param governed   : True to let the driver choose SC_MULT for the stream, false to fix it
+// @param multiplier : SC_MULT to fix it at, 0 to 7, ignored if governed
+void decoder_set_clock(bool governed, uint8_t multiplier);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//                                          Scanner Task                                         //
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// @description : Fills in the track list in the background, see track_list_scan
+//                Pauses while a track is streaming, and sleeps once the library is complete
+// @priority    : PRIORITY_LOW
+void ScannerTask(void *p);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//                                          Reader Task                                          //
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ *  SD card --> ReaderTask --> Mp3Ring --> DecoderTask --> VS1053b
+ *
+ *  The ReaderTask owns the opened mp3 file while streaming.  Every request bumps a generation
+ *  number, and segments tagged with an older generation are dropped by the DecoderTask, so a
+ *  request takes effect immediately without having to drain the ring first.
+ *
+ *  Nothing else touches the opened file while the ReaderTask streams it, and in direct mode the
+ *  DecoderTask waits for the ReaderTask to let go of it before opening one.  Every file it opens
+ *  gets a number, the segments read from it are tagged with it, and a copy of its stream info is
+ *  kept under it for the DecoderTask to take once the first of them turns up.
+ */
+
+// @description : Creates the segment ring and the reader command queue, call before the scheduler starts
+void reader_init(void);
+
+// @description : Task for reading segments of the current track off the SD card into Mp3Ring
+// @priority    : PRIORITY_MEDIUM
+void ReaderTask(void *p);
+
+// @description     : Requests the reader to open a file and stream it from the beginning
+// @param file_name : Struct containing name of the MP3 file to open
+// @returns         : Generation the segments of this stream will be tagged with
+uint32_t reader_start(file_name_S *file_name);
+
+// @description     : Requests the reader to continue streaming a file from another offset
+//                    The file is reopened if the reader already moved on to the next track
+// @param file_name : Struct containing name of the MP3 file being played
+// @param offset    : Byte offset from the beginning of the file
+// @returns         : Generation the segments after the seek will be tagged with
+uint32_t reader_seek(file_name_S *file_name, uint32_t offset);
+
+// @description     : Requests the reader to read a window of a file, and stop at the end of it
+//                    Segments of the window are read the same way as after a seek, the last one can be short
+// @param file_name : Struct containing name of the MP3 file being played
+// @param offset    : Byte offset of the window from the beginning of the file
+// @param size      : Number of bytes in the window
+// @returns         : Generation the segments of the window will be tagged with
+uint32_t reader_read_window(file_name_S *file_name, uint32_t offset, uint32_t size);
+
+// @description : Requests the reader to close the current file and stop streaming
+void reader_stop(void);
+
+// @description : Blocks until the reader has carried out every stream request sent so far
+//                After a reader_stop, the reader no longer has a file open, so another task can open one
+void reader_wait_idle(void);
+
+// @description     : Requests the reader to build the seek index of a file in the background
+//                    Only needed when the file is not streamed by the reader, START indexes on its own
+// @param file_name : Struct containing name of the MP3 file
+void reader_index(file_name_S *file_name);
+
+// @description : Generation of the latest request, older segments are stale
+uint32_t reader_get_generation(void);
+
+// @description : Copies the stream info of a file the reader opened, only the last few are kept
+// @param track : Number the segments read from the file are tagged with, see segment_slot_S
+// @param info  : Struct to copy into
+// @returns     : False if the file is not one of the last few opened
+bool reader_get_track_info(uint32_t track, mp3_track_info_S *info);
+
+// @description : Turns on or off queueing up the next track behind the current one at end of file
+//                Only done between MP3 tracks, other codecs end the stream, see codec.hpp
+// @param on    : True to keep streaming into the next track, false to end the stream at end of file
+void reader_set_gapless(bool on);
+
+// @description : Returns true if the reader streams into the next track at end of file
+bool reader_get_gapless(void);
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //                                         TX / RX Tasks                                         //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -102,9 +308,15 @@ void WatchdogTask(void *p);
 //                                          track_list                                           //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-// Initializes the track list from all the files on the SD card and adds to a circular buffer
+// Sets up an empty track list, as many tracks as fit in MP3_TRACK_TABLE_BUDGET, before the ScannerTask fills it in
 void track_list_init(void);
 
+// @description : Fills in the track list from all the files on the SD card, only called from the ScannerTask
+//                Every name goes in first, codecs and tags come out of the library index, and only new and
+//                changed files are opened afterwards, see library_index.hpp
+//                The track list can be read and played from the whole time
+void track_list_scan(void);
+
 // Print the entire track list from the SD card
 void track_list_print(void);
 
@@ -119,17 +331,39 @@ void track_list_shuffle(void);
 
 void track_list_get4(file_name_S file_names[4]);
 
-file_name_S** track_list_get_track_list();
-
 void track_list_convert_to_short_name(file_name_S *file_names);
 
-char* track_list_get_short_name(uint8_t index);
+// @description : Name of a track for the menu, straight out of the track table
+// @param size  : Characters of the name before its extension, the name goes on past them
+// @returns     : NULL if the index is past the last track
+const char* track_list_get_short_name(uint16_t index, uint32_t *size);
+
+// @description : Tags of a track, "" for the ones it does not have
+// @returns     : False if the index is past the last track
+bool track_list_get_tags(uint16_t index, const char **artist, const char **title, const char **genre);
+
+// @description : Folders in the track list, the root of the SD card is folder 0
+uint16_t track_list_get_folder_count(void);
+
+// @description : Folder and the run of tracks in it and in every folder under it, see track_table.hpp
+// @param name   : Folder name, without the path to it, "" for the root
+// @param parent : Folder it is in
+// @param first  : First track of the run, the index track_list_set_current_track takes
+// @param count  : Tracks in the run
+// @returns      : False if the folder is past the last one
+bool track_list_get_folder(uint16_t folder, const char **name, uint16_t *parent, uint16_t *first, uint16_t *count);
 
-mp3_header_S* track_list_get_headers();
+void track_list_set_current_track(uint16_t index);
 
-void track_list_set_current_track(uint8_t index);
+// @description : Copies out the current track, it can change as soon as the call returns, so it is not handed out
+// @param track : Set to the current track
+void track_list_get_current_track(file_name_S *track);
 
-file_name_S* track_list_get_current_track();
+// @description : Looks up a track and copies out the one that plays after it, wraps around like track_list_next
+// @param track : Track to look up by its path
+// @param after : Set to the next track
+// @returns     : False if the track is not in the list, or nothing in it is played
+bool track_list_get_track_after(const file_name_S *track, file_name_S *after);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //                                            mp3_struct                                         //
@@ -144,7 +378,7 @@ bool mp3_open_file(file_name_S *file_name);
 // @returns     : True for successful, false for unsuccessful, true if no file is currently opened
 bool mp3_close_file(void);
 
-// @description : Restarts the file from the beginning
+// @description : Restarts the file from the first frame
 // @returns     : True for successful, false for unsuccessful
 bool mp3_restart_file(void);
 
@@ -152,10 +386,46 @@ bool mp3_restart_file(void);
 // @returns     : The size of the file in bytes
 uint32_t mp3_get_file_size(void);
 
-// @description : Calculates how long the song is from the bit rate and the size of the file
+// @description : Skip the ID3v2 tag at the start, and the ID3v1 and APE tags at the end, of the next file opened
+//                Only turned off to measure what skipping them saves
+// @param skip  : True to only stream the frames, false to stream the whole file
+void mp3_set_skip_tags(bool skip);
+
+// @description : True if tags are skipped
+bool mp3_get_skip_tags(void);
+
+// @description : Length of the song from the Xing, Info or VBRI frame, or from the bit rate and size of a CBR file
 // @returns     : The song length in seconds
 uint32_t mp3_get_song_length_in_seconds(void);
 
+// @description : Length of the song, without the encoder delay and padding
+// @returns     : The song length in milliseconds, 0 if no file is open
+uint32_t mp3_get_song_length_in_ms(void);
+
+// @description : Copies what mapping between time and offsets of the opened file takes, only called by the task
+//                that opened it, the other tasks are handed the copy, see reader_get_track_info
+// @param track : Struct to copy into, not valid if no file is open
+// @returns     : False if no file is open
+bool mp3_get_track_info(mp3_track_info_S *track);
+
+// @description : Length of a track, without the encoder delay and padding
+// @returns     : The length in milliseconds, 0 if the info is not valid
+uint32_t mp3_track_get_length_ms(const mp3_track_info_S *track);
+
+// @description  : Maps a byte offset of a track to the time it plays at, VBR aware
+// @param offset : Byte offset from the beginning of the file
+// @returns      : Time in milliseconds, 0 if the info is not valid
+uint32_t mp3_track_offset_to_ms(const mp3_track_info_S *track, uint32_t offset);
+
+// @description : Maps a time to a byte offset of a track, VBR aware but not frame aligned
+//                A WAV offset lands on a whole sample
+// @param ms    : Time in milliseconds
+// @returns     : Byte offset from the beginning of the file, 0 if the info is not valid
+uint32_t mp3_track_ms_to_offset(const mp3_track_info_S *track, uint32_t ms);
+
+// @description : Name of the header the length of a track was taken from, or of the codec if it is not MP3
+const char* mp3_track_get_type(const mp3_track_info_S *track);
+
 // @description                : Reads a segment from the opened file
 // @param buffer               : The buffer to read data into
 // @param segment_size         : The size of the segment to read
@@ -163,11 +433,33 @@ uint32_t mp3_get_song_length_in_seconds(void);
 // @returns                    : True for successful, false for unsuccessful
 bool mp3_read_segment(uint8_t *buffer, uint32_t segment_size, uint32_t *current_segment_size);
 
+// Sink for mp3_forward_segment, same as the f_forward streaming function
+// Called with (NULL, 0) to ask if the sink is ready, returns non-zero if ready
+// Otherwise returns the number of bytes it consumed, 0 to abort
+typedef UINT (*mp3_sink_t)(const BYTE *data, UINT size);
+
+// @description          : Streams the next segment straight out of the FatFs sector buffer into a sink
+//                          One sector at a time, the volume is locked while the sink has the sector, not for the segment
+// @param sink           : Function the sector data is handed to
+// @param segment_size   : Max number of bytes to forward
+// @param forwarded_size : Number of bytes actually forwarded
+// @returns              : True for successful, false for unsuccessful
+bool mp3_forward_segment(mp3_sink_t sink, uint32_t segment_size, uint32_t *forwarded_size);
+
 bool mp3_is_file_open(void);
 
 file_name_S mp3_get_name(void);
 
-void mp3_get_header_info(mp3_header_S *header, uint8_t *buffer);
+// @description : Reads the title, artist and genre of the opened file out of its ID3v2 tag, see id3_tag.hpp
+// @param header : Fields the tag leaves out are set to "Unknown"
+void mp3_get_header_info(mp3_header_S *header);
+
+// @description      : Same as mp3_get_header_info, for a file that is not the opened one
+// @param file       : File opened for reading, its read pointer is left anywhere in the tag
+// @param start      : First bytes of the file if they were already read, so they are not read again, NULL if not
+// @param start_size : Number of bytes in start
+// @param header     : Fields the tag leaves out are set to "Unknown"
+void mp3_read_tags(FIL *file, const uint8_t *start, uint32_t start_size, mp3_header_S *header);
 
 const char* mp3_get_artist(void);
 
@@ -175,10 +467,25 @@ const char* mp3_get_title(void);
 
 const char* mp3_get_genre(void);
 
-bool mp3_rewind_segments(uint32_t segments);
+// @description : Moves the read pointer of the opened file
+// @param offset : Byte offset from the beginning of the file
+// @returns     : True for successful, false for unsuccessful
+bool mp3_seek_to_offset(uint32_t offset);
+
+// @description : Current read pointer of the opened file
+// @returns     : Byte offset from the beginning of the file, 0 if no file is open
+uint32_t mp3_get_offset(void);
+
+// @description : Moves the read pointer of the opened file to the frame at or before a point in time
+//                Uses the seek index, so the decoder never lands in the middle of a frame
+// @param ms    : Time from the start of the track
+// @returns     : False if the file is not open or that part of it is not indexed yet
+bool mp3_seek_to_ms(uint32_t ms);
 
 void mp3_set_direction(seek_direction_E direction);
 
 seek_direction_E mp3_get_direction(void);
 
+// @description : Fraction of the song read so far, by time rather than by bytes
+// @returns     : 0.0 to 1.0
 float mp3_get_percentage(void);
\ No newline at end of file
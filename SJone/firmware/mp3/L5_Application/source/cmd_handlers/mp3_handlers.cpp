@@ -0,0 +1,430 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "command_handler.hpp"
+#include "segment_ring.hpp"
+#include "frame_index.hpp"
+#include "track_stats.hpp"
+#include "mp3_tasks.hpp"
+#include "clock_governor.hpp"
+
+
+
+static CMD_HANDLER_FUNC(mp3BufferHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("reset"))
+    {
+        Mp3Ring.ResetStats();
+        output.putline("Segment ring statistics cleared");
+        return true;
+    }
+
+    const segment_ring_stats_S stats = Mp3Ring.GetStats();
+    output.printf("Segment ring : %u x %u bytes\n", (unsigned int)stats.depth, (unsigned int)stats.segment_size);
+    output.printf("    Fill level     : %u\n", (unsigned int)stats.fill_level);
+    output.printf("    Min fill level : %u\n", (unsigned int)stats.min_fill_level);
+    output.printf("    Underruns      : %u\n", (unsigned int)stats.underruns);
+    output.printf("    Reader stalls  : %u\n", (unsigned int)stats.reader_stalls);
+    output.printf("    Segments read  : %u\n", (unsigned int)stats.segments_read);
+    output.printf("    Max read time  : %u us\n", (unsigned int)stats.max_read_us);
+    return true;
+}
+
+// Sums the run time counters of all tasks, and of the idle task alone
+static void mp3GetRunTime(uint32_t *idle, uint32_t *total)
+{
+    const unsigned portBASE_TYPE maxTasks = 16;
+    TaskStatus_t status[maxTasks];
+    const unsigned portBASE_TYPE uxArraySize = uxTaskGetSystemState(&status[0], maxTasks, total);
+
+    const TaskHandle_t idle_task = xTaskGetIdleTaskHandle();
+    *idle = 0;
+    for (unsigned i = 0; i < uxArraySize; i++) {
+        if (status[i].xHandle == idle_task) {
+            *idle = status[i].ulRunTimeCounter;
+        }
+    }
+}
+
+static CMD_HANDLER_FUNC(mp3CpuHandler)
+{
+    int delayInMs = (int)cmdParams;
+    if (delayInMs <= 0) {
+        delayInMs = 1000;
+    }
+
+    uint32_t idle_start = 0, total_start = 0;
+    uint32_t idle_end   = 0, total_end   = 0;
+    mp3GetRunTime(&idle_start, &total_start);
+    vTaskDelayMs(delayInMs);
+    mp3GetRunTime(&idle_end, &total_end);
+
+    const uint32_t idle  = idle_end  - idle_start;
+    const uint32_t total = total_end - total_start;
+    output.printf("Idle CPU : %u%% over %u ms (DREQ %s)\n",
+                  (0 == total) ? 0 : (unsigned int)((100ULL * idle) / total), delayInMs,
+                  MP3Player.IsDreqInterruptEnabled() ? "interrupt" : "polling");
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3SciHandler)
+{
+    int delayInMs = (int)cmdParams;
+    if (delayInMs <= 0) {
+        delayInMs = 1000;
+    }
+
+    const uint32_t start = MP3Player.GetSciTransactionCount();
+    vTaskDelayMs(delayInMs);
+    const uint32_t transactions = MP3Player.GetSciTransactionCount() - start;
+
+    output.printf("SCI : %u transactions over %u ms, %u / s\n", (unsigned int)transactions, delayInMs,
+                  (unsigned int)((1000ULL * transactions) / delayInMs));
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3CancelHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("reset"))
+    {
+        MP3Player.ResetCancelStats();
+        output.putline("Cancel statistics cleared");
+        return true;
+    }
+
+    const vs1053b_cancel_stats_S stats = MP3Player.GetCancelStats();
+    output.printf("Cancels : %u, %u ended with a software reset\n", (unsigned int)stats.count, (unsigned int)stats.resets);
+    output.printf("    Last    : %u us\n", (unsigned int)stats.last_us);
+    output.printf("    Longest : %u us\n", (unsigned int)stats.max_us);
+    for (int i=0; i<VS1053B_CANCEL_BUCKETS; i++)
+    {
+        if (i < VS1053B_CANCEL_BUCKETS - 1) {
+            output.printf("    < %3u ms : %u\n", 1U << i, (unsigned int)stats.buckets[i]);
+        }
+        else {
+            output.printf("    >=%3u ms : %u\n", 1U << (i - 1), (unsigned int)stats.buckets[i]);
+        }
+    }
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3SkipHandler)
+{
+    decoder_skip();
+    output.putline("Skipping to the next track, see 'mp3 cancel' for how long it took");
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3StopHandler)
+{
+    decoder_stop();
+    output.putline("Stopping, see 'mp3 cancel' for how long it took");
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3DreqHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("irq")) {
+        MP3Player.SetDreqInterrupt(true);
+    }
+    else if (cmdParams.beginsWithIgnoreCase("poll")) {
+        MP3Player.SetDreqInterrupt(false);
+    }
+
+    output.printf("Waiting for DREQ by %s\n", MP3Player.IsDreqInterruptEnabled() ? "interrupt" : "polling");
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3StreamHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("on")) {
+        decoder_set_stream_mode(true);
+    }
+    else if (cmdParams.beginsWithIgnoreCase("off")) {
+        decoder_set_stream_mode(false);
+    }
+
+    const vs1053b_transfer_stats_S stats = MP3Player.GetTransferStats();
+    output.printf("Stream mode %s, bursts sized by %s\n", decoder_get_stream_mode() ? "on" : "off",
+                  decoder_get_stream_mode() ? "the stream buffer fill level" : "DREQ");
+    output.printf("    This track : %u bytes in %u bursts, %u fill level reads, %u misread\n", (unsigned int)stats.bytes,
+                  (unsigned int)stats.bursts, (unsigned int)stats.fill_reads, (unsigned int)stats.fill_misreads);
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3ModeHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("direct")) {
+        decoder_set_direct_mode(true);
+    }
+    else if (cmdParams.beginsWithIgnoreCase("ring")) {
+        decoder_set_direct_mode(false);
+    }
+
+    output.printf("Next track is %s\n", decoder_get_direct_mode() ? "forwarded straight from FatFs" : "read ahead into the segment ring");
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3GaplessHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("on")) {
+        reader_set_gapless(true);
+    }
+    else if (cmdParams.beginsWithIgnoreCase("off")) {
+        reader_set_gapless(false);
+    }
+
+    output.printf("Gapless playback %s\n", reader_get_gapless() ? "on" : "off");
+    output.printf("    Last transition gap : %u ms\n", (unsigned int)decoder_get_transition_gap_ms());
+    output.printf("    Segment interval    : %u ms\n", (unsigned int)decoder_get_segment_interval_ms());
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3IndexHandler)
+{
+    const file_name_S file_name = Mp3Index.GetFileName();
+    const frame_index_stats_S stats = Mp3Index.GetStats();
+
+    output.printf("Seek index : %s (%s)\n", file_name.short_name,
+                  stats.building ? "building" : stats.cached ? "cached" : stats.complete ? "complete" : "none");
+    output.printf("    Entries          : %u / %u\n", (unsigned int)stats.entries, (unsigned int)MP3_INDEX_MAX_ENTRIES);
+    output.printf("    Frames per entry : %u\n", (unsigned int)stats.frames_per_entry);
+    output.printf("    Frames           : %u\n", (unsigned int)stats.frames);
+    output.printf("    Sample rate      : %u Hz\n", (unsigned int)stats.sample_rate);
+    output.printf("    Duration         : %u ms\n", (unsigned int)stats.duration_ms);
+    output.printf("    Build time       : %u ms\n", (unsigned int)stats.build_ms);
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3SeekHandler)
+{
+    const int ms = (int)cmdParams;
+    if (ms < 0) {
+        return false;
+    }
+
+    decoder_seek_to_ms(ms);
+    output.printf("Seek to %u ms requested\n", (unsigned int)ms);
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3RewindHandler)
+{
+    if (cmdParams == "") {
+        decoder_set_fast_forward(false);
+        mp3_set_direction((DIR_BACKWARD == mp3_get_direction()) ? (DIR_FORWARD) : (DIR_BACKWARD));
+        decoder_wake();
+    }
+    else {
+        const int speed = (int)cmdParams;
+        if (speed <= 0) {
+            return false;
+        }
+        decoder_set_rewind_speed(speed);
+    }
+
+    output.printf("Rewind %s at %ux\n", (DIR_BACKWARD == mp3_get_direction()) ? "on" : "off",
+                  (unsigned int)decoder_get_rewind_speed());
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3FastForwardHandler)
+{
+    if (cmdParams == "") {
+        decoder_set_fast_forward(!decoder_get_fast_forward());
+    }
+    else {
+        const int ratio = (int)cmdParams;
+        if (ratio <= 0) {
+            return false;
+        }
+        decoder_set_fast_forward_ratio(ratio);
+    }
+
+    output.printf("Fast forward %s at %ux\n", decoder_get_fast_forward() ? "on" : "off",
+                  (unsigned int)decoder_get_fast_forward_ratio());
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3ClockHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("auto")) {
+        decoder_set_clock(true, 0);
+        output.putline("Clock governed, from the next segment");
+        return true;
+    }
+    else if (cmdParams != "") {
+        const int multiplier = (int)cmdParams;
+        if (multiplier < 0 || multiplier > 7 || (0 == multiplier && cmdParams != "0")) {
+            return false;
+        }
+        decoder_set_clock(false, multiplier);
+        output.printf("Clock fixed at SC_MULT %u, from the next segment\n", (unsigned int)multiplier);
+        return true;
+    }
+
+    const vs1053b_clock_stats_S stats = MP3Player.GetClockStats();
+    output.printf("Clock %s : SC_MULT %u, CLKI %u kHz\n", (stats.governor) ? ("governed") : ("fixed"),
+                  (unsigned int)stats.multiplier, (unsigned int)(stats.clki_hz / 1000));
+    output.printf("    SPI max : %u kHz\n", (unsigned int)(stats.spi_hz / 1000));
+    output.printf("    Changes : %u\n", (unsigned int)stats.changes);
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3PluginHandler)
+{
+    if (cmdParams != "") {
+        if (cmdParams.getLen() >= MAX_NAME_LENGTH) {
+            return false;
+        }
+        decoder_load_plugin(cmdParams.c_str());
+        output.printf("Loading %s, 'plugin' to see how it went\n", cmdParams.c_str());
+        return true;
+    }
+
+    const plugin_load_stats_S stats = decoder_get_plugin_stats();
+    output.printf("Last plugin : %s\n", (stats.loaded) ? ("loaded") : ("not loaded"));
+    output.printf("    Words   : %u in %u multiple writes, %u bytes of file\n", (unsigned int)stats.words,
+                  (unsigned int)stats.runs, (unsigned int)stats.bytes);
+    output.printf("    Time    : %u ms, %u ms of it reading the SD card\n", (unsigned int)(stats.total_us / 1000),
+                  (unsigned int)(stats.read_us / 1000));
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3StatsHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("reset")) {
+        Mp3Stats.ResetHistory();
+        output.putline("Track history cleared");
+        return true;
+    }
+
+    // Sends everything below over the ESP32 link too
+    bool log = cmdParams.beginsWithIgnoreCase("log");
+    if (log && NULL == MessageTxQueue) {
+        output.putline("TxTask is not running, nothing is sent to the ESP32");
+        log = false;
+    }
+
+    track_stats_S stats;
+    if (Mp3Stats.GetCurrent(&stats)) {
+        output.printf("Playing : %s\n", stats.name);
+        output.printf("    Duration       : %u ms\n", (unsigned int)stats.duration_ms);
+        output.printf("    Sent           : %u bytes in %u bursts, %u bytes/s\n", (unsigned int)stats.transfer.bytes,
+                      (unsigned int)stats.transfer.bursts, (unsigned int)stats.bytes_per_second);
+        output.printf("    DREQ wait      : %u ms\n", (unsigned int)(stats.transfer.dreq_wait_us / 1000));
+        output.printf("    Longest gap    : %u us\n", (unsigned int)stats.transfer.max_burst_gap_us);
+        output.printf("    Starved        : %u segments\n", (unsigned int)stats.transfer.starvations);
+        output.printf("    Underruns      : %u\n", (unsigned int)stats.underruns);
+        output.printf("    SD reads       : %u, %u / %u / %u us min / avg / max\n", (unsigned int)stats.reads,
+                      (unsigned int)stats.read_min_us, (unsigned int)stats.read_avg_us, (unsigned int)stats.read_max_us);
+        if (log) {
+            Mp3Stats.Log(&stats);
+        }
+    }
+
+    output.printf("Last tracks, newest first : name, ms, bytes/s, starved, underruns, max gap us, max SD read us\n");
+    for (uint32_t i=0; Mp3Stats.GetHistory(i, &stats); i++) {
+        output.printf("    %-12s %7u %6u %4u %4u %6u %6u\n", stats.name, (unsigned int)stats.duration_ms,
+                      (unsigned int)stats.bytes_per_second, (unsigned int)stats.transfer.starvations, (unsigned int)stats.underruns,
+                      (unsigned int)stats.transfer.max_burst_gap_us, (unsigned int)stats.read_max_us);
+        if (log) {
+            Mp3Stats.Log(&stats);
+        }
+    }
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3TimeHandler)
+{
+    // The opened file belongs to the ReaderTask, the DecoderTask keeps a copy of what the time is worked out from
+    mp3_track_info_S track;
+    decoder_get_track_info(&track);
+    const uint32_t position  = decoder_get_position_ms();
+    const uint32_t length    = mp3_track_get_length_ms(&track);
+    const uint32_t byte_rate = (track.valid) ? (mp3_vbr_get_byte_rate(&track.info)) : (0);
+
+    // Segments waiting in the ring, nothing is read ahead when streaming directly
+    const segment_ring_stats_S ring = Mp3Ring.GetStats();
+    const uint32_t ahead = ring.fill_level * ring.segment_size;
+
+    output.printf("Position : %u:%02u / %u:%02u (%s)\n",
+                  (unsigned int)(position / 60000), (unsigned int)(position / 1000 % 60),
+                  (unsigned int)(length / 60000),   (unsigned int)(length / 1000 % 60), mp3_track_get_type(&track));
+    output.printf("    Read ahead : %u bytes, %u ms\n", (unsigned int)ahead,
+                  (unsigned int)((byte_rate) ? ((uint64_t)ahead * 1000 / byte_rate) : (0)));
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3TagsHandler)
+{
+    if (cmdParams.beginsWithIgnoreCase("skip")) {
+        mp3_set_skip_tags(true);
+    }
+    else if (cmdParams.beginsWithIgnoreCase("stream")) {
+        mp3_set_skip_tags(false);
+    }
+
+    output.printf("Tags are %s from the next track on\n", mp3_get_skip_tags() ? "skipped" : "streamed");
+    output.printf("    Last time to first audio : %u ms\n", (unsigned int)decoder_get_time_to_first_audio_ms());
+    return true;
+}
+
+static CMD_HANDLER_FUNC(mp3FolderHandler)
+{
+    const int folder = (cmdParams == "") ? (0) : ((int)cmdParams);
+    const char *name = NULL;
+    uint16_t parent = 0, first = 0, count = 0;
+    if (folder < 0 || !track_list_get_folder(folder, &name, &parent, &first, &count)) {
+        return false;
+    }
+
+    output.printf("Folder %u : %s in %u, %u tracks from %u\n", (unsigned int)folder, (folder) ? (name) : ("/"),
+                  (unsigned int)parent, (unsigned int)count, (unsigned int)first);
+
+    // Folders under it were added after it
+    const uint16_t folders = track_list_get_folder_count();
+    for (uint16_t i=folder + 1; i<folders; i++) {
+        if (track_list_get_folder(i, &name, &parent, &first, &count) && folder == parent) {
+            output.printf("    %u : %s, %u tracks from %u\n", (unsigned int)i, name, (unsigned int)count, (unsigned int)first);
+        }
+    }
+    return true;
+}
+
+CMD_HANDLER_FUNC(mp3Handler)
+{
+    static CommandProcessor *pCmdProcessor = NULL;
+    if (NULL == pCmdProcessor)
+    {
+        pCmdProcessor = new CommandProcessor(20);
+        pCmdProcessor->addHandler(mp3BufferHandler, "buffer", "'buffer' : See the segment ring statistics, 'buffer reset' to clear them");
+        pCmdProcessor->addHandler(mp3CpuHandler,    "cpu",    "'cpu <ms>' : Idle CPU percentage measured over <ms>, 1000 by default");
+        pCmdProcessor->addHandler(mp3CancelHandler, "cancel", "'cancel' : See the time from a stop or skip to silence, 'cancel reset' to clear it");
+        pCmdProcessor->addHandler(mp3SkipHandler,   "skip",   "'skip' : Stop the current track and play the next one, like the next button");
+        pCmdProcessor->addHandler(mp3StopHandler,   "stop",   "'stop' : Stop playback, like the play button while playing");
+        pCmdProcessor->addHandler(mp3SciHandler,    "sci",    "'sci <ms>' : SCI transactions per second measured over <ms>, 1000 by default");
+        pCmdProcessor->addHandler(mp3DreqHandler,   "dreq",   "'dreq irq' or 'dreq poll' : Sleep on the DREQ interrupt, or poll DREQ");
+        pCmdProcessor->addHandler(mp3StreamHandler, "stream", "'stream on' or 'stream off' : Let the decoder adjust its speed to keep its buffer half full, and size bursts by its fill level instead of DREQ");
+        pCmdProcessor->addHandler(mp3GaplessHandler, "gapless", "'gapless on' or 'gapless off' : Queue up the next track behind the current one, and see the last transition gap");
+        pCmdProcessor->addHandler(mp3ModeHandler,   "mode",   "'mode direct' or 'mode ring' : Forward sectors straight to the decoder, or read ahead with the ReaderTask");
+        pCmdProcessor->addHandler(mp3IndexHandler,  "index",  "'index' : See the progress of the seek index of the current track");
+        pCmdProcessor->addHandler(mp3TagsHandler,   "tags",   "'tags skip' or 'tags stream' : Skip ID3 and APE tags instead of sending them to the decoder, and see the time to first audio");
+        pCmdProcessor->addHandler(mp3FolderHandler, "folder", "'folder' or 'folder <n>' : See the root or folder <n> of the track list, its run of tracks, and the folders in it");
+        pCmdProcessor->addHandler(mp3TimeHandler,   "time",   "'time' : See the position and length of the current track");
+        pCmdProcessor->addHandler(mp3SeekHandler,   "seek",   "'seek <ms>' : Continue the current track from the frame at or before <ms>");
+        pCmdProcessor->addHandler(mp3RewindHandler, "rewind", "'rewind' or 'rewind <speed>' : Toggle rewinding, or set how many times faster than playback it goes back, 1 to 8");
+        pCmdProcessor->addHandler(mp3StatsHandler,  "stats",  "'stats' : See how close to underrunning the current and last tracks played, 'stats log' to also send them to the ESP32, 'stats reset' to clear them");
+        pCmdProcessor->addHandler(mp3ClockHandler,  "clock",  "'clock auto' or 'clock <0-7>' : Let CLOCKF follow the stream, or fix SC_MULT, and see the clock and SPI speed");
+        pCmdProcessor->addHandler(mp3PluginHandler, "plugin", "'plugin <file>' : Load a VS1053b patch or plugin, a .plg or .img, off the SD card, or see how the last one loaded");
+        pCmdProcessor->addHandler(mp3FastForwardHandler, "ff", "'ff' or 'ff <ratio>' : Toggle fast forward, or set how many times faster than playback it skips ahead, 2 to 16");
+    }
+
+    /* Display help for empty command */
+    if (cmdParams == "") {
+        cmdParams = "help";
+    }
+
+    return pCmdProcessor->handleCommand(cmdParams, output);
+}
@@ -110,6 +110,7 @@ bool terminalTask::taskEntry()
                                                );
     cp.addHandler(learnIrHandler,  "learn",    "Begin to learn IR codes for numbers 0-9");
     cp.addHandler(wirelessHandler, "wireless", "Use 'wireless' to see the nested commands");
+    cp.addHandler(mp3Handler,      "mp3",      "Use 'mp3' to see the nested commands");
 
     /* Firmware upgrade handlers
      * Please read "netload_readme.txt" at ref_and_datasheets directory.
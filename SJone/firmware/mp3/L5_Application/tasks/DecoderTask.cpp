@@ -1,9 +1,16 @@
 #include "mp3_tasks.hpp"
+#include <cstring>
+#include "segment_ring.hpp"
+#include "frame_index.hpp"
+#include "mp3_reverse.hpp"
+#include "track_stats.hpp"
+#include "segment_plan.hpp"
 #include "ff.h"
 #include "ssp0.h"
 #include "buttons.hpp"
 #include "utilities.hpp"
 #include "gpio_input.hpp"
+#include "lpc_sys.h"
 
 SemaphoreHandle_t PlaySem;
 
@@ -23,12 +30,116 @@ typedef struct
     mp3_header_S *header;
     uint32_t bit_rate;
 
-    file_name_S  curr_track;    // Name of track currently playing
-    const char  *next_track;    // Name of track queued up next to play
+    file_name_S  curr_track;    // Track currently playing, copied out of the track list once per stream
 } MP3_status_S;
 
-// Buffer for an MP3 segment to send to the device
-static uint8_t Buffer[MP3_SEGMENT_SIZE] = { 0 };
+typedef struct
+{
+    bool     active;            // A stream has been requested from the ReaderTask and has not ended
+    bool     direct;            // Stream is forwarded straight from the FatFs sector buffer, the ReaderTask is not used
+    bool     seek_pending;      // Offset was moved while scanning, reader has not been told yet
+    bool     scanning;          // Windows of the track are being played while rewinding or fast forwarding, see Scan
+    uint32_t generation;        // Generation of the latest reader request, older segments are stale
+    uint32_t offset;            // File offset right after the last segment played
+    uint32_t segment_size;      // Bytes forwarded at a time when streaming directly, chosen for the bit rate of the track
+    bool     gap_pending;       // Previous track ended the stream, the next stream's first segment ends the gap
+    uint64_t last_transfer_us;  // Uptime when the last segment finished sending
+    uint32_t gap_ms;            // Last measured time without data between two tracks
+    uint32_t interval_ms;       // Last measured time between two segments of the same track
+    uint64_t start_us;          // Uptime when the stream was requested
+    bool     awaiting_audio;    // First frame of the track has not been sent yet
+    uint32_t first_audio_ms;    // Last measured time from requesting a track to sending its first frame
+    uint32_t track;             // Number the ReaderTask gave the file track_info is for, see reader_get_track_info
+    mp3_track_info_S track_info; // Stream info of the track playing, the DecoderTask only maps time and offsets with it
+} MP3_stream_S;
+
+// Stream being fed by the ReaderTask
+static MP3_stream_S Stream = {
+    .active           = false,
+    .direct           = false,
+    .seek_pending     = false,
+    .scanning         = false,
+    .generation       = 0,
+    .offset           = 0,
+    .segment_size     = MP3_SEGMENT_SIZE,
+    .gap_pending      = false,
+    .last_transfer_us = 0,
+    .gap_ms           = 0,
+    .interval_ms      = 0,
+    .start_us         = 0,
+    .awaiting_audio   = false,
+    .first_audio_ms   = 0,
+    .track            = 0,
+    .track_info       = { },
+};
+
+// Mode the next stream starts in, set from the terminal
+static bool DirectModeRequested = false;
+
+// Status of the last transfer done by ForwardToDecoder
+static vs1053b_transfer_status_E ForwardStatus = TRANSFER_SUCCESS;
+
+// Max time to wait for the ReaderTask before counting an underrun
+static const TickType_t SegmentWaitTicks = 10 / portTICK_PERIOD_MS;
+
+// Audible rewind or fast forward of the current stream
+static mp3_reverse_S Scan;
+
+// Speed of the next rewind, set from the terminal
+static uint32_t RewindSpeed = MP3_REVERSE_DEFAULT_SPEED;
+
+// Fast forward by skipping between windows, and how many times faster than playback, set from the terminal and buttons
+static volatile bool FastForward      = false;
+static uint32_t      FastForwardRatio = MP3_REVERSE_DEFAULT_RATIO;
+
+// Segment of a scan window when streaming directly, it has to be read instead of forwarded to be trimmed to whole frames
+static uint8_t ScanBuffer[MP3_SEGMENT_SIZE];
+
+// Seek requested from the terminal, picked up by the DecoderTask while playing
+static volatile bool     SeekRequested = false;
+static volatile uint32_t SeekTargetMs  = 0;
+
+// Patch or plugin requested from the terminal, picked up by the DecoderTask between segments
+static volatile bool PluginRequested = false;
+static char          PluginRequest[MAX_NAME_LENGTH] = { 0 };
+
+// Stream mode requested from the terminal, SCI_MODE is changed by the DecoderTask between segments
+static volatile bool StreamModeRequested = false;
+static volatile bool StreamModeRequest   = false;
+
+// Clock requested from the terminal, CLOCKF is changed by the DecoderTask between segments
+static volatile bool    ClockRequested       = false;
+static volatile bool    ClockRequestGoverned = true;
+static volatile uint8_t ClockRequestMult     = 0;
+
+// Skip or stop requested from the terminal, handled like the buttons
+static volatile bool SkipRequested = false;
+static volatile bool StopRequested = false;
+
+// Plugin on the device and the reset count when it was loaded, it is loaded again after a reset, empty if none
+static char                Plugin[MAX_NAME_LENGTH] = { 0 };
+static uint32_t            PluginResets = 0;
+static plugin_load_stats_S PluginStats  = { };
+
+// Everything that can wake up the DecoderTask while it has nothing to stream, commands from MessageRxQueue and DecoderWakeSem
+static QueueSetHandle_t DecoderEvents = NULL;
+
+// Given by the other tasks after changing something the DecoderTask has to act on
+static SemaphoreHandle_t DecoderWakeSem = NULL;
+
+// Buttons are on port 1, which has no GPIO interrupts, so they are sampled this often
+// Sampling no faster than this is also what debounces them
+static const TickType_t ButtonPollTicks = 20 / portTICK_PERIOD_MS;
+
+// Buttons on port 1, in the order CheckButtons handles them
+static const uint8_t ButtonPins[] = { 22, 23, 28, 29, 19, 20 };
+
+// Button pins that were high the last time they were sampled, and when that was
+static uint32_t   ButtonsHeld     = 0;
+static TickType_t ButtonPollTick  = 0;
+
+// Buttons let go since CheckButtons last looked, they can be sampled in the middle of a segment
+static uint32_t   ButtonsReleased = 0;
 
 // Application level decoder status
 static MP3_status_S Status = {
@@ -39,7 +150,6 @@ static MP3_status_S Status = {
     .header           = NULL,
     .bit_rate         = 0,
     .curr_track       = { 0 },
-    .next_track       = NULL,
 };
 
 // Next command packet
@@ -59,90 +169,622 @@ GpioInput sw4(GPIO_PORT1, 29);
 GpioInput sw5(GPIO_PORT1, 19);
 GpioInput sw6(GPIO_PORT1, 20);
 
-// Reverses the buffer from 0 to the specified size
-static void ReverseSegment(uint32_t size_of_segment)
+// Sink for mp3_forward_segment, sends sector data from FatFs straight to the device
+static UINT ForwardToDecoder(const BYTE *data, UINT size)
+{
+    // Keep forwarding as long as nothing has failed, TransferData waits for DREQ on its own
+    if (0 == size)
+    {
+        return (TRANSFER_SUCCESS == ForwardStatus);
+    }
+
+    ForwardStatus = MP3Player.TransferData((uint8_t*)data, size);
+    return (TRANSFER_SUCCESS == ForwardStatus) ? (size) : (0);
+}
+
+// Switches the stream info, the terminal reads it too
+static void SetTrackInfo(const mp3_track_info_S *track_info)
+{
+    taskENTER_CRITICAL();
+    {
+        Stream.track_info = *track_info;
+    }
+    taskEXIT_CRITICAL();
+}
+
+// Takes the stream info of a file the ReaderTask opened, once the first segment read from it turns up
+static void TakeTrackInfo(uint32_t track)
+{
+    mp3_track_info_S track_info;
+    memset(&track_info, 0, sizeof(track_info));
+    if (!reader_get_track_info(track, &track_info))
+    {
+        printf("[MP3Task] Stream info of file %lu is gone, cannot seek or scan in it.\n", track);
+    }
+    SetTrackInfo(&track_info);
+    Stream.track = track;
+}
+
+// Opens the current track, or requests it from the ReaderTask
+static bool StartStream(void)
+{
+    Stream.direct         = DirectModeRequested;
+    Stream.seek_pending   = false;
+    Stream.offset         = 0;
+    Stream.start_us       = sys_get_uptime_us();
+    Stream.awaiting_audio = true;
+    track_list_get_current_track(&Status.curr_track);
+    Mp3Stats.Begin(Status.curr_track.short_name);
+
+    // End fill and clock depend on what the track holds
+    const codec_E codec = Status.curr_track.codec;
+    MP3Player.SetStreamCodec(codec);
+    if (codec_get_info(codec)->patched && '\0' == Plugin[0])
+    {
+        printf("[MP3Task] %s needs its patch, which is not loaded, see 'mp3 plugin'.\n", codec_get_info(codec)->name);
+    }
+
+    // Not known until the file is open
+    mp3_track_info_S track_info;
+    memset(&track_info, 0, sizeof(track_info));
+    Stream.track = 0;
+
+    if (Stream.direct)
+    {
+        // Only one file can be open, the ReaderTask may still be on its way to closing the last stream's
+        // ReaderTask is not streaming, but can still build the seek index in the background
+        reader_wait_idle();
+        Stream.active = mp3_open_file(&Status.curr_track);
+        reader_index(&Status.curr_track);
+
+        // Nothing is read ahead, so only the bit rate matters
+        const uint32_t byte_rate = (Stream.active && mp3_get_track_info(&track_info)) ? (mp3_vbr_get_byte_rate(&track_info.info)) : (0);
+        Stream.segment_size = segment_plan_choose(byte_rate, 0, MP3_RING_ARENA_SIZE, MP3_RING_MAX_DEPTH).size;
+    }
+    else
+    {
+        // Taken from the ReaderTask with the first segment, see AcquireSegment
+        Stream.generation = reader_start(&Status.curr_track);
+        Stream.active     = true;
+    }
+    SetTrackInfo(&track_info);
+    return Stream.active;
+}
+
+// Leaves rewinding or fast forwarding, the stream is continued from Stream.offset
+static void EndScan(void)
+{
+    if (Stream.scanning)
+    {
+        Stream.scanning = false;
+        MP3Player.SetRewindMode(false);
+        printf("[MP3Task] %s through %lu windows.\n", (Scan.forward) ? ("Fast forwarded") : ("Rewound"), Scan.windows);
+    }
+}
+
+// Closes the file, segments still in the ring become stale
+static void StopStream(void)
+{
+    EndScan();
+    Mp3Stats.End();
+    Stream.gap_pending = false;
+    if (Stream.active)
+    {
+        printf("Closing file...\n");
+        (Stream.direct) ? (void)mp3_close_file() : reader_stop();
+        Stream.active = false;
+    }
+}
+
+// Continues the stream from Stream.offset
+static bool SeekStream(void)
+{
+    Stream.seek_pending = false;
+    if (Stream.direct)
+    {
+        return mp3_seek_to_offset(Stream.offset);
+    }
+    else
+    {
+        Stream.generation = reader_seek(&Status.curr_track, Stream.offset);
+        return true;
+    }
+}
+
+// Moves the stream to the frame at or before the requested time
+static void HandleSeekRequest(void)
+{
+    SeekRequested = false;
+
+    // Seeking takes over from rewinding and fast forwarding
+    EndScan();
+    mp3_set_direction(DIR_FORWARD);
+    FastForward = false;
+
+    // Only MP3 is walked frame by frame, a WAV plays at a constant byte rate, the rest only play from the start
+    const codec_info_S *codec = codec_get_info(Status.curr_track.codec);
+    uint32_t offset   = 0;
+    uint32_t frame_ms = 0;
+    if (CODEC_SEEK_NONE == codec->seek)
+    {
+        printf("[MP3Task] Cannot seek in %s, only MP3 and WAV can be seeked in.\n", codec->name);
+    }
+    else if (CODEC_SEEK_BYTES == codec->seek)
+    {
+        Stream.offset       = mp3_track_ms_to_offset(&Stream.track_info, SeekTargetMs);
+        Stream.seek_pending = true;
+        printf("[MP3Task] Seeking to %lu ms, at %lu.\n", SeekTargetMs, Stream.offset);
+    }
+    else if (Stream.direct && mp3_seek_to_ms(SeekTargetMs))
+    {
+        Stream.offset = mp3_get_offset();
+        printf("[MP3Task] Seeked to %lu ms.\n", SeekTargetMs);
+    }
+    else if (!Stream.direct && Mp3Index.Lookup(&Status.curr_track, SeekTargetMs, &offset, &frame_ms))
+    {
+        Stream.offset       = offset;
+        Stream.seek_pending = true;
+        printf("[MP3Task] Seeking to %lu ms, frame at %lu ms.\n", SeekTargetMs, frame_ms);
+    }
+    else
+    {
+        printf("[MP3Task] Cannot seek to %lu ms, track is not indexed that far yet.\n", SeekTargetMs);
+    }
+}
+
+// Loads a plugin and remembers it so it can be loaded again after a reset
+static void LoadPlugin(const char *name)
+{
+    char loading[MAX_NAME_LENGTH] = { 0 };
+    strncpy(loading, name, sizeof(loading) - 1);
+
+    Plugin[0] = '\0';
+    if (plugin_load(loading, &PluginStats))
+    {
+        strcpy(Plugin, loading);
+    }
+    PluginResets = MP3Player.GetResetCount();
+}
+
+// Loads the plugin asked for from the terminal, or the last one again if the device has been reset since
+static void HandlePluginRequest(void)
 {
-    for (uint32_t i=0; i<(size_of_segment/2); i++)
+    if (PluginRequested)
+    {
+        char name[MAX_NAME_LENGTH];
+        taskENTER_CRITICAL();
+        {
+            memcpy(name, PluginRequest, sizeof(name));
+            PluginRequested = false;
+        }
+        taskEXIT_CRITICAL();
+        LoadPlugin(name);
+    }
+    else if ('\0' != Plugin[0] && PluginResets != MP3Player.GetResetCount())
     {
-        uint8_t byte = Buffer[i];
-        Buffer[i] = Buffer[size_of_segment - 1 - i];
-        Buffer[size_of_segment - 1 - i] = byte;
+        printf("[MP3Task] Device was reset, loading %s again.\n", Plugin);
+        LoadPlugin(Plugin);
     }
 }
 
+// Changes stream mode between segments, so SCI_MODE is not written in the middle of a transfer
+static void HandleStreamModeRequest(void)
+{
+    if (StreamModeRequested)
+    {
+        StreamModeRequested = false;
+        MP3Player.SetStreamMode(StreamModeRequest);
+    }
+}
+
+// Stops what is playing and moves on to the next track, for the next button and 'mp3 skip'
+static void SkipTrack(void)
+{
+    if (MP3Player.IsPlaying())
+    {
+        // Stop playback
+        MP3Player.CancelDecoding();
+        StopStream();
+        Status.next_state = PLAY;
+    }
+
+    track_list_next();
+    track_list_get_current_track(&Status.curr_track);
+    printf("Current Track: %s \n", Status.curr_track.short_name);
+}
+
+// Skip and stop from the terminal, the cancel was requested when they were asked for
+static void HandleTransportRequest(void)
+{
+    bool skip = false;
+    bool stop = false;
+    taskENTER_CRITICAL();
+    {
+        skip          = SkipRequested;
+        stop          = StopRequested;
+        SkipRequested = false;
+        StopRequested = false;
+    }
+    taskEXIT_CRITICAL();
+
+    if (skip)
+    {
+        SkipTrack();
+    }
+    else if (stop && PLAY == Status.next_state)
+    {
+        Status.next_state = STOP;
+    }
+}
+
+// Changes the clock between segments, the SPI clock follows CLKI, so it cannot change in the middle of a transfer
+static void HandleClockRequest(void)
+{
+    if (ClockRequested)
+    {
+        bool    governed   = false;
+        uint8_t multiplier = 0;
+        taskENTER_CRITICAL();
+        {
+            governed       = ClockRequestGoverned;
+            multiplier     = ClockRequestMult;
+            ClockRequested = false;
+        }
+        taskEXIT_CRITICAL();
+
+        MP3Player.SetClockGovernor(governed);
+        if (!governed)
+        {
+            MP3Player.SetClockMultiplier(multiplier);
+        }
+    }
+}
+
+// Called right before a segment is sent, measures how long the device went without data
+// The interval between segments of the same track is kept as a reference for the gap
+static void MeasureSegmentSpacing(bool first_of_track)
+{
+    const uint64_t now = sys_get_uptime_us();
+    const uint32_t elapsed_ms = (uint32_t)((now - Stream.last_transfer_us) / 1000);
+
+    if (first_of_track)
+    {
+        Stream.gap_ms = elapsed_ms;
+        printf("[MP3Task] Track transition gap: %lu ms (segment interval %lu ms)\n", Stream.gap_ms, Stream.interval_ms);
+    }
+    else if (0 != Stream.last_transfer_us)
+    {
+        Stream.interval_ms = elapsed_ms;
+    }
+}
+
+// Called right after a segment is sent, measures how long it took the first frame to reach the device
+// Anything in front of it, like an ID3v2 tag that was not skipped, counts towards the time
+static void MeasureTimeToFirstAudio(void)
+{
+    const uint32_t audio_start = Stream.track_info.info.stream_start;
+    if (Stream.awaiting_audio && Stream.offset > audio_start)
+    {
+        Stream.awaiting_audio = false;
+        Stream.first_audio_ms = (uint32_t)((Stream.last_transfer_us - Stream.start_us) / 1000);
+        printf("[MP3Task] Time to first audio: %lu ms, %lu bytes of tags %s\n", Stream.first_audio_ms,
+                audio_start, (mp3_get_skip_tags()) ? ("skipped") : ("streamed"));
+    }
+}
+
+// Takes the next segment of the current stream, stale segments are released on the way
+static segment_slot_S* AcquireSegment(void)
+{
+    segment_slot_S *slot = NULL;
+    while (NULL != (slot = Mp3Ring.AcquireFilled(SegmentWaitTicks)))
+    {
+        if (slot->generation == Stream.generation)
+        {
+            // First segment of a file the reader opened, for this stream or queued up behind it
+            if (slot->track != Stream.track)
+            {
+                TakeTrackInfo(slot->track);
+            }
+            return slot;
+        }
+        Mp3Ring.ReleaseFree(slot);
+    }
+
+    // Reader is behind, the device is only playing off its own FIFO now
+    Mp3Ring.RecordUnderrun();
+    return NULL;
+}
+
+// Starts reading the next scan window
+// Returns false once there are no windows left between the last one and the start, or end, of the track
+static bool StartScanWindow(void)
+{
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+    if (!mp3_reverse_next_window(&Scan, &offset, &size))
+    {
+        return false;
+    }
+
+    if (Stream.direct)
+    {
+        return mp3_seek_to_offset(offset);
+    }
+    Stream.generation = reader_read_window(&Status.curr_track, offset, size);
+    return true;
+}
+
+// Plays the next segment of the scan window, trimmed to whole frames
+static vs1053b_transfer_status_E PlayScanSegment(void)
+{
+    vs1053b_transfer_status_E transfer_status = TRANSFER_SUCCESS;
+    segment_slot_S *slot = NULL;
+    uint8_t *data   = ScanBuffer;
+    uint32_t size   = 0;
+    uint32_t offset = 0;
+    bool     end    = false;
+
+    if (Stream.direct)
+    {
+        offset = mp3_get_offset();
+        const uint32_t request = (Scan.read_end > offset) ? (MIN(MP3_SEGMENT_SIZE, Scan.read_end - offset)) : (0);
+        end = !mp3_read_segment(ScanBuffer, request, &size) || (size < request);
+    }
+    else
+    {
+        if (NULL == (slot = AcquireSegment()))
+        {
+            return TRANSFER_SUCCESS;
+        }
+        data   = slot->data;
+        size   = slot->size;
+        offset = slot->offset;
+        end    = slot->last_segment;
+    }
+
+    uint32_t skip = 0;
+    const uint32_t send = mp3_reverse_trim(&Scan, data, size, offset, &skip);
+    if (send > 0)
+    {
+        MP3Player.StartSegment();
+        transfer_status = MP3Player.TransferData(data + skip, send);
+        transfer_status = MP3Player.FinishSegment(transfer_status, false);
+        Stream.offset   = offset + skip + send;
+    }
+
+    // File ended, or could not be read, before the end of the window
+    if (end && !Scan.done)
+    {
+        Scan.done = true;
+        Scan.cut  = offset + size;
+    }
+
+    if (NULL != slot)
+    {
+        Mp3Ring.ReleaseFree(slot);
+    }
+    return transfer_status;
+}
+
+// Turning on fast forward turns off rewinding and the other way around, see decoder_set_fast_forward
+static bool ScanRequested(bool *forward)
+{
+    *forward = FastForward;
+    return FastForward || DIR_BACKWARD == mp3_get_direction();
+}
+
+// Plays the track backwards, or skips through it forwards, in windows, see mp3_reverse.hpp
+// A window that has started is always played to its end, so the stream continues on a frame boundary
+// Returns false once scanning is over, and the stream continues forward from Stream.offset
+static bool ScanStream(vs1053b_transfer_status_E *transfer_status)
+{
+    *transfer_status = TRANSFER_SUCCESS;
+
+    bool forward = false;
+    const bool requested = ScanRequested(&forward);
+
+    if (!Stream.scanning)
+    {
+        // Windows are cut on frame boundaries, only MP3 is walked frame by frame
+        const mp3_stream_info_S *info = &Stream.track_info.info;
+        const bool framed = (CODEC_SEEK_FRAMES == codec_get_info(Status.curr_track.codec)->seek);
+        if (!framed || !Stream.track_info.valid)
+        {
+            printf("[MP3Task] Cannot scan, %s.\n", (framed) ? ("the stream info is not known yet") : ("only MP3 has frames to cut windows on"));
+            FastForward = false;
+            mp3_set_direction(DIR_FORWARD);
+            return false;
+        }
+
+        if (forward)
+        {
+            mp3_reverse_begin_fast_forward(&Scan, info, Stream.offset, FastForwardRatio);
+        }
+        else
+        {
+            mp3_reverse_begin(&Scan, info, Stream.offset, RewindSpeed);
+            MP3Player.SetRewindMode(true);
+        }
+        Stream.scanning = true;
+    }
+
+    // Switching between rewinding and fast forwarding goes through playing forward for a moment
+    if (Scan.done && (!requested || forward != Scan.forward || !StartScanWindow()))
+    {
+        Stream.offset = Scan.cut;
+        EndScan();
+        return false;
+    }
+
+    *transfer_status = PlayScanSegment();
+    return true;
+}
+
+// Plays the next segment the ReaderTask has read
+// Returns false if no segment was ready yet
+static bool PlayRingSegment(vs1053b_transfer_status_E *transfer_status, bool *last_segment)
+{
+    segment_slot_S *slot = AcquireSegment();
+    if (NULL == slot)
+    {
+        return false;
+    }
+
+    if (slot->failed)
+    {
+        printf("[MP3Task] Segment read failed.\n");
+        *transfer_status = TRANSFER_FAILED;
+    }
+    else
+    {
+        // Reader queued up the next track behind the last one, the device just keeps decoding
+        // AcquireSegment already switched to its stream info, so seeking, scanning and time follow the new track
+        if (slot->track_start)
+        {
+            track_list_next();
+            track_list_get_current_track(&Status.curr_track);
+            printf("[MP3Task] Gapless transition to %s\n", Status.curr_track.short_name);
+            Mp3Stats.Begin(Status.curr_track.short_name);
+        }
+
+        MeasureSegmentSpacing(slot->track_start || Stream.gap_pending);
+        Stream.gap_pending = false;
+
+        Stream.offset = slot->offset + slot->size;
+
+        // Time is taken before the end of stream clean up, so the gap includes it
+        MP3Player.StartSegment();
+        *transfer_status = (slot->size > 0) ? (MP3Player.TransferData(slot->data, slot->size)) : (TRANSFER_SUCCESS);
+        Stream.last_transfer_us = sys_get_uptime_us();
+
+        // Segment cut short for a stop or skip does not end the stream, the stop or skip does
+        *last_segment = slot->last_segment && (TRANSFER_CANCELLED != *transfer_status);
+        MeasureTimeToFirstAudio();
+        *transfer_status = MP3Player.FinishSegment(*transfer_status, *last_segment);
+    }
+
+    Mp3Ring.ReleaseFree(slot);
+    return true;
+}
+
+// Forwards the next segment straight from the FatFs sector buffer to the device
+static bool PlayDirectSegment(vs1053b_transfer_status_E *transfer_status, bool *last_segment)
+{
+    uint32_t forwarded = 0;
+    ForwardStatus = TRANSFER_SUCCESS;
+
+    MeasureSegmentSpacing(Stream.gap_pending);
+    Stream.gap_pending = false;
+
+    MP3Player.StartSegment();
+    if (!mp3_forward_segment(ForwardToDecoder, Stream.segment_size, &forwarded) && TRANSFER_SUCCESS == ForwardStatus)
+    {
+        ForwardStatus = TRANSFER_FAILED;
+    }
+    Stream.last_transfer_us = sys_get_uptime_us();
+
+    // Forward stops early at the end of the file, or when the sink gave up on a failed or cancelled transfer
+    *last_segment = (TRANSFER_SUCCESS == ForwardStatus) && (forwarded < Stream.segment_size);
+    Stream.offset = mp3_get_offset();
+    MeasureTimeToFirstAudio();
+    *transfer_status = MP3Player.FinishSegment(ForwardStatus, *last_segment);
+    return true;
+}
+
 // MP3 state machine
 static void HandleStateLogic(void)
 {
     // Status variables that remain
-    static uint32_t current_segment_size = 0;
-    static bool last_segment 		     = false;
+    static bool last_segment = false;
     static vs1053b_transfer_status_E transfer_status;
 
     switch (Status.next_state)
     {
         case IDLE:
             // Make sure file is not open, for next time transitioning to PLAY state
-            if (mp3_is_file_open())
-            {
-                printf("Closing file...\n");
-                mp3_close_file();
-            }
+            StopStream();
             break;
 
         case PLAY:
-            // Not currently playing, set up playback
-            if (!MP3Player.IsPlaying())
+            // Not currently streaming, set up playback
+            if (!Stream.active)
             {
                 // Reset values to default
                 last_segment = false;
-                // Open mp3 file
-                if (!mp3_open_file(track_list_get_current_track()))
+                if (!StartStream())
                 {
                     Status.next_state = IDLE;
                     break;
                 }
             }
 
-            // If in rewind mode, rewind, and continue
-            if (DIR_BACKWARD == mp3_get_direction())
+            if (SeekRequested)
+            {
+                HandleSeekRequest();
+            }
+
+            // If rewinding or fast forwarding, play the next bit of the window
+            if (DIR_BACKWARD == mp3_get_direction() || FastForward || Stream.scanning)
             {
-                if (!mp3_rewind_segments(3))
+                if (ScanStream(&transfer_status))
                 {
-                    mp3_close_file();
-                    Status.next_state = IDLE;
+                    if (TRANSFER_FAILED == transfer_status)
+                    {
+                        printf("[MP3Task] Scan transfer failed. Stopping playback.\n");
+                        StopStream();
+                        Status.next_state = IDLE;
+                    }
                     break;
                 }
+
+                // Hit the beginning or end of the song, or asked to play normally again, continue from the end of the last window
+                // Turning one of them on turns the other off, so a scan ended to switch direction starts again on the next pass
+                if (Scan.forward)
+                {
+                    FastForward = false;
+                }
                 else
                 {
-                    // No need to read segment, or play segment, when rewinding
-                    break;
+                    mp3_set_direction(DIR_FORWARD);
                 }
+                Stream.seek_pending = true;
             }
 
-            // Read a segment at a time before sending to device
-            mp3_read_segment(Buffer, MP3_SEGMENT_SIZE, &current_segment_size);
-
-            // Set flag if last segment
-            last_segment = (current_segment_size < MP3_SEGMENT_SIZE);
+            // Done scanning, continue reading from where the scan stopped
+            if (Stream.seek_pending && !SeekStream())
+            {
+                StopStream();
+                Status.next_state = IDLE;
+                break;
+            }
 
             // Send segment to device
-            transfer_status = MP3Player.PlaySegment((uint8_t*)Buffer, current_segment_size, last_segment);
-
-            // printf("[MP3Task] Played segment %lu with %lu bytes.\n", segment_counter, current_segment_size);
+            if (Stream.direct)
+            {
+                PlayDirectSegment(&transfer_status, &last_segment);
+            }
+            else if (!PlayRingSegment(&transfer_status, &last_segment))
+            {
+                // ReaderTask has not caught up yet
+                break;
+            }
 
             if (TRANSFER_FAILED == transfer_status)
             {
                 printf("[MP3Task] Segment transfer failed. Stopping playback.\n");
+                StopStream();
                 Status.next_state = IDLE;
+                break;
             }
 
-            // Clean up if last segment
-            if (last_segment) 
+            // Clean up if last segment, only reached when the next track could not be queued up
+            if (last_segment)
             {
-                printf("[MP3Task] Last segment, mp3 file closing...\n");
-                mp3_close_file();
+                printf("[MP3Task] Last segment, moving on to the next track...\n");
+                StopStream();
+                Stream.gap_pending = true;
                 track_list_next();
-                // Status.curr_track = track_list_get_current_track();
+                track_list_get_current_track(&Status.curr_track);
                 printf("Current Track: %s \n", Status.curr_track.short_name);
             }
             break;
@@ -153,12 +795,7 @@ static void HandleStateLogic(void)
             {
                 // Stop playback
                 MP3Player.CancelDecoding();
-
-                if (mp3_is_file_open())
-                {
-                    printf("Closing file...\n");
-                    mp3_close_file();
-                }
+                StopStream();
                 // printf("[MP3Task] No need to cancel, not currently playing.\n");
                 Status.next_state = IDLE;
             }
@@ -169,6 +806,35 @@ static void HandleStateLogic(void)
     }
 }
 
+// Samples the buttons, no more often than ButtonPollTicks, and adds the ones let go to ButtonsReleased
+// Also called by TransferData between bursts, so a stop or skip requests the cancel while a long segment is still
+// being sent, instead of after it, CheckButtons acts on it once the segment is given up
+static void SampleButtons(void)
+{
+    const TickType_t now = xTaskGetTickCount();
+    if (now - ButtonPollTick < ButtonPollTicks)
+    {
+        return;
+    }
+    ButtonPollTick = now;
+
+    // A button counts once it is let go, like the LCDTask, which looks at the same buttons
+    uint32_t held = 0;
+    for (uint32_t i=0; i<sizeof(ButtonPins); i++)
+    {
+        held |= LPC_GPIO1->FIOPIN & (1 << ButtonPins[i]);
+    }
+    const uint32_t released = ButtonsHeld & ~held;
+    ButtonsHeld      = held;
+    ButtonsReleased |= released;
+
+    // Next is a skip, play is a stop while playing
+    if ((released & (1 << 23)) || ((released & (1 << 22)) && PLAY == Status.next_state))
+    {
+        MP3Player.RequestCancel();
+    }
+}
+
 // Check if any buttons are pressed, only one button can be registered at a time
 static void CheckButtons(void)
 {
@@ -214,57 +880,34 @@ static void CheckButtons(void)
     //     Status.next_state = STOP;
     // }
 
-    if (LPC_GPIO1->FIOPIN & (1 << 22))
-    {   
-        DELAY_MS(100);
-        while (LPC_GPIO1->FIOPIN & (1 << 22));
+    SampleButtons();
+    const uint32_t released = ButtonsReleased;
+    ButtonsReleased = 0;
+
+    if (released & (1 << 22))
+    {
         if      (Status.next_state == IDLE || Status.next_state == STOP) Status.next_state = PLAY;
         else if (Status.next_state == PLAY)                              Status.next_state = STOP;
     }
-    else if (LPC_GPIO1->FIOPIN & (1 << 23))
-    {   
-        DELAY_MS(100);
-        while (LPC_GPIO1->FIOPIN & (1 << 23));
-        if (MP3Player.IsPlaying())
-        {
-            // Stop playback
-            MP3Player.CancelDecoding();
-
-            if (mp3_is_file_open())
-            {
-                printf("Closing file...\n");
-                mp3_close_file();
-            }
-            // printf("[MP3Task] No need to cancel, not currently playing.\n");
-            Status.next_state = PLAY;
-        }
-
-        track_list_next();
-        // Status.curr_track = track_list_get_current_track();
-        printf("Current Track: %s \n", Status.curr_track.short_name);
+    else if (released & (1 << 23))
+    {
+        SkipTrack();
     }
-    else if (LPC_GPIO1->FIOPIN & (1 << 28))
-    {   
-        DELAY_MS(100);
-        while (LPC_GPIO1->FIOPIN & (1 << 28));
+    else if (released & (1 << 28))
+    {
+        FastForward = false;
         mp3_set_direction( (DIR_FORWARD == mp3_get_direction()) ? (DIR_BACKWARD) : (DIR_FORWARD) );
     }
-    else if (LPC_GPIO1->FIOPIN & (1 << 29))
-    {   
-        DELAY_MS(100);
-        while (LPC_GPIO1->FIOPIN & (1 << 29));
-        MP3Player.SetFastForwardMode(!MP3Player.GetFastForwardMode());
+    else if (released & (1 << 29))
+    {
+        decoder_set_fast_forward(!FastForward);
     }
-    else if (LPC_GPIO1->FIOPIN & (1 << 19))
-    {   
-        DELAY_MS(100);
-        while (LPC_GPIO1->FIOPIN & (1 << 19));
+    else if (released & (1 << 19))
+    {
         MP3Player.IncrementVolume();
     }
-    else if (LPC_GPIO1->FIOPIN & (1 << 20))
-    {   
-        DELAY_MS(100);
-        while (LPC_GPIO1->FIOPIN & (1 << 20));
+    else if (released & (1 << 20))
+    {
         MP3Player.DecrementVolume();
     }
 }
@@ -288,7 +931,6 @@ static bool CheckRxQueue(void)
 static void ServiceCommand(void)
 {
     uint16_t track_size = 0;
-    bool found = false;
     // If received a command_packet, service
     if (CheckRxQueue())
     {
@@ -313,23 +955,23 @@ static void ServiceCommand(void)
                         Status.next_state = PLAY;
                         break;
                     case PACKET_OPCODE_SET_PLAY_NEXT:
-                        Status.next_track = (const char *)(CommandPacket.command.half_word);
+                        // Two bytes have no room for a name, the command is the index of the track in the list
                         track_size = track_list_get_size();
-                        for (int i=0; i<track_size; i++)
-                        {
-                            if (strcmp(Status.curr_track.short_name, Status.next_track) != 0)
-                            {
-                                found = true;
-                            }
-                            track_list_next();
-                        }
-                        if (!found)
+                        if (CommandPacket.command.half_word >= track_size)
                         {
-                            printf("[MP3Task] Specified track to play not found in playlist: %s\n", Status.next_track);
+                            printf("[MP3Task] Track %u to play is not in the track list of %u.\n",
+                                    CommandPacket.command.half_word, track_size);
                             Status.next_state = IDLE;
                         }
                         else
                         {
+                            // Same as skipping with the button
+                            if (Stream.active)
+                            {
+                                MP3Player.CancelDecoding();
+                                StopStream();
+                            }
+                            track_list_set_current_track(CommandPacket.command.half_word);
                             Status.next_state = PLAY;
                         }
                         break;
@@ -340,7 +982,7 @@ static void ServiceCommand(void)
                         Status.next_state = STOP;
                         break;
                     case PACKET_OPCODE_SET_FAST_FORWARD:
-                        (CommandPacket.command.bytes[0] > 0) ? (MP3Player.SetFastForwardMode(true)) : (MP3Player.SetFastForwardMode(false));
+                        decoder_set_fast_forward(CommandPacket.command.bytes[0] > 0);
                         break;
                     case PACKET_OPCODE_SET_REVERSE:
                         // Don't know how to implement yet
@@ -349,7 +991,11 @@ static void ServiceCommand(void)
                         // CircularBuffer.Shuffle()
                         break;
                     case PACKET_OPCODE_SET_RESET:
+                        // Decoder loses whatever it was playing
+                        StopStream();
                         MP3Player.HardwareReset();
+                        Status.next_state = IDLE;
+                        break;
                     default:
                         LOG_INFO("-------------------------------------------------\n");
                         LOG_ERROR("Received write command packet incorrect opcode: %s\n", 
@@ -417,6 +1063,29 @@ static void ServiceCommand(void)
     }
 }
 
+// Blocks until something wakes the DecoderTask up, and services it
+// Never blocks while playing, AcquireSegment and TransferData already block on the reader and DREQ then,
+// and the stream of the next track is started right away after the last one ends
+static void WaitForEvent(void)
+{
+    TickType_t ticks = (PLAY == Status.next_state) ? (0) : (ButtonPollTicks);
+
+    // Every handle in the set has to be taken off its queue, or the set fills up
+    QueueSetMemberHandle_t event = NULL;
+    while (NULL != (event = xQueueSelectFromSet(DecoderEvents, ticks)))
+    {
+        if (event == MessageRxQueue)
+        {
+            ServiceCommand();
+        }
+        else if (event == DecoderWakeSem)
+        {
+            xSemaphoreTake(DecoderWakeSem, 0);
+        }
+        ticks = 0;
+    }
+}
+
 void InitButtons()
 {
     LPC_GPIO1->FIODIR   &= ~(0x1 << 29);
@@ -427,6 +1096,175 @@ void InitButtons()
     LPC_GPIO1->FIODIR   &= ~(0x1 << 19);
 }
 
+void decoder_set_direct_mode(bool on)
+{
+    DirectModeRequested = on;
+}
+
+bool decoder_get_direct_mode(void)
+{
+    return DirectModeRequested;
+}
+
+bool decoder_is_streaming(void)
+{
+    return Stream.active;
+}
+
+uint32_t decoder_get_transition_gap_ms(void)
+{
+    return Stream.gap_ms;
+}
+
+uint32_t decoder_get_segment_interval_ms(void)
+{
+    return Stream.interval_ms;
+}
+
+uint32_t decoder_get_time_to_first_audio_ms(void)
+{
+    return Stream.first_audio_ms;
+}
+
+uint32_t decoder_get_position_ms(void)
+{
+    mp3_track_info_S track_info;
+    uint32_t offset = 0;
+    taskENTER_CRITICAL();
+    {
+        track_info = Stream.track_info;
+        offset     = Stream.offset;
+    }
+    taskEXIT_CRITICAL();
+    return mp3_track_offset_to_ms(&track_info, offset);
+}
+
+bool decoder_get_track_info(mp3_track_info_S *track_info)
+{
+    taskENTER_CRITICAL();
+    {
+        *track_info = Stream.track_info;
+    }
+    taskEXIT_CRITICAL();
+    return track_info->valid;
+}
+
+void decoder_seek_to_ms(uint32_t ms)
+{
+    SeekTargetMs  = ms;
+    SeekRequested = true;
+    decoder_wake();
+}
+
+void decoder_load_plugin(const char *name)
+{
+    taskENTER_CRITICAL();
+    {
+        strncpy(PluginRequest, name, sizeof(PluginRequest) - 1);
+        PluginRequested = true;
+    }
+    taskEXIT_CRITICAL();
+    decoder_wake();
+}
+
+plugin_load_stats_S decoder_get_plugin_stats(void)
+{
+    return PluginStats;
+}
+
+void decoder_set_stream_mode(bool on)
+{
+    taskENTER_CRITICAL();
+    {
+        StreamModeRequest   = on;
+        StreamModeRequested = true;
+    }
+    taskEXIT_CRITICAL();
+    decoder_wake();
+}
+
+bool decoder_get_stream_mode(void)
+{
+    return (StreamModeRequested) ? (StreamModeRequest) : (MP3Player.IsStreamModeEnabled());
+}
+
+void decoder_set_clock(bool governed, uint8_t multiplier)
+{
+    taskENTER_CRITICAL();
+    {
+        ClockRequestGoverned = governed;
+        ClockRequestMult     = multiplier;
+        ClockRequested       = true;
+    }
+    taskEXIT_CRITICAL();
+    decoder_wake();
+}
+
+void decoder_skip(void)
+{
+    MP3Player.RequestCancel();
+    taskENTER_CRITICAL();
+    {
+        SkipRequested = true;
+    }
+    taskEXIT_CRITICAL();
+    decoder_wake();
+}
+
+void decoder_stop(void)
+{
+    MP3Player.RequestCancel();
+    taskENTER_CRITICAL();
+    {
+        StopRequested = true;
+    }
+    taskEXIT_CRITICAL();
+    decoder_wake();
+}
+
+void decoder_set_rewind_speed(uint32_t speed)
+{
+    RewindSpeed = MAX(MP3_REVERSE_MIN_SPEED, MIN(speed, MP3_REVERSE_MAX_SPEED));
+}
+
+uint32_t decoder_get_rewind_speed(void)
+{
+    return RewindSpeed;
+}
+
+void decoder_set_fast_forward(bool on)
+{
+    FastForward = on;
+    if (on)
+    {
+        mp3_set_direction(DIR_FORWARD);
+    }
+    decoder_wake();
+}
+
+bool decoder_get_fast_forward(void)
+{
+    return FastForward;
+}
+
+void decoder_set_fast_forward_ratio(uint32_t ratio)
+{
+    FastForwardRatio = MAX(MP3_REVERSE_MIN_RATIO, MIN(ratio, MP3_REVERSE_MAX_RATIO));
+}
+
+uint32_t decoder_get_fast_forward_ratio(void)
+{
+    return FastForwardRatio;
+}
+
+void decoder_wake(void)
+{
+    if (NULL != DecoderWakeSem)
+    {
+        xSemaphoreGive(DecoderWakeSem);
+    }
+}
+
 void DecoderTask(void *p)
 {
     // Initialize the SPI
@@ -434,6 +1272,24 @@ void DecoderTask(void *p)
 
     // Initialize the decoder
     MP3Player.SystemInit();
+    MP3Player.SetBurstHook(SampleButtons);
+
+    // Patches are gone after every reset, so the ones for this device are kept on the card and loaded at boot
+    FILINFO boot_plugin = { };
+    if (FR_OK == f_stat("1:" MP3_BOOT_PLUGIN, &boot_plugin))
+    {
+        LoadPlugin(MP3_BOOT_PLUGIN);
+    }
+
+    // Created here rather than in the RxTask, which runs at a lower priority, so it exists before the set is made
+    if (NULL == MessageRxQueue)
+    {
+        MessageRxQueue = xQueueCreate(MESSAGE_RX_QUEUE_DEPTH, sizeof(command_packet_S));
+    }
+    DecoderWakeSem = xSemaphoreCreateBinary();
+    DecoderEvents  = xQueueCreateSet(MESSAGE_RX_QUEUE_DEPTH + 1);
+    xQueueAddToSet(MessageRxQueue, DecoderEvents);
+    xQueueAddToSet(DecoderWakeSem, DecoderEvents);
 
     // Don't start until LCD has selected a song
     PlaySem = xSemaphoreCreateBinary();
@@ -444,8 +1300,12 @@ void DecoderTask(void *p)
     while (1)
     {
         CheckButtons();
+        HandleTransportRequest();
+        HandlePluginRequest();
+        HandleStreamModeRequest();
+        HandleClockRequest();
         HandleStateLogic();
-        // CheckRxQueue();
+        WaitForEvent();
 
         // file_name_S file_names[4] = { 0 };
         // track_list_get4(file_names);
@@ -457,6 +1317,5 @@ void DecoderTask(void *p)
         // printf("4: %s\n", file_names[3].full_name);
 
         // xEventGroupSetBits(watchdog_event_group, WATCHDOG_DECODER_BIT);
-        DELAY_MS(100);
     }
 }
\ No newline at end of file
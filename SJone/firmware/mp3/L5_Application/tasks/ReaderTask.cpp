@@ -0,0 +1,471 @@
+#include "mp3_tasks.hpp"
+#include "segment_ring.hpp"
+#include "frame_index.hpp"
+#include "track_stats.hpp"
+#include "segment_plan.hpp"
+#include "stop_watch.hpp"
+#include <cstring>
+#include <stdio.h>
+
+typedef enum
+{
+    READER_CMD_START,
+    READER_CMD_SEEK,
+    READER_CMD_STOP,
+    READER_CMD_INDEX,
+} reader_command_E;
+
+typedef struct
+{
+    reader_command_E command;
+    uint32_t         generation;    // Generation segments read after this command are tagged with
+    uint32_t         offset;        // Only used by READER_CMD_SEEK
+    uint32_t         size;          // Only used by READER_CMD_SEEK, bytes to read from offset, 0 to read to the end
+    file_name_S      file_name;     // File to open for READER_CMD_START, to seek in for READER_CMD_SEEK, or to index
+} reader_command_S;
+
+typedef struct
+{
+    bool     streaming;     // File is open and there are segments left to read
+    bool     stalled;       // Ring was full the last time a free slot was requested
+    bool     track_start;   // Next segment read is the first one of a track queued up behind the previous one
+    uint32_t generation;    // Generation of the command currently being served
+    uint32_t track;         // Number of the file last opened, the segments read from it are tagged with it
+    uint32_t read_end;      // Reading stops at this offset, 0 to read to the end of the file
+    uint32_t byte_rate;     // Average bytes per second of the track being read, 0 if unknown
+    uint32_t planned_read_us; // Slowest read the segment sizes were chosen for
+    bool     replan;        // A read was slower than planned for, or a track was queued up, the ring is split up again when it can be
+    file_name_S file_name;  // File being read, reopened when seeking after EOF
+} reader_status_S;
+
+// Requests from the DecoderTask
+static QueueHandle_t ReaderQueue = NULL;
+
+// Generation of the latest request, only incremented by the requester
+static volatile uint32_t Generation = 0;
+
+// Generation of the last stream request carried out, signalled on CommandHandled, see reader_wait_idle
+static volatile uint32_t HandledGeneration = 0;
+static SemaphoreHandle_t CommandHandled = NULL;
+
+// Keep streaming into the next track at end of file instead of ending the stream
+static volatile bool Gapless = true;
+
+typedef struct
+{
+    uint32_t         track;     // Number of the file, 0 if none was opened yet
+    mp3_track_info_S info;
+} reader_track_S;
+
+// Stream info of the last files opened, for the DecoderTask to take when their first segment turns up
+// A gapless transition has two files in flight, one more leaves room for a seek into the first of them
+static const uint32_t TrackHistory = 3;
+static reader_track_S Tracks[TrackHistory];
+static SemaphoreHandle_t TracksMutex = NULL;
+
+// Status of the reader, only touched by the ReaderTask
+static reader_status_S Status = {
+    .streaming   = false,
+    .stalled     = false,
+    .track_start = false,
+    .generation  = 0,
+    .track       = 0,
+    .read_end    = 0,
+    .byte_rate   = 0,
+    .planned_read_us = 0,
+    .replan      = false,
+    .file_name   = { },
+};
+
+// Max time to wait for a free slot before checking for new commands again
+static const TickType_t SlotWaitTicks = 10 / portTICK_PERIOD_MS;
+
+// Frames of the seek index walked at a time, between checks for commands and free slots
+static const uint32_t IndexStepFrames = 16;
+
+// Increments the generation and queues the command tagged with it
+static uint32_t SendCommand(reader_command_S *command)
+{
+    taskENTER_CRITICAL();
+    {
+        command->generation = ++Generation;
+    }
+    taskEXIT_CRITICAL();
+
+    xQueueSend(ReaderQueue, command, portMAX_DELAY);
+    return command->generation;
+}
+
+// Hands the decoder an empty slot tagged as failed so it finds out the stream is over
+static void ReportFailure(void)
+{
+    segment_slot_S *slot = Mp3Ring.AcquireFree(portMAX_DELAY);
+    slot->size         = 0;
+    slot->offset       = 0;
+    slot->generation   = Status.generation;
+    slot->track        = Status.track;
+    slot->last_segment = true;
+    slot->failed       = true;
+    Mp3Ring.CommitFilled(slot);
+}
+
+// Splits the ring up for the bit rate of the track and the slowest read so far, see segment_plan.hpp
+// Only works while the decoder is not holding a slot, otherwise it is tried again later
+static void PlanSegments(TickType_t ticks)
+{
+    const uint32_t max_read_us = Mp3Ring.GetStats().max_read_us;
+    const segment_plan_S plan  = segment_plan_choose(Status.byte_rate, max_read_us, MP3_RING_ARENA_SIZE, MP3_RING_MAX_DEPTH);
+
+    Status.replan = !Mp3Ring.Resize(plan.size, plan.depth, ticks);
+    if (!Status.replan)
+    {
+        Status.planned_read_us = max_read_us;
+    }
+}
+
+// Average bit rate of the file that was just opened
+static uint32_t GetByteRate(void)
+{
+    mp3_track_info_S track;
+    return (mp3_get_track_info(&track)) ? (mp3_vbr_get_byte_rate(&track.info)) : (0);
+}
+
+// Numbers the file that was just opened and keeps a copy of its stream info, see reader_get_track_info
+static void PublishTrack(void)
+{
+    ++Status.track;
+    reader_track_S *entry = &Tracks[Status.track % TrackHistory];
+
+    xSemaphoreTake(TracksMutex, portMAX_DELAY);
+    entry->track = Status.track;
+    mp3_get_track_info(&entry->info);
+    xSemaphoreGive(TracksMutex);
+}
+
+// Closes the file if it is open and stops reading
+static void StopStreaming(void)
+{
+    if (mp3_is_file_open())
+    {
+        mp3_close_file();
+    }
+    Status.streaming = false;
+}
+
+// Carries out a single command
+// Returns false if the stream could not be continued and the decoder needs to be told
+static bool HandleCommand(reader_command_S *command)
+{
+    // Everything read before this command is stale, take the slots back instead of waiting for the decoder
+    Mp3Ring.Flush();
+    Status.generation = command->generation;
+    Status.read_end   = 0;
+
+    switch (command->command)
+    {
+        case READER_CMD_START:
+            StopStreaming();
+            Status.track_start = false;
+            Status.file_name   = command->file_name;
+            Status.streaming   = mp3_open_file(&Status.file_name);
+            if (Status.streaming)
+            {
+                PublishTrack();
+                Status.byte_rate = GetByteRate();
+                PlanSegments(SlotWaitTicks);
+                Mp3Index.Begin(&Status.file_name);
+            }
+            return Status.streaming;
+
+        case READER_CMD_SEEK:
+            // Reader may have moved on to the next track already, the decoder has not
+            Status.track_start = false;
+            if (0 != strcmp(Status.file_name.full_name, command->file_name.full_name))
+            {
+                StopStreaming();
+                Status.file_name = command->file_name;
+            }
+
+            // File is closed at EOF, but the decoder may still want to go back
+            if (!mp3_is_file_open())
+            {
+                if (!mp3_open_file(&Status.file_name))
+                {
+                    return false;
+                }
+                PublishTrack();
+            }
+            Status.streaming = mp3_seek_to_offset(command->offset);
+            Status.read_end  = (command->size > 0) ? (command->offset + command->size) : (0);
+            if (Status.replan)
+            {
+                PlanSegments(SlotWaitTicks);
+            }
+            if (!Status.streaming)
+            {
+                StopStreaming();
+            }
+            return Status.streaming;
+
+        case READER_CMD_STOP:
+            StopStreaming();
+            return true;
+
+        case READER_CMD_INDEX:
+            // Never reaches here, handled without touching the stream
+            return true;
+    }
+
+    return true;
+}
+
+// Opens the track after the current one so its segments follow right behind
+// Returns false if there is no next track to stream into
+static bool QueueNextTrack(void)
+{
+    // A window ending at the end of the file is not followed by anything
+    // Only a stream of frames can run into the next one, and only if the decoder does not have to start over for it
+    file_name_S next;
+    if (!Gapless || 0 != Status.read_end || !track_list_get_track_after(&Status.file_name, &next) ||
+        !codec_get_info(Status.file_name.codec)->gapless || next.codec != Status.file_name.codec)
+    {
+        return false;
+    }
+
+    mp3_close_file();
+    Status.file_name = next;
+    if (!mp3_open_file(&Status.file_name))
+    {
+        return false;
+    }
+
+    // Slots of the last track are still in flight, the ring is split up for this one once they are back
+    // Its stream info is kept next to the last track's, the decoder switches to it with the first slot
+    PublishTrack();
+    Status.track_start = true;
+    Status.byte_rate   = GetByteRate();
+    Status.replan      = true;
+    Mp3Index.Begin(&Status.file_name);
+    return true;
+}
+
+// Reads the next segment of the file into the slot and passes it on to the decoder
+static void ReadSegment(segment_slot_S *slot)
+{
+    MicroSecondStopWatch timer;
+
+    slot->offset = mp3_get_offset();
+
+    // After a seek the first read only goes up to the next sector, so the ones after it are whole sectors
+    // FatFs reads those straight into the slot, only partial sectors go through the volume's one sector
+    // buffer, which the seek index and the scanner share with _FS_TINY
+    uint32_t request = slot->capacity - (slot->offset % _MAX_SS);
+
+    // A window can start at or past the end of the file, which the seek clamps to, then there is nothing to read
+    if (0 != Status.read_end)
+    {
+        request = (slot->offset < Status.read_end) ? (MIN(request, Status.read_end - slot->offset)) : (0);
+    }
+
+    slot->generation   = Status.generation;
+    slot->track        = Status.track;
+    slot->track_start  = Status.track_start;
+    slot->size         = 0;
+    slot->failed       = (request > 0) && !mp3_read_segment(slot->data, request, &slot->size);
+    slot->last_segment = slot->failed || (slot->size < request);
+    Status.track_start = false;
+
+    // End of file is only the end of the stream if no track follows
+    if (slot->last_segment && !slot->failed && QueueNextTrack())
+    {
+        slot->last_segment = false;
+    }
+
+    const uint32_t read_us = (uint32_t)timer.getElapsedTime();
+    Mp3Ring.RecordReadTime(read_us);
+    Mp3Stats.RecordRead(read_us);
+
+    // Read ahead was chosen for faster reads than this
+    if (read_us > Status.planned_read_us * 3 / 2)
+    {
+        Status.replan = true;
+    }
+
+    // Nothing left to read, file can be closed before the decoder is done with it
+    if (slot->last_segment)
+    {
+        StopStreaming();
+    }
+    // Window is read, file stays open for the next one
+    else if (0 != Status.read_end && (0 == request || slot->offset + slot->size >= Status.read_end))
+    {
+        Status.streaming = false;
+    }
+
+    Mp3Ring.CommitFilled(slot);
+}
+
+void reader_init(void)
+{
+    Mp3Ring.Init();
+    Mp3Index.Init();
+    ReaderQueue = xQueueCreate(4, sizeof(reader_command_S));
+    TracksMutex = xSemaphoreCreateMutex();
+    CommandHandled = xSemaphoreCreateBinary();
+}
+
+uint32_t reader_start(file_name_S *file_name)
+{
+    reader_command_S command = { };
+    command.command   = READER_CMD_START;
+    command.file_name = *file_name;
+    return SendCommand(&command);
+}
+
+uint32_t reader_seek(file_name_S *file_name, uint32_t offset)
+{
+    reader_command_S command = { };
+    command.command   = READER_CMD_SEEK;
+    command.offset    = offset;
+    command.file_name = *file_name;
+    return SendCommand(&command);
+}
+
+uint32_t reader_read_window(file_name_S *file_name, uint32_t offset, uint32_t size)
+{
+    reader_command_S command = { };
+    command.command   = READER_CMD_SEEK;
+    command.offset    = offset;
+    command.size      = size;
+    command.file_name = *file_name;
+    return SendCommand(&command);
+}
+
+void reader_stop(void)
+{
+    reader_command_S command = { };
+    command.command = READER_CMD_STOP;
+    SendCommand(&command);
+}
+
+void reader_index(file_name_S *file_name)
+{
+    // Not a stream request, so the generation is left alone
+    reader_command_S command = { };
+    command.command   = READER_CMD_INDEX;
+    command.file_name = *file_name;
+    xQueueSend(ReaderQueue, &command, portMAX_DELAY);
+}
+
+void reader_wait_idle(void)
+{
+    // Every request bumps the generation and they are carried out in order, so only the latest matters
+    while (HandledGeneration != Generation)
+    {
+        xSemaphoreTake(CommandHandled, SlotWaitTicks);
+    }
+}
+
+uint32_t reader_get_generation(void)
+{
+    return Generation;
+}
+
+bool reader_get_track_info(uint32_t track, mp3_track_info_S *info)
+{
+    const reader_track_S *entry = &Tracks[track % TrackHistory];
+
+    xSemaphoreTake(TracksMutex, portMAX_DELAY);
+    const bool found = (0 != track && entry->track == track);
+    if (found)
+    {
+        *info = entry->info;
+    }
+    xSemaphoreGive(TracksMutex);
+    return found;
+}
+
+void reader_set_gapless(bool on)
+{
+    Gapless = on;
+}
+
+bool reader_get_gapless(void)
+{
+    return Gapless;
+}
+
+void ReaderTask(void *p)
+{
+    reader_command_S command;
+    segment_slot_S *slot = NULL;
+
+    // Main loop
+    while (1)
+    {
+        // Nothing to read or index, sleep until a command arrives
+        const bool indexing = Mp3Index.IsBuilding();
+        const TickType_t command_wait = (Status.streaming || indexing) ? (0) : (portMAX_DELAY);
+
+        // Commands always take priority over reading
+        if (xQueueReceive(ReaderQueue, &command, command_wait))
+        {
+            if (READER_CMD_INDEX == command.command)
+            {
+                Mp3Index.Begin(&command.file_name);
+            }
+            else
+            {
+                if (!HandleCommand(&command))
+                {
+                    ReportFailure();
+                }
+                HandledGeneration = command.generation;
+                xSemaphoreGive(CommandHandled);
+            }
+            continue;
+        }
+
+        // Only indexing, give the lower priority tasks a turn between steps
+        if (!Status.streaming)
+        {
+            Mp3Index.Step(IndexStepFrames);
+            DELAY_MS(1);
+            continue;
+        }
+
+        // Ring has run dry, which is when the decoder is most likely to have given every slot back
+        if (Status.replan && 0 == Mp3Ring.GetFillLevel())
+        {
+            PlanSegments(0);
+        }
+
+        // Wait for the decoder to free a slot, but keep checking for commands
+        slot = Mp3Ring.AcquireFree(0);
+        if (!slot)
+        {
+            if (!Status.stalled)
+            {
+                Mp3Ring.RecordReaderStall();
+                Status.stalled = true;
+            }
+
+            // Ring is full, which leaves time to work on the seek index
+            if (indexing)
+            {
+                Mp3Index.Step(IndexStepFrames);
+                DELAY_MS(1);
+                continue;
+            }
+
+            slot = Mp3Ring.AcquireFree(SlotWaitTicks);
+            if (!slot)
+            {
+                continue;
+            }
+        }
+        Status.stalled = false;
+
+        ReadSegment(slot);
+    }
+}
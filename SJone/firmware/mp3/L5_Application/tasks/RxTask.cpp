@@ -5,12 +5,15 @@
 #define UART (Uart3::getInstance())
 
 
-QueueHandle_t MessageRxQueue;
+QueueHandle_t MessageRxQueue = NULL;
 
 void RxTask(void *p)
 {
-    // Create queue
-    MessageRxQueue = xQueueCreate(3, sizeof(command_packet_S));
+    // Create queue, unless the DecoderTask already has
+    if (NULL == MessageRxQueue)
+    {
+        MessageRxQueue = xQueueCreate(MESSAGE_RX_QUEUE_DEPTH, sizeof(command_packet_S));
+    }
 
     // Packet that iteratively stores byte by byte
     command_packet_S command_packet = { 0 };
@@ -41,6 +44,12 @@ void RxTask(void *p)
                     // Do nothing, keep going
                     break;
                 case PARSER_COMPLETE:
+                    // Stop and play next cancel what is playing, which is timed from when they arrive
+                    if (PACKET_TYPE_COMMAND_WRITE == command_packet.type &&
+                       (PACKET_OPCODE_SET_STOP == command_packet.opcode || PACKET_OPCODE_SET_PLAY_NEXT == command_packet.opcode))
+                    {
+                        MP3Player.RequestCancel();
+                    }
                     // Send to receive queue (wait indefinite)
                     xQueueSend(MessageRxQueue, &command_packet, 1 / portTICK_PERIOD_MS);
                     break;
@@ -0,0 +1,14 @@
+#include "mp3_tasks.hpp"
+#include <stdio.h>
+
+void ScannerTask(void *p)
+{
+    track_list_scan();
+    printf("[ScannerTask] Library is complete %lu ms after boot.\n", (uint32_t)(sys_get_uptime_us() / 1000));
+
+    // Tasks are never deleted, see INCLUDE_vTaskDelete
+    while (1)
+    {
+        vTaskSuspend(NULL);
+    }
+}
@@ -5,7 +5,7 @@
 #define UART (Uart3::getInstance())
 
 
-QueueHandle_t MessageTxQueue;
+QueueHandle_t MessageTxQueue = NULL;
 
 void TxTask(void *p)
 {
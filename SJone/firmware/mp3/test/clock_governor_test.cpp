@@ -0,0 +1,72 @@
+#include "catch.hpp"
+#include "clock_governor.hpp"
+
+// Frame header bytes for a version and layer, with the bit rate and sample rate indexes and channel mode
+static mp3_frame_header_S Header(uint8_t version_layer, uint8_t bit_rate_index, uint8_t sample_rate_index, uint8_t channel_mode)
+{
+    const uint8_t bytes[4] = { 0xFF, version_layer, (uint8_t)((bit_rate_index << 4) | (sample_rate_index << 2)),
+                               (uint8_t)(channel_mode << 6) };
+    mp3_frame_header_S header;
+    REQUIRE(mp3_frame_parse_header(bytes, &header));
+    return header;
+}
+
+// MPEG 1 Layer III, and MPEG 2 Layer III
+static const uint8_t Mpeg1Layer3 = 0xFB;
+static const uint8_t Mpeg2Layer3 = 0xF3;
+
+TEST_CASE("Clock follows what the stream needs to decode", "[clock_governor]")
+{
+    SECTION("Lowest multiplier with enough cycles, and nothing lower would do")
+    {
+        static const uint8_t bit_rates[] = { 1, 5, 9, 11, 14 };
+        for (uint32_t i=0; i<sizeof(bit_rates); i++)
+        {
+            for (uint8_t sample_rate=0; sample_rate<3; sample_rate++)
+            {
+                const mp3_frame_header_S header = Header(Mpeg1Layer3, bit_rates[i], sample_rate, 0);
+                const uint8_t multiplier = clock_governor_choose(&header, 1);
+                INFO(header.bit_rate << " bps at " << header.sample_rate << " Hz : SC_MULT " << (int)multiplier);
+
+                const uint64_t cycles = 2ULL * header.sample_rate * 120 + header.bit_rate * 30ULL + CLOCK_GOVERNOR_BASE_HZ;
+                CHECK(clock_governor_clki_hz(multiplier) * 100ULL >= cycles * CLOCK_GOVERNOR_HEADROOM_PCT);
+                if (multiplier > CLOCK_GOVERNOR_MIN_MULT)
+                {
+                    CHECK(clock_governor_clki_hz(multiplier - 1) * 100ULL < cycles * CLOCK_GOVERNOR_HEADROOM_PCT);
+                }
+            }
+        }
+    }
+
+    SECTION("Typical tracks run below the fixed 3.0x of SystemInit")
+    {
+        const mp3_frame_header_S common  = Header(Mpeg1Layer3, 9, 0, 1);
+        const mp3_frame_header_S highest = Header(Mpeg1Layer3, 14, 1, 0);
+        const mp3_frame_header_S speech  = Header(Mpeg2Layer3, 4, 0, 3);
+
+        CHECK(clock_governor_choose(&common, 1)  == 1);
+        CHECK(clock_governor_choose(&highest, 1) == CLOCK_GOVERNOR_DEFAULT_MULT);
+        CHECK(clock_governor_choose(&speech, 1)  == CLOCK_GOVERNOR_MIN_MULT);
+    }
+
+    SECTION("Faster playback raises the clock, up to what the crystal allows")
+    {
+        const mp3_frame_header_S header = Header(Mpeg1Layer3, 9, 0, 1);
+        CHECK(clock_governor_choose(&header, 2) > clock_governor_choose(&header, 1));
+
+        const mp3_frame_header_S highest = Header(Mpeg1Layer3, 14, 1, 0);
+        CHECK(clock_governor_choose(&highest, 4) == CLOCK_GOVERNOR_MAX_MULT);
+        CHECK(clock_governor_clki_hz(CLOCK_GOVERNOR_MAX_MULT) <= 55300000);
+    }
+
+    SECTION("Unknown stream runs at the default")
+    {
+        CHECK(clock_governor_choose(NULL, 1) == CLOCK_GOVERNOR_DEFAULT_MULT);
+    }
+
+    SECTION("SPI clock is a seventh of CLKI")
+    {
+        CHECK(clock_governor_spi_max_hz(0) == 12288000 / 7);
+        CHECK(clock_governor_spi_max_hz(3) == 36864000 / 7);
+    }
+}
@@ -0,0 +1,179 @@
+#include "catch.hpp"
+#include "codec.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+
+// First CODEC_SNIFF_SIZE bytes of a file, padded with bytes that look like nothing in particular
+static std::vector<uint8_t> File(const uint8_t *bytes, size_t size, uint8_t fill = 0x55)
+{
+    std::vector<uint8_t> file(bytes, bytes + size);
+    file.resize(CODEC_SNIFF_SIZE, fill);
+    return file;
+}
+
+static std::vector<uint8_t> File(const std::string &text, uint8_t fill = 0x55)
+{
+    return File((const uint8_t*)text.data(), text.size(), fill);
+}
+
+// Sniffs the way the track list does, again after an ID3v2 tag
+static codec_E Sniff(const std::vector<uint8_t> &file)
+{
+    uint32_t tag_size = 0;
+    const codec_E codec = codec_sniff(&file[0], CODEC_SNIFF_SIZE, &tag_size);
+    if (tag_size > 0 && tag_size + CODEC_SNIFF_SIZE <= file.size())
+    {
+        return codec_sniff(&file[tag_size], CODEC_SNIFF_SIZE, &tag_size);
+    }
+    return codec;
+}
+
+static const uint8_t Mp3Frame[]  = { 0xFF, 0xFB, 0x90, 0x64 };
+static const uint8_t Mp2Frame[]  = { 0xFF, 0xFD, 0x94, 0x04 };
+static const uint8_t AdtsFrame[] = { 0xFF, 0xF1, 0x50, 0x80, 0x2E, 0x7F, 0xFC };
+static const uint8_t AsfHeader[] = { 0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11, 0xA6, 0xD9, 0x00, 0xAA, 0x00, 0x62, 0xCE, 0x6C };
+
+// Canonical 44 byte header of 16 bit stereo at 44100 Hz, with a LIST chunk in front of the samples
+static std::vector<uint8_t> WavHeader(uint32_t list_size)
+{
+    std::vector<uint8_t> wav;
+    const uint8_t riff[] = { 'R','I','F','F', 0,0,0,0, 'W','A','V','E',
+                             'f','m','t',' ', 16,0,0,0, 1,0, 2,0, 0x44,0xAC,0,0, 0x10,0xB1,0x02,0, 4,0, 16,0 };
+    wav.insert(wav.end(), riff, riff + sizeof(riff));
+    if (list_size > 0)
+    {
+        const uint8_t list[] = { 'L','I','S','T', (uint8_t)list_size,0,0,0 };
+        wav.insert(wav.end(), list, list + sizeof(list));
+        wav.resize(wav.size() + list_size + (list_size & 1), 'x');
+    }
+    const uint8_t data[] = { 'd','a','t','a', 0x00,0x10,0,0 };
+    wav.insert(wav.end(), data, data + sizeof(data));
+    return wav;
+}
+
+TEST_CASE("Codec is told from the first bytes of a file", "[codec]")
+{
+    SECTION("Mixed corpus")
+    {
+        const std::vector<uint8_t> wav = WavHeader(0);
+
+        CHECK(CODEC_MP3  == Sniff(File(Mp3Frame, sizeof(Mp3Frame))));
+        CHECK(CODEC_MP3  == Sniff(File(Mp2Frame, sizeof(Mp2Frame))));
+        CHECK(CODEC_AAC  == Sniff(File(AdtsFrame, sizeof(AdtsFrame))));
+        CHECK(CODEC_AAC  == Sniff(File("ADIF")));
+        CHECK(CODEC_M4A  == Sniff(File(std::string("\0\0\0\x20" "ftypM4A \0\0\0\0", 16))));
+        CHECK(CODEC_OGG  == Sniff(File(std::string("OggS\0\x02", 6) + std::string(22, '\0') + "\x01vorbis")));
+        CHECK(CODEC_WMA  == Sniff(File(AsfHeader, sizeof(AsfHeader))));
+        CHECK(CODEC_WAV  == Sniff(File(&wav[0], wav.size())));
+        CHECK(CODEC_FLAC == Sniff(File("fLaC\0\0\0\x22")));
+        CHECK(CODEC_MIDI == Sniff(File(std::string("MThd\0\0\0\x06", 8))));
+    }
+
+    SECTION("Frames after zero padding, but not after anything else")
+    {
+        std::vector<uint8_t> padded(20, 0x00);
+        padded.insert(padded.end(), Mp3Frame, Mp3Frame + sizeof(Mp3Frame));
+        CHECK(CODEC_MP3 == Sniff(File(&padded[0], padded.size())));
+
+        padded[3] = 0x12;
+        CHECK(CODEC_UNKNOWN == Sniff(File(&padded[0], padded.size())));
+    }
+
+    SECTION("Anything behind an ID3v2 tag is sniffed after it")
+    {
+        // Tag of 0x0101 = 129 bytes after its header, with a footer
+        std::vector<uint8_t> flac = File(std::string("ID3\x04\0\x10\0\0\x01\x01", 10));
+        flac.resize(10 + 129 + 10, 0);
+        flac.insert(flac.end(), (const uint8_t*)"fLaC", (const uint8_t*)"fLaC" + 4);
+        flac.resize(flac.size() + CODEC_SNIFF_SIZE, 0);
+
+        uint32_t tag_size = 0;
+        CHECK(CODEC_UNKNOWN == codec_sniff(&flac[0], CODEC_SNIFF_SIZE, &tag_size));
+        CHECK(tag_size == 10 + 129 + 10);
+        CHECK(CODEC_FLAC == Sniff(flac));
+
+        std::vector<uint8_t> mp3 = File(std::string("ID3\x03\0\0\0\0\0\x10", 10));
+        mp3.resize(26, 0);
+        mp3.insert(mp3.end(), Mp3Frame, Mp3Frame + sizeof(Mp3Frame));
+        mp3.resize(mp3.size() + CODEC_SNIFF_SIZE, 0);
+        CHECK(CODEC_MP3 == Sniff(mp3));
+    }
+
+    SECTION("Files the VS1053b does not decode")
+    {
+        std::vector<uint8_t> broken_tag = File(std::string("ID3\x03\0\0\0\0\x80\x10", 10));
+        uint32_t tag_size = 0;
+        CHECK(CODEC_UNKNOWN == codec_sniff(&broken_tag[0], CODEC_SNIFF_SIZE, &tag_size));
+        CHECK(0 == tag_size);
+
+        CHECK(CODEC_UNKNOWN == Sniff(File(std::string("OggS\0\x02", 6) + std::string(22, '\0') + "OpusHead")));
+        CHECK(CODEC_UNKNOWN == Sniff(File("RIFF\0\0\0\0AVI LIST")));
+        CHECK(CODEC_UNKNOWN == Sniff(File("Just a text file, nothing to play here")));
+        CHECK(CODEC_UNKNOWN == Sniff(File("\xFF\xD8\xFF\xE0\0\x10JFIF")));
+        CHECK(CODEC_UNKNOWN == Sniff(File(std::string(CODEC_SNIFF_SIZE, '\0'), 0)));
+        CHECK(CODEC_UNKNOWN == Sniff(File("\xFF\xF1\x3C\x80")));
+    }
+
+    SECTION("Short files only look at what is there")
+    {
+        uint32_t tag_size = 0;
+        CHECK(CODEC_UNKNOWN == codec_sniff(Mp3Frame, 3, &tag_size));
+        CHECK(CODEC_MP3     == codec_sniff(Mp3Frame, 4, &tag_size));
+        CHECK(CODEC_UNKNOWN == codec_sniff((const uint8_t*)"fLa", 3, &tag_size));
+        CHECK(CODEC_UNKNOWN == codec_sniff((const uint8_t*)"", 0, &tag_size));
+    }
+}
+
+TEST_CASE("Every codec is handled its own way", "[codec]")
+{
+    CHECK(codec_get_info(CODEC_FLAC)->end_fill_size > codec_get_info(CODEC_MP3)->end_fill_size);
+    CHECK(codec_get_info(CODEC_FLAC)->patched);
+    CHECK(CODEC_SEEK_FRAMES == codec_get_info(CODEC_MP3)->seek);
+    CHECK(CODEC_SEEK_BYTES  == codec_get_info(CODEC_WAV)->seek);
+    CHECK(CODEC_SEEK_NONE   == codec_get_info(CODEC_M4A)->seek);
+    CHECK(codec_get_info(CODEC_MP3)->gapless);
+    CHECK_FALSE(codec_get_info(CODEC_OGG)->trailing_tags);
+    CHECK(codec_get_info((codec_E)200) == codec_get_info(CODEC_UNKNOWN));
+
+    for (int codec=0; codec<CODEC_COUNT; codec++)
+    {
+        CHECK(codec_get_info((codec_E)codec)->end_fill_size >= 2052);
+        CHECK(NULL != codec_get_info((codec_E)codec)->name);
+    }
+}
+
+TEST_CASE("WAV header is walked up to the samples", "[codec]")
+{
+    codec_wav_S wav;
+
+    SECTION("Canonical header")
+    {
+        const std::vector<uint8_t> header = WavHeader(0);
+        REQUIRE(codec_parse_wav(&header[0], header.size(), &wav));
+        CHECK(wav.sample_rate == 44100);
+        CHECK(wav.byte_rate   == 176400);
+        CHECK(wav.block_align == 4);
+        CHECK(wav.data_start  == 44);
+        CHECK(wav.data_bytes  == 0x1000);
+    }
+
+    SECTION("Chunks in front of the samples, padded to an even size")
+    {
+        const std::vector<uint8_t> header = WavHeader(27);
+        REQUIRE(codec_parse_wav(&header[0], header.size(), &wav));
+        CHECK(wav.data_start == 44 + 8 + 28);
+    }
+
+    SECTION("Samples past the buffer, or no format")
+    {
+        const std::vector<uint8_t> header = WavHeader(0);
+        CHECK_FALSE(codec_parse_wav(&header[0], 40, &wav));
+
+        std::vector<uint8_t> no_format(header.begin(), header.begin() + 12);
+        no_format.insert(no_format.end(), header.begin() + 36, header.end());
+        CHECK_FALSE(codec_parse_wav(&no_format[0], no_format.size(), &wav));
+
+        CHECK_FALSE(codec_parse_wav((const uint8_t*)"RIFF\0\0\0\0AVI ", 12, &wav));
+    }
+}
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "id3_tag.hpp"
+
+/**
+ *  @explanation:
+ *  Parses a corpus of ID3v2 tags the way mp3_read_tags does, asking for the bytes the parser wants and
+ *  nothing else, and prints per version how many bytes and reads every file took, how many 512 byte sectors
+ *  that touched, and how long the parse itself took on this machine.  Sectors are counted the way FatFs
+ *  with _FS_TINY reads, a sector is read again whenever a read lands on another one than the last.  The
+ *  time on the SD card is worked out from that, next to reading the whole tag in one go.
+ *
+ *  Generated tags are checked against the title, artist and genre they were written with.  They are v2.2,
+ *  v2.3 and v2.4 in ISO-8859-1, UTF-16 and UTF-8, half of them with album art of 20 to 500 KB in front
+ *  of or behind the text frames, some unsynchronised, some v2.4 tags with plain sizes like older iTunes
+ *  wrote, padded with up to 4 KB, and a few files without a tag.
+ *
+ *  @usage:
+ *  id3_bench [-n files] [-r read_us] [-d sd_kbps] [-v] [file.mp3...]
+ *      -n   : Tags to generate, 2000 by default
+ *      -r   : Microseconds every SD card read takes before the first byte, 500 by default
+ *      -d   : Kilobytes per second the SD card moves after that, 1000 by default
+ *      -v   : Print what was found in every file
+ *      file : Parse these instead, only as much of each as the parser asks for is kept
+ */
+
+#define SECTOR_SIZE (512)
+
+typedef std::vector<uint8_t> Bytes;
+
+typedef struct
+{
+    std::string name;
+    Bytes       bytes;
+    uint32_t    size;       // Size of the file, which is more than bytes for the files given on the command line
+    uint8_t     version;    // Written with, 0 for no tag
+    bool        checked;    // Title, artist and genre are known
+    std::string fields[ID3_TAG_FIELD_COUNT];
+} corpus_file_S;
+
+typedef struct
+{
+    uint32_t files;
+    uint64_t tag_bytes;
+    uint64_t bytes_read;
+    uint32_t max_bytes_read;
+    uint64_t reads;
+    uint64_t sectors;
+    uint64_t parse_ns;
+    double   card_us;
+    double   whole_tag_us;
+    uint32_t found;         // Fields found
+    uint32_t wrong;         // Fields found that are not what was written
+} bench_stats_S;
+
+static uint32_t Random(uint32_t low, uint32_t high)
+{
+    return low + (uint32_t)(rand() % (high - low + 1));
+}
+
+static void PutSize(Bytes &bytes, uint32_t size, uint32_t count, bool syncsafe)
+{
+    for (int i=count-1; i>=0; i--)
+    {
+        bytes.push_back((syncsafe) ? ((size >> (7 * i)) & 0x7F) : ((size >> (8 * i)) & 0xFF));
+    }
+}
+
+// Text in the encodings taggers use for the version, with a terminator like most of them write
+static Bytes EncodeText(uint8_t version, const std::string &text)
+{
+    const uint32_t pick = Random(0, 9);
+    const uint8_t encoding = (4 == version && pick < 6) ? (3) : ((pick < 5) ? (0) : ((4 == version && pick == 9) ? (2) : (1)));
+
+    Bytes body(1, encoding);
+    if (0 == encoding || 3 == encoding)
+    {
+        for (size_t i=0; i<=text.size(); i++)
+        {
+            body.push_back((i < text.size()) ? (text[i]) : (0));
+        }
+        return body;
+    }
+
+    const bool big_endian = (2 == encoding) || (0 == Random(0, 3));
+    if (1 == encoding)
+    {
+        body.push_back((big_endian) ? (0xFE) : (0xFF));
+        body.push_back((big_endian) ? (0xFF) : (0xFE));
+    }
+    for (size_t i=0; i<=text.size(); i++)
+    {
+        const uint8_t c = (i < text.size()) ? (text[i]) : (0);
+        body.push_back((big_endian) ? (0) : (c));
+        body.push_back((big_endian) ? (c) : (0));
+    }
+    return body;
+}
+
+static Bytes Frame(uint8_t version, const char *id, const Bytes &body, bool plain_size)
+{
+    Bytes frame(id, id + ((2 == version) ? (3) : (4)));
+    if (2 == version)
+    {
+        PutSize(frame, body.size(), 3, false);
+    }
+    else
+    {
+        PutSize(frame, body.size(), 4, 4 == version && !plain_size);
+        frame.push_back(0);
+        frame.push_back(0);
+    }
+    frame.insert(frame.end(), body.begin(), body.end());
+    return frame;
+}
+
+static std::string Word(uint32_t length)
+{
+    std::string word;
+    for (uint32_t i=0; i<length; i++)
+    {
+        word.push_back((0 == i) ? ('A' + Random(0, 25)) : ('a' + Random(0, 25)));
+    }
+    return word;
+}
+
+static void Generate(corpus_file_S &file, uint32_t number)
+{
+    const uint32_t pick = Random(0, 99);
+    file.version = (pick < 5) ? (0) : ((pick < 15) ? (2) : ((pick < 70) ? (3) : (4)));
+    file.checked = true;
+    file.name    = "generated " + std::to_string(number);
+    file.fields[ID3_TAG_TITLE]  = Word(Random(3, 12)) + " " + Word(Random(3, 12));
+    file.fields[ID3_TAG_ARTIST] = Word(Random(4, 20));
+    file.fields[ID3_TAG_GENRE]  = (0 == Random(0, 1)) ? ("(" + std::to_string(Random(0, 191)) + ")") : (Word(Random(3, 10)));
+
+    const uint8_t audio[] = { 0xFF, 0xFB, 0x90, 0x64 };
+    if (0 == file.version)
+    {
+        file.bytes.assign(audio, audio + sizeof(audio));
+        file.bytes.resize(SECTOR_SIZE, 0x55);
+        file.size = Random(3, 8) * 1024 * 1024;
+        for (uint32_t i=0; i<ID3_TAG_FIELD_COUNT; i++) file.fields[i].clear();
+        return;
+    }
+
+    const uint8_t v = file.version;
+    const bool plain  = (4 == v) && (0 == Random(0, 9));
+    const bool unsync = (4 != v) && (0 == Random(0, 19));
+    static const char *Ids[][2] = { { "TT2", "TIT2" }, { "TP1", "TPE1" }, { "TCO", "TCON" }, { "TAL", "TALB" },
+                                    { "TRK", "TRCK" }, { "COM", "COMM" }, { "PIC", "APIC" } };
+    const uint32_t id = (2 == v) ? (0) : (1);
+
+    Bytes art;
+    if (0 == Random(0, 1))
+    {
+        Bytes picture = EncodeText(3, "image/jpeg");
+        picture.resize(Random(20, 500) * 1024);
+        for (size_t i=12; i<picture.size(); i++) picture[i] = (uint8_t)rand();
+        art = Frame(v, Ids[6][id], picture, plain);
+    }
+
+    Bytes text;
+    const Bytes album   = Frame(v, Ids[3][id], EncodeText(v, Word(Random(4, 30))), plain);
+    const Bytes track   = Frame(v, Ids[4][id], EncodeText(v, std::to_string(Random(1, 20))), plain);
+    const Bytes comment = Frame(v, Ids[5][id], EncodeText(v, "eng" + Word(Random(0, 200))), plain);
+    text.insert(text.end(), album.begin(), album.end());
+    for (uint32_t field=0; field<ID3_TAG_FIELD_COUNT; field++)
+    {
+        const Bytes frame = Frame(v, Ids[field][id], EncodeText(v, file.fields[field]), plain);
+        text.insert(text.end(), frame.begin(), frame.end());
+        if (ID3_TAG_TITLE == field) text.insert(text.end(), track.begin(), track.end());
+    }
+    text.insert(text.end(), comment.begin(), comment.end());
+
+    const bool art_first = (0 == Random(0, 1));
+    Bytes frames = (art_first) ? (art) : (text);
+    frames.insert(frames.end(), (art_first) ? (text.begin()) : (art.begin()), (art_first) ? (text.end()) : (art.end()));
+
+    if (unsync)
+    {
+        Bytes out;
+        for (size_t i=0; i<frames.size(); i++)
+        {
+            out.push_back(frames[i]);
+            if (0xFF == frames[i]) out.push_back(0);
+        }
+        frames.swap(out);
+    }
+
+    const uint32_t padding = (0 == Random(0, 2)) ? (0) : (Random(0, 4096));
+    const uint8_t header[] = { 'I', 'D', '3', v, 0, (uint8_t)((unsync) ? (0x80) : (0)) };
+    file.bytes.assign(header, header + sizeof(header));
+    PutSize(file.bytes, frames.size() + padding, 4, true);
+    file.bytes.insert(file.bytes.end(), frames.begin(), frames.end());
+    file.bytes.resize(file.bytes.size() + padding, 0);
+    file.bytes.insert(file.bytes.end(), audio, audio + sizeof(audio));
+    file.size = file.bytes.size() + Random(3, 8) * 1024 * 1024;
+}
+
+static bool ReadFile(corpus_file_S &file, const char *path)
+{
+    FILE *handle = fopen(path, "rb");
+    if (!handle)
+    {
+        return false;
+    }
+    fseek(handle, 0, SEEK_END);
+    file.size = (uint32_t)ftell(handle);
+    fseek(handle, 0, SEEK_SET);
+    file.bytes.resize(file.size);
+    const bool read = (file.size == fread((file.size > 0) ? (&file.bytes[0]) : (NULL), 1, file.size, handle));
+    fclose(handle);
+    file.name    = path;
+    file.version = (file.size >= 4 && 0 == memcmp(&file.bytes[0], "ID3", 3)) ? (file.bytes[3]) : (0);
+    file.checked = false;
+    return read;
+}
+
+static void Parse(const corpus_file_S &file, uint32_t read_us, uint32_t sd_kbps, bool verbose, bench_stats_S &stats)
+{
+    const double sector_us = 1e6 * SECTOR_SIZE / 1024 / sd_kbps;
+    uint32_t bytes_read = 0;
+    uint32_t reads      = 0;
+    uint32_t sectors    = 0;
+    int64_t  sector     = -1;
+
+    // Timed on its own, the bookkeeping of the sectors is left out
+    id3_tag_S tag;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    id3_tag_init(&tag);
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+    while (id3_tag_next(&tag, &offset, &size))
+    {
+        const uint32_t length = (offset >= file.bytes.size()) ? (0) : (std::min<uint32_t>(size, file.bytes.size() - offset));
+        id3_tag_feed(&tag, (length > 0) ? (&file.bytes[offset]) : (NULL), length);
+        bytes_read += length;
+        ++reads;
+        for (uint32_t s=offset/SECTOR_SIZE; length > 0 && s<=(offset+length-1)/SECTOR_SIZE; s++)
+        {
+            sectors += (s != sector) ? (1) : (0);
+            sector   = s;
+        }
+    }
+    stats.parse_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    ++stats.files;
+    stats.tag_bytes      += tag.tag_size;
+    stats.bytes_read     += bytes_read;
+    stats.max_bytes_read  = std::max(stats.max_bytes_read, bytes_read);
+    stats.reads          += reads;
+    stats.sectors        += sectors;
+    stats.card_us        += sectors * (read_us + sector_us);
+    stats.whole_tag_us   += read_us + ((std::max<uint32_t>(tag.tag_size, ID3_TAG_HEADER_SIZE) + SECTOR_SIZE - 1) / SECTOR_SIZE) * sector_us;
+
+    for (uint32_t field=0; field<ID3_TAG_FIELD_COUNT; field++)
+    {
+        stats.found += (tag.found[field]) ? (1) : (0);
+        if (file.checked && (tag.found[field] != !file.fields[field].empty() || (tag.found[field] && file.fields[field] != tag.text[field])))
+        {
+            ++stats.wrong;
+            printf("[id3_bench] %s: field %u is \"%s\", was written as \"%s\"\n", file.name.c_str(), field,
+                   (tag.found[field]) ? (tag.text[field]) : ("<none>"), file.fields[field].c_str());
+        }
+    }
+
+    if (verbose)
+    {
+        printf("  %-40s %s %7lu byte tag, %5lu bytes in %3lu reads: %s / %s / %s\n", file.name.c_str(), (2 == tag.version) ? ("v2.2") : ((3 == tag.version) ? ("v2.3") : ((4 == tag.version) ? ("v2.4") : ("none"))),
+               (unsigned long)tag.tag_size, (unsigned long)bytes_read, (unsigned long)reads,
+               (tag.found[ID3_TAG_TITLE])  ? (tag.text[ID3_TAG_TITLE])  : ("-"),
+               (tag.found[ID3_TAG_ARTIST]) ? (tag.text[ID3_TAG_ARTIST]) : ("-"),
+               (tag.found[ID3_TAG_GENRE])  ? (tag.text[ID3_TAG_GENRE])  : ("-"));
+    }
+}
+
+static void PrintStats(const char *label, const bench_stats_S &stats)
+{
+    if (0 == stats.files)
+    {
+        return;
+    }
+    const double files = stats.files;
+    printf("  %-8s %6u %9.1f KB %9.0f B %7u B %7.1f %7.2f %9.2f us %8.2f ms %10.2f ms %6u %5u\n", label, stats.files,
+           stats.tag_bytes / files / 1024, stats.bytes_read / files, stats.max_bytes_read, stats.reads / files, stats.sectors / files,
+           stats.parse_ns / files / 1e3, stats.card_us / files / 1e3, stats.whole_tag_us / files / 1e3, stats.found, stats.wrong);
+}
+
+static void Add(bench_stats_S &total, const bench_stats_S &stats)
+{
+    total.files          += stats.files;
+    total.tag_bytes      += stats.tag_bytes;
+    total.bytes_read     += stats.bytes_read;
+    total.max_bytes_read  = std::max(total.max_bytes_read, stats.max_bytes_read);
+    total.reads          += stats.reads;
+    total.sectors        += stats.sectors;
+    total.parse_ns       += stats.parse_ns;
+    total.card_us        += stats.card_us;
+    total.whole_tag_us   += stats.whole_tag_us;
+    total.found          += stats.found;
+    total.wrong          += stats.wrong;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count   = 2000;
+    uint32_t read_us = 500;
+    uint32_t sd_kbps = 1000;
+    bool     verbose = false;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "n:r:d:v")) != -1)
+    {
+        switch (option)
+        {
+            case 'n': count   = atoi(optarg); break;
+            case 'r': read_us = atoi(optarg); break;
+            case 'd': sd_kbps = atoi(optarg); break;
+            case 'v': verbose = true;         break;
+            default:
+                printf("Usage: %s [-n files] [-r read_us] [-d sd_kbps] [-v] [file.mp3...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    srand(1);
+    std::vector<corpus_file_S> corpus((optind < argc) ? (argc - optind) : (count));
+    for (size_t i=0; i<corpus.size(); i++)
+    {
+        if (optind < argc && !ReadFile(corpus[i], argv[optind + i]))
+        {
+            printf("[id3_bench] Could not open %s\n", argv[optind + i]);
+            return 1;
+        }
+        if (optind >= argc)
+        {
+            Generate(corpus[i], i);
+        }
+    }
+
+    // Stats by the version the file was written with, no tag first, and v2.2 and v2.3 tags that are
+    // unsynchronised on their own, which are read through to the last wanted frame
+    bench_stats_S by_version[5];
+    memset(by_version, 0, sizeof(by_version));
+    for (size_t i=0; i<corpus.size(); i++)
+    {
+        const corpus_file_S &file = corpus[i];
+        const bool unsync = (file.version >= 2 && file.version <= 3 && (file.bytes[5] & 0x80));
+        Parse(file, read_us, sd_kbps, verbose, by_version[(unsync) ? (1) : ((file.version <= 4) ? (file.version) : (0))]);
+    }
+
+    bench_stats_S total;
+    memset(&total, 0, sizeof(total));
+    printf("SD card: %u us per read, %u KB/s, sectors of %u bytes\n", read_us, sd_kbps, SECTOR_SIZE);
+    printf("  version   files  tag size    read  most read   reads sectors  parse time   on card  whole tag  found wrong\n");
+    const char *labels[] = { "no tag", "unsync", "v2.2", "v2.3", "v2.4" };
+    for (uint32_t v=0; v<5; v++)
+    {
+        PrintStats(labels[v], by_version[v]);
+        Add(total, by_version[v]);
+    }
+    PrintStats("all", total);
+    return (0 == total.wrong) ? (0) : (1);
+}
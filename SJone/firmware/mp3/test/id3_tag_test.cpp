@@ -0,0 +1,378 @@
+#include "catch.hpp"
+#include "id3_tag.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes Text(uint8_t encoding, const std::string &text)
+{
+    Bytes body(1, encoding);
+    body.insert(body.end(), text.begin(), text.end());
+    return body;
+}
+
+static void PutSize(Bytes &bytes, uint32_t size, uint32_t count, bool syncsafe)
+{
+    for (int i=count-1; i>=0; i--)
+    {
+        bytes.push_back((syncsafe) ? ((size >> (7 * i)) & 0x7F) : ((size >> (8 * i)) & 0xFF));
+    }
+}
+
+static Bytes Frame(uint8_t version, const std::string &id, const Bytes &body, uint8_t flags = 0, bool plain_size = false)
+{
+    Bytes frame(id.begin(), id.end());
+    if (2 == version)
+    {
+        PutSize(frame, body.size(), 3, false);
+    }
+    else
+    {
+        PutSize(frame, body.size(), 4, 4 == version && !plain_size);
+        frame.push_back(0);
+        frame.push_back(flags);
+    }
+    frame.insert(frame.end(), body.begin(), body.end());
+    return frame;
+}
+
+// 0x00 after every 0xFF
+static Bytes Unsync(const Bytes &bytes)
+{
+    Bytes out;
+    for (size_t i=0; i<bytes.size(); i++)
+    {
+        out.push_back(bytes[i]);
+        if (0xFF == bytes[i]) out.push_back(0x00);
+    }
+    return out;
+}
+
+// Tag with the frames and padding, followed by a bit of audio
+static Bytes Tag(uint8_t version, const Bytes &frames, uint32_t padding = 0, uint8_t flags = 0)
+{
+    Bytes tag;
+    tag.push_back('I'); tag.push_back('D'); tag.push_back('3');
+    tag.push_back(version);
+    tag.push_back(0);
+    tag.push_back(flags);
+    PutSize(tag, frames.size() + padding, 4, true);
+    tag.insert(tag.end(), frames.begin(), frames.end());
+    tag.resize(tag.size() + padding, 0);
+    const uint8_t audio[] = { 0xFF, 0xFB, 0x90, 0x64 };
+    tag.insert(tag.end(), audio, audio + sizeof(audio));
+    return tag;
+}
+
+static Bytes Join(const Bytes &a, const Bytes &b, const Bytes &c = Bytes(), const Bytes &d = Bytes())
+{
+    Bytes out(a);
+    out.insert(out.end(), b.begin(), b.end());
+    out.insert(out.end(), c.begin(), c.end());
+    out.insert(out.end(), d.begin(), d.end());
+    return out;
+}
+
+// Reads the way the track list does, only what the parser asks for
+static id3_tag_S Parse(const Bytes &file, uint32_t *bytes_read = NULL, uint32_t *reads = NULL)
+{
+    id3_tag_S tag;
+    id3_tag_init(&tag);
+
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+    uint32_t total  = 0;
+    uint32_t count  = 0;
+    while (id3_tag_next(&tag, &offset, &size))
+    {
+        REQUIRE(size > 0);
+        REQUIRE(size <= ID3_TAG_READ_SIZE);
+        const uint32_t length = (offset >= file.size()) ? (0) : (std::min<uint32_t>(size, file.size() - offset));
+        id3_tag_feed(&tag, (length > 0) ? (&file[offset]) : (NULL), length);
+        total += length;
+        ++count;
+        REQUIRE(count < 10000);
+    }
+    if (bytes_read) *bytes_read = total;
+    if (reads)      *reads      = count;
+    return tag;
+}
+
+static std::string Field(const id3_tag_S &tag, id3_tag_field_E field)
+{
+    return (tag.found[field]) ? (std::string(tag.text[field])) : (std::string("<none>"));
+}
+
+TEST_CASE("ID3v2.3 text frames", "[id3_tag]")
+{
+    const Bytes frames = Join(Frame(3, "TIT2", Text(0, "Song")), Frame(3, "TPE1", Text(0, "Band")),
+                              Frame(3, "TCON", Text(0, "(17)")));
+    const Bytes file = Tag(3, frames, 100);
+    const id3_tag_S tag = Parse(file);
+
+    REQUIRE(3 == tag.version);
+    REQUIRE(file.size() - 4 == tag.tag_size);
+    REQUIRE("Song" == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Band" == Field(tag, ID3_TAG_ARTIST));
+    REQUIRE("(17)" == Field(tag, ID3_TAG_GENRE));
+
+    // Stops after the last wanted frame, the padding is never read
+    REQUIRE(10 + frames.size() == tag.bytes_fed);
+}
+
+TEST_CASE("ID3v2.2 has 3 byte ids and sizes", "[id3_tag]")
+{
+    const Bytes file = Tag(2, Join(Frame(2, "TT2", Text(0, "Old")), Frame(2, "TP1", Text(0, "Timer")),
+                                   Frame(2, "TCO", Text(0, "Jazz"))));
+    const id3_tag_S tag = Parse(file);
+
+    REQUIRE(2 == tag.version);
+    REQUIRE("Old"   == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Timer" == Field(tag, ID3_TAG_ARTIST));
+    REQUIRE("Jazz"  == Field(tag, ID3_TAG_GENRE));
+}
+
+TEST_CASE("ID3v2.4 syncsafe frame sizes jump over album art", "[id3_tag]")
+{
+    Bytes art = Text(0, "image/jpeg");
+    art.resize(300000, 0xFF);
+    const Bytes frames = Join(Frame(4, "APIC", art), Frame(4, "TIT2", Text(3, "Four")),
+                              Frame(4, "TPE1", Text(3, "Artist")), Frame(4, "TCON", Text(3, "Rock")));
+    const Bytes file = Tag(4, frames, 2048);
+
+    uint32_t bytes_read = 0;
+    uint32_t reads      = 0;
+    const id3_tag_S tag = Parse(file, &bytes_read, &reads);
+
+    REQUIRE(4 == tag.version);
+    REQUIRE("Four"   == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Artist" == Field(tag, ID3_TAG_ARTIST));
+    REQUIRE("Rock"   == Field(tag, ID3_TAG_GENRE));
+
+    // Header, four frame headers, the id after the picture to check its size, and three bodies
+    REQUIRE(10 + 4 * 10 + 4 + 5 + 7 + 5 == bytes_read);
+    REQUIRE(bytes_read == tag.bytes_fed);
+    REQUIRE(reads <= 9);
+}
+
+TEST_CASE("ID3v2.4 with plain frame sizes", "[id3_tag]")
+{
+    // 200 does not fit 7 bits, the size byte has its top bit set
+    Bytes comment(200, 'x');
+    const Bytes frames = Join(Frame(4, "COMM", comment, 0, true), Frame(4, "TIT2", Text(0, "Plain"), 0, true));
+    const id3_tag_S tag = Parse(Tag(4, frames));
+
+    REQUIRE("Plain" == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("<none>" == Field(tag, ID3_TAG_ARTIST));
+}
+
+TEST_CASE("ID3v2.4 plain frame sizes that are also syncsafe", "[id3_tag]")
+{
+    // 300 is 00 00 01 2C, which reads as 172 syncsafe, and lands in the middle of the comment
+    Bytes comment(300, 'x');
+    const Bytes frames = Join(Frame(4, "COMM", comment, 0, true), Frame(4, "TIT2", Text(0, "Plain"), 0, true),
+                              Frame(4, "TPE1", Text(0, "Safe")));
+    const id3_tag_S tag = Parse(Tag(4, frames, 500));
+
+    REQUIRE("Plain" == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Safe"  == Field(tag, ID3_TAG_ARTIST));
+}
+
+TEST_CASE("Missing frames end at the padding", "[id3_tag]")
+{
+    const Bytes frames = Frame(3, "TIT2", Text(0, "Alone"));
+    uint32_t bytes_read = 0;
+    const id3_tag_S tag = Parse(Tag(3, frames, 4096), &bytes_read);
+
+    REQUIRE("Alone"  == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("<none>" == Field(tag, ID3_TAG_ARTIST));
+    REQUIRE("<none>" == Field(tag, ID3_TAG_GENRE));
+    REQUIRE(10 + frames.size() + 10 == bytes_read);
+}
+
+TEST_CASE("Text encodings", "[id3_tag]")
+{
+    SECTION("UTF-16 with a little endian byte order mark")
+    {
+        const uint8_t body[] = { 1, 0xFF, 0xFE, 'H', 0, 'i', 0, 0, 0 };
+        const id3_tag_S tag = Parse(Tag(3, Frame(3, "TIT2", Bytes(body, body + sizeof(body)))));
+        REQUIRE("Hi" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("UTF-16 with a big endian byte order mark")
+    {
+        const uint8_t body[] = { 1, 0xFE, 0xFF, 0, 'H', 0, 'i' };
+        const id3_tag_S tag = Parse(Tag(3, Frame(3, "TIT2", Bytes(body, body + sizeof(body)))));
+        REQUIRE("Hi" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("UTF-16BE, a surrogate pair is one character")
+    {
+        const uint8_t body[] = { 2, 0, 'a', 0xD8, 0x3D, 0xDE, 0x00, 0x00, 0xE9, 0, 'b' };
+        const id3_tag_S tag = Parse(Tag(4, Frame(4, "TIT2", Bytes(body, body + sizeof(body)))));
+        REQUIRE("a??b" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("UTF-8, one character for every sequence")
+    {
+        const id3_tag_S tag = Parse(Tag(4, Frame(4, "TIT2", Text(3, "Caf\xC3\xA9 \xE2\x82\xAC"))));
+        REQUIRE("Caf? ?" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("ISO-8859-1 outside of ASCII")
+    {
+        const id3_tag_S tag = Parse(Tag(3, Frame(3, "TIT2", Text(0, "Caf\xE9"))));
+        REQUIRE("Caf?" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("Only the first of several v2.4 strings")
+    {
+        const id3_tag_S tag = Parse(Tag(4, Frame(4, "TCON", Text(3, std::string("Rock\0Pop", 8)))));
+        REQUIRE("Rock" == Field(tag, ID3_TAG_GENRE));
+    }
+    SECTION("Empty text is not found")
+    {
+        const id3_tag_S tag = Parse(Tag(3, Frame(3, "TIT2", Text(0, ""))));
+        REQUIRE("<none>" == Field(tag, ID3_TAG_TITLE));
+    }
+}
+
+TEST_CASE("Long text is cut and the rest of the frame skipped", "[id3_tag]")
+{
+    const std::string title(500, 'T');
+    uint32_t bytes_read = 0;
+    const id3_tag_S tag = Parse(Tag(3, Join(Frame(3, "TIT2", Text(0, title)), Frame(3, "TPE1", Text(0, "After")))), &bytes_read);
+
+    REQUIRE(std::string(ID3_TAG_TEXT_SIZE - 1, 'T') == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("After" == Field(tag, ID3_TAG_ARTIST));
+    REQUIRE(bytes_read < 10 + 10 + ID3_TAG_READ_SIZE + 10 + 6 + 10 + 1);
+}
+
+TEST_CASE("v2.3 unsynchronisation covers the whole tag", "[id3_tag]")
+{
+    Bytes art = Text(0, "image/png");
+    art.resize(1000, 0xFF);
+    const Bytes frames = Unsync(Join(Frame(3, "APIC", art), Frame(3, "TIT2", Text(0, "\xFFX")), Frame(3, "TPE1", Text(0, "Sync"))));
+    const id3_tag_S tag = Parse(Tag(3, frames, 0, 0x80));
+
+    REQUIRE("?X"   == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Sync" == Field(tag, ID3_TAG_ARTIST));
+}
+
+TEST_CASE("v2.4 unsynchronisation is a flag of each frame", "[id3_tag]")
+{
+    const Bytes body = Unsync(Text(0, "A\xFF" "B"));
+    const Bytes frames = Join(Frame(4, "TIT2", body, 0x02), Frame(4, "TPE1", Text(0, "Next")));
+    const id3_tag_S tag = Parse(Tag(4, frames));
+
+    REQUIRE("A?B"  == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Next" == Field(tag, ID3_TAG_ARTIST));
+}
+
+TEST_CASE("Extended headers are skipped", "[id3_tag]")
+{
+    SECTION("v2.3 size does not count itself")
+    {
+        const uint8_t extended[] = { 0, 0, 0, 6, 0, 0, 0, 0, 0, 0 };
+        const Bytes frames = Join(Bytes(extended, extended + sizeof(extended)), Frame(3, "TIT2", Text(0, "Ext3")));
+        const id3_tag_S tag = Parse(Tag(3, frames, 0, 0x40));
+        REQUIRE("Ext3" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("v2.4 size is syncsafe and counts itself")
+    {
+        const uint8_t extended[] = { 0, 0, 0, 6, 1, 0 };
+        const Bytes frames = Join(Bytes(extended, extended + sizeof(extended)), Frame(4, "TIT2", Text(0, "Ext4")));
+        const id3_tag_S tag = Parse(Tag(4, frames, 0, 0x40));
+        REQUIRE("Ext4" == Field(tag, ID3_TAG_TITLE));
+    }
+}
+
+TEST_CASE("Frame flags", "[id3_tag]")
+{
+    SECTION("v2.4 group id and data length come before the body")
+    {
+        const uint8_t prefix[] = { 7, 0, 0, 0, 6 };
+        const Bytes frames = Frame(4, "TIT2", Join(Bytes(prefix, prefix + sizeof(prefix)), Text(0, "Group")), 0x41);
+        const id3_tag_S tag = Parse(Tag(4, frames));
+        REQUIRE("Group" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("v2.3 group id comes before the body")
+    {
+        const Bytes frames = Frame(3, "TIT2", Join(Bytes(1, 9), Text(0, "Group")), 0x20);
+        const id3_tag_S tag = Parse(Tag(3, frames));
+        REQUIRE("Group" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("Compressed frames are skipped")
+    {
+        const Bytes frames = Join(Frame(3, "TIT2", Text(0, "zlib"), 0x80), Frame(3, "TPE1", Text(0, "Plain")));
+        const id3_tag_S tag = Parse(Tag(3, frames));
+        REQUIRE("<none>" == Field(tag, ID3_TAG_TITLE));
+        REQUIRE("Plain"  == Field(tag, ID3_TAG_ARTIST));
+    }
+}
+
+TEST_CASE("Files without a whole tag", "[id3_tag]")
+{
+    SECTION("No tag")
+    {
+        const uint8_t audio[] = { 0xFF, 0xFB, 0x90, 0x64, 0, 0, 0, 0, 0, 0, 0, 0 };
+        uint32_t bytes_read = 0;
+        const id3_tag_S tag = Parse(Bytes(audio, audio + sizeof(audio)), &bytes_read);
+        REQUIRE(0 == tag.version);
+        REQUIRE(0 == tag.tag_size);
+        REQUIRE(ID3_TAG_HEADER_SIZE == bytes_read);
+    }
+    SECTION("File shorter than a header")
+    {
+        const id3_tag_S tag = Parse(Bytes(3, 'I'));
+        REQUIRE(0 == tag.version);
+    }
+    SECTION("File ends inside a frame")
+    {
+        Bytes file = Tag(3, Join(Frame(3, "TPE1", Text(0, "Whole")), Frame(3, "TIT2", Text(0, "Truncated"))));
+        file.resize(10 + 16 + 14);
+        const id3_tag_S tag = Parse(file);
+        REQUIRE("Whole"  == Field(tag, ID3_TAG_ARTIST));
+        REQUIRE("<none>" == Field(tag, ID3_TAG_TITLE));
+    }
+    SECTION("Frame runs past the end of the tag")
+    {
+        Bytes file = Tag(3, Frame(3, "TIT2", Text(0, "Spill")));
+        file[9] -= 3;
+        const id3_tag_S tag = Parse(file);
+        REQUIRE("<none>" == Field(tag, ID3_TAG_TITLE));
+    }
+}
+
+TEST_CASE("Bytes past what was asked for are left alone", "[id3_tag]")
+{
+    const Bytes file = Tag(3, Join(Frame(3, "TIT2", Text(0, "Whole")), Frame(3, "TPE1", Text(0, "Read"))));
+    id3_tag_S tag;
+    id3_tag_init(&tag);
+
+    // The whole file at once, the way a caller with the start of the file already in a buffer would
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+    REQUIRE(id3_tag_next(&tag, &offset, &size));
+    const uint32_t used = id3_tag_feed(&tag, &file[0], file.size());
+
+    REQUIRE(file.size() - 4 == used);
+    REQUIRE(!id3_tag_next(&tag, &offset, &size));
+    REQUIRE("Whole" == Field(tag, ID3_TAG_TITLE));
+    REQUIRE("Read"  == Field(tag, ID3_TAG_ARTIST));
+}
+
+TEST_CASE("Genre numbers", "[id3_tag]")
+{
+    uint8_t number = 0;
+    REQUIRE(id3_tag_genre_number("(17)", &number));
+    REQUIRE(17 == number);
+    REQUIRE(id3_tag_genre_number("(9)Metal", &number));
+    REQUIRE(9 == number);
+    REQUIRE(id3_tag_genre_number("131", &number));
+    REQUIRE(131 == number);
+
+    REQUIRE(!id3_tag_genre_number("Rock", &number));
+    REQUIRE(!id3_tag_genre_number("(RX)", &number));
+    REQUIRE(!id3_tag_genre_number("17 Rock", &number));
+    REQUIRE(!id3_tag_genre_number("(300)", &number));
+    REQUIRE(!id3_tag_genre_number("(1234)", &number));
+    REQUIRE(!id3_tag_genre_number("", &number));
+}
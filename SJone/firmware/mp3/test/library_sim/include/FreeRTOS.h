@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  @explanation:
+ *  Host stand-in for FreeRTOS.h, only what ffconf.h uses.  There is one task, so the FatFs sync objects
+ *  never block, see sim_disk.cpp.
+ */
+
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t      TickType_t;
+
+#define pdFALSE       ((BaseType_t)0)
+#define pdTRUE        ((BaseType_t)1)
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
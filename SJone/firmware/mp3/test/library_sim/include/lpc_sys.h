@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Simulated time since power on, only moved forward by the SD card
+uint64_t sys_get_uptime_us(void);
+
+#ifdef __cplusplus
+}
+#endif
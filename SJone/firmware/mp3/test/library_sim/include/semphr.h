@@ -0,0 +1,4 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef struct sim_semaphore* SemaphoreHandle_t;
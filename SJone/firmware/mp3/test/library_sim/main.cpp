@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "ff.h"
+#include "library_index.hpp"
+#include "id3_tag.hpp"
+#include "track_table.hpp"
+#include "sim_disk.hpp"
+
+/**
+ *  @explanation:
+ *  Boots a library of generated tracks off a FatFs card in RAM, the way track_list_scan does, and prints how
+ *  long the SD card keeps it from getting to the menu, mount included:
+ *      no index      : Every file sniffed and every track opened for its tags, what every boot did before the index
+ *      names first   : Names pass of the ScannerTask, every file by name, see track_list_scan
+ *      then parse    : Parse pass right after it, every file is opened as there is no index, which is written
+ *      first boot    : The parse pass alone, with no index
+ *      warm boot     : Nothing changed, everything comes out of the index
+ *      changes, names: Some tracks retagged, some removed and as many added, the names pass
+ *      then parse    : Parse pass right after it, only the changed files are opened
+ *      warm again    : Nothing changed since
+ *  The tracks found, their paths and their titles are checked against what is on the card at every boot,
+ *  "first" is how long it takes for the first track to be there to play, and files/s is how fast the walk got
+ *  through the card.  The tracks of the last boot are then put in a
+ *  track table the size of MP3_TRACK_TABLE_BUDGET, and one of the most the table can take, to see how many
+ *  bytes a track takes in it next to the fixed arrays of before.
+ *
+ *  Files are parsed with reads of the same sizes at the same offsets as ParseFile, and the title comes out of
+ *  the tag with the same parser.  Tracks are 3 to 8 MB with an ID3v2 tag of 4 to 64 KB in front, most of
+ *  them, and an ID3v1 tag at the end.  Tags hold a title, one of 97 artists, and one of a few genres.  Every
+ *  50th file is a text file, which is sniffed but not played.  With -t the tracks are put in folders, 10 to an
+ *  album, "Artist 0012/Album 0345/Disc 1/Track 3450.mp3" for 3 levels, next to a chain of folders one deeper than
+ *  LIBRARY_MAX_DEPTH and a path longer than LIBRARY_PATH_SIZE, each with a track that has to be left out.
+ *
+ *  @usage:
+ *  library_sim [-r read_us] [-w write_us] [-d sd_kbps] [-c changed] [-t levels] [-s] [tracks...]
+ *      -r     : Microseconds every SD card read takes before the first byte, 500 by default
+ *      -w     : Microseconds every SD card write takes before the first byte, 1000 by default
+ *      -d     : Kilobytes per second the SD card moves after that, 1000 by default
+ *      -c     : Tracks out of every 100 retagged, and out of every 100 removed and replaced, 1 by default
+ *      -t     : Folders every track is under, 0 for all of them in the root by default
+ *      -s     : Skip the boots without an index, they take long to simulate for thousands of tracks
+ *      tracks : Library sizes to boot, 20, 500 and 5000 by default
+ */
+
+// Same as CODEC_SNIFF_SIZE
+#define SNIFF_SIZE       (64)
+
+#define ID3V1_TAG_SIZE   (128)
+
+// Same as MP3_TRACK_TABLE_BUDGET
+#define TRACK_TABLE_BUDGET (16 * 1024)
+
+// Bytes a track took before the track table, see track_list.cpp
+#define FIXED_BYTES_PER_TRACK (4 + 68 + 164)
+
+// Tracks are this long, and start a title this far into the tag
+#define TITLE_OFFSET     (21)
+#define TITLE_LENGTH     (10)
+
+static const uint8_t Mp3Frame[] = { 0xFF, 0xFB, 0x90, 0x64 };
+
+static const char *Genres[] = { "Rock", "Jazz", "Pop", "Classical", "Electronic", "Hip-Hop" };
+
+// Tracks that were added at the last boot
+static std::vector<library_record_S> Tracks;
+
+// Path of every folder handed over at the last boot, with a slash after it, and the folder it is in
+static std::vector<std::string> Folders;
+static std::vector<uint16_t> Parents;
+
+// Title of every file on the card, by its path, empty if it is not played
+static std::map<std::string, std::string> Expected;
+
+// Files and folders on the card the walk has to leave out
+static uint32_t ExpectedSkipped = 0;
+
+static FATFS Fs;
+
+static uint32_t Random(uint32_t low, uint32_t high)
+{
+    return low + (uint32_t)(rand() % (high - low + 1));
+}
+
+static std::string Path(const std::string &path)
+{
+    return std::string("1:") + path;
+}
+
+static std::string TrackPath(const library_record_S &record)
+{
+    return Folders[record.folder] + record.name;
+}
+
+// Stand-in for ParseFile and mp3_read_tags, see track_list.cpp and mp3_struct.cpp
+static void ParseFile(const char *track_path, library_record_S *record)
+{
+    const std::string path = Path(track_path);
+    uint8_t start[SNIFF_SIZE] = { 0 };
+    uint8_t buffer[ID3_TAG_READ_SIZE] = { 0 };
+    uint32_t tag_size = 0;
+    UINT read = 0;
+    UINT start_size = 0;
+    FIL file;
+
+    if (FR_OK != f_open(&file, path.c_str(), FA_OPEN_EXISTING | FA_READ))
+    {
+        return;
+    }
+    f_read(&file, start, sizeof(start), &start_size);
+    codec_E codec = codec_sniff(start, start_size, &tag_size);
+
+    id3_tag_S tag;
+    id3_tag_init(&tag);
+    uint32_t offset = 0;
+    uint32_t size   = 0;
+    while (id3_tag_next(&tag, &offset, &size))
+    {
+        if (offset + size <= start_size)
+        {
+            id3_tag_feed(&tag, &start[offset], start_size - offset);
+        }
+        else if (FR_OK == f_lseek(&file, offset) && FR_OK == f_read(&file, buffer, size, &read))
+        {
+            id3_tag_feed(&tag, buffer, read);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (tag_size > 0 && FR_OK == f_lseek(&file, tag_size) && FR_OK == f_read(&file, buffer, SNIFF_SIZE, &read))
+    {
+        codec = codec_sniff(buffer, read, &tag_size);
+    }
+    f_close(&file);
+
+    record->codec = codec;
+    if (CODEC_UNKNOWN != codec)
+    {
+        memcpy(record->title,  tag.text[ID3_TAG_TITLE],  sizeof(record->title));
+        memcpy(record->artist, tag.text[ID3_TAG_ARTIST], sizeof(record->artist));
+        memcpy(record->genre,  tag.text[ID3_TAG_GENRE],  sizeof(record->genre));
+    }
+}
+
+static bool AddTrack(const library_record_S *record)
+{
+    Tracks.push_back(*record);
+    return true;
+}
+
+static bool AddFolder(uint16_t folder, uint16_t parent, const char *name)
+{
+    Folders.resize(folder + 1);
+    Parents.resize(folder + 1);
+    Folders[folder] = Folders[parent] + name + "/";
+    Parents[folder] = parent;
+    return true;
+}
+
+// Makes every folder of a path that is not there yet
+static bool MakeFolders(const std::string &path)
+{
+    for (size_t slash=path.find('/'); std::string::npos != slash; slash=path.find('/', slash + 1))
+    {
+        const FRESULT result = f_mkdir(Path(path.substr(0, slash)).c_str());
+        if (FR_OK != result && FR_EXIST != result)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool WriteAt(FIL *file, uint32_t offset, const void *data, UINT size)
+{
+    UINT written = 0;
+    return FR_OK == f_lseek(file, offset) && FR_OK == f_write(file, data, size, &written) && size == written;
+}
+
+// ID3v2.3 text frame, Latin-1
+static void AppendFrame(std::vector<uint8_t> *tag, const char *id, const std::string &text)
+{
+    const uint32_t size = text.size() + 1;
+    const uint8_t header[] = { (uint8_t)id[0], (uint8_t)id[1], (uint8_t)id[2], (uint8_t)id[3],
+                               (uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size, 0, 0, 0 };
+    tag->insert(tag->end(), header, header + sizeof(header));
+    tag->insert(tag->end(), text.begin(), text.end());
+}
+
+static bool CreateTrack(const std::string &name, const std::string &title, uint32_t artist)
+{
+    FIL file;
+    if (!MakeFolders(name) || FR_OK != f_open(&file, Path(name).c_str(), FA_CREATE_ALWAYS | FA_WRITE))
+    {
+        return false;
+    }
+
+    const uint32_t size = Random(3, 8) * 1024 * 1024 + Random(0, 1023);
+    const bool has_tag  = (0 != rand() % 8);
+    uint32_t audio_start = 0;
+    bool written = true;
+
+    if (has_tag)
+    {
+        // ID3v2.3 with a TIT2 frame first, then TPE1 and TCON, then padding, often album art
+        const uint32_t tag_body = Random(4, 64) * 1024;
+        const uint8_t header[] = { 'I', 'D', '3', 3, 0, 0,
+                                   (uint8_t)((tag_body >> 21) & 0x7F), (uint8_t)((tag_body >> 14) & 0x7F),
+                                   (uint8_t)((tag_body >> 7) & 0x7F),  (uint8_t)(tag_body & 0x7F) };
+        char artist_name[16];
+        snprintf(artist_name, sizeof(artist_name), "Artist %04u", artist);
+        std::vector<uint8_t> tag(header, header + sizeof(header));
+        AppendFrame(&tag, "TIT2", title.substr(0, TITLE_LENGTH));
+        AppendFrame(&tag, "TPE1", artist_name);
+        AppendFrame(&tag, "TCON", Genres[artist % (sizeof(Genres) / sizeof(Genres[0]))]);
+        written     = WriteAt(&file, 0, &tag[0], tag.size());
+        audio_start = 10 + tag_body;
+    }
+
+    uint8_t frame[1024];
+    memset(frame, 0x55, sizeof(frame));
+    memcpy(frame, Mp3Frame, sizeof(Mp3Frame));
+    written = written && WriteAt(&file, audio_start, frame, sizeof(frame));
+
+    // Everything between the first frame and the ID3v1 tag is never written, and takes no memory
+    uint8_t id3v1[ID3V1_TAG_SIZE] = { 'T', 'A', 'G' };
+    memcpy(&id3v1[3], title.c_str(), TITLE_LENGTH);
+    written = written && WriteAt(&file, size - ID3V1_TAG_SIZE, id3v1, sizeof(id3v1));
+
+    f_close(&file);
+    Expected[name] = (has_tag) ? (title) : ("");
+    return written;
+}
+
+static bool CreateText(const std::string &name)
+{
+    FIL file;
+    const char text[] = "Liner notes, nothing to play here.\n";
+    const bool written = FR_OK == f_open(&file, Path(name).c_str(), FA_CREATE_ALWAYS | FA_WRITE) &&
+                         WriteAt(&file, 0, text, sizeof(text) - 1);
+    f_close(&file);
+    Expected[name] = "-";
+    return written;
+}
+
+static bool Retag(const std::string &name, const std::string &title)
+{
+    FIL file;
+    if (FR_OK != f_open(&file, Path(name).c_str(), FA_OPEN_EXISTING | FA_WRITE))
+    {
+        return false;
+    }
+    // Tracks without a tag get the title written over their first frame, and only a new modification time
+    const bool written = WriteAt(&file, TITLE_OFFSET, title.c_str(), TITLE_LENGTH);
+    f_close(&file);
+    if (!Expected[name].empty())
+    {
+        Expected[name] = title;
+    }
+    return written;
+}
+
+// Every track on the card was added, with the title it has now, and nothing else
+static bool Check(void)
+{
+    uint32_t tracks = 0;
+    for (std::map<std::string, std::string>::const_iterator it=Expected.begin(); it!=Expected.end(); it++)
+    {
+        tracks += ("-" != it->second);
+    }
+
+    bool ok = (tracks == Tracks.size());
+    for (size_t i=0; i<Tracks.size() && ok; i++)
+    {
+        std::map<std::string, std::string>::const_iterator found = Expected.find(TrackPath(Tracks[i]));
+        ok = (Expected.end() != found) && (CODEC_MP3 == Tracks[i].codec) &&
+             (0 == strncmp(Tracks[i].title, found->second.c_str(), sizeof(Tracks[i].title)));
+    }
+    return ok;
+}
+
+// Puts the tracks of the last boot in a track table, as many as fit
+static void ReportTable(const char *label, uint32_t budget)
+{
+    std::vector<uint8_t> memory(budget);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+
+    bool ok = true;
+    bool full = false;
+    char path[LIBRARY_PATH_SIZE];
+    for (size_t i=0; i<Tracks.size() && !full; i++)
+    {
+        // Folders up to the one the track is in, in the order the walk handed them over
+        const library_record_S &record = Tracks[i];
+        while (table.folder_count <= record.folder && !full)
+        {
+            const std::string &folder = Folders[table.folder_count];
+            const size_t slash = folder.rfind('/', folder.size() - 2);
+            const std::string name = folder.substr((std::string::npos == slash) ? (0) : (slash + 1));
+            full = !track_table_add_folder(&table, Parents[table.folder_count], name.substr(0, name.size() - 1).c_str());
+        }
+        if (full || !track_table_add(&table, record.folder, record.name, record.artist, record.title, record.genre, record.codec))
+        {
+            break;
+        }
+        const track_record_S *added = track_table_get(&table, i);
+        ok = ok && track_table_get_path(&table, i, path, sizeof(path)) && (TrackPath(record) == path) &&
+                   (0 == strcmp(record.title, track_table_string(&table, added->title)))  &&
+                   (0 == strcmp(record.genre, track_table_string(&table, added->genre)));
+    }
+
+    const uint32_t used = track_table_get_used(&table);
+    printf("  %-14s %5u of %5u tracks in %5u of %5u bytes, %5.1f bytes a track, %u fixed, %u tags shared, %u folders %s\n",
+           label, table.count, (uint32_t)Tracks.size(), used, table.size, (table.count) ? ((double)used / table.count) : (0.0),
+           FIXED_BYTES_PER_TRACK, table.shared, table.folder_count, (ok) ? ("ok") : ("WRONG STRINGS"));
+}
+
+// Parses a file as soon as the walk gets to it
+static bool ParseAndAdd(const library_record_S *listed)
+{
+    library_record_S record = *listed;
+    ParseFile(TrackPath(record).c_str(), &record);
+    return (CODEC_UNKNOWN == record.codec) || AddTrack(&record);
+}
+
+// Parses every file with no index, like track_list_init before it
+static void WalkWithoutIndex(library_scan_stats_S *stats)
+{
+    library_list(ParseAndAdd, AddFolder, NULL, stats);
+    stats->parsed = stats->files;
+    stats->tracks = Tracks.size();
+}
+
+typedef enum
+{
+    BOOT_NO_INDEX,
+    BOOT_NAMES,
+    BOOT_PARSE,
+    BOOT_INDEX,
+} boot_E;
+
+static bool Boot(const char *label, boot_E boot)
+{
+    Tracks.clear();
+    Folders.assign(1, "");
+    Parents.assign(1, LIBRARY_ROOT_FOLDER);
+    sim_disk_reset_stats();
+    const uint64_t start = sim_disk_now_us();
+
+    // Mounted again, so nothing is left in the sector buffer, the parse pass runs right after the names pass
+    if (BOOT_PARSE != boot)
+    {
+        f_mount(NULL, "1:", 0);
+        f_mount(&Fs, "1:", 1);
+    }
+
+    library_scan_stats_S stats;
+    if (BOOT_NO_INDEX == boot)   WalkWithoutIndex(&stats);
+    else if (BOOT_NAMES == boot) library_list(AddTrack, AddFolder, NULL, &stats);
+    else                         library_scan(ParseFile, AddTrack, AddFolder, NULL, &stats);
+
+    const double ms = (sim_disk_now_us() - start) / 1000.0;
+    const sim_disk_stats_S disk = sim_disk_get_stats();
+    const bool ok = ((BOOT_NAMES == boot) ? (Tracks.size() == Expected.size()) : (Check())) && (ExpectedSkipped == stats.skipped);
+    printf("  %-14s %9.1f ms first %7.1f ms %8.0f files/s %7u reads %9.1f KB %5u writes %7.1f KB   parsed %5u reused %5u removed %3u %-5s %s\n",
+           label, ms, stats.first_us / 1000.0, (ms > 0) ? (stats.files * 1000.0 / ms) : (0.0), disk.reads, disk.read_bytes / 1024.0,
+           disk.writes, disk.write_bytes / 1024.0, stats.parsed, stats.reused, stats.removed, (stats.saved) ? ("saved") : (""),
+           (ok) ? ("ok") : ("WRONG TRACKS"));
+    return ok;
+}
+
+// Path of a track, in levels folders, 10 tracks to an album
+static std::string TrackName(uint32_t track, uint32_t levels, const char *kind)
+{
+    char name[64];
+    std::string path;
+    for (uint32_t level=0; level<levels; level++)
+    {
+        if (0 == level)      snprintf(name, sizeof(name), "Artist %04u/", (track / 10) % 97);
+        else if (1 == level) snprintf(name, sizeof(name), "Album %04u/", track / 10);
+        else                 snprintf(name, sizeof(name), "Disc %u/", (track / 5) % 2 + 1);
+        path += name;
+    }
+    if (levels > 0) snprintf(name, sizeof(name), "%s %04u.mp3", kind, track);
+    else            snprintf(name, sizeof(name), "Artist %04u - %s %04u.mp3", track % 97, kind, track);
+    return path + name;
+}
+
+// Tracks the walk has to leave out, one folder too deep and one path too long
+static bool CreateLeftOut(void)
+{
+    std::string deep = "Deep/";
+    for (uint32_t level=1; level<LIBRARY_MAX_DEPTH; level++)
+    {
+        deep += std::to_string(level) + "/";
+    }
+    const std::string long_name(60, 'L');
+    const bool created = CreateTrack(deep + "Too deep/Left out.mp3", "Deep", 0) &&
+                         CreateTrack("Long/" + long_name + "/" + long_name + "/Left out.mp3", "Long", 0);
+    Expected.erase(deep + "Too deep/Left out.mp3");
+    Expected.erase("Long/" + long_name + "/" + long_name + "/Left out.mp3");
+    ExpectedSkipped = 2;
+    return created;
+}
+
+static bool Run(uint32_t track_count, uint32_t changed, uint32_t levels, bool skip_no_index, const sim_disk_config_S &config)
+{
+    // SDHC sized, so it is FAT32 like any card of a few GB, with 32 KB clusters
+    sim_disk_config_S disk = config;
+    const uint64_t needed = (uint64_t)track_count * 9 * 1024 * 1024 / 512;
+    disk.sectors = (uint32_t)((needed > 16ULL * 1024 * 1024) ? (needed) : (16ULL * 1024 * 1024));
+    sim_disk_init(disk);
+    sim_disk_set_time((46UL << 25) | (1UL << 21) | (1UL << 16));
+    Expected.clear();
+    ExpectedSkipped = 0;
+    srand(track_count);
+
+    f_mount(&Fs, "1:", 0);
+    if (FR_OK != f_mkfs("1:", 1, 32768))
+    {
+        printf("Failed to format the card.\n");
+        return false;
+    }
+
+    std::string name;
+    char title[32];
+    for (uint32_t i=0; i<track_count; i++)
+    {
+        name = TrackName(i, levels, "Track");
+        snprintf(title, sizeof(title), "Title %04u", i);
+        const std::string notes = name.substr(0, name.rfind('/') + 1) + "Notes " + title + ".txt";
+        if (!CreateTrack(name, title, (i / 10) % 97) || (0 == i % 50 && !CreateText((levels > 0) ? (notes) : (std::string("Notes ") + title + ".txt"))))
+        {
+            printf("Failed to create %s.\n", name.c_str());
+            return false;
+        }
+    }
+    if (levels > 0 && !CreateLeftOut())
+    {
+        printf("Failed to create the tracks that are left out.\n");
+        return false;
+    }
+
+    printf("%u tracks, %u files, %u levels of folders:\n", track_count, (uint32_t)Expected.size(), levels);
+    bool ok = skip_no_index || Boot("no index", BOOT_NO_INDEX);
+    ok = skip_no_index || (Boot("names first", BOOT_NAMES) && Boot("then parse", BOOT_PARSE) && ok);
+    ok = (skip_no_index || (FR_OK == f_unlink(LIBRARY_INDEX_PATH))) && ok;
+    ok = Boot("first boot", BOOT_INDEX) && ok;
+    ok = Boot("warm boot", BOOT_INDEX) && ok;
+
+    // A day later, some tracks are retagged, and some replaced by new ones
+    sim_disk_set_time((46UL << 25) | (1UL << 21) | (2UL << 16));
+    const uint32_t step = (changed > 0) ? (100 / changed) : (0);
+    for (uint32_t i=0; step > 0 && i<track_count; i+=step)
+    {
+        snprintf(title, sizeof(title), "Retag %04u", i);
+        ok = Retag(TrackName(i, levels, "Track"), title) && ok;
+
+        const uint32_t removed = i + step / 2;
+        if (removed < track_count)
+        {
+            name = TrackName(removed, levels, "Track");
+            ok = (FR_OK == f_unlink(Path(name).c_str())) && ok;
+            Expected.erase(name);
+
+            snprintf(title, sizeof(title), "Added %04u", removed);
+            ok = CreateTrack(TrackName(removed, levels, "Added"), title, (removed / 10) % 97) && ok;
+        }
+    }
+
+    ok = Boot("changes, names", BOOT_NAMES) && ok;
+    ok = Boot("then parse", BOOT_PARSE) && ok;
+    ok = Boot("warm again", BOOT_INDEX) && ok;
+    ReportTable("track table", TRACK_TABLE_BUDGET);
+    ReportTable("largest table", TRACK_TABLE_MAX_SIZE);
+    f_mount(NULL, "1:", 0);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    sim_disk_config_S config = { 0, 500, 1000, 1000 };
+    uint32_t changed = 1;
+    uint32_t levels  = 0;
+    bool skip_no_index = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "r:w:d:c:t:s")) != -1)
+    {
+        switch (option)
+        {
+            case 'r': config.read_us  = atoi(optarg); break;
+            case 'w': config.write_us = atoi(optarg); break;
+            case 'd': config.kbps     = atoi(optarg); break;
+            case 'c': changed         = atoi(optarg); break;
+            case 't': levels          = atoi(optarg); break;
+            case 's': skip_no_index   = true;         break;
+            default:
+                printf("Usage: %s [-r read_us] [-w write_us] [-d sd_kbps] [-c changed] [-t levels] [-s] [tracks...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<uint32_t> sizes;
+    for (int i=optind; i<argc; i++)
+    {
+        sizes.push_back(atoi(argv[i]));
+    }
+    if (sizes.empty())
+    {
+        sizes.push_back(20);
+        sizes.push_back(500);
+        sizes.push_back(5000);
+    }
+
+    printf("SD card: %u us per read, %u us per write, %u KB/s, record of %u bytes\n",
+           config.read_us, config.write_us, config.kbps, (uint32_t)sizeof(library_record_S));
+
+    bool ok = true;
+    for (size_t i=0; i<sizes.size(); i++)
+    {
+        ok = Run(sizes[i], changed, levels, skip_no_index, config) && ok;
+    }
+    return (ok) ? (0) : (1);
+}
@@ -0,0 +1,154 @@
+#include "sim_disk.hpp"
+#include "ff.h"
+#include "disk/diskio.h"
+#include "lpc_sys.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+/**
+ *  @explanation:
+ *  Host versions of everything FatFs calls outside of itself: the disk, the time stamps and the sync objects.
+ *  There is one task, so the sync objects are always granted.
+ */
+
+#define SECTOR_SIZE (512)
+
+static sim_disk_config_S Config;
+static sim_disk_stats_S  Stats;
+static uint32_t          FatTime = 0;
+
+// Time in nanoseconds, so transfers of a sector at a time do not round away
+static uint64_t NowNs = 0;
+
+// Sectors that hold anything but zeros
+static std::map<DWORD, std::vector<BYTE> > Sectors;
+
+static void Transfer(uint32_t access_us, uint32_t bytes)
+{
+    NowNs += (uint64_t)access_us * 1000 + (uint64_t)bytes * 1000 * 1000 / Config.kbps;
+}
+
+void sim_disk_init(const sim_disk_config_S &config)
+{
+    Config = config;
+    Sectors.clear();
+    sim_disk_reset_stats();
+}
+
+void sim_disk_reset_stats(void)
+{
+    memset(&Stats, 0, sizeof(Stats));
+}
+
+sim_disk_stats_S sim_disk_get_stats(void)
+{
+    return Stats;
+}
+
+void sim_disk_set_time(uint32_t fattime)
+{
+    FatTime = fattime;
+}
+
+uint64_t sim_disk_now_us(void)
+{
+    return NowNs / 1000;
+}
+
+extern "C" {
+
+uint64_t sys_get_uptime_us(void)
+{
+    return sim_disk_now_us();
+}
+
+DSTATUS disk_initialize(BYTE drv)
+{
+    return 0;
+}
+
+DSTATUS disk_status(BYTE drv)
+{
+    return 0;
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+    if (sector + count > Config.sectors)
+    {
+        return RES_PARERR;
+    }
+
+    for (BYTE i=0; i<count; i++)
+    {
+        std::map<DWORD, std::vector<BYTE> >::const_iterator found = Sectors.find(sector + i);
+        if (Sectors.end() == found) memset(&buff[i * SECTOR_SIZE], 0, SECTOR_SIZE);
+        else                        memcpy(&buff[i * SECTOR_SIZE], &found->second[0], SECTOR_SIZE);
+    }
+
+    ++Stats.reads;
+    Stats.read_bytes += count * SECTOR_SIZE;
+    Transfer(Config.read_us, count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count)
+{
+    if (sector + count > Config.sectors)
+    {
+        return RES_PARERR;
+    }
+
+    static const BYTE Zeros[SECTOR_SIZE] = { 0 };
+    for (BYTE i=0; i<count; i++)
+    {
+        const BYTE *data = &buff[i * SECTOR_SIZE];
+        if (0 == memcmp(data, Zeros, SECTOR_SIZE)) Sectors.erase(sector + i);
+        else                                       Sectors[sector + i].assign(data, data + SECTOR_SIZE);
+    }
+
+    ++Stats.writes;
+    Stats.write_bytes += count * SECTOR_SIZE;
+    Transfer(Config.write_us, count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+    switch (ctrl)
+    {
+        case CTRL_SYNC:        return RES_OK;
+        case GET_SECTOR_COUNT: *(DWORD*)buff = Config.sectors; return RES_OK;
+        case GET_SECTOR_SIZE:  *(WORD*)buff  = SECTOR_SIZE;    return RES_OK;
+        case GET_BLOCK_SIZE:   *(DWORD*)buff = 1;              return RES_OK;
+        default:               return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void)
+{
+    return FatTime;
+}
+
+int ff_cre_syncobj(BYTE vol, _SYNC_t *sobj)
+{
+    *sobj = NULL;
+    return 1;
+}
+
+int ff_req_grant(_SYNC_t sobj)
+{
+    return 1;
+}
+
+void ff_rel_grant(_SYNC_t sobj)
+{
+}
+
+int ff_del_syncobj(_SYNC_t sobj)
+{
+    return 1;
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  SD card in RAM for running FatFs on a host, on a simulated clock.  Every disk_read and disk_write is one
+ *  card command, which takes a fixed access time before the first byte and then moves bytes at a fixed rate,
+ *  so a multiple sector read costs a lot less than as many single sector reads, like on the board.  Only
+ *  sectors that were written with something other than zeros are kept, so a card of many GB with thousands
+ *  of tracks fits, as long as most of every track is never written.
+ *
+ *  Only time spent waiting on the card moves the clock, the CPU time of FatFs and the scan is not counted.
+ */
+
+typedef struct
+{
+    uint32_t sectors;           // Size of the card
+    uint32_t read_us;           // Time every read takes before the first byte
+    uint32_t write_us;          // Time every write takes before the first byte, programming included
+    uint32_t kbps;              // Kilobytes per second moved after that
+} sim_disk_config_S;
+
+typedef struct
+{
+    uint32_t reads;             // Card commands
+    uint32_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+} sim_disk_stats_S;
+
+// @description : Throws away everything on the card and sets its timing
+void sim_disk_init(const sim_disk_config_S &config);
+
+void sim_disk_reset_stats(void);
+
+sim_disk_stats_S sim_disk_get_stats(void);
+
+// @description : Date and time files are stamped with, in FatFs format, see get_fattime
+void sim_disk_set_time(uint32_t fattime);
+
+// @description : Simulated time, the same as sys_get_uptime_us
+uint64_t sim_disk_now_us(void);
@@ -0,0 +1,228 @@
+#include "catch.hpp"
+#include "mp3_reverse.hpp"
+#include "mp3_frame.hpp"
+#include <cstring>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+// Tracks of MPEG 1 Layer III frames at 44100 Hz, filled with bytes that never form a sync word, and a reader
+// that counts the seeks and bytes the rewind costs when reading the track the way the ReaderTask does
+
+// Same as MP3_SEGMENT_SIZE
+static const uint32_t SegmentSize = 1024;
+
+// Bit rate index of every frame, 128 kbps is 9 and 320 kbps is 14
+static void PutFrame(std::vector<uint8_t> &track, std::set<uint32_t> &frames, uint8_t bit_rate_index)
+{
+    static const uint16_t kbps[15] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
+    const uint32_t size = 144 * kbps[bit_rate_index] * 1000 / 44100;
+
+    frames.insert(track.size());
+    const uint8_t header[4] = { 0xFF, 0xFB, (uint8_t)(bit_rate_index << 4), 0x00 };
+    track.insert(track.end(), header, header + sizeof(header));
+    for (uint32_t i=sizeof(header); i<size; i++)
+    {
+        track.push_back((uint8_t)(rand() & 0x7F));
+    }
+}
+
+static void PutBigEndian(uint8_t *bytes, uint32_t value)
+{
+    for (int i=0; i<4; i++)
+    {
+        bytes[i] = (value >> (8 * (3 - i))) & 0xFF;
+    }
+}
+
+// Rewinds from an offset until the start of the track, or fast forwards until the end, checks every window
+// is whole frames and moves the right way, and adds up what the reads cost
+typedef struct
+{
+    uint32_t windows;
+    uint32_t seeks;
+    uint32_t bytes_read;
+    uint32_t bytes_played;
+    uint32_t played_ms;     // Time of the track heard while scanning
+    uint32_t scanned_ms;    // Time of the track rewound or fast forwarded through
+    uint32_t final_cut;
+} scan_cost_S;
+
+static scan_cost_S Scan(const std::vector<uint8_t> &track, const std::set<uint32_t> &frames,
+                        const mp3_stream_info_S *info, uint32_t from, bool forward, uint32_t speed)
+{
+    scan_cost_S cost = { };
+    mp3_reverse_S reverse;
+    if (forward)
+    {
+        mp3_reverse_begin_fast_forward(&reverse, info, from, speed);
+    }
+    else
+    {
+        mp3_reverse_begin(&reverse, info, from, speed);
+    }
+
+    uint32_t window_offset = 0;
+    uint32_t window_size   = 0;
+    uint32_t last_start    = from;
+    while (mp3_reverse_next_window(&reverse, &window_offset, &window_size))
+    {
+        ++cost.windows;
+        ++cost.seeks;
+
+        // One segment at a time, stopping as soon as the window is done like the DecoderTask does
+        uint32_t first_frame = 0;
+        uint32_t expected    = 0;
+        for (uint32_t offset=window_offset; !reverse.done && offset<track.size(); offset+=SegmentSize)
+        {
+            const uint32_t size = std::min(SegmentSize, std::min((uint32_t)track.size(), window_offset + window_size) - offset);
+            cost.bytes_read += size;
+
+            const bool aligned = reverse.aligned;
+            uint32_t skip = 0;
+            const uint32_t send = mp3_reverse_trim(&reverse, &track[offset], size, offset, &skip);
+
+            // Window starts on a frame, and continues where it left off in every segment after
+            if (!aligned && reverse.aligned)
+            {
+                first_frame = offset + skip;
+                expected    = first_frame;
+                REQUIRE(frames.count(first_frame) == 1);
+            }
+            if (send > 0)
+            {
+                REQUIRE(offset + skip == expected);
+                expected += send;
+            }
+            cost.bytes_played += send;
+        }
+
+        REQUIRE(reverse.done);
+        REQUIRE(frames.count(reverse.cut) == 1);
+        REQUIRE(reverse.cut == expected);
+        const bool moved = (forward) ? (first_frame > last_start) : (first_frame < last_start);
+        REQUIRE(moved);
+
+        cost.played_ms += mp3_vbr_offset_to_ms(info, reverse.cut) - mp3_vbr_offset_to_ms(info, first_frame);
+        last_start = first_frame;
+    }
+
+    cost.scanned_ms = (forward) ? (mp3_vbr_offset_to_ms(info, reverse.cut) - mp3_vbr_offset_to_ms(info, from))
+                                : (mp3_vbr_offset_to_ms(info, from) - mp3_vbr_offset_to_ms(info, last_start));
+    cost.final_cut  = reverse.cut;
+    return cost;
+}
+
+TEST_CASE("Rewinding plays whole frames and stays within the SD card budget", "[mp3_reverse]")
+{
+    std::vector<uint8_t> track;
+    std::set<uint32_t> frames;
+    mp3_stream_info_S info;
+    srand(1);
+
+    SECTION("CBR track, 128 kbps")
+    {
+        // 60 s
+        for (int i=0; i<2297; i++)
+        {
+            PutFrame(track, frames, 9);
+        }
+        REQUIRE(mp3_vbr_parse(&track[0], 512, 0, track.size(), &info));
+        const uint32_t from = *frames.lower_bound(track.size() / 2);
+
+        for (uint32_t speed=MP3_REVERSE_MIN_SPEED; speed<=MP3_REVERSE_MAX_SPEED; speed*=2)
+        {
+            const scan_cost_S cost = Scan(track, frames, &info, from, false, speed);
+            INFO("Speed " << speed << " : " << cost.windows << " windows, " << cost.bytes_read << " bytes read, "
+                 << cost.played_ms << " ms heard, " << cost.scanned_ms << " ms rewound");
+
+            // Back at the first frame, where playing forward carries on from
+            CHECK(cost.final_cut > info.audio_start);
+            CHECK(cost.scanned_ms == mp3_vbr_offset_to_ms(&info, from));
+
+            // Moves back about speed times as fast as it plays
+            CHECK(cost.scanned_ms >= (speed - 0.5) * cost.played_ms);
+            CHECK(cost.scanned_ms <= (speed + 1.0) * cost.played_ms);
+
+            // One seek per window, no more than 5 per second heard
+            CHECK(cost.seeks == cost.windows);
+            CHECK(cost.seeks * 1000 <= 5 * cost.played_ms);
+
+            // Reads are no more than twice what is played
+            CHECK(cost.bytes_read <= 2 * cost.bytes_played);
+        }
+    }
+
+    SECTION("VBR track from 64 to 320 kbps, with a Xing table of contents")
+    {
+        // Xing frame first, then 60 s of audio
+        std::vector<uint32_t> offsets;
+        PutFrame(track, frames, 9);
+        for (int i=0; i<2297; i++)
+        {
+            offsets.push_back(track.size());
+            PutFrame(track, frames, 5 + rand() % 10);
+        }
+
+        // Table of contents from where every percent of the frames actually is
+        uint8_t *xing = &track[4 + 32];
+        memcpy(xing, "Xing", 4);
+        PutBigEndian(&xing[4], 0x7);
+        PutBigEndian(&xing[8], offsets.size());
+        PutBigEndian(&xing[12], track.size());
+        for (int i=0; i<100; i++)
+        {
+            xing[16 + i] = (uint8_t)((uint64_t)offsets[i * offsets.size() / 100] * 256 / track.size());
+        }
+
+        REQUIRE(mp3_vbr_parse(&track[0], 512, 0, track.size(), &info));
+        REQUIRE(info.type == MP3_VBR_XING);
+        const uint32_t from = *frames.lower_bound(track.size() * 3 / 4);
+
+        const scan_cost_S cost = Scan(track, frames, &info, from, false, MP3_REVERSE_DEFAULT_SPEED);
+        INFO(cost.windows << " windows, " << cost.bytes_read << " bytes read, " << cost.played_ms << " ms heard");
+
+        CHECK(cost.final_cut > info.audio_start);
+        CHECK(cost.seeks * 1000 <= 5 * cost.played_ms);
+        CHECK(cost.bytes_read <= 2 * cost.bytes_played);
+    }
+}
+
+TEST_CASE("Fast forward sends a fraction of the track to the decoder", "[mp3_reverse]")
+{
+    std::vector<uint8_t> track;
+    std::set<uint32_t> frames;
+    mp3_stream_info_S info;
+    srand(2);
+
+    // 60 s at 128 kbps
+    for (int i=0; i<2297; i++)
+    {
+        PutFrame(track, frames, 9);
+    }
+    REQUIRE(mp3_vbr_parse(&track[0], 512, 0, track.size(), &info));
+    const uint32_t from = *frames.lower_bound(track.size() / 4);
+    const uint32_t duration_ms = mp3_vbr_get_duration_ms(&info);
+
+    for (uint32_t ratio=4; ratio<=MP3_REVERSE_MAX_RATIO; ratio*=2)
+    {
+        const scan_cost_S cost = Scan(track, frames, &info, from, true, ratio);
+        INFO("Ratio " << ratio << " : " << cost.windows << " windows, " << cost.bytes_read << " bytes read, "
+             << cost.bytes_played << " bytes sent, " << cost.played_ms << " ms heard, " << cost.scanned_ms << " ms scanned");
+
+        // Stops less than a jump and a window before the end, the rest is played normally
+        CHECK(cost.final_cut < track.size());
+        CHECK(duration_ms - mp3_vbr_offset_to_ms(&info, cost.final_cut) <= MP3_REVERSE_PLAY_MS * ratio);
+
+        // Moves ahead about ratio times as fast as it plays
+        CHECK(cost.scanned_ms >= (ratio - 1.0) * cost.played_ms);
+        CHECK(cost.scanned_ms <= (ratio + 1.0) * cost.played_ms);
+
+        // Bytes sent per second scanned are about 1 / ratio of playing it all
+        const uint32_t scanned_bytes = cost.final_cut - from;
+        CHECK(cost.bytes_played * ratio <= scanned_bytes * 1.25);
+
+        CHECK(cost.seeks * 1000 <= 5 * cost.played_ms);
+        CHECK(cost.bytes_read <= 2 * cost.bytes_played);
+    }
+}
@@ -0,0 +1,181 @@
+#include "catch.hpp"
+#include "mp3_vbr.hpp"
+#include <cstring>
+
+// Corpus of first frames written the way LAME, Fraunhofer and plain CBR encoders lay them out,
+// each with the duration the encoder reports for the whole file
+
+// MPEG 1 Layer III, 128 kbps, 44100 Hz, stereo, 417 byte frames
+static const uint8_t Mpeg1Header[4] = { 0xFF, 0xFB, 0x90, 0x00 };
+
+// MPEG 2 Layer III, 64 kbps, 22050 Hz, mono, 208 byte frames
+static const uint8_t Mpeg2MonoHeader[4] = { 0xFF, 0xF3, 0x80, 0xC0 };
+
+static void PutBigEndian(uint8_t *bytes, uint32_t value, uint32_t size)
+{
+    for (uint32_t i=0; i<size; i++)
+    {
+        bytes[i] = (value >> (8 * (size - 1 - i))) & 0xFF;
+    }
+}
+
+// Writes a frame header, and the header of the frame after it so the sync search accepts it
+static void PutFrames(uint8_t *buffer, const uint8_t *header, uint32_t frame_size)
+{
+    memcpy(&buffer[0], header, 4);
+    memcpy(&buffer[frame_size], header, 4);
+}
+
+// Xing or Info header with every field, a linear table of contents, and optionally a LAME tag
+static void PutXing(uint8_t *frame, uint32_t side_info, const char *tag, uint32_t frames, uint32_t bytes,
+                    const uint8_t *toc, bool lame, uint16_t delay, uint16_t padding)
+{
+    uint8_t *xing = &frame[4 + side_info];
+    memcpy(xing, tag, 4);
+    PutBigEndian(&xing[4],  0xF, 4);
+    PutBigEndian(&xing[8],  frames, 4);
+    PutBigEndian(&xing[12], bytes, 4);
+    memcpy(&xing[16], toc, 100);
+    PutBigEndian(&xing[116], 50, 4);
+
+    if (lame)
+    {
+        uint8_t *lame_tag = &xing[120];
+        memcpy(lame_tag, "LAME3.99r", 9);
+        lame_tag[21] = delay >> 4;
+        lame_tag[22] = ((delay & 0xF) << 4) | (padding >> 8);
+        lame_tag[23] = padding & 0xFF;
+    }
+}
+
+static void LinearToc(uint8_t *toc)
+{
+    for (int i=0; i<100; i++)
+    {
+        toc[i] = (uint8_t)(i * 256 / 100);
+    }
+}
+
+TEST_CASE("Duration of VBR and CBR files from their first frame", "[mp3_vbr]")
+{
+    uint8_t buffer[512];
+    uint8_t toc[100];
+    mp3_stream_info_S info;
+    memset(buffer, 0, sizeof(buffer));
+    LinearToc(toc);
+
+    SECTION("Xing header with LAME delay and padding")
+    {
+        // 1000 frames * 1152 samples - 576 delay - 1000 padding = 1150424 samples
+        PutFrames(buffer, Mpeg1Header, 417);
+        PutXing(buffer, 32, "Xing", 1000, 400000, toc, true, 576, 1000);
+
+        REQUIRE(mp3_vbr_parse(buffer, sizeof(buffer), 2048, 2048 + 400000, &info));
+        CHECK(info.type            == MP3_VBR_XING);
+        CHECK(info.stream_start    == 2048);
+        CHECK(info.audio_start     == 2048 + 417);
+        CHECK(info.frames          == 1000);
+        CHECK(info.encoder_delay   == 576);
+        CHECK(info.encoder_padding == 1000);
+        CHECK(info.has_toc);
+        CHECK(mp3_vbr_get_duration_ms(&info) == 26086);
+        CHECK(mp3_vbr_get_byte_rate(&info)   == 15317);
+    }
+
+    SECTION("Info header of a CBR file")
+    {
+        PutFrames(buffer, Mpeg1Header, 417);
+        PutXing(buffer, 32, "Info", 500, 208500, toc, false, 0, 0);
+
+        REQUIRE(mp3_vbr_parse(buffer, sizeof(buffer), 0, 208500, &info));
+        CHECK(info.type == MP3_VBR_INFO);
+        CHECK(mp3_vbr_get_duration_ms(&info) == 13061);
+    }
+
+    SECTION("Xing header of an MPEG 2 mono file, side information is 9 bytes")
+    {
+        PutFrames(buffer, Mpeg2MonoHeader, 208);
+        PutXing(buffer, 9, "Xing", 300, 60000, toc, false, 0, 0);
+
+        REQUIRE(mp3_vbr_parse(buffer, sizeof(buffer), 0, 60000, &info));
+        CHECK(info.type   == MP3_VBR_XING);
+        CHECK(info.frames == 300);
+        CHECK(mp3_vbr_get_duration_ms(&info) == 7836);
+    }
+
+    SECTION("VBRI header with a table of contents")
+    {
+        // 10 entries of 200 frames, each 40000 bytes
+        PutFrames(buffer, Mpeg1Header, 417);
+        uint8_t *vbri = &buffer[36];
+        memcpy(vbri, "VBRI", 4);
+        PutBigEndian(&vbri[10], 400000, 4);
+        PutBigEndian(&vbri[14], 2000, 4);
+        PutBigEndian(&vbri[18], 10, 2);
+        PutBigEndian(&vbri[20], 1, 2);
+        PutBigEndian(&vbri[22], 2, 2);
+        PutBigEndian(&vbri[24], 200, 2);
+        for (int i=0; i<10; i++)
+        {
+            PutBigEndian(&vbri[26 + i * 2], 40000, 2);
+        }
+
+        REQUIRE(mp3_vbr_parse(buffer, sizeof(buffer), 0, 400000, &info));
+        CHECK(info.type   == MP3_VBR_VBRI);
+        CHECK(info.frames == 2000);
+        CHECK(info.has_toc);
+        CHECK(info.toc[50] == 128);
+        CHECK(mp3_vbr_get_duration_ms(&info) == 52244);
+    }
+
+    SECTION("No header, duration from the bit rate")
+    {
+        PutFrames(buffer, Mpeg1Header, 417);
+
+        REQUIRE(mp3_vbr_parse(buffer, sizeof(buffer), 0, 1000000, &info));
+        CHECK(info.type        == MP3_VBR_NONE);
+        CHECK(info.audio_start == 0);
+        CHECK(mp3_vbr_get_duration_ms(&info) == 62500);
+        CHECK(mp3_vbr_get_byte_rate(&info)   == 16000);
+        CHECK(mp3_vbr_offset_to_ms(&info, 500000) == 31250);
+        CHECK(mp3_vbr_ms_to_offset(&info, 31250)  == 500000);
+    }
+
+    SECTION("No frame at all")
+    {
+        CHECK_FALSE(mp3_vbr_parse(buffer, sizeof(buffer), 0, 1000000, &info));
+    }
+}
+
+TEST_CASE("Byte to time mapping follows the table of contents", "[mp3_vbr]")
+{
+    uint8_t buffer[512];
+    uint8_t toc[100];
+    mp3_stream_info_S info;
+    memset(buffer, 0, sizeof(buffer));
+
+    // First half of the time takes a quarter of the bytes
+    for (int i=0; i<100; i++)
+    {
+        toc[i] = (i < 50) ? (uint8_t)(i * 64 / 50) : (uint8_t)(64 + (i - 50) * 192 / 50);
+    }
+    PutFrames(buffer, Mpeg1Header, 417);
+    PutXing(buffer, 32, "Xing", 1000, 400000, toc, false, 0, 0);
+    REQUIRE(mp3_vbr_parse(buffer, sizeof(buffer), 0, 400000, &info));
+
+    const uint32_t duration = mp3_vbr_get_duration_ms(&info);
+    REQUIRE(duration == 26122);
+
+    // A CBR estimate would put a quarter of the bytes at a quarter of the time
+    const uint32_t half = mp3_vbr_offset_to_ms(&info, 100000);
+    CHECK(half >= duration / 2 - 300);
+    CHECK(half <= duration / 2 + 300);
+
+    const uint32_t offset = mp3_vbr_ms_to_offset(&info, duration / 2);
+    CHECK(offset >= 100000 - 2000);
+    CHECK(offset <= 100000 + 2000);
+
+    CHECK(mp3_vbr_offset_to_ms(&info, 0)      == 0);
+    CHECK(mp3_vbr_offset_to_ms(&info, 400000) == duration);
+    CHECK(mp3_vbr_ms_to_offset(&info, 0)      == info.audio_start);
+}
@@ -0,0 +1,185 @@
+#include "catch.hpp"
+#include "plugin_image.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Register and value of every word the runs write, repeats spelled out
+struct Write
+{
+    uint8_t  reg;
+    uint16_t value;
+    bool operator==(const Write &other) const { return reg == other.reg && value == other.value; }
+};
+
+// Decodes a file handed over a few bytes at a time, like reads off the SD card
+static bool Decode(plugin_format_E format, const std::vector<uint8_t> &file, size_t piece, std::vector<Write> &writes,
+                   uint32_t *runs = NULL)
+{
+    plugin_image_S image;
+    plugin_image_init(&image, format);
+
+    for (size_t offset=0; offset<file.size(); )
+    {
+        const size_t size = std::min(piece, file.size() - offset);
+        offset += plugin_image_decode(&image, &file[offset], size);
+        if (image.run_ready)
+        {
+            REQUIRE(image.run.count > 0);
+            REQUIRE((image.run.repeat || image.run.count <= PLUGIN_IMAGE_RUN_SIZE));
+            for (uint16_t i=0; i<image.run.count; i++)
+            {
+                const Write write = { image.run.reg, image.run.values[(image.run.repeat) ? (0) : (i)] };
+                writes.push_back(write);
+            }
+            if (runs) ++*runs;
+        }
+        if (image.failed)
+        {
+            return false;
+        }
+    }
+    return plugin_image_finish(&image);
+}
+
+static std::vector<uint8_t> Bytes(const std::string &text)
+{
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static std::vector<uint8_t> Img(const std::vector<uint16_t> &words)
+{
+    std::vector<uint8_t> bytes;
+    for (size_t i=0; i<words.size(); i++)
+    {
+        bytes.push_back(words[i] & 0xFF);
+        bytes.push_back(words[i] >> 8);
+    }
+    return bytes;
+}
+
+// Same layout VLSI ships its plugins in
+static const char *Plg =
+    "/* User application code loading tables for VS10xx */\n"
+    "\n"
+    "#ifndef SKIP_PLUGIN_VARNAME\n"
+    "#define PLUGIN_SIZE 11\n"
+    "const unsigned short plugin[11] = { /* Compressed plugin */\n"
+    "#endif\n"
+    "  0x0007, 0x0001, /*copy 1*/\n"
+    "  0x8050,\n"
+    "  0x0006, 0x0003, /*copy 3*/\n"
+    "  0x1234, 0x5678, 0x9abc, // last one\n"
+    "  0x0006, 0x8004, /*Rle(4)*/\n"
+    "  0x0000,\n"
+    "#ifndef SKIP_PLUGIN_VARNAME\n"
+    "};\n"
+    "#endif\n";
+
+static const Write PlgWrites[] = {
+    { 7, 0x8050 }, { 6, 0x1234 }, { 6, 0x5678 }, { 6, 0x9ABC }, { 6, 0 }, { 6, 0 }, { 6, 0 }, { 6, 0 },
+};
+
+TEST_CASE("Plugin files decode into register writes", "[plugin_image]")
+{
+    const std::vector<Write> expected(PlgWrites, PlgWrites + sizeof(PlgWrites) / sizeof(PlgWrites[0]));
+
+    SECTION("C array, skipping comments and preprocessor lines, in pieces of any size")
+    {
+        for (size_t piece=1; piece<=64; piece++)
+        {
+            INFO("Pieces of " << piece);
+            std::vector<Write> writes;
+            REQUIRE(Decode(PLUGIN_FORMAT_PLG, Bytes(Plg), piece, writes));
+            CHECK(writes == expected);
+        }
+    }
+
+    SECTION("Raw little endian words")
+    {
+        static const uint16_t words[] = { 7, 1, 0x8050, 6, 3, 0x1234, 0x5678, 0x9ABC, 6, 0x8004, 0 };
+        for (size_t piece=1; piece<=8; piece++)
+        {
+            std::vector<Write> writes;
+            REQUIRE(Decode(PLUGIN_FORMAT_IMG, Img(std::vector<uint16_t>(words, words + 11)), piece, writes));
+            CHECK(writes == expected);
+        }
+    }
+
+    SECTION("Long records are split into runs, long repeats are not")
+    {
+        std::vector<uint16_t> words;
+        words.push_back(6);
+        words.push_back(PLUGIN_IMAGE_RUN_SIZE * 2 + 1);
+        for (uint16_t i=0; i<PLUGIN_IMAGE_RUN_SIZE * 2 + 1; i++) words.push_back(i);
+        words.push_back(6);
+        words.push_back(0x8000 | 0x7FFF);
+        words.push_back(0xAAAA);
+
+        std::vector<Write> writes;
+        uint32_t runs = 0;
+        REQUIRE(Decode(PLUGIN_FORMAT_IMG, Img(words), 512, writes, &runs));
+        CHECK(runs == 4);
+        REQUIRE(writes.size() == PLUGIN_IMAGE_RUN_SIZE * 2 + 1 + 0x7FFF);
+        CHECK(writes[PLUGIN_IMAGE_RUN_SIZE * 2].value == PLUGIN_IMAGE_RUN_SIZE * 2);
+        CHECK(writes.back().value == 0xAAAA);
+    }
+
+    SECTION("Decimal numbers and suffixes")
+    {
+        std::vector<Write> writes;
+        REQUIRE(Decode(PLUGIN_FORMAT_PLG, Bytes("x[] = { 10, 1, 65535U, 0XA, 0x8002UL, 3 };"), 4, writes));
+        REQUIRE(writes.size() == 3);
+        CHECK(writes[0].reg == 10);
+        CHECK(writes[0].value == 65535);
+        CHECK(writes[2].value == 3);
+    }
+}
+
+TEST_CASE("Files that are not whole plugins are turned down", "[plugin_image]")
+{
+    std::vector<Write> writes;
+
+    SECTION("Ends in the middle of a record")
+    {
+        static const uint16_t words[] = { 7, 1, 0x8050, 6, 3, 0x1234 };
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_IMG, Img(std::vector<uint16_t>(words, words + 6)), 16, writes));
+    }
+
+    SECTION("Odd number of bytes")
+    {
+        std::vector<uint8_t> bytes = Img(std::vector<uint16_t>(1, 7));
+        bytes.push_back(1);
+        bytes.push_back(0);
+        bytes.push_back(0x50);
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_IMG, bytes, 16, writes));
+    }
+
+    SECTION("Register past the SCI registers")
+    {
+        static const uint16_t words[] = { 0x20, 1, 0 };
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_IMG, Img(std::vector<uint16_t>(words, words + 3)), 16, writes));
+    }
+
+    SECTION("Array that is cut off, or holds something other than numbers")
+    {
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_PLG, Bytes("p[] = { 7, 1, 0x8050, "), 16, writes));
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_PLG, Bytes("p[] = { 7, 1, 0x10000 };"), 16, writes));
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_PLG, Bytes("p[] = { 7, 1, PLUGIN_SIZE };"), 16, writes));
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_PLG, Bytes("p[] = { 7, 1, 8 / 2 };"), 16, writes));
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_PLG, Bytes("no array here"), 16, writes));
+        CHECK_FALSE(Decode(PLUGIN_FORMAT_PLG, Bytes("p[] = { };"), 16, writes));
+    }
+}
+
+TEST_CASE("Plugin format comes from the extension", "[plugin_image]")
+{
+    plugin_format_E format = PLUGIN_FORMAT_IMG;
+    CHECK(plugin_image_format_from_name("flac.plg", &format));
+    CHECK(PLUGIN_FORMAT_PLG == format);
+    CHECK(plugin_image_format_from_name("FLAC.IMG", &format));
+    CHECK(PLUGIN_FORMAT_IMG == format);
+    CHECK_FALSE(plugin_image_format_from_name("flac.plgx", &format));
+    CHECK_FALSE(plugin_image_format_from_name("flac", &format));
+    CHECK_FALSE(plugin_image_format_from_name("song.mp3", &format));
+}
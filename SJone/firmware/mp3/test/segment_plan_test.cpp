@@ -0,0 +1,68 @@
+#include "catch.hpp"
+#include "segment_plan.hpp"
+
+// Same as MP3_RING_ARENA_SIZE and MP3_RING_MAX_DEPTH
+static const uint32_t ArenaSize = 8192;
+static const uint32_t MaxDepth  = 16;
+
+TEST_CASE("Segment size follows the bit rate and the slowest read", "[segment_plan]")
+{
+    SECTION("Low bit rates get larger segments than the fixed 1024 bytes, up to the longest a segment can play")
+    {
+        const segment_plan_S plan = segment_plan_choose(64000 / 8, 20000, ArenaSize, MaxDepth);
+        CHECK(plan.size  == 2048);
+        CHECK(plan.depth == 4);
+
+        // Fewer segments per second than 1024 byte ones
+        CHECK(8000 / plan.size < 8000 / 1024);
+
+        const segment_plan_S slowest = segment_plan_choose(32000 / 8, 20000, ArenaSize, MaxDepth);
+        CHECK(slowest.size  == 1024);
+        CHECK(slowest.depth == 8);
+    }
+
+    SECTION("Every plan fits in the arena and never plays longer than the limit per segment")
+    {
+        static const uint32_t kbps[] = { 32, 64, 96, 128, 160, 192, 256, 320 };
+        for (uint32_t i=0; i<sizeof(kbps)/sizeof(kbps[0]); i++)
+        {
+            for (uint32_t read_us=0; read_us<=200000; read_us+=10000)
+            {
+                const uint32_t byte_rate = kbps[i] * 1000 / 8;
+                const segment_plan_S plan = segment_plan_choose(byte_rate, read_us, ArenaSize, MaxDepth);
+                INFO(kbps[i] << " kbps, " << read_us << " us read : " << plan.depth << " x " << plan.size);
+
+                CHECK(plan.size * plan.depth <= ArenaSize);
+                CHECK(plan.depth >= 2);
+                CHECK(plan.depth <= MaxDepth);
+                CHECK(plan.size * 1000 / byte_rate <= SEGMENT_PLAN_MAX_MS);
+            }
+        }
+    }
+
+    SECTION("High bit rates drop to smaller segments in a deeper ring once reads get slow")
+    {
+        const segment_plan_S fast = segment_plan_choose(320000 / 8, 20000, ArenaSize, MaxDepth);
+        CHECK(fast.size  == 4096);
+        CHECK(fast.depth == 2);
+        CHECK(fast.read_ahead_ms >= SEGMENT_PLAN_READ_MARGIN * 20);
+
+        const segment_plan_S slow = segment_plan_choose(320000 / 8, 60000, ArenaSize, MaxDepth);
+        CHECK(slow.size  == 2048);
+        CHECK(slow.depth == 4);
+        CHECK(slow.read_ahead_ms >= SEGMENT_PLAN_READ_MARGIN * 60);
+
+        // Slower than the arena can cover, as much read ahead as there can be
+        const segment_plan_S slowest = segment_plan_choose(320000 / 8, 500000, ArenaSize, MaxDepth);
+        CHECK(slowest.size  == SEGMENT_PLAN_MIN_SIZE);
+        CHECK(slowest.depth == MaxDepth);
+    }
+
+    SECTION("Unknown bit rate is planned for the highest one")
+    {
+        const segment_plan_S unknown = segment_plan_choose(0, 20000, ArenaSize, MaxDepth);
+        const segment_plan_S highest = segment_plan_choose(320000 / 8, 20000, ArenaSize, MaxDepth);
+        CHECK(unknown.size  == highest.size);
+        CHECK(unknown.depth == highest.depth);
+    }
+}
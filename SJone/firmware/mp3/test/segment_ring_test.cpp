@@ -0,0 +1,201 @@
+#include "catch.hpp"
+#include "segment_ring.hpp"
+#include "segment_plan.hpp"
+#include <deque>
+#include <vector>
+
+// The ring only needs its queues and the tick count from FreeRTOS, these stand in for them on the host.
+// Nothing ever blocks, the reader and decoder below take turns on a simulated clock and only ever ask for
+// what is already there.
+static uint64_t Now = 0;
+
+typedef struct
+{
+    UBaseType_t length;
+    UBaseType_t item_size;
+    std::deque< std::vector<uint8_t> > items;
+} host_queue_S;
+
+QueueHandle_t xQueueGenericCreate(const UBaseType_t uxQueueLength, const UBaseType_t uxItemSize, const uint8_t ucQueueType)
+{
+    host_queue_S *queue = new host_queue_S;
+    queue->length    = uxQueueLength;
+    queue->item_size = uxItemSize;
+    return queue;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait,
+                             const BaseType_t xCopyPosition)
+{
+    host_queue_S *queue = (host_queue_S *)xQueue;
+    if (queue->items.size() >= queue->length)
+    {
+        return pdFALSE;
+    }
+    const uint8_t *item = (const uint8_t *)pvItemToQueue;
+    queue->items.push_back(std::vector<uint8_t>(item, item + queue->item_size));
+    return pdTRUE;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait,
+                                const BaseType_t xJustPeek)
+{
+    host_queue_S *queue = (host_queue_S *)xQueue;
+    if (queue->items.empty())
+    {
+        return pdFALSE;
+    }
+    std::copy(queue->items.front().begin(), queue->items.front().end(), (uint8_t *)pvBuffer);
+    if (!xJustPeek)
+    {
+        queue->items.pop_front();
+    }
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t xQueue)
+{
+    return ((host_queue_S *)xQueue)->items.size();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(Now / 1000);
+}
+
+// 320 kbps, the highest MP3 bit rate, leaves the least time per byte
+static const uint32_t ByteRate = 320000 / 8;
+
+// Same as SegmentWaitTicks of the DecoderTask, how long it waits for a segment before it counts an underrun
+static const uint64_t SegmentWaitUs = 10000;
+
+// SD card read times, most reads are quick and every spike_every-th one is held up by the card
+typedef struct
+{
+    uint32_t read_us;
+    uint32_t spike_us;
+    uint32_t spike_every;
+} sd_latency_S;
+
+// Plays seconds of audio out of the ring, with the reader filling it as fast as the SD card lets it
+// The decoder plays a segment for as long as it holds that much audio, the VS1053b FIFO is left out
+static segment_ring_stats_S Play(SegmentRing &ring, const segment_plan_S &plan, const sd_latency_S &sd, uint32_t seconds)
+{
+    Now = 0;
+    REQUIRE(ring.Resize(plan.size, plan.depth, 0));
+    ring.ResetStats();
+
+    segment_slot_S *reading  = NULL;
+    segment_slot_S *playing  = NULL;
+    uint64_t read_done       = 0;
+    uint64_t play_done       = 0;
+    uint64_t wait_until      = SegmentWaitUs;
+    uint32_t reads           = 0;
+    bool     stalled         = false;
+    const uint64_t end       = seconds * 1000000ULL;
+
+    while (Now < end)
+    {
+        if (!reading)
+        {
+            reading = ring.AcquireFree(0);
+            if (reading)
+            {
+                const uint32_t read_us = (0 == ++reads % sd.spike_every) ? (sd.spike_us) : (sd.read_us);
+                read_done = Now + read_us;
+                ring.RecordReadTime(read_us);
+                stalled = false;
+            }
+            else if (!stalled)
+            {
+                ring.RecordReaderStall();
+                stalled = true;
+            }
+        }
+
+        if (!playing)
+        {
+            playing = ring.AcquireFilled(0);
+            if (playing)
+            {
+                play_done = Now + playing->size * 1000000ULL / ByteRate;
+            }
+            else if (Now >= wait_until)
+            {
+                ring.RecordUnderrun();
+                wait_until = Now + SegmentWaitUs;
+            }
+        }
+
+        // Next thing that happens, there is always a slot either being read or being played
+        Now = (playing) ? (play_done) : (wait_until);
+        if (reading)
+        {
+            Now = MIN(Now, read_done);
+        }
+
+        if (reading && read_done <= Now)
+        {
+            reading->size = reading->capacity;
+            ring.CommitFilled(reading);
+            reading = NULL;
+        }
+        if (playing && play_done <= Now)
+        {
+            ring.ReleaseFree(playing);
+            playing    = NULL;
+            wait_until = Now + SegmentWaitUs;
+        }
+    }
+
+    // Give back whatever is still out, for the next Resize
+    if (reading)
+    {
+        ring.ReleaseFree(reading);
+    }
+    if (playing)
+    {
+        ring.ReleaseFree(playing);
+    }
+    ring.Flush();
+    return ring.GetStats();
+}
+
+TEST_CASE("Segment ring keeps a 320 kbps stream playing through slow SD card reads", "[segment_ring]")
+{
+    static SegmentRing ring;
+    ring.Init();
+
+    SECTION("Plan for a track that was just opened rides out reads of up to 70 ms")
+    {
+        const sd_latency_S sd = { 4000, 70000, 20 };
+        const segment_plan_S plan = segment_plan_choose(ByteRate, 0, MP3_RING_ARENA_SIZE, MP3_RING_MAX_DEPTH);
+        const segment_ring_stats_S stats = Play(ring, plan, sd, 60);
+        INFO(plan.depth << " x " << plan.size << " bytes, " << plan.read_ahead_ms << " ms read ahead");
+
+        CHECK(stats.underruns == 0);
+        CHECK(stats.max_read_us == 70000);
+        CHECK(stats.segments_read >= 60 * ByteRate / plan.size);
+    }
+
+    SECTION("Plan for the slowest read seen rides out reads of up to 150 ms")
+    {
+        const sd_latency_S sd = { 4000, 150000, 50 };
+        const segment_plan_S plan = segment_plan_choose(ByteRate, sd.spike_us, MP3_RING_ARENA_SIZE, MP3_RING_MAX_DEPTH);
+        const segment_ring_stats_S stats = Play(ring, plan, sd, 60);
+        INFO(plan.depth << " x " << plan.size << " bytes, " << plan.read_ahead_ms << " ms read ahead");
+
+        CHECK(stats.underruns == 0);
+        CHECK(stats.min_fill_level < stats.depth);
+    }
+
+    SECTION("Reading one segment at a time, as without the ring, underruns on the same card")
+    {
+        const sd_latency_S sd = { 4000, 70000, 20 };
+        const segment_plan_S plan = { 1024, 1, 0 };
+        const segment_ring_stats_S stats = Play(ring, plan, sd, 60);
+
+        CHECK(stats.underruns > 0);
+        CHECK(stats.reader_stalls > 0);
+    }
+}
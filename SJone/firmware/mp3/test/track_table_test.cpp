@@ -0,0 +1,248 @@
+#include "catch.hpp"
+#include "track_table.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::string Name(const track_table_S &table, uint32_t index)
+{
+    return track_table_string(&table, track_table_get(&table, index)->name);
+}
+
+TEST_CASE("Tracks keep their strings", "[track_table]")
+{
+    std::vector<uint8_t> memory(4096);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "Song.mp3", "Artist", "Title", "Rock", 1));
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "A name that is a lot longer than thirty two characters.flac", NULL, "", "Rock", 3));
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "no extension", "Other", "Title", NULL, 2));
+    REQUIRE(3 == table.count);
+
+    const track_record_S *first = track_table_get(&table, 0);
+    REQUIRE("Song.mp3" == Name(table, 0));
+    REQUIRE(std::string("Artist") == track_table_string(&table, first->artist));
+    REQUIRE(std::string("Title")  == track_table_string(&table, first->title));
+    REQUIRE(std::string("Rock")   == track_table_string(&table, first->genre));
+    REQUIRE(4 == first->short_size);
+    REQUIRE(1 == first->codec);
+
+    const track_record_S *second = track_table_get(&table, 1);
+    REQUIRE("A name that is a lot longer than thirty two characters.flac" == Name(table, 1));
+    REQUIRE(54 == second->short_size);
+    REQUIRE(TRACK_STRING_NONE == second->artist);
+    REQUIRE(TRACK_STRING_NONE == second->title);
+    REQUIRE(std::string("") == track_table_string(&table, second->artist));
+
+    REQUIRE(12 == track_table_get(&table, 2)->short_size);
+    REQUIRE(NULL == track_table_get(&table, 3));
+}
+
+TEST_CASE("Repeated strings are stored once", "[track_table]")
+{
+    std::vector<uint8_t> memory(8192);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+
+    for (int i=0; i<20; i++)
+    {
+        const std::string name = "Track " + std::to_string(i) + ".mp3";
+        REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, name.c_str(), "Band", ("Song " + std::to_string(i % 5)).c_str(), "Jazz", 1));
+    }
+
+    // Band and Jazz once, 5 titles, 20 names
+    REQUIRE(track_table_get(&table, 0)->artist == track_table_get(&table, 19)->artist);
+    REQUIRE(track_table_get(&table, 0)->genre  == track_table_get(&table, 19)->genre);
+    REQUIRE(track_table_get(&table, 0)->title  == track_table_get(&table, 5)->title);
+    REQUIRE(track_table_get(&table, 0)->title  != track_table_get(&table, 1)->title);
+    REQUIRE(19 + 19 + 15 == table.shared);
+
+    uint32_t names = 0;
+    for (int i=0; i<20; i++) names += Name(table, i).size() + 1;
+    const uint32_t strings = names + 5 + 5 + 5 * 7;
+    REQUIRE(table.bottom + strings == track_table_get_used(&table));
+    REQUIRE(table.bottom == table.slot_count * 2 + table.folder_capacity * sizeof(track_folder_S) + 20 * sizeof(track_record_S));
+}
+
+TEST_CASE("A full table takes nothing of a track that does not fit", "[track_table]")
+{
+    std::vector<uint8_t> memory(256);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+
+    uint32_t added = 0;
+    while (track_table_add(&table, TRACK_FOLDER_ROOT, ("Track " + std::to_string(added) + ".mp3").c_str(), "Band",
+                           ("A title " + std::to_string(added)).c_str(), "Genre", 1))
+    {
+        ++added;
+    }
+    REQUIRE(added > 3);
+    REQUIRE(added == table.count);
+
+    const uint32_t used = track_table_get_used(&table);
+    const uint32_t shared = table.shared;
+    REQUIRE(!track_table_add(&table, TRACK_FOLDER_ROOT, "Another.mp3", "New artist", "New title", "New genre", 1));
+    REQUIRE(used == track_table_get_used(&table));
+    REQUIRE(shared == table.shared);
+
+    // Strings the failed track interned are gone from the slots too
+    for (uint32_t slot=0; slot<table.slot_count; slot++)
+    {
+        if (TRACK_STRING_NONE != table.slots[slot])
+        {
+            REQUIRE(table.slots[slot] >= table.top);
+        }
+    }
+
+    // Whatever fit is still right
+    for (uint32_t i=0; i<table.count; i++)
+    {
+        REQUIRE("Track " + std::to_string(i) + ".mp3" == Name(table, i));
+        REQUIRE(std::string("A title " + std::to_string(i)) == track_table_string(&table, track_table_get(&table, i)->title));
+    }
+}
+
+TEST_CASE("Strings are stored without interning once the slots fill up", "[track_table]")
+{
+    // 8 slots, of which 6 are used
+    std::vector<uint8_t> memory(256);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+    REQUIRE(8 == table.slot_count);
+
+    for (int i=0; i<10; i++)
+    {
+        const std::string text = std::to_string(i);
+        track_table_add(&table, TRACK_FOLDER_ROOT, text.c_str(), text.c_str(), NULL, NULL, 0);
+    }
+    REQUIRE(6 == table.slots_used);
+    for (uint32_t i=0; i<table.count; i++)
+    {
+        REQUIRE(std::to_string(i) == track_table_string(&table, track_table_get(&table, i)->artist));
+    }
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "again", "9", NULL, NULL, 0));
+    REQUIRE(std::string("9") == track_table_string(&table, track_table_get(&table, table.count - 1)->artist));
+}
+
+TEST_CASE("Tracks added before their tags are filled in later", "[track_table]")
+{
+    std::vector<uint8_t> memory(1024);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "a.mp3", NULL, NULL, NULL, TRACK_CODEC_PENDING));
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "b.mp3", "Band", NULL, "Jazz", 1));
+    const char *name = track_table_string(&table, track_table_get(&table, 0)->name);
+
+    REQUIRE(track_table_update(&table, 0, "Band", "Song", NULL, 2));
+    const track_record_S *record = track_table_get(&table, 0);
+    REQUIRE(2 == record->codec);
+    REQUIRE(record->artist == track_table_get(&table, 1)->artist);
+    REQUIRE(std::string("Song") == track_table_string(&table, record->title));
+    REQUIRE(TRACK_STRING_NONE == record->genre);
+
+    // Strings already handed out stay where they are
+    REQUIRE(name == track_table_string(&table, record->name));
+    REQUIRE(std::string("a.mp3") == name);
+
+    // Tags that do not fit leave the ones before, the codec is set anyway
+    const std::string title(2000, 't');
+    REQUIRE(!track_table_update(&table, 0, "Other", title.c_str(), NULL, 3));
+    REQUIRE(3 == record->codec);
+    REQUIRE(std::string("Song") == track_table_string(&table, record->title));
+    REQUIRE(std::string("Band") == track_table_string(&table, record->artist));
+}
+
+TEST_CASE("Tracks are found by name", "[track_table]")
+{
+    std::vector<uint8_t> memory(1024);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+    track_table_add(&table, TRACK_FOLDER_ROOT, "a.mp3", NULL, NULL, NULL, 1);
+    track_table_add(&table, TRACK_FOLDER_ROOT, "b.mp3", NULL, NULL, NULL, 1);
+
+    REQUIRE(1  == track_table_find(&table, "b.mp3"));
+    REQUIRE(0  == track_table_find(&table, "a.mp3"));
+    REQUIRE(-1 == track_table_find(&table, "c.mp3"));
+}
+
+TEST_CASE("Offsets limit the size of the table", "[track_table]")
+{
+    std::vector<uint8_t> memory(100000);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+    REQUIRE(TRACK_TABLE_MAX_SIZE == table.size);
+
+    const std::string name(60, 'n');
+    while (track_table_add(&table, TRACK_FOLDER_ROOT, (name + std::to_string(table.count)).c_str(), "Artist", NULL, NULL, 1)) { }
+    REQUIRE(table.top < TRACK_TABLE_MAX_SIZE);
+    REQUIRE(std::string("Artist") == track_table_string(&table, track_table_get(&table, table.count - 1)->artist));
+}
+
+TEST_CASE("Folders are runs of the tracks under them", "[track_table]")
+{
+    std::vector<uint8_t> memory(4096);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+    REQUIRE(1 == table.folder_count);
+
+    // Depth first: Intro.mp3, Band/, Band/Live.mp3, Band/First/, Band/First/1.mp3, Band/First/2.mp3, Band/Second/,
+    // Band/Second/1.mp3, Other/, Outro.mp3
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "Intro.mp3", NULL, NULL, NULL, 1));
+    REQUIRE(track_table_add_folder(&table, TRACK_FOLDER_ROOT, "Band"));
+    REQUIRE(track_table_add(&table, 1, "Live.mp3", NULL, NULL, NULL, 1));
+    REQUIRE(track_table_add_folder(&table, 1, "First"));
+    REQUIRE(track_table_add(&table, 2, "1.mp3", NULL, NULL, NULL, 1));
+    REQUIRE(track_table_add(&table, 2, "2.mp3", NULL, NULL, NULL, 1));
+    REQUIRE(track_table_add_folder(&table, 1, "Second"));
+    REQUIRE(track_table_add(&table, 3, "1.mp3", NULL, NULL, NULL, 1));
+    REQUIRE(track_table_add_folder(&table, TRACK_FOLDER_ROOT, "Other"));
+    REQUIRE(track_table_add(&table, TRACK_FOLDER_ROOT, "Outro.mp3", NULL, NULL, NULL, 1));
+    REQUIRE(5 == table.folder_count);
+
+    const uint16_t runs[][2] = { { 0, 6 }, { 1, 4 }, { 2, 2 }, { 4, 1 }, { 5, 0 } };
+    for (uint32_t i=0; i<table.folder_count; i++)
+    {
+        REQUIRE(runs[i][0] == track_table_get_folder(&table, i)->first);
+        REQUIRE(runs[i][1] == track_table_get_folder(&table, i)->count);
+    }
+    REQUIRE(1 == track_table_get_folder(&table, 3)->parent);
+    REQUIRE(std::string("Second") == track_table_string(&table, track_table_get_folder(&table, 3)->name));
+    REQUIRE(NULL == track_table_get_folder(&table, 5));
+
+    char path[32];
+    REQUIRE(track_table_get_path(&table, 4, path, sizeof(path)));
+    REQUIRE(std::string("Band/Second/1.mp3") == path);
+    REQUIRE(track_table_get_path(&table, 5, path, sizeof(path)));
+    REQUIRE(std::string("Outro.mp3") == path);
+
+    // Exactly enough room, and one short
+    REQUIRE(track_table_get_path(&table, 2, path, 17));
+    REQUIRE(std::string("Band/First/1.mp3") == path);
+    REQUIRE(!track_table_get_path(&table, 2, path, 16));
+    REQUIRE(!track_table_get_path(&table, 6, path, sizeof(path)));
+
+    // Same name in two folders
+    REQUIRE(2  == track_table_find(&table, "Band/First/1.mp3"));
+    REQUIRE(4  == track_table_find(&table, "Band/Second/1.mp3"));
+    REQUIRE(-1 == track_table_find(&table, "1.mp3"));
+    REQUIRE(-1 == track_table_find(&table, "Second/1.mp3"));
+    REQUIRE(-1 == track_table_find(&table, "xBand/Second/1.mp3"));
+    REQUIRE(0  == track_table_find(&table, "Intro.mp3"));
+}
+
+TEST_CASE("Folders stop at their share of the budget", "[track_table]")
+{
+    std::vector<uint8_t> memory(512);
+    track_table_S table;
+    track_table_init(&table, &memory[0], memory.size());
+    REQUIRE(4 == table.folder_capacity);
+
+    REQUIRE(track_table_add_folder(&table, TRACK_FOLDER_ROOT, "a"));
+    REQUIRE(track_table_add_folder(&table, 1, "b"));
+    REQUIRE(track_table_add_folder(&table, 2, "c"));
+    const uint32_t used = track_table_get_used(&table);
+    REQUIRE(!track_table_add_folder(&table, 3, "d"));
+    REQUIRE(used == track_table_get_used(&table));
+    REQUIRE(4 == table.folder_count);
+}
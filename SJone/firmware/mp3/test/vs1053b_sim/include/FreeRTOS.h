@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *  @explanation:
+ *  Host stand-in for FreeRTOS.h, only what the DecoderTask, the ReaderTask and what they call use.  Every task
+ *  is a thread, but only one runs at a time, and every blocking call moves the simulated clock forward once
+ *  none of them can run, see sim_port.cpp.
+ */
+
+typedef long          BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t      TickType_t;
+
+#define pdFALSE             ((BaseType_t)0)
+#define pdTRUE              ((BaseType_t)1)
+#define pdPASS              (pdTRUE)
+#define pdFAIL              (pdFALSE)
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS  ((TickType_t)1)
+
+// Same as FreeRTOSConfig.h
+#define PRIORITY_LOW        (1)
+#define PRIORITY_MEDIUM     (2)
+#define PRIORITY_HIGH       (3)
+
+// Tasks only switch in blocking calls, see sim_port.cpp
+#define portYIELD_FROM_ISR(x) ((void)(x))
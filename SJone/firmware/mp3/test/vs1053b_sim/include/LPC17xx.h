@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  Host stand-in for LPC17xx.h.  The peripherals the drivers touch directly are plain memory, so writes
+ *  to them are harmless, the simulated device only sees the pins through the Gpio classes.
+ */
+
+#define __I  volatile const
+#define __O  volatile
+#define __IO volatile
+
+typedef struct LPC_GPIO_type
+{
+    __IO uint32_t FIODIR;
+    uint32_t RESERVED0[3];
+    __IO uint32_t FIOMASK;
+    __IO uint32_t FIOPIN;
+    __IO uint32_t FIOSET;
+    __O  uint32_t FIOCLR;
+} LPC_GPIO_TypeDef;
+
+typedef struct
+{
+    __IO uint32_t CR0;
+    __IO uint32_t CR1;
+    __IO uint32_t DR;
+    __IO uint32_t SR;
+    __IO uint32_t CPSR;
+    __IO uint32_t IMSC;
+    __IO uint32_t RIS;
+    __IO uint32_t MIS;
+    __IO uint32_t ICR;
+    __IO uint32_t DMACR;
+} LPC_SSP_TypeDef;
+
+extern LPC_GPIO_TypeDef SimGpio[4];
+extern LPC_SSP_TypeDef  SimSsp[2];
+
+#define LPC_GPIO0 (&SimGpio[0])
+#define LPC_GPIO1 (&SimGpio[1])
+#define LPC_GPIO2 (&SimGpio[2])
+#define LPC_GPIO3 (&SimGpio[3])
+#define LPC_SSP0  (&SimSsp[0])
+#define LPC_SSP1  (&SimSsp[1])
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include "lpc_sys.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    eint_rising_edge,
+    eint_falling_edge
+} eint_intr_t;
+
+// Rising edges of the simulated DREQ call func, other pins never interrupt
+void eint3_enable_port0(uint8_t pin_num, eint_intr_t type, void_func_t func);
+void eint3_enable_port2(uint8_t pin_num, eint_intr_t type, void_func_t func);
+
+#ifdef __cplusplus
+}
+#endif
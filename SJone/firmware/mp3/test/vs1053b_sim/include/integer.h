@@ -0,0 +1,24 @@
+#pragma once
+
+/**
+ *  @explanation:
+ *  Host stand-in for the FatFs integer.h, included ahead of everything by the makefile.  A long is 32 bits
+ *  on the board but 64 bits here, and FatFs reads and writes DWORD fields of the disk straight through them,
+ *  so the same guard is taken first with types of the right size.
+ */
+
+#ifndef _FF_INTEGER
+#define _FF_INTEGER
+
+#include <stdint.h>
+
+typedef uint8_t  BYTE;
+typedef int16_t  SHORT;
+typedef uint16_t WORD;
+typedef uint16_t WCHAR;
+typedef int      INT;
+typedef unsigned UINT;
+typedef int32_t  LONG;
+typedef uint32_t DWORD;
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*void_func_t)(void);
+
+// Simulated time since power on, every call costs a little time so busy waits on it finish
+uint64_t sys_get_uptime_us(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef struct sim_queue* QueueHandle_t;
+
+// Sets and their members are queues too, like in FreeRTOS
+typedef QueueHandle_t QueueSetHandle_t;
+typedef QueueHandle_t QueueSetMemberHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t    xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t    xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t queue);
+
+// Selecting hands out the first member that is not empty, which is enough for WaitForEvent
+QueueSetHandle_t       xQueueCreateSet(UBaseType_t length);
+BaseType_t             xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set);
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks);
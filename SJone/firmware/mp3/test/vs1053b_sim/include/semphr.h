@@ -0,0 +1,13 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "queue.h"
+
+// Semaphores are queues of items without data, like in FreeRTOS, so they can be put in a queue set
+typedef QueueHandle_t SemaphoreHandle_t;
+
+// Mutexes do not inherit priority
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t        xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higher_priority_task_woken);
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shifts one byte to the simulated device, taking one byte time of the simulated SPI clock
+char ssp0_exchange_byte(char out);
+
+// Powers up SSP0 on the board, the argument is not used there either, the clock stays at the simulated one
+void ssp0_init(unsigned int max_clock_mhz);
+
+// Sets the simulated SPI clock to the CPU clock over the smallest even divider that is not over max_clock_mhz
+void ssp0_set_max_clock(unsigned int max_clock_mhz);
+
+// DMA writes complete on the simulated clock, the callback is called from the blocking call that reaches it
+void     ssp0_dma_init(void (*done_callback)(void));
+unsigned ssp0_dma_write_block(const unsigned char* pBuffer, uint32_t num_bytes);
+unsigned ssp0_dma_finish_write(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define taskSCHEDULER_SUSPENDED     ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED   ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING       ((BaseType_t)2)
+
+// Tasks only switch in blocking calls, never in between, so nothing can get in between
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+// Stack depth is left to the thread
+BaseType_t   xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack_depth, void *param, UBaseType_t priority,
+                         TaskHandle_t *handle);
+BaseType_t   xTaskGetSchedulerState(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t   xTaskGetTickCount(void);
+void         vTaskDelay(TickType_t ticks);
+uint32_t     ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+void         vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
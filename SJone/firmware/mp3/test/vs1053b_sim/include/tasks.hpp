@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in for tasks.hpp, the driver only needs the FreeRTOS types from it
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include "vs1053b_sim.hpp"
+#include "sim_port.hpp"
+#include "sim_disk.hpp"
+#include "sim_app.hpp"
+#include "mp3_tasks.hpp"
+#include "segment_ring.hpp"
+#include "track_stats.hpp"
+#include "plugin_image.hpp"
+#include "clock_governor.hpp"
+
+/**
+ *  @explanation:
+ *  Plays an mp3 file, or a generated CBR stream, through the DecoderTask and the ReaderTask of the firmware, the
+ *  unchanged VS1053b driver and the simulated device.  The file is put on a FatFs card in RAM, see sim_disk.hpp,
+ *  and the tasks are started the way main.cpp does.  Once the DecoderTask waits on PlaySem, the settings are
+ *  made the way the terminal makes them, PlaySem is given like the LCDTask does, and the play button is pressed.
+ *  The ReaderTask then fills the segment ring off the card while the DecoderTask plays it, or the DecoderTask
+ *  forwards sectors straight off the card in direct mode.  Prints the throughput, underruns, ring, SD card, SCI
+ *  traffic and CPU time once the DecoderTask moves on from the track, or once a cancel has closed the stream.
+ *
+ *  A patch or plugin can be loaded first, the way plugin_load does it, which prints how long it took and
+ *  checks that every word of WRAM made it to the device.
+ *
+ *  @usage:
+ *  vs1053b_sim [-s spi_hz] [-b burst] [-f] [-p] [-n] [-e] [-r read_us] [-d sd_kbps] [-x spike_us] [-c cancel_ms]
+ *              [-m mult] [-l plugin] [-w] [-v] [-k kbps] [-t seconds] [file.mp3]
+ *      -s : SSP0 clock until the driver sets it from CLOCKF, 1 MHz by default like the firmware
+ *      -b : Bytes per DREQ check, see VS1053b::SetBurstSize
+ *      -f : Stream mode, bursts are sized by the fill level of the FIFO, see decoder_set_stream_mode
+ *      -p : Poll DREQ instead of sleeping on the interrupt
+ *      -n : Run the driver as if the scheduler was not started, which also sends SDI bytes without DMA
+ *      -e : Direct mode, sectors are forwarded straight off the card, see decoder_set_direct_mode
+ *      -r : Microseconds every SD card command takes before the first byte, 500 by default
+ *      -d : Kilobytes per second the SD card reads at after that, 1000 by default
+ *      -x : Microseconds added to every 32nd command, like FatFs walking the cluster chain
+ *      -c : Stop playback after this many milliseconds, like 'mp3 stop', and measure how long the device takes
+ *      -m : Fix SC_MULT of CLOCKF, 0 to 7, instead of letting the driver choose it from the stream
+ *      -l : Load a .plg or .img file before playing, see plugin_image.hpp
+ *      -w : Load the plugin a word at a time, setting WRAMADDR for every word of WRAM like WriteRam does
+ *      -v : Press the volume buttons twice a second, down and up in turns, while playing
+ *      -k : Bit rate of the generated audio, 128 kbps by default
+ *      -t : Seconds of audio to generate when no file is given
+ */
+
+// Every this many card commands, one takes longer by the spike
+#define READ_SPIKE_PERIOD (32)
+
+// SDHC sized, so it is FAT32 like any card of a few GB, with 32 KB clusters, like library_sim
+#define CARD_SECTORS      (8UL * 1024 * 1024)
+#define CARD_CLUSTER_SIZE (32768)
+
+// Buttons are sampled every 20 ms by the DecoderTask, a press is held long enough for it to see the button down
+#define BUTTON_HOLD_MS    (50)
+#define BUTTON_PLAY       (22)
+#define BUTTON_VOLUME_UP  (19)
+#define BUTTON_VOLUME_DN  (20)
+
+// CheckButtons takes one button per pass and a pass can wait for a whole segment, so presses are a segment apart or more
+#define VOLUME_PERIOD_MS  (500)
+
+// Longest the device is given to play out what is left, or to get to the cancel, after the run
+#define PLAY_OUT_MS       (1000)
+
+// Track played, the name the DecoderTask prints
+#define TRACK_NAME        "sim"
+
+static FATFS Fs;
+
+// Bit rates of MPEG 1 Layer III, in the order of the bit rate index of the header
+static const uint16_t BitRates[] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 };
+
+// MPEG 1 Layer III, 44100 Hz, stereo, padded every few frames to keep the bit rate
+// @returns : False if the bit rate is not one a header can have
+static bool GenerateStream(std::vector<uint8_t> &mp3, uint32_t seconds, uint32_t kbps)
+{
+    uint8_t index = 1;
+    while (index < sizeof(BitRates) / sizeof(BitRates[0]) && BitRates[index] != kbps)
+    {
+        index++;
+    }
+    if (index == sizeof(BitRates) / sizeof(BitRates[0]))
+    {
+        return false;
+    }
+
+    // 128 kbps : 128000 / 8 * 1152 / 44100 = 417.96 bytes per frame
+    const uint32_t bytes_per_second = kbps * 1000 / 8;
+    const uint32_t frame_size       = bytes_per_second * 1152 / 44100;
+    const uint32_t frames           = seconds * 44100 / 1152;
+    uint32_t remainder = 0;
+    for (uint32_t frame=0; frame<frames; frame++)
+    {
+        remainder += bytes_per_second * 1152 % 44100;
+        const bool padding = (remainder >= 44100);
+        remainder -= (padding) ? (44100) : (0);
+
+        const uint8_t header[4] = { 0xFF, 0xFB, (uint8_t)((index << 4) | (padding << 1)), 0x00 };
+        mp3.insert(mp3.end(), header, header + sizeof(header));
+        for (uint32_t i=0; i<frame_size + padding - sizeof(header); i++)
+        {
+            mp3.push_back((uint8_t)(rand() & 0x7F));
+        }
+    }
+    return true;
+}
+
+static bool ReadFile(std::vector<uint8_t> &mp3, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    uint8_t buffer[4096];
+    size_t size = 0;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        mp3.insert(mp3.end(), buffer, buffer + size);
+    }
+    fclose(file);
+    return true;
+}
+
+// Loads a plugin the way plugin_load does, 2048 bytes at a time off the simulated SD card, at the top clock
+// @param word_at_a_time : Set WRAMADDR before every word of WRAM and write it on its own
+// @returns              : False if the file could not be loaded
+static bool LoadPlugin(VS1053b &player, const char *path, uint32_t read_us, uint32_t sd_kbps, bool word_at_a_time)
+{
+    plugin_format_E format;
+    std::vector<uint8_t> file;
+    if (!plugin_image_format_from_name(path, &format) || !ReadFile(file, path))
+    {
+        printf("[vs1053b_sim] Could not open %s as a .plg or .img file\n", path);
+        return false;
+    }
+
+    Device.ResetStats();
+    const uint64_t start_ns = Device.Now();
+    uint64_t read_ns = 0;
+    uint32_t runs    = 0;
+    bool written     = true;
+
+    // What every word of WRAM should end up as
+    std::map<uint16_t, uint16_t> expected;
+    uint16_t address = 0;
+
+    const uint8_t multiplier = player.GetClockStats().multiplier;
+    player.SetClockMultiplier(CLOCK_GOVERNOR_MAX_MULT);
+
+    plugin_image_S image;
+    plugin_image_init(&image, format);
+    for (size_t offset=0; offset<file.size() && written && !image.failed; offset+=2048)
+    {
+        const size_t size       = std::min((size_t)2048, file.size() - offset);
+        const uint64_t sector_ns = (uint64_t)read_us * 1000 + (uint64_t)size * 1000 * 1000 / sd_kbps;
+        Device.AdvanceTo(Device.Now() + sector_ns, false);
+        read_ns += sector_ns;
+
+        for (size_t used=0; used<size && written && !image.failed; )
+        {
+            used += plugin_image_decode(&image, &file[offset + used], size - used);
+            if (!image.run_ready)
+            {
+                continue;
+            }
+            ++runs;
+
+            const plugin_run_S &run = image.run;
+            for (uint16_t i=0; i<run.count && written; i++)
+            {
+                uint16_t value = run.values[(run.repeat) ? (0) : (i)];
+                if (WRAM == run.reg && word_at_a_time)
+                {
+                    written = player.WriteRegisterWords(WRAMADDR, &address, 1) && player.WriteRegisterWords(WRAM, &value, 1);
+                }
+                if      (WRAMADDR == run.reg) address = value;
+                else if (WRAM == run.reg)     expected[address++] = value;
+            }
+            if (!word_at_a_time || WRAM != run.reg)
+            {
+                written = written && player.WriteRegisterWords((SCI_reg)run.reg, run.values, run.count, run.repeat);
+            }
+        }
+    }
+
+    const uint32_t spi_hz = Device.GetConfig().spi_hz;
+    player.SetClockMultiplier(multiplier);
+
+    if (!written || !plugin_image_finish(&image))
+    {
+        printf("[vs1053b_sim] %s stopped after %u words, %s\n", path, image.words,
+               (written) ? ("not a whole plugin") : ("could not write to the device"));
+        return false;
+    }
+
+    uint32_t wrong = 0;
+    for (std::map<uint16_t, uint16_t>::const_iterator it=expected.begin(); it!=expected.end(); ++it)
+    {
+        wrong += (Device.PeekRam(it->first) != it->second);
+    }
+
+    const sim_stats_S &stats = Device.GetStats();
+    printf("------------------------------------------------------\n");
+    printf("Plugin          : %s, %u words in %u runs, %s\n", path, image.words, runs,
+           (word_at_a_time) ? ("a word at a time") : ("multiple writes"));
+    printf("Load time       : %.3f ms, %.3f ms of it reading the SD card, SPI at %.3f MHz\n", (Device.Now() - start_ns) / 1e6,
+           read_ns / 1e6, spi_hz / 1e6);
+    printf("SCI             : %llu writes, %llu lost to DREQ, CPU busy %.3f ms\n", (unsigned long long)stats.sci_writes,
+           (unsigned long long)stats.sci_lost_writes, stats.busy_ns / 1e6);
+    printf("WRAM            : %u words checked, %u wrong\n", (unsigned int)expected.size(), wrong);
+    printf("------------------------------------------------------\n");
+    return 0 == wrong;
+}
+
+// What the track was played as, the way the track list sniffs it, looking past one tag
+static codec_E SniffCodec(const std::vector<uint8_t> &file)
+{
+    uint32_t tag_size = 0;
+    codec_E codec = codec_sniff(&file[0], std::min((size_t)CODEC_SNIFF_SIZE, file.size()), &tag_size);
+    if (tag_size > 0 && tag_size < file.size())
+    {
+        codec = codec_sniff(&file[tag_size], std::min((size_t)CODEC_SNIFF_SIZE, file.size() - tag_size), &tag_size);
+    }
+    return codec;
+}
+
+// @returns : False if the card could not be formatted or the file did not fit
+static bool WriteCard(const std::vector<uint8_t> &file, const char *path)
+{
+    FIL fil;
+    UINT written = 0;
+    const bool ok = FR_OK == f_mount(&Fs, "1:", 0)
+                 && FR_OK == f_mkfs("1:", 1, CARD_CLUSTER_SIZE)
+                 && FR_OK == f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (!ok)
+    {
+        return false;
+    }
+    const bool all = FR_OK == f_write(&fil, &file[0], file.size(), &written) && written == file.size();
+    return FR_OK == f_close(&fil) && all;
+}
+
+// Holds a button down long enough for the DecoderTask to sample it, then lets go, which is when it acts
+static void PressButton(uint8_t pin)
+{
+    LPC_GPIO1->FIOPIN |= (1 << pin);
+    vTaskDelay(BUTTON_HOLD_MS / portTICK_PERIOD_MS);
+    LPC_GPIO1->FIOPIN &= ~(1 << pin);
+    vTaskDelay(BUTTON_HOLD_MS / portTICK_PERIOD_MS);
+}
+
+static void PrintReport(const sim_stats_S &stats, const vs1053b_clock_stats_S &clock, uint64_t elapsed_ns, bool direct)
+{
+    // The record of the track, moved into the history when the DecoderTask stopped it
+    // Its transfer counters are the ones to go by, MP3Player's are reset if the DecoderTask got to start the next track
+    track_stats_S track = { };
+    const bool recorded = Mp3Stats.GetHistory(0, &track) || Mp3Stats.GetCurrent(&track);
+    const vs1053b_transfer_stats_S transfer = (recorded) ? (track.transfer) : (MP3Player.GetTransferStats());
+
+    const double seconds       = elapsed_ns / 1e9;
+    const double audio_seconds = stats.audio_ns / 1e9;
+    const double needed        = (stats.audio_ns > 0) ? (stats.audio_bytes / audio_seconds) : (0);
+    const segment_ring_stats_S ring = Mp3Ring.GetStats();
+    const sim_disk_stats_S     disk = sim_disk_get_stats();
+    const vs1053b_cancel_stats_S cancel = MP3Player.GetCancelStats();
+
+    printf("------------------------------------------------------\n");
+    printf("Elapsed         : %.3f s for %.3f s of audio, %llu frames\n", seconds, audio_seconds, (unsigned long long)stats.frames);
+    if (direct)
+    {
+        printf("Segments        : forwarded straight off the card, no ring\n");
+    }
+    else
+    {
+        printf("Segments        : %u x %u bytes in the ring, %u read, lowest fill %u, %u underruns, %u reader stalls\n",
+               ring.depth, ring.segment_size, ring.segments_read, ring.min_fill_level, ring.underruns, ring.reader_stalls);
+    }
+    printf("SD card         : %u reads, %u writes, %.3f ms busy, longest segment read %.3f ms\n", disk.reads, disk.writes,
+           disk.busy_ns / 1e6, ring.max_read_us / 1e3);
+    printf("First audio     : %u ms after the play button\n", decoder_get_time_to_first_audio_ms());
+    printf("Throughput      : %.0f bytes/s, the stream needs %.0f bytes/s\n", stats.sdi_bytes / seconds, needed);
+    printf("Underruns       : %u, starved for %.3f ms\n", stats.underruns, stats.starved_ns / 1e6);
+    printf("Lowest fill     : %u of %u bytes\n", (stats.frames > 0) ? (stats.min_fill) : (0), SIM_FIFO_SIZE);
+    printf("Overflows       : %llu bytes\n", (unsigned long long)stats.overflow_bytes);
+    printf("Stray bytes     : %llu\n", (unsigned long long)stats.stray_bytes);
+    printf("SCI             : %llu reads, %llu writes, %.1f / s, %llu writes lost to DREQ\n", (unsigned long long)stats.sci_reads,
+           (unsigned long long)stats.sci_writes, (stats.sci_reads + stats.sci_writes) / seconds, (unsigned long long)stats.sci_lost_writes);
+    printf("DREQ            : %llu reads, %llu rising edges\n", (unsigned long long)stats.dreq_reads, (unsigned long long)stats.dreq_edges);
+    printf("CPU busy        : %.3f ms, %.2f %%\n", stats.busy_ns / 1e6, 100.0 * stats.busy_ns / elapsed_ns);
+    printf("CPU blocked     : %.3f ms, %.2f %%\n", stats.blocked_ns / 1e6, 100.0 * stats.blocked_ns / elapsed_ns);
+    if (stats.cancels > 0 || cancel.count > 0)
+    {
+        printf("Cancel          : %u, longest %.3f ms on the device, %.3f ms from the request to silence, %u resets\n",
+               stats.cancels, stats.cancel_ns_max / 1e6, cancel.max_us / 1e3, cancel.resets);
+    }
+    printf("Driver counters : %u bytes, %u bursts, %.3f ms on DREQ, longest gap %.3f ms, %u starved segments\n",
+           transfer.bytes, transfer.bursts, transfer.dreq_wait_us / 1e3, transfer.max_burst_gap_us / 1e3, transfer.starvations);
+    printf("Bursts          : %.1f / s, %.0f bytes each, %u fill level reads, %u misread\n", transfer.bursts / seconds,
+           (transfer.bursts > 0) ? ((double)transfer.bytes / transfer.bursts) : (0.0), transfer.fill_reads, transfer.fill_misreads);
+    printf("Clock           : SC_MULT %u%s, CLKI %.3f MHz, SPI %.3f MHz, %u changes\n", clock.multiplier,
+           (clock.governor) ? (" chosen by the driver") : (" fixed"), clock.clki_hz / 1e6, Device.GetConfig().spi_hz / 1e6, clock.changes);
+    if (recorded)
+    {
+        printf("Track stats     : %s, %u ms, %u bytes/s, %u reads of %u to %u us, %u underruns\n", track.name, track.duration_ms,
+               track.bytes_per_second, track.reads, track.read_min_us, track.read_max_us, track.underruns);
+    }
+    printf("------------------------------------------------------\n");
+}
+
+int main(int argc, char **argv)
+{
+    sim_config_S config = Device.GetConfig();
+    uint16_t burst      = 32;
+    bool     poll       = false;
+    bool     direct     = false;
+    uint32_t read_us    = 500;
+    uint32_t sd_kbps    = 1000;
+    uint32_t spike_us   = 0;
+    uint32_t cancel_ms  = 0;
+    bool     volume     = false;
+    bool     stream     = false;
+    uint32_t seconds    = 10;
+    uint32_t kbps       = 128;
+    int      multiplier = -1;
+    const char *plugin  = NULL;
+    bool     word_at_a_time = false;
+
+    int option = 0;
+    while ((option = getopt(argc, argv, "s:b:fpner:d:x:c:m:l:wvk:t:")) != -1)
+    {
+        switch (option)
+        {
+            case 's': config.spi_hz = atoi(optarg);    break;
+            case 'b': burst         = atoi(optarg);    break;
+            case 'f': stream        = true;            break;
+            case 'p': poll          = true;            break;
+            case 'n': SimSchedulerRunning = false;     break;
+            case 'e': direct        = true;            break;
+            case 'r': read_us       = atoi(optarg);    break;
+            case 'd': sd_kbps       = atoi(optarg);    break;
+            case 'x': spike_us      = atoi(optarg);    break;
+            case 'c': cancel_ms     = atoi(optarg);    break;
+            case 'm': multiplier    = atoi(optarg);    break;
+            case 'l': plugin        = optarg;          break;
+            case 'w': word_at_a_time = true;           break;
+            case 'v': volume        = true;            break;
+            case 'k': kbps          = atoi(optarg);    break;
+            case 't': seconds       = atoi(optarg);    break;
+            default:
+                printf("Usage: %s [-s spi_hz] [-b burst] [-f] [-p] [-n] [-e] [-r read_us] [-d sd_kbps] [-x spike_us] [-c cancel_ms] "
+                       "[-m mult] [-l plugin] [-w] [-v] [-k kbps] [-t seconds] [file.mp3]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::vector<uint8_t> mp3;
+    if (optind < argc)
+    {
+        if (!ReadFile(mp3, argv[optind]))
+        {
+            printf("[vs1053b_sim] Could not open %s\n", argv[optind]);
+            return 1;
+        }
+    }
+    else if (!GenerateStream(mp3, seconds, kbps))
+    {
+        printf("[vs1053b_sim] %u kbps is not an MPEG 1 Layer III bit rate\n", kbps);
+        return 1;
+    }
+
+    // Writing the file takes simulated time as well, before anything is measured
+    const sim_disk_config_S card = { CARD_SECTORS, read_us, read_us, sd_kbps, spike_us, READ_SPIKE_PERIOD };
+    sim_disk_init(card);
+    file_name_S track = { };
+    strcpy(track.full_name,  TRACK_NAME ".mp3");
+    strcpy(track.short_name, TRACK_NAME);
+    track.codec = SniffCodec(mp3);
+    if (!WriteCard(mp3, "1:" TRACK_NAME ".mp3"))
+    {
+        printf("[vs1053b_sim] Could not put %lu bytes on the simulated card\n", (unsigned long)mp3.size());
+        return 1;
+    }
+    sim_track_list_init(&track);
+
+    // Pins have to be known before the DecoderTask initializes the device, same tasks and priorities as main.cpp
+    Device.Configure(config, gpio_init);
+    reader_init();
+    xTaskCreate(DecoderTask, "DecoderTask", 4098, NULL, PRIORITY_HIGH,   NULL);
+    xTaskCreate(ReaderTask,  "ReaderTask",  2048, NULL, PRIORITY_MEDIUM, NULL);
+
+    // Settings are made once the DecoderTask waits for the LCDTask, the way the terminal makes them
+    while (NULL == PlaySem)
+    {
+        vTaskDelay(1);
+    }
+    MP3Player.SetBurstSize(burst);
+    MP3Player.SetDreqInterrupt(!poll);
+    decoder_set_stream_mode(stream);
+    decoder_set_direct_mode(direct);
+    if (multiplier >= 0)
+    {
+        decoder_set_clock(false, multiplier);
+    }
+
+    if (plugin && !LoadPlugin(MP3Player, plugin, read_us, sd_kbps, word_at_a_time))
+    {
+        fflush(stdout);
+        _exit(1);
+    }
+
+    printf("[vs1053b_sim] %lu bytes, SPI at %u Hz, bursts of %u%s, DREQ %s%s%s\n", (unsigned long)mp3.size(), config.spi_hz, burst,
+           (stream) ? (" or the free space in stream mode") : (""),
+           (MP3Player.IsDreqInterruptEnabled()) ? ("interrupt") : ("polled"), (direct) ? (", direct mode") : (""),
+           (SimSchedulerRunning) ? ("") : (", no scheduler"));
+
+    // Only the playback is measured
+    Device.ResetStats();
+    sim_disk_reset_stats();
+    Mp3Ring.ResetStats();
+    MP3Player.ResetCancelStats();
+    const uint64_t start_ns = Device.Now();
+
+    // Same as the LCDTask once a track is picked, then the play button, like a listener would
+    xSemaphoreGive(PlaySem);
+    PressButton(BUTTON_PLAY);
+
+    // Until the DecoderTask moves on from the track, or has closed the stream after the cancel
+    // Given up on after as long as the file lasts at the lowest bit rate, and then some
+    const uint64_t timeout_ns = start_ns + (uint64_t)(mp3.size() * 8 / BitRates[1] + 10 * 1000) * 1000 * 1000;
+    bool cancelled = false;
+    uint32_t presses = 0;
+    uint64_t press_ns = start_ns;
+    while (!sim_track_list_done() && Device.Now() < timeout_ns)
+    {
+        if (cancelled && !decoder_is_streaming())
+        {
+            break;
+        }
+        if (cancel_ms > 0 && !cancelled && Device.Now() - start_ns >= (uint64_t)cancel_ms * 1000 * 1000)
+        {
+            // Same as 'mp3 stop' from the terminal
+            decoder_stop();
+            cancelled = true;
+        }
+        if (volume && !cancelled && Device.Now() >= press_ns)
+        {
+            PressButton((presses++ & 1) ? (BUTTON_VOLUME_UP) : (BUTTON_VOLUME_DN));
+            press_ns = Device.Now() + (uint64_t)VOLUME_PERIOD_MS * 1000 * 1000;
+        }
+        else
+        {
+            vTaskDelay(1);
+        }
+    }
+    if (Device.Now() >= timeout_ns)
+    {
+        printf("[vs1053b_sim] Timed out, the DecoderTask never got to the end of the track\n");
+    }
+    sim_stop_tasks();
+
+    // Let the device play out what is left, or get to the cancel, for up to a second
+    const uint64_t play_out_ns = Device.Now() + (uint64_t)PLAY_OUT_MS * 1000 * 1000;
+    while (!Device.IsIdle() && Device.Now() < play_out_ns)
+    {
+        Device.AdvanceTo(Device.Now() + 1000 * 1000, false);
+    }
+    if (Device.IsCancelPending())
+    {
+        printf("[vs1053b_sim] SM_CANCEL was never cleared, the device did not get to the end of a frame\n");
+    }
+
+    PrintReport(Device.GetStats(), MP3Player.GetClockStats(), Device.Now() - start_ns, direct);
+
+    // The tasks are still blocked in their threads, which are never joined, so leave without running the destructors
+    fflush(stdout);
+    _exit(0);
+}
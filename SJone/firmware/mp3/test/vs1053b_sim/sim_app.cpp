@@ -0,0 +1,54 @@
+#include "sim_app.hpp"
+#include "sim_port.hpp"
+#include "mp3_tasks.hpp"
+#include <cstring>
+
+/**
+ *  @explanation:
+ *  Host versions of the parts of the app the DecoderTask and the ReaderTask call that the simulator leaves out.
+ *  The track list holds the one track being played, and moving on from it ends the run.  The RxTask and TxTask
+ *  do not run, like in main.cpp, so commands only come from the simulator and logs to the ESP32 are dropped by msg_protocol.cpp.
+ */
+
+QueueHandle_t MessageRxQueue = NULL;
+QueueHandle_t MessageTxQueue = NULL;
+
+static file_name_S Track;
+static bool        Done = false;
+
+void sim_track_list_init(const file_name_S *track)
+{
+    Track = *track;
+    Done  = false;
+}
+
+bool sim_track_list_done(void)
+{
+    return Done;
+}
+
+void track_list_next(void)
+{
+    Done = true;
+    sim_stop_tasks();
+}
+
+uint16_t track_list_get_size(void)
+{
+    return 1;
+}
+
+void track_list_set_current_track(uint16_t index)
+{
+    /* EMPTY */
+}
+
+void track_list_get_current_track(file_name_S *track)
+{
+    *track = Track;
+}
+
+bool track_list_get_track_after(const file_name_S *track, file_name_S *after)
+{
+    return false;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "common.hpp"
+
+// @description : Makes the track list hold only this track, nothing plays after it
+void sim_track_list_init(const file_name_S *track);
+
+// @description : True once the DecoderTask moved on from the track, the tasks are stopped then, see sim_stop_tasks
+bool sim_track_list_done(void);
@@ -0,0 +1,145 @@
+#include "sim_disk.hpp"
+#include "sim_port.hpp"
+#include "vs1053b_sim.hpp"
+// Ahead of ff.h, which would otherwise pull it in inside its extern "C"
+#include "semphr.h"
+#include "ff.h"
+#include "disk/diskio.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+/**
+ *  @explanation:
+ *  Host versions of everything FatFs calls outside of itself: the disk, the time stamps and the sync objects.
+ */
+
+#define SECTOR_SIZE (512)
+
+static sim_disk_config_S Config;
+static sim_disk_stats_S  Stats;
+static uint32_t          Commands = 0;
+
+// Sectors that hold anything but zeros
+static std::map<DWORD, std::vector<BYTE> > Sectors;
+
+// Blocks the calling task for as long as the card takes to move the bytes
+static void Transfer(uint32_t access_us, uint32_t bytes)
+{
+    const uint32_t spike_us = (Config.spike_every > 0 && 0 == ++Commands % Config.spike_every) ? (Config.spike_us) : (0);
+    const uint64_t busy_ns  = (uint64_t)(access_us + spike_us) * 1000 + (uint64_t)bytes * 1000 * 1000 / Config.kbps;
+    Stats.busy_ns += busy_ns;
+    sim_sleep_until_ns(Device.Now() + busy_ns);
+}
+
+void sim_disk_init(const sim_disk_config_S &config)
+{
+    Config   = config;
+    Commands = 0;
+    Sectors.clear();
+    sim_disk_reset_stats();
+}
+
+void sim_disk_reset_stats(void)
+{
+    memset(&Stats, 0, sizeof(Stats));
+}
+
+sim_disk_stats_S sim_disk_get_stats(void)
+{
+    return Stats;
+}
+
+extern "C" {
+
+DSTATUS disk_initialize(BYTE drv)
+{
+    return 0;
+}
+
+DSTATUS disk_status(BYTE drv)
+{
+    return 0;
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count)
+{
+    if (sector + count > Config.sectors)
+    {
+        return RES_PARERR;
+    }
+
+    for (BYTE i=0; i<count; i++)
+    {
+        std::map<DWORD, std::vector<BYTE> >::const_iterator found = Sectors.find(sector + i);
+        if (Sectors.end() == found) memset(&buff[i * SECTOR_SIZE], 0, SECTOR_SIZE);
+        else                        memcpy(&buff[i * SECTOR_SIZE], &found->second[0], SECTOR_SIZE);
+    }
+
+    ++Stats.reads;
+    Stats.read_bytes += count * SECTOR_SIZE;
+    Transfer(Config.read_us, count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count)
+{
+    if (sector + count > Config.sectors)
+    {
+        return RES_PARERR;
+    }
+
+    static const BYTE Zeros[SECTOR_SIZE] = { 0 };
+    for (BYTE i=0; i<count; i++)
+    {
+        const BYTE *data = &buff[i * SECTOR_SIZE];
+        if (0 == memcmp(data, Zeros, SECTOR_SIZE)) Sectors.erase(sector + i);
+        else                                       Sectors[sector + i].assign(data, data + SECTOR_SIZE);
+    }
+
+    ++Stats.writes;
+    Stats.write_bytes += count * SECTOR_SIZE;
+    Transfer(Config.write_us, count * SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+    switch (ctrl)
+    {
+        case CTRL_SYNC:        return RES_OK;
+        case GET_SECTOR_COUNT: *(DWORD*)buff = Config.sectors; return RES_OK;
+        case GET_SECTOR_SIZE:  *(WORD*)buff  = SECTOR_SIZE;    return RES_OK;
+        case GET_BLOCK_SIZE:   *(DWORD*)buff = 1;              return RES_OK;
+        default:               return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void)
+{
+    // 2026-01-01
+    return (46UL << 25) | (1UL << 21) | (1UL << 16);
+}
+
+int ff_cre_syncobj(BYTE vol, _SYNC_t *sobj)
+{
+    *sobj = xSemaphoreCreateMutex();
+    return 1;
+}
+
+int ff_req_grant(_SYNC_t sobj)
+{
+    return pdTRUE == xSemaphoreTake(sobj, _FS_TIMEOUT);
+}
+
+void ff_rel_grant(_SYNC_t sobj)
+{
+    xSemaphoreGive(sobj);
+}
+
+int ff_del_syncobj(_SYNC_t sobj)
+{
+    return 1;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ *  @explanation:
+ *  SD card in RAM for running FatFs under the DecoderTask and the ReaderTask, like the one of library_sim, but on
+ *  the clock of the simulated device.  Every disk_read and disk_write is one card command, which takes a fixed
+ *  access time before the first byte and then moves bytes at a fixed rate, and every spike_every-th command
+ *  takes longer by the spike, like FatFs walking the cluster chain.
+ *
+ *  A command blocks the task that makes it for as long as it takes, other tasks get the CPU in the meantime,
+ *  like the DecoderTask preempts the ReaderTask on the board.  The volume lock of FatFs is a mutex, so one task
+ *  waits for the other to be done with the card.
+ */
+
+typedef struct
+{
+    uint32_t sectors;           // Size of the card
+    uint32_t read_us;           // Time every read takes before the first byte
+    uint32_t write_us;          // Time every write takes before the first byte, programming included
+    uint32_t kbps;              // Kilobytes per second moved after that
+    uint32_t spike_us;          // Time added to every spike_every-th command
+    uint32_t spike_every;
+} sim_disk_config_S;
+
+typedef struct
+{
+    uint32_t reads;             // Card commands
+    uint32_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t busy_ns;           // Time the card was busy with commands
+} sim_disk_stats_S;
+
+// @description : Throws away everything on the card and sets its timing
+void sim_disk_init(const sim_disk_config_S &config);
+
+void sim_disk_reset_stats(void);
+
+sim_disk_stats_S sim_disk_get_stats(void);
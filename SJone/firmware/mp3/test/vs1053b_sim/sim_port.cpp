@@ -0,0 +1,522 @@
+#include "vs1053b_sim.hpp"
+#include "sim_port.hpp"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "ssp0.h"
+#include "eint.h"
+#include "lpc_sys.h"
+#include "gpio_output.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ *  @explanation:
+ *  Host versions of everything the firmware calls outside of itself, other than FatFs, see sim_disk.cpp.
+ *
+ *  Every task is a thread, but only one of them runs at a time: the one with the highest priority that is not
+ *  blocked, main being the lowest.  A task keeps the CPU until it blocks, or until it unblocks a task with a
+ *  higher priority, which then takes over right away like on the board.  An interrupt only gets its task going
+ *  at the next call into the scheduler, as tasks never switch in between.
+ *
+ *  When every task is blocked, the device is run forward to the next event that could wake one up, the DMA
+ *  done or DREQ interrupt, or to the first timeout.  Time spent there is counted as blocked, time spent shifting
+ *  bytes and busy waiting is counted as busy.
+ */
+
+#define NEVER (UINT64_MAX)
+
+LPC_GPIO_TypeDef SimGpio[4];
+LPC_SSP_TypeDef  SimSsp[2];
+
+bool SimSchedulerRunning = true;
+
+struct sim_task
+{
+    const char            *name;
+    UBaseType_t            priority;
+    TaskFunction_t         code;
+    void                  *param;
+    std::function<bool()>  until;       // Blocked until this is true, empty while it can run
+    uint64_t               deadline_ns; // Or until this time, NEVER if there is no timeout
+    uint32_t               notify_count;
+};
+
+struct sim_queue
+{
+    UBaseType_t length;
+    UBaseType_t item_size;
+    std::deque< std::vector<uint8_t> > items;
+    std::vector<sim_queue*> members;    // Only used by queue sets
+};
+
+// Tasks in the order they were made, main first
+static std::vector<sim_task*> Tasks;
+
+// Task holding the CPU, the others wait on TaskSwitched until it is them
+static sim_task               *Running = NULL;
+static std::mutex              SwitchLock;
+static std::condition_variable TaskSwitched;
+
+// Only main runs once the tasks are stopped, see sim_stop_tasks
+static bool Stopped = false;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                            SCHEDULER                                           //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static sim_task* NewTask(const char *name, UBaseType_t priority, TaskFunction_t code, void *param)
+{
+    sim_task *task = new sim_task;
+    task->name         = name;
+    task->priority     = priority;
+    task->code         = code;
+    task->param        = param;
+    task->deadline_ns  = NEVER;
+    task->notify_count = 0;
+    Tasks.push_back(task);
+    return task;
+}
+
+// Task making the call, the first call comes from main, which becomes the task with the lowest priority
+static sim_task* Current(void)
+{
+    if (NULL == Running)
+    {
+        Running = NewTask("main", 0, NULL, NULL);
+    }
+    return Running;
+}
+
+static bool CanRun(const sim_task *task)
+{
+    if (Stopped && task != Tasks[0])
+    {
+        return false;
+    }
+    return !task->until || task->until() || Device.Now() >= task->deadline_ns;
+}
+
+// Highest priority task that can run, the running one wins a tie so it is not switched out for nothing
+static sim_task* Highest(void)
+{
+    sim_task *best = NULL;
+    for (size_t i=0; i<Tasks.size(); i++)
+    {
+        sim_task *task = Tasks[i];
+        if (CanRun(task) && (!best || task->priority > best->priority || (task == Running && task->priority == best->priority)))
+        {
+            best = task;
+        }
+    }
+    return best;
+}
+
+static uint64_t FirstDeadline(void)
+{
+    uint64_t first = NEVER;
+    for (size_t i=0; i<Tasks.size(); i++)
+    {
+        first = std::min(first, Tasks[i]->deadline_ns);
+    }
+    return first;
+}
+
+// Hands the CPU to a task that can run, and waits for it to come back
+static void SwitchTo(sim_task *next)
+{
+    sim_task *self = Running;
+    next->until       = NULL;
+    next->deadline_ns = NEVER;
+    if (next == self)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(SwitchLock);
+    Running = next;
+    TaskSwitched.notify_all();
+    TaskSwitched.wait(lock, [self] { return Running == self; });
+}
+
+// Runs the task with the highest priority that can, moving the device on while none can
+// Returns once the calling task has the CPU again
+static void Schedule(void)
+{
+    while (1)
+    {
+        sim_task *next = Highest();
+        if (next)
+        {
+            SwitchTo(next);
+            return;
+        }
+
+        const uint64_t event = std::min(Device.NextEventNs(), FirstDeadline());
+        if (NEVER == event)
+        {
+            printf("[vs1053b_sim] Every task is blocked with nothing left that could wake one up\n");
+            exit(1);
+        }
+        // Always make progress, the DREQ estimate can land on the current time
+        Device.AdvanceTo(std::max(event, Device.Now() + 1), false);
+    }
+}
+
+// Blocks the calling task until a condition is met or the deadline passes
+// @returns : True if the condition was met
+static bool BlockUntil(const std::function<bool()> &until, uint64_t deadline_ns)
+{
+    sim_task *self = Current();
+    if (!until() && Device.Now() < deadline_ns)
+    {
+        self->until       = until;
+        self->deadline_ns = deadline_ns;
+        Schedule();
+    }
+    return until();
+}
+
+static uint64_t DeadlineOf(TickType_t ticks)
+{
+    return (portMAX_DELAY == ticks) ? (NEVER) : (Device.Now() + (uint64_t)ticks * 1000 * 1000);
+}
+
+// Hands the CPU over if the calling task just unblocked one with a higher priority
+static void Preempt(void)
+{
+    sim_task *self = Current();
+    sim_task *next = Highest();
+    if (next && next->priority > self->priority)
+    {
+        SwitchTo(next);
+    }
+}
+
+static void RunTask(sim_task *task)
+{
+    {
+        std::unique_lock<std::mutex> lock(SwitchLock);
+        TaskSwitched.wait(lock, [task] { return Running == task; });
+    }
+    task->code(task->param);
+
+    printf("[vs1053b_sim] %s returned, tasks never do on the board\n", task->name);
+    exit(1);
+}
+
+void sim_sleep_until_ns(uint64_t ns)
+{
+    BlockUntil([] { return false; }, ns);
+}
+
+void sim_stop_tasks(void)
+{
+    Stopped = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                             FREERTOS                                           //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack_depth, void *param, UBaseType_t priority,
+                       TaskHandle_t *handle)
+{
+    Current();
+    sim_task *task = NewTask(name, priority, code, param);
+    std::thread(RunTask, task).detach();
+    if (handle)
+    {
+        *handle = task;
+    }
+    Preempt();
+    return pdPASS;
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+    return (SimSchedulerRunning) ? (taskSCHEDULER_RUNNING) : (taskSCHEDULER_NOT_STARTED);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return Current();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return Device.Now() / (1000 * 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    BlockUntil([] { return false; }, DeadlineOf(ticks));
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    sim_task *self = Current();
+    BlockUntil([self] { return self->notify_count > 0; }, DeadlineOf(ticks));
+    const uint32_t count = self->notify_count;
+    if (count > 0)
+    {
+        self->notify_count = (clear_on_exit) ? (0) : (count - 1);
+    }
+    return count;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+    ++((sim_task*)task)->notify_count;
+    *higher_priority_task_woken = pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    sim_queue *queue = new sim_queue;
+    queue->length    = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+// Adds an item without giving up the CPU, for interrupts
+static BaseType_t Push(QueueHandle_t queue, const void *item)
+{
+    if (queue->items.size() >= queue->length)
+    {
+        return pdFALSE;
+    }
+    queue->items.push_back(std::vector<uint8_t>(queue->item_size));
+    if (queue->item_size > 0)
+    {
+        memcpy(&queue->items.back()[0], item, queue->item_size);
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    if (!BlockUntil([queue] { return queue->items.size() < queue->length; }, DeadlineOf(ticks)))
+    {
+        return pdFALSE;
+    }
+    Push(queue, item);
+    Preempt();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks)
+{
+    if (!BlockUntil([queue] { return !queue->items.empty(); }, DeadlineOf(ticks)))
+    {
+        return pdFALSE;
+    }
+    if (queue->item_size > 0)
+    {
+        memcpy(buffer, &queue->items.front()[0], queue->item_size);
+    }
+    queue->items.pop_front();
+    Preempt();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->items.size();
+}
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t length)
+{
+    return xQueueCreate(length, 0);
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set)
+{
+    set->members.push_back(member);
+    return pdPASS;
+}
+
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks)
+{
+    QueueSetMemberHandle_t selected = NULL;
+    BlockUntil([set, &selected]
+    {
+        selected = NULL;
+        for (size_t i=0; i<set->members.size() && !selected; i++)
+        {
+            selected = (set->members[i]->items.empty()) ? (NULL) : (set->members[i]);
+        }
+        return NULL != selected;
+    }, DeadlineOf(ticks));
+    return selected;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+    Push(mutex, NULL);
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    return xQueueReceive(semaphore, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xQueueSend(semaphore, NULL, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higher_priority_task_woken)
+{
+    *higher_priority_task_woken = pdTRUE;
+    return Push(semaphore, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                           PERIPHERALS                                          //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t sys_get_uptime_us(void)
+{
+    Device.AdvanceTo(Device.Now() + Device.GetConfig().uptime_read_ns, true);
+    return Device.Now() / 1000;
+}
+
+char ssp0_exchange_byte(char out)
+{
+    return Device.Exchange(out);
+}
+
+void ssp0_init(unsigned int max_clock_mhz)
+{
+    /* EMPTY */
+}
+
+void ssp0_set_max_clock(unsigned int max_clock_mhz)
+{
+    // Same divider search as ssp_set_max_clock, with the CPU at 48 MHz
+    const unsigned int cpu_clock_mhz = 48;
+    unsigned int divider = 2;
+    while (max_clock_mhz < (cpu_clock_mhz / divider) && divider <= 254)
+    {
+        divider += 2;
+    }
+    Device.SetSpiHz(cpu_clock_mhz * 1000 * 1000 / divider);
+}
+
+void ssp0_dma_init(void (*done_callback)(void))
+{
+    Device.SetDmaCallback(done_callback);
+}
+
+unsigned ssp0_dma_write_block(const unsigned char* pBuffer, uint32_t num_bytes)
+{
+    Device.StartDma(pBuffer, num_bytes);
+    return 0;
+}
+
+unsigned ssp0_dma_finish_write(void)
+{
+    return 0;
+}
+
+void eint3_enable_port0(uint8_t pin_num, eint_intr_t type, void_func_t func)
+{
+    if (eint_rising_edge == type)
+    {
+        Device.SetDreqCallback(GPIO_PORT0, pin_num, func);
+    }
+}
+
+void eint3_enable_port2(uint8_t pin_num, eint_intr_t type, void_func_t func)
+{
+    if (eint_rising_edge == type)
+    {
+        Device.SetDreqCallback(GPIO_PORT2, pin_num, func);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                               GPIO                                             //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t PortOf(const LPC_GPIO_TypeDef *gpio)
+{
+    return gpio - SimGpio;
+}
+
+Gpio::Gpio(gpio_port_t port, gpio_pin_t pin, gpio_mode_t mode)
+{
+    Pin     = pin;
+    GpioPtr = &SimGpio[port];
+
+    switch (mode)
+    {
+        case INPUT:  GpioPtr->FIODIR &= ~(1 << Pin); break;
+        case OUTPUT: GpioPtr->FIODIR |=  (1 << Pin); break;
+    }
+}
+
+void Gpio::SelectGpioFunction(gpio_port_t port)
+{
+    /* EMPTY */
+}
+
+bool Gpio::IsHigh()
+{
+    bool value = false;
+    if (Device.ReadPin(PortOf(GpioPtr), Pin, &value))
+    {
+        return value;
+    }
+    return GpioPtr->FIOPIN & (1 << Pin);
+}
+
+bool Gpio::IsLow()
+{
+    return !IsHigh();
+}
+
+void GpioOutput::SetValue(bool value)
+{
+    (value) ? (GpioPtr->FIOPIN |= (1 << Pin)) : (GpioPtr->FIOPIN &= ~(1 << Pin));
+    Device.WritePin(PortOf(GpioPtr), Pin, value);
+
+    LastValue = value;
+}
+
+void GpioOutput::SetHigh()
+{
+    SetValue(true);
+}
+
+void GpioOutput::SetLow()
+{
+    SetValue(false);
+}
+
+void GpioOutput::Toggle()
+{
+    SetValue(!LastValue);
+}
+
+bool GpioOutput::GetValue()
+{
+    return LastValue;
+}
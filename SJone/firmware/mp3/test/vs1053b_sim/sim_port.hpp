@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+
+// Run without the scheduler as far as the driver can tell, it then polls DREQ and sends every byte through the FIFO
+extern bool SimSchedulerRunning;
+
+// @description : Blocks the calling task until a time that is finer than a tick, for the SD card
+// @param ns    : Simulated time to wake up at
+void sim_sleep_until_ns(uint64_t ns);
+
+// @description : Stops handing the CPU to the tasks made with xTaskCreate, the calling one runs on until it blocks
+//                From then on only main runs, the others stay wherever they blocked
+void sim_stop_tasks(void);
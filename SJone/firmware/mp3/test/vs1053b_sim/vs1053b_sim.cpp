@@ -0,0 +1,555 @@
+#include "vs1053b_sim.hpp"
+#include "mp3_frame.hpp"
+#include <algorithm>
+#include <cstring>
+
+// MODE bits the model acts on
+#define SM_RESET    (1 << 2)
+#define SM_CANCEL   (1 << 3)
+#define SM_STREAM   (1 << 6)
+
+// Register values after a hardware reset
+#define MODE_RESET_VALUE    (0x4800)
+#define STATUS_RESET_VALUE  (0x0040)
+
+#define NEVER (UINT64_MAX)
+
+// Clock cycles the device needs after a write to each register, DREQ is low until then
+// CLOCKF is counted in XTALI cycles, everything else in CLKI cycles
+static const uint16_t WriteCycles[16] =
+{
+    80, 80, 80, 1200, 100, 450, 100, 100, 80, 80, 210, 80, 80, 80, 80, 80
+};
+
+// CLKI multiplier from SC_MULT of CLOCKF, in tenths
+static const uint8_t ClockMultiplier[8] = { 10, 20, 25, 30, 35, 40, 45, 50 };
+
+Vs1053bSim Device;
+
+Vs1053bSim::Vs1053bSim() : Ram(1 << 16, 0)
+{
+    const sim_config_S defaults =
+    {
+        .spi_hz         = 1000000,
+        .xtali_hz       = 12288000,
+        .skip_ns        = 200,
+        .reset_us       = 1800,
+        .pin_read_ns    = 100,
+        .uptime_read_ns = 250,
+    };
+    memset(&Pins, 0, sizeof(Pins));
+    Config = defaults;
+
+    NowNs        = 0;
+    ResetPin     = true;
+    XcsPin       = true;
+    XdcsPin      = true;
+    DmaDoneNs    = NEVER;
+    DmaCallback  = NULL;
+    DreqCallback = NULL;
+
+    Reset();
+    LastDreq = Dreq();
+    ResetStats();
+}
+
+void Vs1053bSim::Configure(const sim_config_S &config, const vs1053b_gpio_init_t &pins)
+{
+    Config = config;
+    Pins   = pins;
+}
+
+void Vs1053bSim::ResetStats()
+{
+    memset(&Stats, 0, sizeof(Stats));
+    Stats.min_fill = SIM_FIFO_SIZE;
+}
+
+const sim_config_S& Vs1053bSim::GetConfig() const
+{
+    return Config;
+}
+
+const sim_stats_S& Vs1053bSim::GetStats() const
+{
+    return Stats;
+}
+
+bool Vs1053bSim::IsCancelPending() const
+{
+    return Registers[MODE] & SM_CANCEL;
+}
+
+uint16_t Vs1053bSim::PeekRam(uint16_t address) const
+{
+    return Ram[address];
+}
+
+bool Vs1053bSim::IsIdle() const
+{
+    return (0 == FifoCount) && !IsCancelPending();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                              CLOCK                                             //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint64_t Vs1053bSim::Now() const
+{
+    return NowNs;
+}
+
+void Vs1053bSim::AdvanceTo(uint64_t ns, bool busy)
+{
+    if (ns <= NowNs)
+    {
+        return;
+    }
+
+    if (busy) Stats.busy_ns    += ns - NowNs;
+    else      Stats.blocked_ns += ns - NowNs;
+
+    while (true)
+    {
+        // Decoder only runs when there is something to decode, or a cancel to honor between frames
+        const bool in_reset = (NowNs < ResetDoneNs);
+        const bool decoding = (FifoCount > 0) || (IsCancelPending() && 0 == FrameRemaining);
+        const uint64_t decode_ns = (decoding && !in_reset) ? (std::max((uint64_t)NextByteNs, NowNs)) : (NEVER);
+
+        // Only stop at reset and SCI busy ends to catch the DREQ edge
+        uint64_t event = std::min(decode_ns, DmaDoneNs);
+        if (ResetDoneNs > NowNs) event = std::min(event, ResetDoneNs);
+        if (SciBusyNs   > NowNs) event = std::min(event, SciBusyNs);
+
+        if (event > ns)
+        {
+            break;
+        }
+
+        NowNs = event;
+        if (event == DmaDoneNs)
+        {
+            DmaDoneNs = NEVER;
+            for (size_t i=0; i<DmaData.size(); i++)
+            {
+                if (!XdcsPin) PushSdi(DmaData[i]);
+                else          ++Stats.stray_bytes;
+            }
+            if (DmaCallback)
+            {
+                DmaCallback();
+            }
+        }
+        else if (event == decode_ns)
+        {
+            DecodeByte();
+        }
+        CheckDreqEdge();
+    }
+
+    NowNs = ns;
+    CheckDreqEdge();
+}
+
+uint64_t Vs1053bSim::NextEventNs() const
+{
+    uint64_t event = DmaDoneNs;
+
+    // DREQ can only rise if the decoder frees up the FIFO, or a reset or SCI write finishes
+    if (!Dreq())
+    {
+        if (ResetDoneNs > NowNs) event = std::min(event, ResetDoneNs);
+        if (SciBusyNs   > NowNs) event = std::min(event, SciBusyNs);
+        if (FifoCount > 0)       event = std::min(event, std::max((uint64_t)NextByteNs, NowNs));
+    }
+    return event;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                              SEAMS                                             //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Vs1053bSim::WritePin(uint8_t port, uint8_t pin, bool value)
+{
+    if (port == Pins.port_reset && pin == Pins.pin_reset)
+    {
+        // Held in reset while low, starts up when released
+        if (!value)
+        {
+            Reset();
+            ResetDoneNs = NEVER;
+        }
+        else if (!ResetPin)
+        {
+            ResetDoneNs = NowNs + (uint64_t)Config.reset_us * 1000;
+        }
+        ResetPin = value;
+    }
+    else if (port == Pins.port_xcs && pin == Pins.pin_xcs)
+    {
+        // Deselecting ends the SCI transaction
+        if (value)
+        {
+            SciIndex = 0;
+        }
+        XcsPin = value;
+    }
+    else if (port == Pins.port_xdcs && pin == Pins.pin_xdcs)
+    {
+        XdcsPin = value;
+    }
+    CheckDreqEdge();
+}
+
+bool Vs1053bSim::ReadPin(uint8_t port, uint8_t pin, bool *value)
+{
+    if (port != Pins.port_dreq || pin != Pins.pin_dreq)
+    {
+        return false;
+    }
+
+    ++Stats.dreq_reads;
+    AdvanceTo(NowNs + Config.pin_read_ns, true);
+    *value = Dreq();
+    return true;
+}
+
+void Vs1053bSim::SetSpiHz(uint32_t spi_hz)
+{
+    Config.spi_hz = spi_hz;
+}
+
+uint8_t Vs1053bSim::Exchange(uint8_t out)
+{
+    AdvanceTo(NowNs + ByteTimeNs(), true);
+
+    uint8_t in = 0;
+    if      (!XcsPin)  SciByte(out, &in);
+    else if (!XdcsPin) PushSdi(out);
+    else               ++Stats.stray_bytes;
+    return in;
+}
+
+void Vs1053bSim::StartDma(const uint8_t *data, uint32_t size)
+{
+    DmaData.assign(data, data + size);
+    DmaDoneNs = NowNs + ByteTimeNs() * size;
+}
+
+void Vs1053bSim::SetDmaCallback(void (*callback)(void))
+{
+    DmaCallback = callback;
+}
+
+void Vs1053bSim::SetDreqCallback(uint8_t port, uint8_t pin, void (*callback)(void))
+{
+    if (port == Pins.port_dreq && pin == Pins.pin_dreq)
+    {
+        DreqCallback = callback;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                             DEVICE                                             //
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void Vs1053bSim::Reset()
+{
+    memset(Registers, 0, sizeof(Registers));
+    Registers[MODE]   = MODE_RESET_VALUE;
+    Registers[STATUS] = STATUS_RESET_VALUE;
+
+    // endFillByte is 0, playSpeed is 1
+    std::fill(Ram.begin(), Ram.end(), 0);
+    Ram[0x1E04] = 1;
+
+    SciIndex    = 0;
+    SciOpcode   = 0;
+    SciAddress  = 0;
+    SciData     = 0;
+    ResetDoneNs = NowNs + (uint64_t)Config.reset_us * 1000;
+    SciBusyNs   = 0;
+
+    FifoHead  = 0;
+    FifoCount = 0;
+
+    NextByteNs      = NowNs;
+    FrameRemaining  = 0;
+    ByteNs          = 0;
+    Skipped         = 0;
+    InStream        = false;
+    Primed          = false;
+    DecodedSamples  = 0;
+    SampleRate      = 0;
+    CancelRequestNs = 0;
+    memset(Window, 0, sizeof(Window));
+}
+
+bool Vs1053bSim::Dreq() const
+{
+    if (!ResetPin || NowNs < ResetDoneNs || NowNs < SciBusyNs)
+    {
+        return false;
+    }
+    return (SIM_FIFO_SIZE - FifoCount) >= SIM_DREQ_FREE;
+}
+
+uint64_t Vs1053bSim::ByteTimeNs() const
+{
+    return 8ULL * 1000 * 1000 * 1000 / Config.spi_hz;
+}
+
+uint32_t Vs1053bSim::ClockiHz() const
+{
+    return (uint64_t)Config.xtali_hz * ClockMultiplier[Registers[CLOCKF] >> 13] / 10;
+}
+
+void Vs1053bSim::CheckDreqEdge()
+{
+    const bool dreq = Dreq();
+    if (dreq && !LastDreq)
+    {
+        ++Stats.dreq_edges;
+        LastDreq = dreq;
+        if (DreqCallback)
+        {
+            DreqCallback();
+        }
+    }
+    LastDreq = dreq;
+}
+
+void Vs1053bSim::PushSdi(uint8_t byte)
+{
+    if (FifoCount >= SIM_FIFO_SIZE)
+    {
+        ++Stats.overflow_bytes;
+        return;
+    }
+
+    // Decoder has been waiting for this byte since NextByteNs
+    if (0 == FifoCount)
+    {
+        if (InStream && NowNs > NextByteNs)
+        {
+            ++Stats.underruns;
+            Stats.starved_ns += NowNs - (uint64_t)NextByteNs;
+        }
+        NextByteNs = std::max(NextByteNs, (double)NowNs);
+    }
+
+    Fifo[(FifoHead + FifoCount) % SIM_FIFO_SIZE] = byte;
+    ++FifoCount;
+    ++Stats.sdi_bytes;
+
+    // Startup ramp does not count towards the lowest fill
+    if (InStream && !Dreq())
+    {
+        Primed = true;
+    }
+}
+
+void Vs1053bSim::DecodeByte()
+{
+    if (IsCancelPending() && 0 == FrameRemaining)
+    {
+        HonorCancel();
+        return;
+    }
+
+    const uint8_t byte = Fifo[FifoHead];
+    FifoHead = (FifoHead + 1) % SIM_FIFO_SIZE;
+    --FifoCount;
+
+    const double start = std::max(NextByteNs, (double)NowNs);
+    if (FrameRemaining > 0)
+    {
+        // Stream mode aims for a half full FIFO, slower below and faster above
+        const double half   = SIM_FIFO_SIZE / 2.0;
+        const double adjust = (Registers[MODE] & SM_STREAM) ? (SIM_STREAM_ADJUST * (half - FifoCount) / half) : (0.0);
+        const double byte_ns = ByteNs * (1.0 + adjust);
+
+        --FrameRemaining;
+        ++Stats.audio_bytes;
+        Stats.audio_ns += byte_ns;
+        NextByteNs = start + byte_ns;
+    }
+    else
+    {
+        // Look for the next frame header in the bytes between frames
+        memmove(&Window[0], &Window[1], sizeof(Window) - 1);
+        Window[sizeof(Window) - 1] = byte;
+        ++Skipped;
+        NextByteNs = start + Config.skip_ns;
+
+        mp3_frame_header_S header;
+        if (Skipped >= MP3_FRAME_HEADER_SIZE && mp3_frame_parse_header(Window, &header))
+        {
+            // Header is decoded at the rate of its frame too
+            ByteNs         = 8.0e9 / header.bit_rate;
+            FrameRemaining = header.size - MP3_FRAME_HEADER_SIZE;
+            NextByteNs    += ByteNs * MP3_FRAME_HEADER_SIZE;
+            Stats.audio_ns += ByteNs * MP3_FRAME_HEADER_SIZE;
+            Stats.audio_bytes += MP3_FRAME_HEADER_SIZE;
+
+            Registers[HDAT1] = (Window[0] << 8) | Window[1];
+            Registers[HDAT0] = (Window[2] << 8) | Window[3];
+            SampleRate       = header.sample_rate;
+            Ram[VS1053B_PARAM_BYTE_RATE] = header.bit_rate / 8;
+            DecodedSamples  += header.samples;
+            Skipped          = 0;
+            InStream         = true;
+            ++Stats.frames;
+        }
+        else if (Skipped > MP3_FRAME_HEADER_SIZE)
+        {
+            // Tags, end fill bytes, or garbage, the stream has ended
+            InStream = false;
+            Primed   = false;
+        }
+    }
+
+    if (Primed && FifoCount < Stats.min_fill)
+    {
+        Stats.min_fill = FifoCount;
+    }
+}
+
+void Vs1053bSim::HonorCancel()
+{
+    FifoHead  = 0;
+    FifoCount = 0;
+
+    Registers[MODE]  &= ~SM_CANCEL;
+    Registers[HDAT0]  = 0;
+    Registers[HDAT1]  = 0;
+    FrameRemaining    = 0;
+    Skipped           = 0;
+    InStream          = false;
+    Primed            = false;
+    NextByteNs        = NowNs;
+
+    const uint64_t latency = NowNs - CancelRequestNs;
+    Stats.cancel_ns_total += latency;
+    Stats.cancel_ns_max    = std::max(Stats.cancel_ns_max, latency);
+    ++Stats.cancels;
+}
+
+void Vs1053bSim::SciByte(uint8_t out, uint8_t *in)
+{
+    const bool read = (OPCODE_READ == SciOpcode);
+    switch (SciIndex)
+    {
+        case 0:
+            SciOpcode = out;
+            break;
+        case 1:
+            SciAddress = out & 0xF;
+            if (read) SciData = SciRead(SciAddress);
+            break;
+        case 2:
+            if (read) *in = SciData >> 8;
+            else      SciData = out << 8;
+            break;
+        case 3:
+            if (read)
+            {
+                *in = SciData & 0xFF;
+            }
+            else if (OPCODE_WRITE == SciOpcode)
+            {
+                SciData |= out;
+                SciWrite(SciAddress, SciData);
+
+                // Multiple write, the next two bytes are another word for the same register
+                SciIndex = 2;
+                return;
+            }
+            break;
+    }
+
+    // XCS can stay low for the next transaction
+    SciIndex = (SciIndex + 1) % 4;
+}
+
+void Vs1053bSim::SciWrite(uint8_t address, uint16_t value)
+{
+    ++Stats.sci_writes;
+    if (NowNs < SciBusyNs)
+    {
+        ++Stats.sci_lost_writes;
+    }
+
+    switch (address)
+    {
+        case MODE:
+            if ((value & SM_CANCEL) && !(Registers[MODE] & SM_CANCEL))
+            {
+                CancelRequestNs = NowNs;
+            }
+            Registers[MODE] = value & ~SM_RESET;
+
+            // Software reset keeps the registers, but throws away the stream
+            if (value & SM_RESET)
+            {
+                FifoHead       = 0;
+                FifoCount      = 0;
+                FrameRemaining = 0;
+                Skipped        = 0;
+                InStream       = false;
+                Primed         = false;
+                DecodedSamples = 0;
+                NextByteNs     = NowNs;
+                Registers[HDAT0] = 0;
+                Registers[HDAT1] = 0;
+                ResetDoneNs    = NowNs + (uint64_t)Config.reset_us * 1000;
+            }
+            break;
+        case DECODE_TIME:
+            Registers[DECODE_TIME] = value;
+            DecodedSamples = (uint64_t)value * SampleRate;
+            break;
+        case WRAM:
+            Ram[Registers[WRAMADDR]] = value;
+            Registers[WRAMADDR]++;
+            break;
+        case HDAT0:
+        case HDAT1:
+            // Read only
+            break;
+        default:
+            Registers[address] = value;
+            break;
+    }
+
+    const uint64_t clock_hz = (CLOCKF == address) ? (Config.xtali_hz) : (ClockiHz());
+    SciBusyNs = NowNs + (uint64_t)WriteCycles[address] * 1000 * 1000 * 1000 / clock_hz;
+    CheckDreqEdge();
+}
+
+uint16_t Vs1053bSim::SciRead(uint8_t address)
+{
+    ++Stats.sci_reads;
+
+    switch (address)
+    {
+        case DECODE_TIME:
+            return (SampleRate > 0) ? (DecodedSamples / SampleRate) : (Registers[DECODE_TIME]);
+        case WRAM:
+        {
+            // FIFO pointers are in words, like the ones in the device
+            const uint16_t address = Registers[WRAMADDR]++;
+            if (VS1053B_STREAM_WRITE_POINTER == address)
+            {
+                return ((FifoHead + FifoCount) % SIM_FIFO_SIZE) / 2;
+            }
+            if (VS1053B_STREAM_READ_POINTER == address)
+            {
+                return FifoHead / 2;
+            }
+            return Ram[address];
+        }
+        default:
+            return Registers[address];
+    }
+}
@@ -0,0 +1,201 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "vs1053b.hpp"
+
+/**
+ *  @explanation:
+ *  Behavioral model of a VS1053b, on a simulated clock, for running the driver on a host.
+ *  The driver talks to it through the same seams it uses on the board, see sim_port.cpp:
+ *      - SCI      : XCS low, opcode, register, two data bytes MSB first, through ssp0_exchange_byte
+ *                   Writes can go on with more data words to the same register while XCS stays low
+ *      - SDI      : XDCS low, bytes go into a 2048 byte FIFO, through ssp0_exchange_byte or SSP0 DMA
+ *      - DREQ     : High while at least 32 bytes of the FIFO are free, low during resets and SCI writes
+ *      - RESET    : Low holds the device in reset, DREQ rises a while after it goes high
+ *
+ *  The decoder drains the FIFO one byte at a time, at the bit rate of the frame it is in, so the FIFO
+ *  empties at the same rate it does on the board.  Bytes that are not part of a frame, like tags and
+ *  end fill bytes, are thrown away at a fast fixed rate.  Frame headers are parsed with mp3_frame, and
+ *  update HDAT0 / HDAT1 and DECODE_TIME the way the device does.
+ *
+ *  SM_RESET flushes the FIFO and restores the registers, SM_CANCEL is honored at the next frame boundary,
+ *  which flushes the FIFO, clears HDAT0 / HDAT1, and clears the bit.  SM_STREAM slows the decoder down by
+ *  up to SIM_STREAM_ADJUST when the FIFO is less than half full, and speeds it up by as much above, and
+ *  the FIFO pointers can be read through WRAM at VS1053B_STREAM_WRITE_POINTER / VS1053B_STREAM_READ_POINTER.
+ */
+
+// Size of the SDI FIFO
+#define SIM_FIFO_SIZE (2048)
+
+// DREQ is high while at least this many bytes of the FIFO are free
+#define SIM_DREQ_FREE (32)
+
+// Most SM_STREAM changes the time to decode a byte by, as a fraction
+#define SIM_STREAM_ADJUST (0.05)
+
+typedef struct
+{
+    uint32_t spi_hz;            // SSP0 clock, the firmware runs it at 1 MHz until the driver sets it from CLOCKF
+    uint32_t xtali_hz;          // Crystal, CLKI is a multiple of it set by CLOCKF
+    uint32_t skip_ns;           // Time to throw away a byte that is not part of a frame
+    uint32_t reset_us;          // Time DREQ stays low after a hardware or software reset
+    uint32_t pin_read_ns;       // CPU time of reading a GPIO pin
+    uint32_t uptime_read_ns;    // CPU time of reading the uptime, so busy waits on it finish
+} sim_config_S;
+
+typedef struct
+{
+    uint64_t sdi_bytes;         // Bytes that made it into the FIFO
+    uint64_t overflow_bytes;    // Bytes sent while the FIFO was full, lost
+    uint64_t stray_bytes;       // Bytes sent with neither chip select low
+    uint64_t sci_reads;
+    uint64_t sci_writes;
+    uint64_t sci_lost_writes;   // SCI writes that came while DREQ was low from the last one, the device would miss them
+    uint64_t dreq_reads;        // Times the DREQ pin was read
+    uint64_t dreq_edges;        // Rising edges of DREQ
+    uint64_t frames;            // Frames decoded
+    uint64_t audio_bytes;       // Bytes decoded as part of a frame
+    uint64_t audio_ns;          // Time the decoder spent decoding frames
+    uint32_t underruns;         // Times the FIFO ran dry in the middle of a stream
+    uint64_t starved_ns;        // Time the decoder waited for data in the middle of a stream
+    uint32_t min_fill;          // Lowest FIFO fill while decoding a stream, after it first filled up
+    uint64_t busy_ns;           // Time the CPU spent shifting bytes and polling
+    uint64_t blocked_ns;        // Time the CPU spent in blocking calls, free for other tasks
+    uint32_t cancels;           // SM_CANCEL requests honored
+    uint64_t cancel_ns_max;     // Longest time from setting SM_CANCEL to the device clearing it
+    uint64_t cancel_ns_total;
+} sim_stats_S;
+
+class Vs1053bSim
+{
+public:
+
+    Vs1053bSim();
+
+    // @description : Sets the timing of the model, and the pins the driver was constructed with
+    void Configure(const sim_config_S &config, const vs1053b_gpio_init_t &pins);
+
+    // @description : Clears the counters, but not the state of the device
+    void ResetStats();
+
+    const sim_config_S& GetConfig() const;
+
+    const sim_stats_S& GetStats() const;
+
+    // @description : True while SM_CANCEL is set and the decoder has not honored it yet
+    bool IsCancelPending() const;
+
+    // @description : Word of RAM, as written through WRAMADDR and WRAM
+    uint16_t PeekRam(uint16_t address) const;
+
+    // @description : True when the FIFO is empty and nothing is pending
+    bool IsIdle() const;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    //                                              CLOCK                                             //
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    uint64_t Now() const;
+
+    // @description : Runs the device up to a time
+    // @param ns    : Time to run to
+    // @param busy  : True if the CPU was busy until then, false if it was blocked
+    void AdvanceTo(uint64_t ns, bool busy);
+
+    // @description : Time of the next event that could wake up a blocked task, DMA done or DREQ rising
+    uint64_t NextEventNs() const;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+    //                                              SEAMS                                             //
+    ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+    // @description : Called when the driver sets one of the pins of the device
+    void WritePin(uint8_t port, uint8_t pin, bool value);
+
+    // @description : Reads a pin driven by the device
+    // @param value : Set to the level of the pin
+    // @returns     : False if the device does not drive the pin
+    bool ReadPin(uint8_t port, uint8_t pin, bool *value);
+
+    // @description : Called when the driver changes the SSP0 clock
+    void SetSpiHz(uint32_t spi_hz);
+
+    // @description : Shifts a byte to the device, taking a byte time of the SPI clock
+    // @returns     : Byte shifted out by the device
+    uint8_t Exchange(uint8_t out);
+
+    // @description : Starts a DMA write, the bytes reach the device when it completes
+    void StartDma(const uint8_t *data, uint32_t size);
+
+    // @description : Callback of the DMA done interrupt
+    void SetDmaCallback(void (*callback)(void));
+
+    // @description : Callback of the DREQ rising edge interrupt, port and pin have to be DREQ
+    void SetDreqCallback(uint8_t port, uint8_t pin, void (*callback)(void));
+
+private:
+
+    sim_config_S        Config;
+    vs1053b_gpio_init_t Pins;
+    sim_stats_S         Stats;
+
+    // Clock, in nanoseconds since power on
+    uint64_t NowNs;
+
+    // Pin levels driven by the driver
+    bool ResetPin;
+    bool XcsPin;
+    bool XdcsPin;
+
+    // Registers, and the WRAM behind WRAMADDR
+    uint16_t Registers[16];
+    std::vector<uint16_t> Ram;
+
+    // State of the SCI transaction in progress
+    uint8_t  SciIndex;
+    uint8_t  SciOpcode;
+    uint8_t  SciAddress;
+    uint16_t SciData;
+
+    // DREQ stays low until these times
+    uint64_t ResetDoneNs;
+    uint64_t SciBusyNs;
+    bool     LastDreq;
+
+    // SDI FIFO
+    uint8_t  Fifo[SIM_FIFO_SIZE];
+    uint32_t FifoHead;
+    uint32_t FifoCount;
+
+    // Decoder
+    double   NextByteNs;        // Time the decoder takes the next byte
+    uint32_t FrameRemaining;    // Bytes left in the frame being decoded
+    double   ByteNs;            // Time to decode a byte of the current frame
+    uint8_t  Window[4];         // Last bytes seen outside of a frame, to find the next header
+    uint32_t Skipped;           // Bytes outside of a frame since the last header
+    bool     InStream;          // True while frames follow each other, FIFO running dry is an underrun
+    bool     Primed;            // FIFO has filled up since the stream started
+    uint64_t DecodedSamples;
+    uint32_t SampleRate;
+    uint64_t CancelRequestNs;
+
+    // DMA write in progress
+    std::vector<uint8_t> DmaData;
+    uint64_t DmaDoneNs;
+    void   (*DmaCallback)(void);
+    void   (*DreqCallback)(void);
+
+    void     Reset();
+    bool     Dreq() const;
+    uint64_t ByteTimeNs() const;
+    uint32_t ClockiHz() const;
+    void     CheckDreqEdge();
+    void     PushSdi(uint8_t byte);
+    void     DecodeByte();
+    void     HonorCancel();
+    void     SciByte(uint8_t out, uint8_t *in);
+    void     SciWrite(uint8_t address, uint16_t value);
+    uint16_t SciRead(uint8_t address);
+};
+
+extern Vs1053bSim Device;